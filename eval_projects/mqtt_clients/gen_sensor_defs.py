@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Generate the sensor table of the firmware from a model configuration.
+
+The firmware of tmeas_lcd-display_mqtt-client_esp8266 takes the defaults of
+its sensor table (ROM code, name, calibration offset, resolution and alarm
+thresholds per slot)
+from include/sensor_defs.h.  This script writes that header from the
+sbN_tsdat/sbN_sensors sections of a model configuration (see tmc_sensors.py),
+so the model and the firmware run with the same sensor table::
+
+    python gen_sensor_defs.py -c mqtt_tmc_model_config.yml
+
+The configuration is checked as the firmware checks the header at compile
+time (static_assert): slot counts, name lengths, ROM CRCs, duplicate ROMs and
+the offset, resolution and alarm threshold ranges.
+
+Required packages: PyYAML
+"""
+
+import argparse
+import os
+import sys
+from typing import List
+
+import yaml
+
+import tmc_sensors
+
+DEFAULT_OUTPUT = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..",
+                                              "tmeas_lcd-display_mqtt-client_esp8266", "include", "sensor_defs.h"))
+
+
+def render(table: List[tmc_sensors.SensorDef], source: str) -> str:
+    lines = [
+        f"// Sensor table of the firmware, generated by mqtt_clients/gen_sensor_defs.py from {source}.",
+        "// Change the configuration and generate again rather than editing this file.",
+        "//",
+        "// bank, slot, ROM code, name, calibration offset (centi-degrees), resolution (bits)"
+        " [, alarm thresholds TL, TH (degrees)]",
+        "",
+        "#ifndef SENSOR_DEFS_H",
+        "#define SENSOR_DEFS_H",
+        "",
+        "#include <SensorTable.h>",
+        "",
+    ]
+    if table:
+        lines.append("constexpr SensorDef SENSOR_DEFS[] = {")
+        for d in table:
+            rom = ",".join(f"0x{b:02X}" for b in d.rom)
+            alarm = f", {d.alarm_low}, {d.alarm_high}" if d.has_alarm else ""
+            lines.append(f'  {{ {d.bank}, {d.slot}, {{{rom}}}, "{d.name}", {d.offset_centi}, {d.resolution}{alarm} }},')
+        lines.append("};")
+    else:
+        lines.append("constexpr SensorDef SENSOR_DEFS[1] = {};      // no sensor known yet")
+    lines += [
+        f"constexpr size_t SENSOR_DEF_COUNT = {len(table)};",
+        "",
+        "#endif // SENSOR_DEFS_H",
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description="generate include/sensor_defs.h of the firmware")
+    parser.add_argument("-c", "--config", default="mqtt_tmc_model_config.yml", help="path to yaml configuration file")
+    parser.add_argument("-o", "--output", default=DEFAULT_OUTPUT, help="header to write")
+    args = parser.parse_args()
+
+    with open(args.config, "r") as f:
+        config = yaml.safe_load(f)
+    try:
+        table = tmc_sensors.sensor_table(config)
+    except ValueError as err:
+        print(f"{args.config}: {err}", file=sys.stderr)
+        return 1
+
+    with open(args.output, "w") as f:
+        f.write(render(table, os.path.basename(args.config)))
+    print(f"{args.output}: {len(table)} sensor(s)")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
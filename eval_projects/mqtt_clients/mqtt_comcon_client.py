@@ -1,14 +1,8 @@
-
 #
 # This is supposed to be the command- and control client for the mqtt driven mctms project
 #
-# The code below currently is just a placedholder
-
-# 1st trail version to get an mqtt client going, conceived by using the GitHub Copilot
-# AI prompt "is it possible to write a mqtt client in python?"
-# The result is the code below, and it is working fine.
-#
-# Simple MQTT client that connects to a broker, publishes a message, and disconnects.
+# First step: send one command to a temperature measurement client (tmc) and print the response,
+# see <repo_root>/doc/requirements/command_response.txt.
 #
 # Prerequisites:
 # Create a virtual environment and install paho-mqtt:
@@ -18,24 +12,108 @@
 #                       venv\Scripts\Activate.ps1
 #   Windows cmd: venv\Scripts\activate.bat
 # pip install paho-mqtt
-# 
-# Usage: python simple_client.py
+#
+# Usage: python mqtt_comcon_client.py <client> <command> [value]
+#   e.g. python mqtt_comcon_client.py tmc0 status
+#        python mqtt_comcon_client.py tmc0 measure        -> prints the fresh datasets and the round trip time
+#        python mqtt_comcon_client.py tmc0 interval 2000  -> sample period in ms
+#        python mqtt_comcon_client.py tmc0 deadband 10    -> dead-band in centi-degrees (0.10 degree C)
+#        python mqtt_comcon_client.py tmc0 scan --sb 0    -> ROM codes on the bus not yet assigned to a slot
+#        python mqtt_comcon_client.py tmc0 sensor --sb 0 --slot 3 [--rom 28D0089F0000009F] [--name Cellar] [--res 10]
 # Optioanlly, when done deactivate the virtual environment:
 #   Windows:  just type "deactivate" on the command line (no path, no nothing else)
 #
 # Note: Make sure an MQTT broker is running at the specified connection address.
 
+import argparse
+import json
+import random
+import sys
+import threading
+import time
+
 import paho.mqtt.client as mqtt
 
-# Create a client instance
-client = mqtt.Client(callback_api_version=mqtt.CallbackAPIVersion.VERSION2)
+import tmc_cbor
+
+BROKER_ADDRESS = "192.168.2.32"
+BROKER_PORT = 1883
+RESPONSE_TIMEOUT = 5.0      # seconds to wait for the response
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description="Send a command to a temperature measurement client.")
+    parser.add_argument("client", help="client name, e.g. tmc0")
+    parser.add_argument("command", choices=["status", "interval", "measure", "deadband", "sensor", "scan"])
+    parser.add_argument("value", nargs="?", type=int, help="interval in ms, or dead-band in centi-degrees")
+    parser.add_argument("--sb", type=int, help="sensor bank (sensor, scan)")
+    parser.add_argument("--slot", type=int, help="slot (sensor)")
+    parser.add_argument("--rom", help="ROM code as 16 hex digits, family code first, \"\" clears the slot (sensor)")
+    parser.add_argument("--name", help="friendly name (sensor)")
+    parser.add_argument("--res", type=int, help="resolution in bits, 9..12 (sensor)")
+    parser.add_argument("-b", "--broker", default=BROKER_ADDRESS, help="broker address")
+    parser.add_argument("-p", "--port", type=int, default=BROKER_PORT, help="broker port")
+    args = parser.parse_args()
+
+    request = {"id": random.randint(0, 0x7FFFFFFF), "cmd": args.command}
+    if args.value is not None:
+        request["value"] = args.value
+    for member in ("sb", "slot", "rom", "name", "res"):
+        if getattr(args, member) is not None:
+            request[member] = getattr(args, member)
+
+    subscribed = threading.Event()
+    done = threading.Event()
+    sent_at = [0.0]
+    names = tmc_cbor.NameCache()
+
+    def on_connect(client, userdata, flags, rc, properties=None):
+        # the datasets of a "measure" command are published before its response
+        client.subscribe(f"{args.client}/+/#")
+
+    def on_subscribe(client, userdata, mid, reason_codes, properties=None):
+        subscribed.set()
 
-# Connect to the broker
-client.connect("192.168.2.32", 1883, 60)
+    def on_message(client, userdata, msg):
+        if msg.topic.endswith(tmc_cbor.NAMES_SUBTOPIC):
+            names.update(msg.topic, msg.payload)     # retained, arrives right after subscribing
+            return
+        if not sent_at[0]:
+            return
+        elapsed = (time.monotonic() - sent_at[0]) * 1000
+        if msg.topic.endswith(tmc_cbor.CBOR_SUBTOPIC) and args.command == "measure":
+            print(f"{elapsed:7.1f} ms  {msg.topic}: {names.decode(msg.topic, msg.payload)}")
+        elif msg.topic == f"{args.client}/rsp":
+            try:
+                rsp = json.loads(msg.payload.decode("utf-8"))
+            except ValueError:
+                return
+            if rsp.get("id") != request["id"]:
+                return          # response to another controlling entity
+            print(f"{elapsed:7.1f} ms  {msg.topic}: {json.dumps(rsp)}")
+            done.set()
+        elif args.command == "measure" and msg.topic.split("/")[1].startswith("sb") and not msg.retain:
+            print(f"{elapsed:7.1f} ms  {msg.topic}: {msg.payload.decode('utf-8', 'replace')}")
 
-# Publish a message
-client.publish("test/topic", "Hello MQTT")
+    client = mqtt.Client(callback_api_version=mqtt.CallbackAPIVersion.VERSION2)
+    client.on_connect = on_connect
+    client.on_subscribe = on_subscribe
+    client.on_message = on_message
+    client.connect(args.broker, args.port, 60)
+    client.loop_start()
+    try:
+        if not subscribed.wait(RESPONSE_TIMEOUT):
+            print("no connection to the broker")
+            sys.exit(1)
+        sent_at[0] = time.monotonic()
+        client.publish(f"{args.client}/cmd", json.dumps(request, separators=(',', ':')))
+        if not done.wait(RESPONSE_TIMEOUT):
+            print(f"no response from {args.client} within {RESPONSE_TIMEOUT:.0f} s")
+            sys.exit(1)
+    finally:
+        client.loop_stop()
+        client.disconnect()
 
-# Disconnect
-client.disconnect()
 
+if __name__ == "__main__":
+    main()
@@ -11,6 +11,8 @@ MQTT-driven display client for 64x64 LED matrix.
 
     - Subscribes to a JSON measurements topic (default `tmc1/sb0`).
     - Expects payload in the new format: {"client":"tmc0","sb_nr":0,"ds_nr":0,"ts_dat": {"s0":20.0, "s1":21.1}}
+    - Alternatively subscribes to the binary payload of a bank (e.g. `tmc1/sb0/cbor`), the slot names
+      are then taken from the bank's retained `names` topic.
     - Displays two configured sensor values (default `s0` and `s1`) on the matrix.
 
 Requirements:
@@ -30,6 +32,8 @@ import time
 import yaml
 import paho.mqtt.client as mqtt
 
+import tmc_cbor
+
 try:
     from rgbmatrix import RGBMatrix, RGBMatrixOptions, graphics
 except Exception as e:
@@ -81,12 +85,16 @@ class LEDMDisplay:
 
         self.connected = threading.Event()
         self.current_values = {self.key1: "--", self.key2: "--"}
+        self.slot_names = tmc_cbor.NameCache()
         self._stop = threading.Event()
 
     def _on_connect(self, client, userdata, flags, rc, properties=None):
         if rc == 0:
             print("Connected to broker")
             self.client.subscribe(self.topic)
+            if self.topic.endswith(tmc_cbor.CBOR_SUBTOPIC):
+                # binary payload carries slot indices only, the names come retained on the names topic
+                self.client.subscribe(self.topic[:-len(tmc_cbor.CBOR_SUBTOPIC)] + tmc_cbor.NAMES_SUBTOPIC)
             self.connected.set()
         else:
             print(f"Failed to connect rc={rc}")
@@ -97,7 +105,13 @@ class LEDMDisplay:
 
     def _on_message(self, client, userdata, msg):
         try:
-            payload = json.loads(msg.payload.decode())
+            if msg.topic.endswith(tmc_cbor.NAMES_SUBTOPIC):
+                self.slot_names.update(msg.topic, msg.payload)
+                return
+            if msg.topic.endswith(tmc_cbor.CBOR_SUBTOPIC):
+                payload = self.slot_names.decode(msg.topic, msg.payload)
+            else:
+                payload = json.loads(msg.payload.decode())
 
             # support new payload format: { ..., "ts_dat": {"s0": 20.0, ...} }
             ts_dat = None
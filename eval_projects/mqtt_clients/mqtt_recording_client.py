@@ -10,6 +10,8 @@ import json
 from datetime import datetime
 import os
 
+import tmc_cbor
+
 # Configuration
 BROKER_ADDRESS = "192.168.2.32"
 BROKER_PORT = 1883
@@ -19,6 +21,7 @@ OUTPUT_FILE = "temperature_data.jsonl"
 
 # Global variables
 sensor_readings = {}
+slot_names = tmc_cbor.NameCache()   # slot names of the banks publishing binary (CBOR) payloads
 client = None
 running = True
 
@@ -50,24 +53,52 @@ def on_message(client, userdata, msg):
     """Callback when message is received"""
     try:
         topic = msg.topic
-        payload = (msg.payload.decode())
+        if topic.endswith(tmc_cbor.NAMES_SUBTOPIC):
+            # slot names for the binary payload, nothing to record
+            slot_names.update(topic, msg.payload)
+            return
+        if topic.endswith(tmc_cbor.CBOR_SUBTOPIC):
+            # binary payload: record it in the same layout as the JSON payload
+            payload = json.dumps(slot_names.decode(topic, msg.payload), separators=(',', ':'))
+        else:
+            payload = (msg.payload.decode())
         
         # Store reading with topic as key
         sensor_readings[topic] = payload
+        sample_time = sample_time_of(payload)
         
         print(f"Received: {topic} = {payload}°C")
         
         # Write to file when we have all 32 sensors (adjust count as needed)
         #if len(sensor_readings) >= 3:
-        write_record()
+        write_record(sample_time)
             
-    except ValueError:
+    except (ValueError, KeyError, IndexError):
         print(f"Invalid payload on {msg.topic}: {msg.payload}")
 
-def write_record():
-    """Write sensor readings to JSON Lines file"""
+def sample_time_of(payload):
+    """Sample time of a dataset as datetime, None if the payload carries none.
+
+    Clients with payload v1.5 send the time the sample was taken ("time_ms",
+    epoch ms), which doesn't suffer from broker queuing, buffered sends or the
+    clock of this machine.
+    """
+    try:
+        time_ms = json.loads(payload).get("time_ms")
+    except (ValueError, AttributeError):
+        return None
+    return datetime.fromtimestamp(time_ms / 1000) if time_ms else None
+
+def write_record(sample_time=None):
+    """Write sensor readings to JSON Lines file
+
+    "timestamp" is the sample time if known, else the arrival time; the
+    arrival time is kept in "received".
+    """
+    received = datetime.now()
     record = {
-        "timestamp": datetime.now().isoformat(),
+        "timestamp": (sample_time or received).isoformat(),
+        "received": received.isoformat(),
         **sensor_readings
     }
     
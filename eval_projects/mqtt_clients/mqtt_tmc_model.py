@@ -12,6 +12,39 @@ Configuration may either provide a single `ts_dat` mapping reused for every
 sensor bank (legacy behaviour), or – more flexibly – supply separate
 `sb0_tsdat`, `sb1_tsdat`, … sections for each individual bank.  The latter is
 preferred when different banks should generate distinct payloads.
+The optional `payload_format` setting selects the encoding: "json" (default),
+"cbor" (compact binary payload on "<client>/sb<N>/cbor", see tmc_cbor.py) or
+"both".  The number of payload bytes published per encoding is reported on
+shutdown, so the savings of the binary payload can be measured under load.
+
+With `deadband` (degree C) set above 0, a bank is only published when a sensor
+moved by more than the dead-band since the last published dataset, or when
+`heartbeat` seconds passed without publishing.  As in the firmware, ds_nr is
+counted per bank and only for published datasets, so gaps in ds_nr still mean
+lost datasets.  Published and suppressed datasets are reported on shutdown.
+
+Like the firmware, the model executes the commands received on "<client>/cmd"
+(status, interval, measure, deadband) and replies on "<client>/rsp", see
+<repo_root>/doc/requirements/command_response.txt.  "measure" publishes a
+fresh dataset of every bank right away instead of waiting for the next cycle.
+
+An optional `sbN_sensors` section assigns the physical sensors (ROM code,
+calibration offset, resolution) to the slots of a bank, see tmc_sensors.py.
+As in the firmware, only the slots listed there are published, with the
+offset added to their values.  gen_sensor_defs.py writes the sensor table of
+the firmware from the same sections.
+
+Every `stats_period` seconds (default 60, 0 = off) the timing statistics of the
+publishing cycle are published on "<client>/stats" in the schema of the
+firmware (see tmc_stats.py); the phases the model doesn't have report count 0.
+
+Every `agg_window` seconds (default 60, 0 = off) the minimum, maximum and mean
+of every sensor over the window are published on "<client>/sbN/agg", taken
+from all samples including the ones the dead-band suppresses (see tmc_agg.py).
+
+Sensors with alarm thresholds (``alarm: [tl, th]`` in sbN_sensors) are checked
+against every sample; a sensor crossing a threshold, and later getting back
+into range, is published right away on "<client>/sbN/alert" (see tmc_alert.py).
 Example invocation::
 
     python mqtt_tmc_model.py -c my_client.yml
@@ -19,27 +52,48 @@ Example invocation::
 Required packages: paho-mqtt, PyYAML
 
 The script handles ctrl+c (SIGINT) and cleanly disconnects from the broker.
-It also subscribes to "<client_name>/#" so that you can send commands or monitor
-activity directed at this modelled client.
 """
 
 import argparse
 import json
 import signal
 import sys
+import threading
 import time
-from typing import Any, Dict, List
+from typing import Any, Dict, List, Optional
 
 # Version history:
 # VERSION = "0.1.0"   # Initial version
 # VERSION = "0.1.1"   # Updated to reflect payload spec v1.3
-VERSION   = "0.1.2"   # Added per‑bank ts_dat support and dropped sb_cnt requirement
+# VERSION = "0.1.2"   # Added per‑bank ts_dat support and dropped sb_cnt requirement
+# VERSION = "0.1.3"   # Added optional CBOR payload
+# VERSION = "0.1.4"   # Added dead-band publishing with heartbeat, ds_nr per bank
+# VERSION = "0.1.5"   # Added command/response channel
+# VERSION = "0.1.6"   # Added cycle timing statistics
+# VERSION = "0.1.7"   # Added the sample time to the datasets (payload v1.5)
+# VERSION = "0.1.8"   # Added the sensor table (sbN_sensors) with calibration offsets
+# VERSION = "0.1.9"   # Added the windowed aggregates on <client>/sbN/agg
+# VERSION = "0.2.0"   # Added the alarm thresholds and alerts on <client>/sbN/alert
+VERSION   = "0.2.1"   # Missing value -327.68 (payload v1.6)
 
 import yaml
 
 import paho.mqtt.client as mqtt
 from paho.mqtt.client import CallbackAPIVersion
 
+import tmc_agg
+import tmc_alert
+import tmc_cbor
+import tmc_stats
+import tmc_sensors
+
+PAYLOAD_JSON_VERSION = "1.6"
+
+# limits of the "interval" (ms) and "deadband" (centi-degrees) commands, as in the firmware
+SAMPLE_PERIOD_MIN_MS = 200
+SAMPLE_PERIOD_MAX_MS = 3600000
+DEADBAND_MAX_CENTI = 1000
+
 
 # ---------------------------------------------------------------------------
 # configuration helpers
@@ -65,7 +119,9 @@ def on_connect(client: mqtt.Client, userdata: Any, flags: Dict[str, int], rc: in
 def on_message(client: mqtt.Client, userdata: Any, msg: mqtt.MQTTMessage) -> None:
     # print any message that is published to topics we subscribe to
     if getattr(userdata, "verbose", False):
-        print(f"[received] {msg.topic}: {msg.payload.decode('utf-8')}" )
+        print(f"[received] {msg.topic}: {msg.payload.decode('utf-8', 'replace')}" )
+    if msg.topic == userdata.cmd_topic:
+        userdata.handle_command(msg.payload)
 
 
 # ---------------------------------------------------------------------------
@@ -73,18 +129,31 @@ def on_message(client: mqtt.Client, userdata: Any, msg: mqtt.MQTTMessage) -> Non
 # ---------------------------------------------------------------------------
 
 class SensorBank:
-    def __init__(self, ts_dat: Dict[str, List[float]]):
+    def __init__(self, ts_dat: Dict[str, List[float]],
+                 sensors: Optional[Dict[str, tmc_sensors.SensorDef]] = None):
         # keep a copy of the sequences and an index for each sensor
         self._ts_dat = ts_dat
         self._indices = {name: 0 for name in ts_dat}
+        # slot index of a sensor = position in the configuration
+        self.slots = {name: slot for slot, name in enumerate(ts_dat)}
+        # configured slots and their calibration offsets (centi-degrees); all slots without sbN_sensors
+        if sensors is None:
+            self._offsets = {name: 0 for name in ts_dat}
+        else:
+            self._offsets = {name: sensors[name].offset_centi for name in ts_dat if name in sensors}
+        # slot names as published on <client>/sbN/names, "" = not configured
+        self.names = [name if name in self._offsets else "" for name in ts_dat]
+        self.configured = len(self._offsets)
 
     def next_values(self) -> Dict[str, float]:
-        """Return the next measurement for every sensor and advance the index."""
+        """Return the next measurement of every configured sensor and advance the index."""
         result: Dict[str, float] = {}
         for name, values in self._ts_dat.items():
             idx = self._indices[name]
-            result[name] = values[idx]
             self._indices[name] = (idx + 1) % len(values)
+            if name in self._offsets:
+                # offset added in centi-degrees, as the firmware does
+                result[name] = (tmc_cbor.to_centi(values[idx]) + self._offsets[name]) / 100
         return result
 
 
@@ -98,6 +167,10 @@ class TmcModel:
         self.sb_cnt = int(config.get("sb_cnt", 0))
         self.meas_delay = int(config.get("meas_delay", 2))
         self.ds_nr = int(config.get("ds_nr", 0))
+        self.deadband = float(config.get("deadband", 0.0))
+        self.heartbeat = float(config.get("heartbeat", 60))
+        self.stats_period = float(config.get("stats_period", 60))
+        self.agg_window = float(config.get("agg_window", 60))
 
         def normalize_ts_dat(raw_ts_dat: Dict[str, Any], bank_idx: int) -> Dict[str, List[float]]:
             if not isinstance(raw_ts_dat, dict):
@@ -139,7 +212,28 @@ class TmcModel:
         if self.sb_cnt == 0:
             raise ValueError("no sensor bank data found in configuration")
 
-        self.banks = [SensorBank(data) for data in banks_data]
+        self.payload_format = str(config.get("payload_format", "json")).lower()
+        if self.payload_format not in ("json", "cbor", "both"):
+            raise ValueError("payload_format must be one of json, cbor, both")
+        # payload bytes and encoding time per format, reported on shutdown
+        self.stats = {fmt: {"msgs": 0, "bytes": 0, "secs": 0.0} for fmt in ("json", "cbor")}
+
+        bank_defs = [tmc_sensors.bank_sensors(config, sb_nr, list(data)) for sb_nr, data in enumerate(banks_data)]
+        self.banks = [SensorBank(data, defs) for data, defs in zip(banks_data, bank_defs)]
+        # same checks as the firmware's sensor table (ROM codes used twice)
+        if "ts_dat" not in config:
+            tmc_sensors.sensor_table(config)
+        # per bank: next ds_nr, last published values and time
+        self.bank_ds_nr = [self.ds_nr] * self.sb_cnt
+        self.last_values: List[Dict[str, float]] = [{} for _ in range(self.sb_cnt)]
+        self.last_publish = [0.0] * self.sb_cnt
+        self.published = 0
+        self.suppressed = 0
+        # per bank: aggregates of the current window, None = off
+        self.aggs = [tmc_agg.WindowAgg(self.agg_window) if self.agg_window > 0 else None
+                     for _ in range(self.sb_cnt)]
+        # per bank: alarm state of the sensors with thresholds
+        self.alarms = [tmc_alert.SensorAlarm(defs) for defs in bank_defs]
 
         # create mqtt client.  the default callback API version (1) is
         # deprecated and triggers a warning; request version 2 explicitly.
@@ -154,14 +248,28 @@ class TmcModel:
         self.mqtt.on_connect = on_connect
         self.mqtt.on_message = on_message
 
+        self.cmd_topic = f"{self.client_name}/cmd"
+        self.rsp_topic = f"{self.client_name}/rsp"
+        self.start_time = time.monotonic()
+        # pending "measure" command: (has_id, id), answered after the forced cycle
+        self._measure_req = None
+        self._wake = threading.Event()
+        self.cycle_stats = tmc_stats.CycleStats()
+        self.stats_topic = f"{self.client_name}{tmc_stats.STATS_SUBTOPIC}"
+
         self._stop = False
 
         # future optional features could be added here
 
     def connect(self) -> None:
         self.mqtt.connect(self.broker_ip, self.broker_port)
-        # subscribe to our own namespace so that commands can be sent
-        self.mqtt.subscribe(f"{self.client_name}/#")
+        # commands of controlling entities; the bank topics would only echo our own datasets
+        self.mqtt.subscribe(self.cmd_topic)
+        if self.payload_format != "json":
+            # slot names for the receivers of the binary payload, slot index = position in sbN_tsdat
+            for sb_nr, bank in enumerate(self.banks):
+                topic = f"{self.client_name}/sb{sb_nr}{tmc_cbor.NAMES_SUBTOPIC}"
+                self.mqtt.publish(topic, tmc_cbor.names_payload(self.client_name, sb_nr, bank.names), retain=True)
         # start network loop in background thread
         self.mqtt.loop_start()
 
@@ -171,39 +279,233 @@ class TmcModel:
 
     def run(self) -> None:
         print(f"starting model '{self.client_name}' ({self.sb_cnt} bank(s))")
+        stats_start = time.monotonic()
+        due = time.monotonic()
         try:
             while not self._stop:
-                for sb_nr, bank in enumerate(self.banks):
-                    ts_values = bank.next_values()
-                    # assemble payload dict; ordering is not critical but keep the
-                    # same sequence as the firmware so that any human reading the
-                    # JSON will see the familiar layout.
-                    payload: Dict[str, Any] = {
-                        "client": self.client_name,
-                        "sb_nr": sb_nr,
-                        "ds_nr": self.ds_nr,
-                        "ts_dat": ts_values,
-                    }
-
-                    topic = f"{self.client_name}/sb{sb_nr}"
-                    # firmware uses compact JSON without any spaces; mimic that
-                    msg = json.dumps(payload, separators=(',',':'))
-                    self.mqtt.publish(topic, msg)
-
+                request = self._measure_req
+                start = time.monotonic()
+                if request is None:
+                    # delay of the cycle behind its scheduled start
+                    self.cycle_stats.add("lag", max(0.0, start - due) * 1e6)
+                self.publish_cycle(forced=request is not None)
+                if request is not None:
+                    self._measure_req = None
+                    self.respond(request, "measure", "ok",
+                                 ds_nr=[(nr - 1) & 0xFFFF for nr in self.bank_ds_nr])
+                end = time.monotonic()
+                self.cycle_stats.add("loop", (end - start) * 1e6)
+                self.cycle_stats.cycles += 1
+                if end - start > self.meas_delay:
+                    self.cycle_stats.missed += 1
+
+                if self.stats_period > 0 and end - stats_start >= self.stats_period:
+                    msg = self.cycle_stats.payload(self.client_name, end - self.start_time, (end - stats_start) * 1000)
+                    self.mqtt.publish(self.stats_topic, msg)
                     if self.verbose:
-                        print(f"[published] {topic} {msg}")
-
-                # increment data set counter and wrap at 65535
-                self.ds_nr = (self.ds_nr + 1) & 0xFFFF
-                time.sleep(self.meas_delay)
+                        print(f"[published] {self.stats_topic} {msg}")
+                    self.cycle_stats.reset()
+                    stats_start = end
+
+                # sleep until the next cycle, a "measure" command wakes us up early
+                due = start + self.meas_delay
+                self._wake.wait(max(0.0, due - time.monotonic()))
+                self._wake.clear()
         except KeyboardInterrupt:
             pass
         finally:
             print("shutting down")
+            self.report_stats()
             self.disconnect()
 
+    def publish_cycle(self, forced: bool = False) -> None:
+        """Take the next values of all banks and publish them, subject to the dead-band."""
+        time_ms = int(time.time() * 1000)      # sample time, same for all banks as in the firmware
+        for sb_nr, bank in enumerate(self.banks):
+            ts_values = bank.next_values()
+            self.aggregate(sb_nr, ts_values, time_ms)
+            self.check_alarms(sb_nr, ts_values, time_ms)
+            if not forced and not self.needs_publish(sb_nr, ts_values):
+                self.suppressed += 1
+                continue
+            ds_nr = self.bank_ds_nr[sb_nr]
+            # increment data set counter and wrap at 65535
+            self.bank_ds_nr[sb_nr] = (ds_nr + 1) & 0xFFFF
+            self.last_values[sb_nr] = ts_values
+            self.last_publish[sb_nr] = time.monotonic()
+            self.published += 1
+
+            # assemble payload dict; ordering is not critical but keep the
+            # same sequence as the firmware so that any human reading the
+            # JSON will see the familiar layout.
+            payload: Dict[str, Any] = {
+                "client": self.client_name,
+                "sb_nr": sb_nr,
+                "ds_nr": ds_nr,
+                "time_ms": time_ms,
+                "ts_dat": ts_values,
+            }
+
+            topic = f"{self.client_name}/sb{sb_nr}"
+            if self.payload_format != "cbor":
+                # firmware uses compact JSON without any spaces; mimic that
+                t0 = time.perf_counter()
+                msg = json.dumps(payload, separators=(',',':'))
+                self._count("json", len(msg), time.perf_counter() - t0)
+                t1 = time.perf_counter()
+                self.mqtt.publish(topic, msg)
+                self.cycle_stats.add("pub", (time.perf_counter() - t1) * 1e6)
+
+                if self.verbose:
+                    print(f"[published] {topic} {msg}")
+
+            if self.payload_format != "json":
+                t0 = time.perf_counter()
+                centi = {bank.slots[name]: tmc_cbor.to_centi(v) for name, v in ts_values.items()}
+                blob = tmc_cbor.encode_dataset(self.client_name, sb_nr, ds_nr, centi, time_ms)
+                self._count("cbor", len(blob), time.perf_counter() - t0)
+                t1 = time.perf_counter()
+                self.mqtt.publish(topic + tmc_cbor.CBOR_SUBTOPIC, blob)
+                self.cycle_stats.add("pub", (time.perf_counter() - t1) * 1e6)
+
+                if self.verbose:
+                    print(f"[published] {topic}{tmc_cbor.CBOR_SUBTOPIC} {len(blob)} bytes")
+
+    def aggregate(self, sb_nr: int, values: Dict[str, float], time_ms: int) -> None:
+        """Add the values to the bank's window, publish the window they ended."""
+        agg = self.aggs[sb_nr]
+        if agg is None:
+            return
+        ended = agg.add(values, time_ms)
+        if ended is None:
+            return
+        agg_nr, start_ms, ts_agg = ended
+        topic = f"{self.client_name}/sb{sb_nr}{tmc_agg.AGG_SUBTOPIC}"
+        msg = json.dumps(tmc_agg.payload(self.client_name, sb_nr, agg_nr, start_ms, agg.window_ms, ts_agg),
+                         separators=(',', ':'))
+        self.mqtt.publish(topic, msg)
+        if self.verbose:
+            print(f"[published] {topic} {msg}")
+
+    def check_alarms(self, sb_nr: int, values: Dict[str, float], time_ms: int) -> None:
+        """Check the values against the bank's thresholds, publish the changes of state."""
+        alarm = self.alarms[sb_nr]
+        if not alarm:
+            return
+        ts_alert = alarm.update(values)
+        if not ts_alert:
+            return
+        topic = f"{self.client_name}/sb{sb_nr}{tmc_alert.ALERT_SUBTOPIC}"
+        msg = json.dumps(tmc_alert.payload(self.client_name, sb_nr, alarm.alert_nr, time_ms, ts_alert),
+                         separators=(',', ':'))
+        alarm.alert_nr = (alarm.alert_nr + 1) & 0xFFFFFFFF
+        self.mqtt.publish(topic, msg)
+        if self.verbose:
+            print(f"[published] {topic} {msg}")
+
+    # -----------------------------------------------------------------------
+    # commands, see doc/requirements/command_response.txt
+    # -----------------------------------------------------------------------
+
+    def respond(self, request: Any, cmd: str, rc: str, **values: Any) -> None:
+        """Publish a response; request is the (has_id, id) tuple of the command."""
+        rsp: Dict[str, Any] = {}
+        has_id, cmd_id = request
+        if has_id:
+            rsp["id"] = cmd_id
+        rsp["cmd"] = cmd
+        rsp["rc"] = rc
+        rsp.update(values)
+        msg = json.dumps(rsp, separators=(',', ':'))
+        self.mqtt.publish(self.rsp_topic, msg)
+        if self.verbose:
+            print(f"[published] {self.rsp_topic} {msg}")
+
+    def handle_command(self, payload: bytes) -> None:
+        """Execute a command, called from the network thread of paho-mqtt."""
+        try:
+            req = json.loads(payload.decode("utf-8"))
+        except (UnicodeDecodeError, ValueError):
+            req = None
+        if not isinstance(req, dict):
+            self.respond((False, 0), "", "syntax")
+            return
+        cmd_id = req.get("id")
+        has_id = isinstance(cmd_id, int) and not isinstance(cmd_id, bool) and cmd_id >= 0
+        request = (has_id, cmd_id if has_id else 0)
+        if ("id" in req and not has_id) or not isinstance(req.get("cmd"), str):
+            self.respond(request, "", "syntax")
+            return
+        cmd = req["cmd"]
+        value = req.get("value")
+        if cmd not in ("status", "interval", "measure", "deadband"):
+            self.respond(request, "", "unknown")
+            return
+        if cmd in ("interval", "deadband") and (not isinstance(value, int) or isinstance(value, bool)):
+            self.respond(request, cmd, "value")
+            return
+
+        if cmd == "status":
+            self.respond(request, cmd, "ok",
+                         uptime=int(time.monotonic() - self.start_time),
+                         plv=PAYLOAD_JSON_VERSION,
+                         interval=int(self.meas_delay * 1000),
+                         deadband=int(round(self.deadband * 100)),
+                         conv_ms=0,
+                         backlog=0,
+                         time_ms=int(time.time() * 1000),
+                         sensors=[bank.configured for bank in self.banks])
+        elif cmd == "interval":
+            if not SAMPLE_PERIOD_MIN_MS <= value <= SAMPLE_PERIOD_MAX_MS:
+                self.respond(request, cmd, "value")
+                return
+            self.meas_delay = value / 1000
+            self.respond(request, cmd, "ok", interval=value)
+        elif cmd == "deadband":
+            if not 0 <= value <= DEADBAND_MAX_CENTI:
+                self.respond(request, cmd, "value")
+                return
+            self.deadband = value / 100
+            self.respond(request, cmd, "ok", deadband=value)
+        elif cmd == "measure":
+            if self._measure_req is not None:
+                self.respond(request, cmd, "busy")
+                return
+            # answered by run() once the datasets are published
+            self._measure_req = request
+            self._wake.set()
+
+    def needs_publish(self, sb_nr: int, values: Dict[str, float]) -> bool:
+        """Dead-band check against the last published dataset of the bank."""
+        last = self.last_values[sb_nr]
+        if self.deadband <= 0 or not last:
+            return True
+        if time.monotonic() - self.last_publish[sb_nr] >= self.heartbeat:
+            return True
+        return any(abs(v - last.get(name, v + 2 * self.deadband)) > self.deadband
+                   for name, v in values.items())
+
+    def _count(self, fmt: str, size: int, secs: float) -> None:
+        self.cycle_stats.add("build", secs * 1e6)
+        st = self.stats[fmt]
+        st["msgs"] += 1
+        st["bytes"] += size
+        st["secs"] += secs
+
+    def report_stats(self) -> None:
+        total = self.published + self.suppressed
+        if total:
+            print(f"datasets: {self.published} published, {self.suppressed} suppressed by dead-band "
+                  f"({100 * self.suppressed / total:.1f}%)")
+        for fmt, st in self.stats.items():
+            if st["msgs"]:
+                print(f"{fmt}: {st['msgs']} payloads, {st['bytes']} bytes "
+                      f"({st['bytes'] / st['msgs']:.1f} bytes/payload, "
+                      f"{st['secs'] * 1e6 / st['msgs']:.1f} us encoding/payload)")
+
     def stop(self) -> None:
         self._stop = True
+        self._wake.set()
 
 
 def main() -> None:
@@ -0,0 +1,80 @@
+"""Windowed aggregates of the sensor values, published on "<client>/sbN/agg".
+
+Same schema and windows as the firmware (lib/WindowAgg), see
+<repo_root>/doc/requirements/payload_agg_json.txt::
+
+    {"client":"tmc0","sb_nr":0,"agg_nr":12,"time_ms":1760612340000,"window_s":60,
+     "ts_agg":{"Indoor0":[20.01,20.45,20.22,15],"Outdoor":[-327.68,-327.68,-327.68,0]}}
+
+with [min, max, mean, count] per sensor.  The windows are aligned to multiples
+of their length on the sample time (epoch ms), a window ends with the first
+sample of a later window.
+"""
+
+from typing import Any, Dict, Optional, Tuple
+
+AGG_SUBTOPIC = "/agg"
+
+TEMP_INVALID = -327.68      # missing value, payload_json.txt v1.6
+
+
+class WindowAgg:
+    """Aggregates of one sensor bank over the current window."""
+
+    def __init__(self, window_s: float) -> None:
+        self.window_ms = max(1, int(window_s * 1000))
+        self.agg_nr = 0
+        self._index: Optional[int] = None
+        # name -> [min, max, sum, count], values in centi-degrees as on the firmware
+        self._slots: Dict[str, list] = {}
+
+    def add(self, values: Dict[str, Optional[float]], time_ms: int) -> Optional[Tuple[int, int, Dict[str, list]]]:
+        """Add the values of one sample.
+
+        Returns (agg_nr, start_ms, ts_agg) of the window the sample ended, None
+        while the window goes on.  A value of None or -327.68 counts as not valid.
+        """
+        index = time_ms // self.window_ms
+        ended = None
+        if self._index is not None and index != self._index:
+            ended = (self.agg_nr, self._index * self.window_ms, self._ts_agg())
+            self.agg_nr = (self.agg_nr + 1) & 0xFFFFFFFF
+        if self._index != index:
+            self._index = index
+            self._slots = {}
+        for name, value in values.items():
+            slot = self._slots.setdefault(name, [0, 0, 0, 0])
+            if value is None or value == TEMP_INVALID:
+                continue
+            centi = int(round(value * 100))
+            if not slot[3] or centi < slot[0]:
+                slot[0] = centi
+            if not slot[3] or centi > slot[1]:
+                slot[1] = centi
+            slot[2] += centi
+            slot[3] += 1
+        return ended
+
+    def _ts_agg(self) -> Dict[str, list]:
+        ts_agg = {}
+        for name, (lo, hi, total, count) in self._slots.items():
+            if not count:
+                ts_agg[name] = [TEMP_INVALID, TEMP_INVALID, TEMP_INVALID, 0]
+                continue
+            # mean rounded to the nearest centi-degree, halves away from zero (as the firmware)
+            mean = (abs(total) + count // 2) // count
+            ts_agg[name] = [lo / 100, hi / 100, (mean if total >= 0 else -mean) / 100, count]
+        return ts_agg
+
+
+def payload(client: str, sb_nr: int, agg_nr: int, start_ms: int, window_ms: int,
+            ts_agg: Dict[str, list]) -> Dict[str, Any]:
+    """Payload dict of one window, in the key order of the firmware."""
+    return {
+        "client": client,
+        "sb_nr": sb_nr,
+        "agg_nr": agg_nr,
+        "time_ms": start_ms,
+        "window_s": window_ms // 1000,
+        "ts_agg": ts_agg,
+    }
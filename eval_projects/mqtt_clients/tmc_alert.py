@@ -0,0 +1,84 @@
+"""Alarm thresholds of the sensors, alerts published on "<client>/sbN/alert".
+
+Same schema and states as the firmware (lib/SensorAlarm), see
+<repo_root>/doc/requirements/payload_alert_json.txt::
+
+    {"client":"tmc0","sb_nr":0,"alert_nr":3,"time_ms":1760612345250,
+     "ts_alert":{"Freezer":{"state":"high","temp":-11.94,"tl":-30,"th":-12}}}
+
+with the sensors whose state changed.  The firmware learns about a trip from
+the alarm search of the DS18B20 between its cycles; the model has no sensors
+and checks the thresholds against every sample instead.
+"""
+
+from typing import Any, Dict, Optional
+
+import tmc_sensors
+
+ALERT_SUBTOPIC = "/alert"
+
+ALARM_CLEAR_ROUNDS = 3      # samples in a row within range until a tripped sensor clears
+
+TEMP_INVALID = -327.68      # missing value, payload_json.txt v1.6
+
+
+class SensorAlarm:
+    """Alarm state of the sensors of one bank that have thresholds."""
+
+    def __init__(self, sensors: Optional[Dict[str, tmc_sensors.SensorDef]],
+                 clear_rounds: int = ALARM_CLEAR_ROUNDS) -> None:
+        self.clear_rounds = max(1, clear_rounds)
+        self.alert_nr = 0
+        self._defs = {name: d for name, d in (sensors or {}).items() if d.has_alarm}
+        self._state = {name: "clear" for name in self._defs}
+        self._quiet = {name: 0 for name in self._defs}
+        self._temp: Dict[str, float] = {}
+
+    def __bool__(self) -> bool:
+        return bool(self._defs)
+
+    def update(self, values: Dict[str, Optional[float]]) -> Dict[str, Dict[str, Any]]:
+        """Check the values of one sample, returns ts_alert of the sensors whose state changed."""
+        changed: Dict[str, Dict[str, Any]] = {}
+        for name, d in self._defs.items():
+            value = values.get(name)
+            state = "clear"
+            if value is not None and value != TEMP_INVALID:
+                # compared without the offset and rounded down to whole degrees, as the DS18B20 does
+                deg = (int(round(value * 100)) - d.offset_centi) // 100
+                if deg >= d.alarm_high:
+                    state = "high"
+                elif deg <= d.alarm_low:
+                    state = "low"
+                self._temp[name] = value
+            if state != "clear":
+                self._quiet[name] = 0
+                if self._state[name] == state:
+                    continue
+            elif self._state[name] == "clear":
+                continue
+            else:
+                self._quiet[name] += 1
+                if self._quiet[name] < self.clear_rounds:
+                    continue
+                self._quiet[name] = 0
+            self._state[name] = state
+            changed[name] = {
+                "state": state,
+                "temp": self._temp.get(name, TEMP_INVALID),
+                "tl": d.alarm_low,
+                "th": d.alarm_high,
+            }
+        return changed
+
+
+def payload(client: str, sb_nr: int, alert_nr: int, time_ms: int,
+            ts_alert: Dict[str, Dict[str, Any]]) -> Dict[str, Any]:
+    """Payload dict of one alert, in the key order of the firmware."""
+    return {
+        "client": client,
+        "sb_nr": sb_nr,
+        "alert_nr": alert_nr,
+        "time_ms": time_ms,
+        "ts_alert": ts_alert,
+    }
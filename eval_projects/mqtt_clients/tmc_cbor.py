@@ -0,0 +1,172 @@
+"""Compact binary (CBOR) payload of the temperature measurement clients.
+
+The binary payload carries the same dataset as the JSON payload v1.6, see
+<repo_root>/doc/requirements/payload_cbor.txt::
+
+    {0: "tmc0", 1: 0, 2: 17, 4: 1760612345678, 3: {0: 2000, 2: 2220}}
+
+i.e. client name, sb_nr, ds_nr, the sample time in epoch ms (optional) and
+ts_dat with the slot index as key and the temperature in centi-degrees as
+value (-32768 = no data).  The friendly names of
+the slots are published retained as JSON on "<client>/sb<N>/names".
+
+Only the subset of CBOR (RFC 8949) used by this payload is supported: unsigned
+and negative integers, text strings, arrays and maps.  No extra package needed.
+"""
+
+import json
+import struct
+from typing import Any, Dict, List, Optional, Tuple
+
+CBOR_SUBTOPIC = "/cbor"
+NAMES_SUBTOPIC = "/names"
+
+# integer keys of the top level map
+KEY_CLIENT = 0
+KEY_SB_NR = 1
+KEY_DS_NR = 2
+KEY_TS_DAT = 3
+KEY_TIME_MS = 4
+
+TEMP_INVALID_CENTI = -32768
+
+
+# ---------------------------------------------------------------------------
+# encoder
+# ---------------------------------------------------------------------------
+
+def _head(major: int, value: int) -> bytes:
+    major <<= 5
+    if value < 24:
+        return bytes([major | value])
+    if value <= 0xFF:
+        return bytes([major | 24, value])
+    if value <= 0xFFFF:
+        return bytes([major | 25]) + struct.pack(">H", value)
+    if value <= 0xFFFFFFFF:
+        return bytes([major | 26]) + struct.pack(">I", value)
+    return bytes([major | 27]) + struct.pack(">Q", value)
+
+
+def _encode(item: Any) -> bytes:
+    if isinstance(item, bool):
+        raise TypeError("bool is not supported")
+    if isinstance(item, int):
+        return _head(0, item) if item >= 0 else _head(1, -1 - item)
+    if isinstance(item, str):
+        raw = item.encode("utf-8")
+        return _head(3, len(raw)) + raw
+    if isinstance(item, (list, tuple)):
+        return _head(4, len(item)) + b"".join(_encode(v) for v in item)
+    if isinstance(item, dict):
+        return _head(5, len(item)) + b"".join(_encode(k) + _encode(v) for k, v in item.items())
+    raise TypeError(f"type {type(item).__name__} is not supported")
+
+
+def encode_dataset(client: str, sb_nr: int, ds_nr: int, centi: Dict[int, int],
+                   time_ms: Optional[int] = None) -> bytes:
+    """Encode one dataset, centi maps slot index -> temperature in centi-degrees."""
+    dataset: Dict[int, Any] = {KEY_CLIENT: client, KEY_SB_NR: sb_nr, KEY_DS_NR: ds_nr}
+    if time_ms:
+        dataset[KEY_TIME_MS] = time_ms
+    dataset[KEY_TS_DAT] = centi
+    return _encode(dataset)
+
+
+def to_centi(value: float) -> int:
+    return int(round(value * 100))
+
+
+# ---------------------------------------------------------------------------
+# decoder
+# ---------------------------------------------------------------------------
+
+def _decode(data: bytes, pos: int) -> Tuple[Any, int]:
+    initial = data[pos]
+    pos += 1
+    major, info = initial >> 5, initial & 0x1F
+    if info < 24:
+        value = info
+    elif info == 24:
+        value = data[pos]
+        pos += 1
+    elif info == 25:
+        value = struct.unpack_from(">H", data, pos)[0]
+        pos += 2
+    elif info == 26:
+        value = struct.unpack_from(">I", data, pos)[0]
+        pos += 4
+    elif info == 27:
+        value = struct.unpack_from(">Q", data, pos)[0]
+        pos += 8
+    else:
+        raise ValueError(f"unsupported CBOR additional info {info}")
+
+    if major == 0:
+        return value, pos
+    if major == 1:
+        return -1 - value, pos
+    if major == 3:
+        return data[pos:pos + value].decode("utf-8"), pos + value
+    if major == 4:
+        items: List[Any] = []
+        for _ in range(value):
+            item, pos = _decode(data, pos)
+            items.append(item)
+        return items, pos
+    if major == 5:
+        result: Dict[Any, Any] = {}
+        for _ in range(value):
+            key, pos = _decode(data, pos)
+            result[key], pos = _decode(data, pos)
+        return result, pos
+    raise ValueError(f"unsupported CBOR major type {major}")
+
+
+def decode(data: bytes) -> Any:
+    item, pos = _decode(data, 0)
+    if pos != len(data):
+        raise ValueError("trailing bytes after CBOR item")
+    return item
+
+
+def decode_dataset(data: bytes, names: Optional[List[str]] = None) -> Dict[str, Any]:
+    """Decode a binary dataset into the layout of the JSON payload v1.6.
+
+    names is the slot name list from the "names" topic; slots without a known
+    name get the key "slot<N>", as the firmware does for blank names.
+    """
+    raw = decode(data)
+    ts_dat: Dict[str, float] = {}
+    for slot, centi in raw[KEY_TS_DAT].items():
+        name = names[slot] if names and slot < len(names) and names[slot] else f"slot{slot}"
+        ts_dat[name] = centi / 100
+    dataset = {
+        "client": raw[KEY_CLIENT],
+        "sb_nr": raw[KEY_SB_NR],
+        "ds_nr": raw[KEY_DS_NR],
+    }
+    if KEY_TIME_MS in raw:
+        dataset["time_ms"] = raw[KEY_TIME_MS]
+    dataset["ts_dat"] = ts_dat
+    return dataset
+
+
+def names_payload(client: str, sb_nr: int, names: List[str]) -> str:
+    """JSON payload of the retained names topic."""
+    return json.dumps({"client": client, "sb_nr": sb_nr, "names": names}, separators=(',', ':'))
+
+
+class NameCache:
+    """Collects the slot names published on the "<bank topic>/names" topics."""
+
+    def __init__(self) -> None:
+        self._names: Dict[str, List[str]] = {}
+
+    def update(self, topic: str, payload: bytes) -> None:
+        base = topic[:-len(NAMES_SUBTOPIC)]
+        self._names[base] = json.loads(payload.decode("utf-8")).get("names", [])
+
+    def decode(self, topic: str, payload: bytes) -> Dict[str, Any]:
+        base = topic[:-len(CBOR_SUBTOPIC)]
+        return decode_dataset(payload, self._names.get(base))
@@ -0,0 +1,134 @@
+"""Sensor table of a temperature measurement client configuration.
+
+Shared by the model (mqtt_tmc_model.py) and the generator of the firmware's
+sensor table (gen_sensor_defs.py), so both read the same schema, see
+<repo_root>/doc/requirements/tmc_model_config_yml.txt.  Next to the values of
+a bank (``sbN_tsdat``, slot index = position) an optional ``sbN_sensors``
+section gives the physical sensor of each slot::
+
+    sb0_sensors:
+      "ID":  {rom: "28D0089F0000009F", offset: -0.12, resolution: 12}
+      "OD":  {rom: "282C446E000000A6", alarm: [-20, 35]}
+
+``rom`` is the ROM code as 16 hex digits in bus order (family code first),
+``offset`` the calibration offset in degree C added to the readings (default
+0, at most +-5.00), ``resolution`` 9..12 bit (default 12), ``alarm`` the
+alarm thresholds [tl, th] in whole degrees C (default none, see
+tmc_alert.py).  Without an
+``sbN_sensors`` section all slots of ``sbN_tsdat`` count as configured; with
+it, only the slots listed there do, as on the firmware where a slot without
+ROM code is neither read nor published.
+"""
+
+from typing import Any, Dict, List, NamedTuple, Optional, Tuple
+
+SLOTS_PER_BANK = 8
+NAME_MAX = 8
+ROM_SIZE = 8
+OFFSET_MAX_CENTI = 500
+RESOLUTION_DEFAULT = 12
+ALARM_OFF_LOW = -55         # thresholds of a slot without alarm: the range of the DS18B20
+ALARM_OFF_HIGH = 125
+
+
+class SensorDef(NamedTuple):
+    bank: int
+    slot: int
+    name: str
+    rom: bytes
+    offset_centi: int
+    resolution: int
+    alarm_low: int = ALARM_OFF_LOW
+    alarm_high: int = ALARM_OFF_HIGH
+
+    @property
+    def has_alarm(self) -> bool:
+        return self.alarm_low > ALARM_OFF_LOW or self.alarm_high < ALARM_OFF_HIGH
+
+
+def dallas_crc8(data: bytes) -> int:
+    crc = 0
+    for byte in data:
+        for _ in range(8):
+            mix = (crc ^ byte) & 0x01
+            crc >>= 1
+            if mix:
+                crc ^= 0x8C
+            byte >>= 1
+    return crc
+
+
+def parse_rom(text: str) -> bytes:
+    """16 hex digits into a ROM code, checked like parseRom() of the firmware."""
+    try:
+        rom = bytes.fromhex(text)
+    except (TypeError, ValueError):
+        raise ValueError(f"ROM code '{text}' is not 16 hex digits")
+    if len(rom) != ROM_SIZE:
+        raise ValueError(f"ROM code '{text}' is not 16 hex digits")
+    if not any(rom) or dallas_crc8(rom[:-1]) != rom[-1]:
+        raise ValueError(f"ROM code '{text}' has a wrong CRC")
+    return rom
+
+
+def parse_alarm(value: Any, what: str) -> Tuple[int, int]:
+    """[tl, th] in whole degrees C into the thresholds, checked like sensorDefsInRange() of the firmware."""
+    if value is None:
+        return ALARM_OFF_LOW, ALARM_OFF_HIGH
+    if not isinstance(value, list) or len(value) != 2 or not all(isinstance(v, int) for v in value):
+        raise ValueError(f"{what} must be [tl, th] in whole degrees")
+    low, high = value
+    if not ALARM_OFF_LOW <= low < high <= ALARM_OFF_HIGH:
+        raise ValueError(f"{what} must be within {ALARM_OFF_LOW}..{ALARM_OFF_HIGH} with tl < th")
+    return low, high
+
+
+def bank_sensors(config: Dict[str, Any], bank: int, names: List[str]) -> Optional[Dict[str, SensorDef]]:
+    """Sensors of a bank by name, None if the bank has no sbN_sensors section.
+
+    names are the slot names of the bank in slot order (keys of sbN_tsdat).
+    """
+    key = f"sb{bank}_sensors"
+    section = config.get(key)
+    if section is None:
+        return None
+    if not isinstance(section, dict):
+        raise ValueError(f"{key} must be a mapping")
+    sensors: Dict[str, SensorDef] = {}
+    for name, entry in section.items():
+        if name not in names:
+            raise ValueError(f"{key}: sensor '{name}' has no slot in sb{bank}_tsdat")
+        if not isinstance(entry, dict) or "rom" not in entry:
+            raise ValueError(f"{key}: sensor '{name}' needs a rom")
+        offset_centi = int(round(float(entry.get("offset", 0)) * 100))
+        if abs(offset_centi) > OFFSET_MAX_CENTI:
+            raise ValueError(f"{key}: offset of '{name}' exceeds +-{OFFSET_MAX_CENTI / 100:.2f}")
+        resolution = int(entry.get("resolution", RESOLUTION_DEFAULT))
+        if not 9 <= resolution <= 12:
+            raise ValueError(f"{key}: resolution of '{name}' must be 9..12")
+        alarm_low, alarm_high = parse_alarm(entry.get("alarm"), f"{key}: alarm of '{name}'")
+        sensors[name] = SensorDef(bank, names.index(name), name, parse_rom(str(entry["rom"])),
+                                  offset_centi, resolution, alarm_low, alarm_high)
+    return sensors
+
+
+def sensor_table(config: Dict[str, Any]) -> List[SensorDef]:
+    """All sensors of the sbN_tsdat/sbN_sensors sections, checked as the firmware does at compile time."""
+    table: List[SensorDef] = []
+    bank = 0
+    while f"sb{bank}_tsdat" in config:
+        names = list(config[f"sb{bank}_tsdat"] or {})
+        if len(names) > SLOTS_PER_BANK:
+            raise ValueError(f"sb{bank}_tsdat: a bank has at most {SLOTS_PER_BANK} slots")
+        for name in names:
+            if len(name) > NAME_MAX or " " in name:
+                raise ValueError(f"sb{bank}_tsdat: sensor names must be <={NAME_MAX} chars and contain no spaces")
+        sensors = bank_sensors(config, bank, names)
+        if sensors:
+            table.extend(sorted(sensors.values(), key=lambda d: d.slot))
+        bank += 1
+    roms = [d.rom for d in table]
+    for rom in roms:
+        if roms.count(rom) > 1:
+            raise ValueError(f"ROM code {rom.hex().upper()} is used twice")
+    return table
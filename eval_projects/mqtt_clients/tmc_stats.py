@@ -0,0 +1,105 @@
+"""Timing statistics of the measurement cycle, published on "<client>/stats".
+
+Same schema and percentile method as the firmware (lib/CycleStats), see
+<repo_root>/doc/requirements/stats_json.txt::
+
+    {"client":"tmc0","uptime":3600,"period_ms":60004,"cycles":15,"missed":0,
+     "us":{"conv":[15,750113,750342,751208,751615],...}}
+
+with [count, min, avg, max, p99] per phase in microseconds.  The percentile is
+the upper bound of a log-linear histogram bucket (4 buckets per power of two),
+at most 25% above the exact value, as on the firmware.
+"""
+
+import json
+from typing import Any, Dict, List
+
+STATS_SUBTOPIC = "/stats"
+
+# phases in the order of the firmware; phases a client doesn't have report count 0
+PHASES = ("conv", "read", "lcd", "build", "pub", "loop", "lag", "alarm")
+
+STATS_CLAMP_US = 1 << 22
+STATS_BUCKETS = 4 * (22 - 1) + 1
+
+
+def bucket_of(us: int) -> int:
+    if us >= STATS_CLAMP_US:
+        return STATS_BUCKETS - 1
+    if us < 4:
+        return us
+    msb = us.bit_length() - 1
+    return 4 * (msb - 1) + ((us >> (msb - 2)) & 0x03)
+
+
+def bucket_upper(bucket: int) -> int:
+    if bucket < 4:
+        return bucket
+    msb = bucket // 4 + 1
+    return ((4 + bucket % 4 + 1) << (msb - 2)) - 1
+
+
+class PhaseStats:
+    def __init__(self) -> None:
+        self.reset()
+
+    def reset(self) -> None:
+        self.count = 0
+        self.min = 0
+        self.max = 0
+        self.sum = 0
+        self.hist: List[int] = [0] * STATS_BUCKETS
+
+    def add(self, us: int) -> None:
+        us = max(0, int(us))
+        self.min = us if self.count == 0 else min(self.min, us)
+        self.max = max(self.max, us)
+        self.count += 1
+        self.sum += us
+        self.hist[bucket_of(us)] += 1
+
+    def percentile(self, pct: int) -> int:
+        total = sum(self.hist)
+        if not total:
+            return 0
+        rank = (total * pct + 99) // 100
+        seen = 0
+        for i, n in enumerate(self.hist):
+            seen += n
+            if seen >= rank:
+                upper = bucket_upper(i)
+                return self.max if i == STATS_BUCKETS - 1 or upper > self.max else upper
+        return self.max
+
+    def summary(self) -> List[int]:
+        avg = self.sum // self.count if self.count else 0
+        return [self.count, self.min, avg, self.max, self.percentile(99)]
+
+
+class CycleStats:
+    """Statistics of all phases of one reporting period."""
+
+    def __init__(self) -> None:
+        self.phases: Dict[str, PhaseStats] = {name: PhaseStats() for name in PHASES}
+        self.cycles = 0
+        self.missed = 0
+
+    def add(self, phase: str, us: float) -> None:
+        self.phases[phase].add(int(us))
+
+    def payload(self, client: str, uptime_s: float, period_ms: float) -> str:
+        data: Dict[str, Any] = {
+            "client": client,
+            "uptime": int(uptime_s),
+            "period_ms": int(period_ms),
+            "cycles": self.cycles,
+            "missed": self.missed,
+            "us": {name: st.summary() for name, st in self.phases.items()},
+        }
+        return json.dumps(data, separators=(',', ':'))
+
+    def reset(self) -> None:
+        for st in self.phases.values():
+            st.reset()
+        self.cycles = 0
+        self.missed = 0
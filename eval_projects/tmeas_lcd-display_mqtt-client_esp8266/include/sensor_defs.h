@@ -0,0 +1,18 @@
+// Sensor table of the firmware, generated by mqtt_clients/gen_sensor_defs.py from mqtt_tmc_model_config.yml.
+// Change the configuration and generate again rather than editing this file.
+//
+// bank, slot, ROM code, name, calibration offset (centi-degrees), resolution (bits) [, alarm thresholds TL, TH (degrees)]
+
+#ifndef SENSOR_DEFS_H
+#define SENSOR_DEFS_H
+
+#include <SensorTable.h>
+
+constexpr SensorDef SENSOR_DEFS[] = {
+  { 0, 0, {0x28,0xD0,0x08,0x9F,0x00,0x00,0x00,0x9F}, "ID", 0, 12 },
+  { 0, 1, {0x28,0xEC,0x67,0x9F,0x00,0x00,0x00,0x71}, "ID1", 0, 12 },
+  { 0, 2, {0x28,0x2C,0x44,0x6E,0x00,0x00,0x00,0xA6}, "OD", 0, 12 },
+};
+constexpr size_t SENSOR_DEF_COUNT = 3;
+
+#endif // SENSOR_DEFS_H
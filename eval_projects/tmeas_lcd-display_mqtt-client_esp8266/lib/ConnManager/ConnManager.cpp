@@ -0,0 +1,177 @@
+#include "ConnManager.h"
+
+#include <string.h>
+
+namespace {
+
+const uint8_t FAST_MAGIC[4] = { 'T', 'M', 'W', 'F' };
+
+// CRC-16/CCITT-FALSE
+uint16_t crc16(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    crc ^= (uint16_t)*data++ << 8;
+    for (uint8_t b = 0; b < 8; b++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+} // namespace
+
+size_t FastConnectFile::serialize(uint8_t* buf, size_t size, const WifiFastConnect& fc) {
+  if (size < FILE_SIZE) return 0;
+  memcpy(buf, FAST_MAGIC, 4);
+  memcpy(buf + 4, &fc, sizeof(fc));
+  uint16_t crc = crc16(buf, FILE_SIZE - 2);
+  buf[FILE_SIZE - 2] = crc >> 8;
+  buf[FILE_SIZE - 1] = crc & 0xFF;
+  return FILE_SIZE;
+}
+
+bool FastConnectFile::deserialize(const uint8_t* buf, size_t len, WifiFastConnect& fc) {
+  if (len != FILE_SIZE || memcmp(buf, FAST_MAGIC, 4) != 0) return false;
+  if (crc16(buf, FILE_SIZE - 2) != (uint16_t)((buf[FILE_SIZE - 2] << 8) | buf[FILE_SIZE - 1])) return false;
+  memcpy(&fc, buf + 4, sizeof(fc));
+  return true;
+}
+
+#if defined(ARDUINO_ARCH_ESP8266)
+
+#include <LittleFS.h>
+
+bool FastConnectFile::load(const char* path, WifiFastConnect& fc) {
+  uint8_t buf[FILE_SIZE];
+  File f = LittleFS.open(path, "r");
+  if (!f) return false;
+  bool ok = f.size() == FILE_SIZE && f.read(buf, FILE_SIZE) == FILE_SIZE;
+  f.close();
+  return ok && deserialize(buf, FILE_SIZE, fc);
+}
+
+bool FastConnectFile::save(const char* path, const WifiFastConnect& fc) {
+  uint8_t buf[FILE_SIZE];
+  serialize(buf, sizeof(buf), fc);
+  File f = LittleFS.open(path, "w");
+  if (!f) return false;
+  bool ok = f.write(buf, FILE_SIZE) == FILE_SIZE;
+  f.close();
+  return ok;
+}
+
+#endif // ARDUINO_ARCH_ESP8266
+
+ConnManager::ConnManager(ConnLink &link, uint32_t seed, uint32_t wifiTimeoutMs,
+                         uint32_t minBackoffMs, uint32_t maxBackoffMs, uint32_t fastTimeoutMs)
+    : _link(link), _state(CONN_WIFI_START), _retryState(CONN_WIFI_START), _wifiUp(false),
+      _fast(false), _fastOk(true), _fastRetry(false), _stateStartMs(0), _backoffMs(minBackoffMs), _waitMs(0),
+      _rng(seed ? seed : 0x2545F491), _wifiTimeoutMs(wifiTimeoutMs), _minBackoffMs(minBackoffMs),
+      _maxBackoffMs(maxBackoffMs), _fastTimeoutMs(fastTimeoutMs), _stats() {}
+
+const char *ConnManager::stateName(ConnState state) {
+  switch (state) {
+    case CONN_WIFI_START:   return "wifi_start";
+    case CONN_WIFI_WAIT:    return "wifi_wait";
+    case CONN_MQTT_CONNECT: return "mqtt_connect";
+    case CONN_ONLINE:       return "online";
+    case CONN_BACKOFF:      return "backoff";
+  }
+  return "unknown";
+}
+
+uint32_t ConnManager::jitter(uint32_t delayMs) {
+  _rng ^= _rng << 13;
+  _rng ^= _rng >> 17;
+  _rng ^= _rng << 5;
+  uint32_t span = delayMs / 2;          // +-25% of the delay
+  if (!span) return delayMs;
+  return delayMs - span / 2 + _rng % (span + 1);
+}
+
+void ConnManager::fail(uint32_t nowMs, ConnState retryState) {
+  _waitMs = jitter(_backoffMs);
+  _backoffMs = (_backoffMs >= _maxBackoffMs / 2) ? _maxBackoffMs : _backoffMs * 2;
+  _retryState = retryState;
+  _state = CONN_BACKOFF;
+  _stateStartMs = nowMs;
+}
+
+void ConnManager::step(uint32_t nowMs) {
+  _wifiUp = _link.wifiConnected();
+
+  switch (_state) {
+    case CONN_WIFI_START:
+      if (_wifiUp && _fastOk) {         // e.g. the SDK rejoined on its own
+        _state = CONN_MQTT_CONNECT;
+        break;
+      }
+      _fast = _link.wifiBegin(_fastOk);
+      _fastRetry = false;
+      _state = CONN_WIFI_WAIT;
+      _stateStartMs = nowMs;
+      break;
+
+    case CONN_WIFI_WAIT:
+      if (_wifiUp) {
+        _fastOk = true;
+        _state = CONN_MQTT_CONNECT;
+      } else if (_fast && nowMs - _stateStartMs >= _fastTimeoutMs) {
+        _stats.fastFailures++;
+        _fastOk = false;                // join again right away, with scan and DHCP
+        _state = CONN_WIFI_START;
+      } else if (nowMs - _stateStartMs >= _wifiTimeoutMs) {
+        _stats.wifiFailures++;
+        fail(nowMs, CONN_WIFI_START);
+      }
+      break;
+
+    case CONN_MQTT_CONNECT: {
+      if (!_wifiUp) {
+        _state = CONN_WIFI_START;
+        break;
+      }
+      BrokerResult result = _link.mqttConnect();
+      if (result == BROKER_CONNECTED) {
+        _stats.connects++;
+        _backoffMs = _minBackoffMs;
+        _fastRetry = false;
+        _state = CONN_ONLINE;
+        _link.onOnline();
+        break;
+      }
+      _stats.mqttFailures++;
+      if (_fast && result == BROKER_UNREACHABLE) {
+        // the IP configuration of the fast connect may be stale (e.g. an expired lease)
+        _stats.fastFailures++;
+        _fast = false;
+        _fastOk = false;
+        _state = CONN_WIFI_START;
+      } else if (_fast && _fastRetry) {
+        // refused again, join with scan and DHCP
+        _fast = false;
+        _fastOk = false;
+        _state = CONN_WIFI_START;
+      } else {
+        _fastRetry = _fast;
+        fail(nowMs, CONN_MQTT_CONNECT);
+      }
+      break;
+    }
+
+    case CONN_ONLINE:
+      if (!_wifiUp) {
+        _stats.connectionLosses++;
+        _state = CONN_WIFI_START;
+      } else if (!_link.mqttConnected()) {
+        _stats.connectionLosses++;
+        _state = CONN_MQTT_CONNECT;
+      }
+      break;
+
+    case CONN_BACKOFF:
+      if (nowMs - _stateStartMs >= _waitMs) {
+        // if WiFi came back while waiting for a WiFi retry, skip straight to the broker
+        _state = (_retryState == CONN_WIFI_START && _wifiUp) ? CONN_MQTT_CONNECT : _retryState;
+      }
+      break;
+  }
+}
@@ -0,0 +1,135 @@
+/*
+  ConnManager - non-blocking WiFi/MQTT connection manager
+
+  The manager is advanced by step() from loop() and never waits itself:
+
+    CONN_WIFI_START     start joining the WiFi network
+    CONN_WIFI_WAIT      wait for the WiFi connection, give up after wifiTimeoutMs
+    CONN_MQTT_CONNECT   one connection attempt to the broker
+    CONN_ONLINE         connected, watch WiFi and broker connection
+    CONN_BACKOFF        wait before the next attempt
+
+  Failed attempts are retried with an exponential backoff (doubled per failure, limited to
+  maxBackoffMs) plus a random jitter of up to +-25%, so a flapping network or a rebooting
+  broker is not hammered by all clients at the same time. A successful connection resets
+  the backoff.
+
+  Fast connect: with the data of the last connection (access point BSSID and channel, IP
+  configuration) the link joins without scanning for the access point and without DHCP, which
+  takes a fraction of the time. A fast join gets fastTimeoutMs; if it fails (the access point
+  changed its channel) or the broker can't be reached over it (no TCP connection: the network
+  changed its addresses, the lease expired), the next join scans and uses DHCP without waiting
+  for a backoff. A broker that answers and refuses the connection says nothing about the IP
+  configuration: the attempt is retried once after the normal backoff, only a second refusal
+  drops WiFi for a join with scan and DHCP. Once a join succeeded, fast connect is tried again
+  on the next one.
+
+  The hardware is accessed through ConnLink, so the manager can run against simulated
+  WiFi and MQTT implementations as well.
+*/
+
+#ifndef CONN_MANAGER_H
+#define CONN_MANAGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum ConnState : uint8_t {
+  CONN_WIFI_START,
+  CONN_WIFI_WAIT,
+  CONN_MQTT_CONNECT,
+  CONN_ONLINE,
+  CONN_BACKOFF
+};
+
+// Result of a connection attempt to the broker
+enum BrokerResult : uint8_t {
+  BROKER_CONNECTED,
+  BROKER_UNREACHABLE,               // no TCP connection (no route, timeout), after a fast join a stale IP configuration
+  BROKER_REFUSED                    // the broker answered but didn't accept the connection (CONNACK return code, no CONNACK)
+};
+
+// Data of the last WiFi connection, IPv4 addresses as uint32_t of IPAddress
+struct WifiFastConnect {
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint8_t bssid[6];
+  uint8_t channel;                  // 0 = no fast-connect data
+  uint8_t reserved;
+};
+
+// Fast-connect data on flash: unlike the RTC memory it survives a power cycle, so a cold boot
+// connects fast as well. The file carries a magic and a CRC-16.
+class FastConnectFile {
+public:
+  static constexpr size_t FILE_SIZE = 4 + sizeof(WifiFastConnect) + 2;
+
+  static size_t serialize(uint8_t* buf, size_t size, const WifiFastConnect& fc);   // 0 if buf is too small
+  static bool deserialize(const uint8_t* buf, size_t len, WifiFastConnect& fc);    // false: fc unchanged
+
+  static bool load(const char* path, WifiFastConnect& fc);
+  static bool save(const char* path, const WifiFastConnect& fc);
+};
+
+// Access to the network hardware, implemented by the firmware (or a simulation)
+class ConnLink {
+public:
+  virtual ~ConnLink() {}
+  // Start joining the WiFi network, returns immediately. fast: a fast connect may be used;
+  // returns true if one was started.
+  virtual bool wifiBegin(bool fast) = 0;
+  virtual bool wifiConnected() = 0;
+  virtual BrokerResult mqttConnect() = 0;   // one connection attempt to the broker
+  virtual bool mqttConnected() = 0;
+  virtual void onOnline() = 0;          // called once per successful connect, e.g. to subscribe
+};
+
+// Counters reported as telemetry
+struct ConnStats {
+  uint32_t wifiFailures;                // WiFi join attempts timed out
+  uint32_t mqttFailures;                // broker connection attempts failed
+  uint32_t connects;                    // successful broker connections
+  uint32_t connectionLosses;            // WiFi or broker connection lost while online
+  uint32_t fastFailures;                // fast joins that failed or couldn't reach the broker, each followed by a
+                                        // join with scan and DHCP
+};
+
+class ConnManager {
+public:
+  ConnManager(ConnLink &link, uint32_t seed, uint32_t wifiTimeoutMs = 10000,
+              uint32_t minBackoffMs = 500, uint32_t maxBackoffMs = 60000, uint32_t fastTimeoutMs = 3000);
+
+  void step(uint32_t nowMs);            // advance the state machine, never blocks
+
+  ConnState state() const { return _state; }
+  bool online() const { return _state == CONN_ONLINE; }
+  bool wifiUp() const { return _wifiUp; }
+  bool fast() const { return _fast; }   // the current (or last) join was a fast connect
+  const ConnStats &stats() const { return _stats; }
+  static const char *stateName(ConnState state);
+
+private:
+  void fail(uint32_t nowMs, ConnState retryState);
+  uint32_t jitter(uint32_t delayMs);
+
+  ConnLink &_link;
+  ConnState _state;
+  ConnState _retryState;                // state to enter when the backoff has elapsed
+  bool _wifiUp;
+  bool _fast;                           // the current join is a fast connect
+  bool _fastOk;                         // a fast connect may be tried on the next join
+  bool _fastRetry;                      // a refused broker connection of the current fast join was retried
+  uint32_t _stateStartMs;
+  uint32_t _backoffMs;                  // current (unjittered) backoff
+  uint32_t _waitMs;                     // jittered wait of the current backoff
+  uint32_t _rng;                        // xorshift32 state for the jitter
+  uint32_t _wifiTimeoutMs;
+  uint32_t _minBackoffMs;
+  uint32_t _maxBackoffMs;
+  uint32_t _fastTimeoutMs;
+  ConnStats _stats;
+};
+
+#endif // CONN_MANAGER_H
@@ -0,0 +1,82 @@
+#include "CoopScheduler.h"
+
+#include <string.h>
+
+CoopScheduler::CoopScheduler(Clock& clock) : _clock(clock), _count(0), _lagMs(0) {}
+
+int8_t CoopScheduler::add(const char* name, TaskFn fn, uint32_t periodMs, uint32_t budgetUs, bool oneShot, bool armed,
+                          uint32_t delayMs) {
+  if (_count >= TASKS_MAX) return -1;
+  Task& t = _tasks[_count];
+  t.name = name;
+  t.fn = fn;
+  t.periodMs = periodMs;
+  t.budgetUs = budgetUs;
+  t.nextMs = _clock.millis() + delayMs;
+  t.oneShot = oneShot;
+  t.armed = armed;
+  memset(&t.stats, 0, sizeof(t.stats));
+  return _count++;
+}
+
+int8_t CoopScheduler::addPeriodic(const char* name, TaskFn fn, uint32_t periodMs, uint32_t budgetUs, uint32_t phaseMs) {
+  return add(name, fn, periodMs, budgetUs, false, true, phaseMs);
+}
+
+int8_t CoopScheduler::addOneShot(const char* name, TaskFn fn, uint32_t budgetUs) {
+  return add(name, fn, 0, budgetUs, true, false, 0);
+}
+
+void CoopScheduler::runAfter(int8_t task, uint32_t delayMs) {
+  if (task < 0 || task >= _count) return;
+  _tasks[task].nextMs = _clock.millis() + delayMs;
+  _tasks[task].armed = true;
+}
+
+void CoopScheduler::cancel(int8_t task) {
+  if (task >= 0 && task < _count) _tasks[task].armed = false;
+}
+
+void CoopScheduler::setPeriod(int8_t task, uint32_t periodMs) {
+  if (task < 0 || task >= _count || _tasks[task].oneShot) return;
+  Task& t = _tasks[task];
+  t.nextMs = t.nextMs - t.periodMs + periodMs;
+  t.periodMs = periodMs;
+}
+
+// The task is disarmed (one-shot) or its next due time set (periodic) before it runs, so it
+// can arm itself again from its run.
+void CoopScheduler::tick() {
+  for (uint8_t i = 0; i < _count; i++) {
+    Task& t = _tasks[i];
+    if (!t.armed) continue;
+    uint32_t now = _clock.millis();
+    bool everyTick = !t.oneShot && t.periodMs == EVERY_TICK;
+    if (!everyTick && (int32_t)(now - t.nextMs) < 0) continue;
+
+    _lagMs = everyTick ? 0 : now - t.nextMs;
+    if (t.oneShot) {
+      t.armed = false;
+    } else if (!everyTick) {
+      uint32_t due = t.nextMs;
+      if (_lagMs >= t.periodMs) {
+        t.stats.skipped += _lagMs / t.periodMs;
+        due = now;
+      }
+      t.nextMs = due + t.periodMs;
+    }
+    if (_lagMs > t.stats.maxLagMs) t.stats.maxLagMs = _lagMs;
+
+    uint32_t startUs = _clock.micros();
+    t.fn();
+    uint32_t us = _clock.micros() - startUs;
+    t.stats.runs++;
+    if (us > t.stats.maxUs) t.stats.maxUs = us;
+    if (us > t.budgetUs) t.stats.overruns++;
+  }
+  _lagMs = 0;
+}
+
+void CoopScheduler::resetStats() {
+  for (uint8_t i = 0; i < _count; i++) memset(&_tasks[i].stats, 0, sizeof(_tasks[i].stats));
+}
@@ -0,0 +1,89 @@
+/*
+  CoopScheduler - cooperative scheduler of the firmware's tasks
+
+  All work of the client runs as short tasks from one tick() per loop() pass; a task never
+  waits, it returns and gets run again when it is due:
+
+    periodic    runs on a fixed grid of its period, independent of how long the tasks take;
+                if it fell behind by a whole period or more, the grid is restarted from now
+                and the dropped grid points are counted as skipped. EVERY_TICK: on every tick.
+    one-shot    runs once after being armed by runAfter(), e.g. to continue a job on the next
+                tick or after a wait; it may arm itself again from its own run.
+
+  Each task has a time budget: a run taking longer is counted as an overrun, so a task that
+  stretches the ticks (and with it the other tasks' latency) shows up in the statistics.
+  Per task the runs, overruns, longest run, skipped grid points and the longest delay of a
+  run behind its due time are kept until resetStats().
+
+  Tasks run in the order they were added, each at most once per tick. Times are taken from
+  a Clock (see TmcCore.h), so the scheduler runs on the host as well. No dynamic allocation.
+*/
+
+#ifndef COOP_SCHEDULER_H
+#define COOP_SCHEDULER_H
+
+#include <stdint.h>
+
+#include <TmcCore.h>
+
+typedef void (*TaskFn)();
+
+struct TaskStats {
+  uint32_t runs;
+  uint32_t overruns;                  // runs longer than the budget
+  uint32_t maxUs;                     // longest run
+  uint32_t skipped;                   // grid points of a periodic task dropped after falling behind
+  uint32_t maxLagMs;                  // longest delay of a run behind its due time
+};
+
+class CoopScheduler {
+public:
+  static constexpr uint8_t TASKS_MAX = 10;
+  static constexpr uint32_t EVERY_TICK = 0;
+
+  explicit CoopScheduler(Clock& clock);
+
+  // Periodic task, first run phaseMs from now; -1 if there is no room for another task
+  int8_t addPeriodic(const char* name, TaskFn fn, uint32_t periodMs, uint32_t budgetUs, uint32_t phaseMs = 0);
+  // One-shot task, idle until armed by runAfter()
+  int8_t addOneShot(const char* name, TaskFn fn, uint32_t budgetUs);
+
+  // Arm a one-shot task to run delayMs from now; a periodic task restarts its grid from there
+  void runAfter(int8_t task, uint32_t delayMs);
+  void cancel(int8_t task);           // disarm; a periodic task stays stopped until runAfter()
+  // Change the period of a periodic task, the next run moves along with it
+  void setPeriod(int8_t task, uint32_t periodMs);
+  bool armed(int8_t task) const { return task >= 0 && task < _count && _tasks[task].armed; }
+
+  void tick();                        // run every task that is due, once
+
+  // Delay of the task currently running behind its due time (0 for EVERY_TICK tasks)
+  uint32_t lagMs() const { return _lagMs; }
+
+  uint8_t count() const { return _count; }
+  const char* name(uint8_t task) const { return _tasks[task].name; }
+  uint32_t budgetUs(uint8_t task) const { return _tasks[task].budgetUs; }
+  const TaskStats& stats(uint8_t task) const { return _tasks[task].stats; }
+  void resetStats();
+
+private:
+  struct Task {
+    const char* name;
+    TaskFn fn;
+    uint32_t periodMs;
+    uint32_t budgetUs;
+    uint32_t nextMs;                  // due time
+    bool oneShot;
+    bool armed;
+    TaskStats stats;
+  };
+
+  int8_t add(const char* name, TaskFn fn, uint32_t periodMs, uint32_t budgetUs, bool oneShot, bool armed, uint32_t delayMs);
+
+  Clock& _clock;
+  Task _tasks[TASKS_MAX];
+  uint8_t _count;
+  uint32_t _lagMs;
+};
+
+#endif // COOP_SCHEDULER_H
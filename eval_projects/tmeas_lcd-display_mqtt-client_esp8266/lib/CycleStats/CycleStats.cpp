@@ -0,0 +1,56 @@
+#include "CycleStats.h"
+
+void PhaseStats::reset() {
+  _count = 0;
+  _min = 0xFFFFFFFF;
+  _max = 0;
+  _sum = 0;
+  for (uint8_t i = 0; i < STATS_BUCKETS; i++) _hist[i] = 0;
+}
+
+// Values below 4 get a bucket each, above 4 buckets per power of two:
+// the bucket is given by the most significant bit and the two bits below it
+uint8_t PhaseStats::bucketOf(uint32_t us) {
+  if (us >= STATS_CLAMP_US) return STATS_BUCKETS - 1;
+  if (us < 4) return us;
+  uint8_t msb = 31 - __builtin_clz(us);
+  return 4 * (msb - 1) + ((us >> (msb - 2)) & 0x03);
+}
+
+uint32_t PhaseStats::bucketUpper(uint8_t bucket) {
+  if (bucket < 4) return bucket;
+  uint8_t msb = bucket / 4 + 1;
+  uint32_t sub = bucket % 4;
+  return ((4 + sub + 1) << (msb - 2)) - 1;
+}
+
+void PhaseStats::add(uint32_t us) {
+  _count++;
+  _sum += us;
+  if (us < _min) _min = us;
+  if (us > _max) _max = us;
+
+  uint8_t b = bucketOf(us);
+  if (_hist[b] == 0xFFFF) {
+    for (uint8_t i = 0; i < STATS_BUCKETS; i++) _hist[i] >>= 1;
+  }
+  _hist[b]++;
+}
+
+uint32_t PhaseStats::percentile(uint8_t pct) const {
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < STATS_BUCKETS; i++) total += _hist[i];
+  if (!total) return 0;
+
+  // smallest bucket with at least pct percent of the samples at or below it
+  uint32_t rank = (total * pct + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < STATS_BUCKETS; i++) {
+    seen += _hist[i];
+    if (seen >= rank) {
+      uint32_t upper = bucketUpper(i);
+      return (i == STATS_BUCKETS - 1 || upper > _max) ? _max : upper;
+    }
+  }
+  return _max;
+}
@@ -0,0 +1,47 @@
+/*
+  CycleStats - lightweight timing statistics of the measurement cycle phases
+
+  Each phase collects count, min, max and average of its durations in microseconds, plus a
+  log-linear histogram for percentiles: 4 buckets per power of two, so a percentile is
+  reported as the upper bound of its bucket, at most 25% above the exact value.
+  Durations from STATS_CLAMP_US on share the last bucket (min/max/avg stay exact).
+
+  When a bucket is about to overflow, all buckets are halved, so the histogram keeps the
+  shape of the distribution even for phases counted on every loop() pass.
+
+  Memory: about 200 bytes per phase, no dynamic allocation.
+*/
+
+#ifndef CYCLE_STATS_H
+#define CYCLE_STATS_H
+
+#include <stdint.h>
+
+constexpr uint32_t STATS_CLAMP_US = 1UL << 22;                   // ~4.2 s
+constexpr uint8_t STATS_BUCKETS = 4 * (22 - 1) + 1;              // bucket of STATS_CLAMP_US is the last
+
+class PhaseStats {
+public:
+  PhaseStats() { reset(); }
+
+  void add(uint32_t us);
+  void reset();
+
+  uint32_t count() const { return _count; }
+  uint32_t min() const { return _count ? _min : 0; }
+  uint32_t max() const { return _max; }
+  uint32_t avg() const { return _count ? (uint32_t)(_sum / _count) : 0; }
+  uint32_t percentile(uint8_t pct) const;     // upper bound of the bucket holding the percentile
+
+private:
+  static uint8_t bucketOf(uint32_t us);
+  static uint32_t bucketUpper(uint8_t bucket);
+
+  uint32_t _count;
+  uint32_t _min;
+  uint32_t _max;
+  uint64_t _sum;
+  uint16_t _hist[STATS_BUCKETS];
+};
+
+#endif // CYCLE_STATS_H
@@ -0,0 +1,51 @@
+#include "DatasetBuffer.h"
+
+DatasetRing::DatasetRing(DatasetRecord *storage, uint16_t capacity)
+    : _storage(storage), _capacity(capacity), _head(0), _count(0) {}
+
+bool DatasetRing::push(const DatasetRecord &rec) {
+  if (full()) return false;
+  _storage[(_head + _count) % _capacity] = rec;
+  _count++;
+  return true;
+}
+
+bool DatasetRing::peek(DatasetRecord &rec) const {
+  if (!_count) return false;
+  rec = _storage[_head];
+  return true;
+}
+
+void DatasetRing::pop() {
+  if (!_count) return;
+  _head = (_head + 1) % _capacity;
+  _count--;
+}
+
+DatasetBuffer::DatasetBuffer(DatasetRecord *storage, uint16_t capacity, SpillArea *spill)
+    : _ring(storage, capacity), _spill(spill), _dropped(0) {}
+
+void DatasetBuffer::push(const DatasetRecord &rec) {
+  if (_ring.full()) {
+    // make room: the oldest RAM record goes to the spill area (it is younger than anything in there)
+    DatasetRecord oldest;
+    _ring.peek(oldest);
+    _ring.pop();
+    if (!_spill || !_spill->append(oldest)) _dropped++;
+  }
+  _ring.push(rec);
+}
+
+bool DatasetBuffer::peek(DatasetRecord &rec) {
+  if (_spill && _spill->count()) return _spill->peek(rec);
+  return _ring.peek(rec);
+}
+
+void DatasetBuffer::pop() {
+  if (_spill && _spill->count()) _spill->pop();
+  else _ring.pop();
+}
+
+uint32_t DatasetBuffer::pending() const {
+  return _ring.count() + (_spill ? _spill->count() : 0);
+}
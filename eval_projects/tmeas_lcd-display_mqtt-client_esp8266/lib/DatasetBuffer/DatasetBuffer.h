@@ -0,0 +1,74 @@
+/*
+  DatasetBuffer - store-and-forward buffer for sensor bank datasets
+
+  While the MQTT broker is unreachable the measurement keeps running and every dataset is
+  stored as a compact DatasetRecord. The records are kept in a fixed size RAM ring; when the
+  ring is full, the oldest record is moved to an optional spill area (e.g. a file on LittleFS).
+  Once the broker is back, the records are read back oldest first: spill area before RAM.
+  Only if both are full, the oldest record of the RAM ring gets dropped, this is counted.
+*/
+
+#ifndef DATASET_BUFFER_H
+#define DATASET_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <TmcPayload.h>
+
+// One dataset of one sensor bank, values of the configured slots in centi-degrees
+struct DatasetRecord {
+  uint64_t timeMs;                      // sample time in epoch ms (UTC), 0 = unknown
+  uint32_t dsNr;                        // dataset number
+  uint8_t sbNr;                         // sensor bank number
+  uint8_t slotMask;                     // bit n set: slot n is configured and centi[n] is valid
+  int16_t centi[SLOTS_PER_BANK];        // temperature per slot, TEMP_INVALID_CENTI if not available
+};
+
+// Secondary storage the buffer spills to when the RAM ring is full (FIFO semantics)
+class SpillArea {
+public:
+  virtual ~SpillArea() {}
+  virtual bool append(const DatasetRecord &rec) = 0;    // false if the spill area is full
+  virtual bool peek(DatasetRecord &rec) = 0;            // oldest record, false if empty
+  virtual void pop() = 0;                               // remove the oldest record
+  virtual uint32_t count() const = 0;                   // number of records stored
+};
+
+// Fixed capacity FIFO of records on caller provided storage
+class DatasetRing {
+public:
+  DatasetRing(DatasetRecord *storage, uint16_t capacity);
+
+  bool push(const DatasetRecord &rec);    // false if full
+  bool peek(DatasetRecord &rec) const;    // oldest record, false if empty
+  void pop();                             // remove the oldest record
+
+  uint16_t count() const { return _count; }
+  bool full() const { return _count == _capacity; }
+
+private:
+  DatasetRecord *_storage;
+  uint16_t _capacity;
+  uint16_t _head;                         // index of the oldest record
+  uint16_t _count;
+};
+
+// RAM ring with an optional spill area behind it
+class DatasetBuffer {
+public:
+  DatasetBuffer(DatasetRecord *storage, uint16_t capacity, SpillArea *spill = nullptr);
+
+  void push(const DatasetRecord &rec);    // always succeeds, the oldest record may get dropped
+  bool peek(DatasetRecord &rec);          // oldest record, false if empty
+  void pop();                             // remove the oldest record
+
+  uint32_t pending() const;               // records waiting to be forwarded
+  uint32_t dropped() const { return _dropped; }
+
+private:
+  DatasetRing _ring;
+  SpillArea *_spill;
+  uint32_t _dropped;
+};
+
+#endif // DATASET_BUFFER_H
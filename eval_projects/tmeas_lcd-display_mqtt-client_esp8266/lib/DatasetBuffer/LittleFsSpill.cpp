@@ -0,0 +1,111 @@
+#include "LittleFsSpill.h"
+
+#if defined(ARDUINO_ARCH_ESP8266)
+
+#include <LittleFS.h>
+#include <stdio.h>
+
+LittleFsSpill::LittleFsSpill(const char *dataPath, const char *posPath, uint32_t maxRecords)
+    : _dataPath(dataPath), _posPath(posPath), _maxRecords(maxRecords), _written(0), _readPos(0), _mounted(false) {}
+
+bool LittleFsSpill::begin() {
+  _mounted = LittleFS.begin();
+  if (!_mounted) return false;
+
+  File f = LittleFS.open(_dataPath, "r");
+  if (f) {
+    _written = f.size() / sizeof(DatasetRecord);
+    f.close();
+  }
+  File p = LittleFS.open(_posPath, "r");
+  if (p) {
+    if (p.read((uint8_t *)&_readPos, sizeof(_readPos)) != sizeof(_readPos)) _readPos = 0;
+    p.close();
+  }
+  if (_readPos > _written) _readPos = _written;
+  char tmpPath[32];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", _dataPath);
+  LittleFS.remove(tmpPath);           // a compaction cut short by a reset
+  return true;
+}
+
+bool LittleFsSpill::append(const DatasetRecord &rec) {
+  if (!_mounted || count() >= _maxRecords) return false;
+  File f = LittleFS.open(_dataPath, "a");
+  if (!f) return false;
+  bool ok = f.write((const uint8_t *)&rec, sizeof(rec)) == sizeof(rec);
+  f.close();
+  if (ok) _written++;
+  return ok;
+}
+
+bool LittleFsSpill::peek(DatasetRecord &rec) {
+  if (!count()) return false;
+  File f = LittleFS.open(_dataPath, "r");
+  if (!f) return false;
+  bool ok = f.seek(_readPos * sizeof(DatasetRecord), SeekSet) &&
+            f.read((uint8_t *)&rec, sizeof(rec)) == sizeof(rec);
+  f.close();
+  return ok;
+}
+
+void LittleFsSpill::pop() {
+  if (!count()) return;
+  _readPos++;
+  if (_readPos == _written) {
+    // everything forwarded: start over with an empty file
+    LittleFS.remove(_dataPath);
+    LittleFS.remove(_posPath);
+    _written = 0;
+    _readPos = 0;
+  } else if (_readPos >= _maxRecords / 2) {
+    compact();
+  } else if (_readPos % SPILL_POS_SAVE_EVERY == 0) {
+    savePos();
+  }
+}
+
+uint32_t LittleFsSpill::count() const {
+  return _written - _readPos;
+}
+
+// Copy the unread records to a new data file, which replaces the old one by a rename. The position
+// file is removed first: a reset before the rename forwards the records already read twice, one
+// after it finds the new file read from its start.
+void LittleFsSpill::compact() {
+  char tmpPath[32];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", _dataPath);
+  File in = LittleFS.open(_dataPath, "r");
+  if (!in) return;
+  File out = LittleFS.open(tmpPath, "w");
+  bool ok = out && in.seek(_readPos * sizeof(DatasetRecord), SeekSet);
+  DatasetRecord rec;
+  for (uint32_t i = _readPos; ok && i < _written; i++) {
+    ok = in.read((uint8_t *)&rec, sizeof(rec)) == sizeof(rec) &&
+         out.write((const uint8_t *)&rec, sizeof(rec)) == sizeof(rec);
+  }
+  in.close();
+  if (out) out.close();
+  if (!ok) {                          // keep reading the old file, try again with the next pop
+    LittleFS.remove(tmpPath);
+    savePos();
+    return;
+  }
+  LittleFS.remove(_posPath);
+  if (!LittleFS.rename(tmpPath, _dataPath)) {
+    LittleFS.remove(tmpPath);
+    savePos();
+    return;
+  }
+  _written -= _readPos;
+  _readPos = 0;
+}
+
+void LittleFsSpill::savePos() {
+  File p = LittleFS.open(_posPath, "w");
+  if (!p) return;
+  p.write((const uint8_t *)&_readPos, sizeof(_readPos));
+  p.close();
+}
+
+#endif // ARDUINO_ARCH_ESP8266
@@ -0,0 +1,49 @@
+/*
+  LittleFsSpill - spill area of the DatasetBuffer in a file on the LittleFS flash file system
+
+  Records are appended to a data file and read back from a read position. The read position
+  is saved to a second file every SPILL_POS_SAVE_EVERY records, so after a reset at most that
+  many records are forwarded twice (recognizable by their ds_nr). Once all records have been
+  read back, both files are removed.
+
+  Only the records not read back yet count against maxRecords. Once the read position passes
+  half of maxRecords, the unread records are copied to a new data file, so the file holds at
+  most maxRecords / 2 records already read besides.
+*/
+
+#ifndef LITTLEFS_SPILL_H
+#define LITTLEFS_SPILL_H
+
+#include "DatasetBuffer.h"
+
+#if defined(ARDUINO_ARCH_ESP8266)
+
+#define SPILL_POS_SAVE_EVERY 16
+
+class LittleFsSpill : public SpillArea {
+public:
+  // maxRecords limits the records waiting to be read back (the flash space is 1.5 times that)
+  LittleFsSpill(const char *dataPath, const char *posPath, uint32_t maxRecords);
+
+  bool begin();             // mount LittleFS and pick up records left from before a reset
+
+  bool append(const DatasetRecord &rec) override;
+  bool peek(DatasetRecord &rec) override;
+  void pop() override;
+  uint32_t count() const override;
+
+private:
+  void savePos();
+  void compact();
+
+  const char *_dataPath;
+  const char *_posPath;
+  uint32_t _maxRecords;
+  uint32_t _written;        // records in the data file
+  uint32_t _readPos;        // records already read back
+  bool _mounted;
+};
+
+#endif // ARDUINO_ARCH_ESP8266
+
+#endif // LITTLEFS_SPILL_H
@@ -0,0 +1,90 @@
+/*
+  LcdFrameBuffer - shadow framebuffer for a 20x4 character LCD
+
+  The firmware renders into the back buffer (setCursor()/print() like on the LCD itself),
+  flush() then compares it with the front buffer, which mirrors the LCD content, and sends
+  only the runs of changed characters. This avoids lcd.clear() (about 2 ms and a visible
+  flicker on HD44780 displays) and rewriting all 80 characters over the slow I2C bus when
+  only a digit changed.
+
+  flush() is a template, so it works with LiquidCrystal_I2C as well as with any other type
+  offering setCursor(col, row) and write(uint8_t).
+*/
+
+#ifndef LCD_FRAME_BUFFER_H
+#define LCD_FRAME_BUFFER_H
+
+#include <stdint.h>
+#include <string.h>
+
+class LcdFrameBuffer {
+public:
+  static const uint8_t COLS = 20;
+  static const uint8_t ROWS = 4;
+
+  LcdFrameBuffer() { clear(); invalidate(); }
+
+  // Fill the back buffer with spaces and move the cursor home
+  void clear() {
+    memset(_back, ' ', sizeof(_back));
+    _col = 0;
+    _row = 0;
+  }
+
+  // Force a full redraw with the next flush(), e.g. after the LCD was written directly
+  void invalidate() { memset(_front, 0, sizeof(_front)); }
+
+  void setCursor(uint8_t col, uint8_t row) {
+    _col = col;
+    _row = row;
+  }
+
+  // Characters beyond the end of a row are dropped, there is no wrap around
+  void print(char c) {
+    if (_row < ROWS && _col < COLS) _back[_row][_col] = c;
+    _col++;
+  }
+
+  void print(const char *text) {
+    while (*text) print(*text++);
+  }
+
+  // Send the changed characters to the LCD, returns the number of characters sent.
+  // Changed runs separated by a single unchanged character are merged, rewriting one
+  // character is cheaper than repositioning the cursor.
+  template <class Lcd>
+  uint16_t flush(Lcd &lcd) {
+    uint16_t sent = 0;
+    for (uint8_t r = 0; r < ROWS; r++) {
+      uint8_t c = 0;
+      while (c < COLS) {
+        if (_back[r][c] == _front[r][c]) {
+          c++;
+          continue;
+        }
+        uint8_t start = c;
+        uint8_t end = c + 1;              // one past the last changed character of the run
+        for (uint8_t i = end; i < COLS; i++) {
+          if (_back[r][i] != _front[r][i]) end = i + 1;
+          else if (i - end >= 1) break;   // gap of two unchanged characters ends the run
+        }
+        lcd.setCursor(start, r);
+        for (uint8_t i = start; i < end; i++) {
+          lcd.write((uint8_t)_back[r][i]);
+          _front[r][i] = _back[r][i];
+          sent++;
+        }
+        c = end;
+      }
+    }
+    return sent;
+  }
+
+private:
+  char _back[ROWS][COLS];     // content rendered by the firmware
+  char _front[ROWS][COLS];    // content currently shown on the LCD
+  uint8_t _col;
+  uint8_t _row;
+};
+
+#endif // LCD_FRAME_BUFFER_H
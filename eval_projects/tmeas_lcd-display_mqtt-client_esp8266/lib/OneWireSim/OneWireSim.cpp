@@ -0,0 +1,379 @@
+#include "OneWireSim.h"
+
+#include <string.h>
+
+namespace {
+
+// DS18B20 commands
+constexpr uint8_t CMD_SEARCH_ROM = 0xF0;
+constexpr uint8_t CMD_ALARM_SEARCH = 0xEC;
+constexpr uint8_t CMD_MATCH_ROM = 0x55;
+constexpr uint8_t CMD_SKIP_ROM = 0xCC;
+constexpr uint8_t CMD_CONVERT_T = 0x44;
+constexpr uint8_t CMD_READ_SCRATCHPAD = 0xBE;
+constexpr uint8_t CMD_WRITE_SCRATCHPAD = 0x4E;
+constexpr uint8_t CMD_COPY_SCRATCHPAD = 0x48;
+constexpr uint8_t CMD_RECALL_E2 = 0xB8;
+constexpr uint8_t CMD_READ_POWER_SUPPLY = 0xB4;
+
+constexpr uint8_t DEFAULT_TH = 75;        // factory TH/TL of the EEPROM
+constexpr uint8_t DEFAULT_TL = 70;
+
+int16_t centiToRaw(int16_t centi) {
+  int32_t v = (int32_t)centi * 16;
+  return (int16_t)((v + (v >= 0 ? 50 : -50)) / 100);
+}
+
+} // namespace
+
+OneWireSim::OneWireSim(uint32_t seed)
+    : _count(0), _nowUs(0), _busUs(0), _rand(seed ? seed : 1), _glitch(0), _bitErrors(0), _convScale(100),
+      _state(IDLE), _pos(0), _readLen(0) {
+  reset_search();
+}
+
+int8_t OneWireSim::add(const uint8_t* rom, int16_t centi, uint8_t resolution, bool parasite) {
+  if (_count >= SIM_DEVICES_MAX) return -1;
+  if (resolution < 9) resolution = 9;
+  if (resolution > 12) resolution = 12;
+  Device& d = _dev[_count];
+  memset(&d, 0, sizeof(d));
+  memcpy(d.rom, rom, sizeof(d.rom));
+  d.raw = centiToRaw(centi);
+  d.eeprom[0] = DEFAULT_TH;
+  d.eeprom[1] = DEFAULT_TL;
+  d.eeprom[2] = ((resolution - 9) << 5) | 0x1F;
+  d.parasite = parasite;
+  powerOn(d);
+  return _count++;
+}
+
+void OneWireSim::setTemperature(uint8_t dev, int16_t centi) {
+  if (dev < _count) _dev[dev].raw = centiToRaw(centi);
+}
+
+void OneWireSim::setAlarm(uint8_t dev, int8_t th, int8_t tl) {
+  if (dev >= _count) return;
+  _dev[dev].eeprom[0] = (uint8_t)th;
+  _dev[dev].eeprom[1] = (uint8_t)tl;
+}
+
+void OneWireSim::powerOn(uint8_t dev) {
+  if (dev < _count) powerOn(_dev[dev]);
+}
+
+void OneWireSim::setDropout(uint8_t dev, uint16_t perMille) {
+  if (dev < _count) _dev[dev].dropout = perMille;
+}
+
+// Power-on state: 85 degree C in the temperature register, TH/TL and configuration recalled from the EEPROM
+void OneWireSim::powerOn(Device& d) {
+  d.scratch[0] = SIM_POWER_ON_RAW & 0xFF;
+  d.scratch[1] = SIM_POWER_ON_RAW >> 8;
+  memcpy(&d.scratch[2], d.eeprom, sizeof(d.eeprom));
+  d.scratch[5] = 0xFF;
+  d.scratch[6] = 0x0C;
+  d.scratch[7] = 0x10;
+  updateCrc(d);
+  d.converting = false;
+}
+
+uint8_t OneWireSim::reset() {
+  bus(SIM_RESET_US);
+  bool presence = false;
+  for (uint8_t i = 0; i < _count; i++) {
+    _dev[i].answering = !chance(_dev[i].dropout);
+    _dev[i].selected = false;
+    presence = presence || _dev[i].answering;
+  }
+  _state = ROM_CMD;
+  _pos = 0;
+  _readLen = 0;
+  return presence ? 1 : 0;
+}
+
+void OneWireSim::select(const uint8_t* rom) {
+  write(CMD_MATCH_ROM);
+  for (uint8_t i = 0; i < 8; i++) write(rom[i]);
+}
+
+void OneWireSim::skip() {
+  write(CMD_SKIP_ROM);
+}
+
+void OneWireSim::write_bit(uint8_t v) {
+  bus(v ? SIM_WRITE1_US : SIM_WRITE0_US);
+}
+
+void OneWireSim::write(uint8_t v, uint8_t power) {
+  (void)power;                  // the strong pullup for parasite powered devices is assumed to be there
+  for (uint8_t b = 0; b < 8; b++) write_bit((v >> b) & 1);
+
+  switch (_state) {
+    case ROM_CMD:
+      if (v == CMD_MATCH_ROM) {
+        _state = MATCH;
+        _pos = 0;
+      } else if (v == CMD_SKIP_ROM) {
+        for (uint8_t i = 0; i < _count; i++) _dev[i].selected = _dev[i].answering;
+        _state = FUNCTION;
+      } else {
+        _state = IDLE;          // searches go through search(), READ ROM isn't used on a shared bus
+      }
+      break;
+
+    case MATCH:
+      _romBuf[_pos++] = v;
+      if (_pos < 8) break;
+      for (uint8_t i = 0; i < _count; i++)
+        _dev[i].selected = _dev[i].answering && memcmp(_dev[i].rom, _romBuf, sizeof(_romBuf)) == 0;
+      _state = FUNCTION;
+      break;
+
+    case FUNCTION:
+      _state = DONE;
+      if (v == CMD_CONVERT_T) {
+        for (uint8_t i = 0; i < _count; i++) {
+          Device& d = _dev[i];
+          if (!d.selected || d.converting) continue;
+          d.converting = true;
+          d.convEndUs = _nowUs + conversionUs(d);
+        }
+        _state = CONVERTING;
+      } else if (v == CMD_READ_SCRATCHPAD) {
+        // Several selected devices answer at the same time, the bus gives the wired AND
+        memset(_readBuf, 0xFF, sizeof(_readBuf));
+        for (uint8_t i = 0; i < _count; i++)
+          if (_dev[i].selected)
+            for (uint8_t b = 0; b < sizeof(_readBuf); b++) _readBuf[b] &= _dev[i].scratch[b];
+        _readLen = sizeof(_readBuf);
+        _pos = 0;
+        _state = READ;
+      } else if (v == CMD_WRITE_SCRATCHPAD) {
+        _pos = 0;
+        _state = WRITE_SCRATCH;
+      } else if (v == CMD_COPY_SCRATCHPAD) {
+        for (uint8_t i = 0; i < _count; i++)
+          if (_dev[i].selected) memcpy(_dev[i].eeprom, &_dev[i].scratch[2], sizeof(_dev[i].eeprom));
+      } else if (v == CMD_RECALL_E2) {
+        for (uint8_t i = 0; i < _count; i++) {
+          if (!_dev[i].selected) continue;
+          memcpy(&_dev[i].scratch[2], _dev[i].eeprom, sizeof(_dev[i].eeprom));
+          updateCrc(_dev[i]);
+        }
+      } else if (v == CMD_READ_POWER_SUPPLY) {
+        _state = POWER;
+      }
+      break;
+
+    case WRITE_SCRATCH:
+      // TH, TL and the configuration register, of which only the resolution bits are writable
+      for (uint8_t i = 0; i < _count; i++) {
+        if (!_dev[i].selected) continue;
+        _dev[i].scratch[2 + _pos] = _pos == 2 ? ((v & 0x60) | 0x1F) : v;
+        updateCrc(_dev[i]);
+      }
+      if (++_pos == 3) _state = DONE;
+      break;
+
+    default:
+      break;
+  }
+}
+
+uint8_t OneWireSim::read() {
+  bus(8 * SIM_READ_US);
+  if (_state != READ) return statusBit() ? 0xFF : 0x00;
+  if (_pos >= _readLen) return 0xFF;
+  uint8_t b = _readBuf[_pos++];
+  if (chance(_bitErrors)) b ^= 1 << (_rand % 8);
+  return b;
+}
+
+uint8_t OneWireSim::read_bit() {
+  bus(SIM_READ_US);
+  return statusBit();
+}
+
+// Read slot outside of a data read: after CONVERT T 0 while a selected device converts, after
+// READ POWER SUPPLY 0 if a selected device is parasite powered, else the idle bus
+uint8_t OneWireSim::statusBit() const {
+  for (uint8_t i = 0; i < _count; i++) {
+    if (!_dev[i].selected) continue;
+    if (_state == CONVERTING && _dev[i].converting) return 0;
+    if (_state == POWER && _dev[i].parasite) return 0;
+  }
+  return 1;
+}
+
+void OneWireSim::reset_search() {
+  _lastDiscrepancy = 0;
+  _lastDevice = false;
+  memset(_searchRom, 0, sizeof(_searchRom));
+}
+
+// The search algorithm of the OneWire library (Maxim application note 187), the devices taking
+// part answer each bit and its complement as wired AND
+bool OneWireSim::search(uint8_t* rom, bool search_mode) {
+  if (_lastDevice) {
+    reset_search();
+    return false;
+  }
+  if (!reset()) {
+    reset_search();
+    return false;
+  }
+  for (uint8_t b = 0; b < 8; b++) write_bit(((search_mode ? CMD_SEARCH_ROM : CMD_ALARM_SEARCH) >> b) & 1);
+  _state = IDLE;
+
+  bool taking[SIM_DEVICES_MAX];
+  for (uint8_t i = 0; i < _count; i++) taking[i] = _dev[i].answering && (search_mode || alarmed(_dev[i]));
+
+  uint8_t lastZero = 0;
+  uint8_t bitNr = 1;
+  for (; bitNr <= 64; bitNr++) {
+    uint8_t byteNr = (bitNr - 1) / 8, mask = 1 << ((bitNr - 1) % 8);
+    bool idBit = true, cmpBit = true;
+    for (uint8_t i = 0; i < _count; i++) {
+      if (!taking[i]) continue;
+      if (_dev[i].rom[byteNr] & mask) cmpBit = false;
+      else idBit = false;
+    }
+    bus(2 * SIM_READ_US);
+    if (idBit && cmpBit) break;               // no device left
+
+    bool dir;
+    if (idBit != cmpBit) {
+      dir = idBit;
+    } else {
+      if (bitNr < _lastDiscrepancy) dir = (_searchRom[byteNr] & mask) != 0;
+      else dir = bitNr == _lastDiscrepancy;
+      if (!dir) lastZero = bitNr;
+    }
+    if (dir) _searchRom[byteNr] |= mask;
+    else _searchRom[byteNr] &= ~mask;
+    write_bit(dir);
+    for (uint8_t i = 0; i < _count; i++)
+      if (taking[i] && ((_dev[i].rom[byteNr] & mask) != 0) != dir) taking[i] = false;
+  }
+
+  if (bitNr <= 64 || _searchRom[0] == 0) {
+    reset_search();
+    return false;
+  }
+  _lastDiscrepancy = lastZero;
+  _lastDevice = lastZero == 0;
+  memcpy(rom, _searchRom, sizeof(_searchRom));
+  return true;
+}
+
+uint8_t OneWireSim::crc8(const uint8_t* data, uint8_t len) {
+  return dallasCrc8(data, len);
+}
+
+uint32_t OneWireSim::conversionMs(uint8_t resolution) {
+  return 750 >> (12 - resolution);
+}
+
+void OneWireSim::advance(uint64_t us) {
+  _nowUs += us;
+  finishConversions();
+}
+
+void OneWireSim::bus(uint64_t us) {
+  _busUs += us;
+  advance(us);
+}
+
+void OneWireSim::finishConversions() {
+  for (uint8_t i = 0; i < _count; i++) {
+    Device& d = _dev[i];
+    if (!d.converting || d.convEndUs > _nowUs) continue;
+    d.converting = false;
+    convert(d);
+  }
+}
+
+// A power glitch during the conversion resets the device, it shows the power-on value afterwards.
+// The low bits undefined below 12 bit resolution keep what the 12 bit value has there.
+void OneWireSim::convert(Device& d) {
+  if (chance(_glitch)) {
+    powerOn(d);
+    return;
+  }
+  d.scratch[0] = d.raw & 0xFF;
+  d.scratch[1] = (uint16_t)d.raw >> 8;
+  updateCrc(d);
+}
+
+uint32_t OneWireSim::conversionUs(const Device& d) const {
+  return (750000UL >> (12 - resolutionOf(d))) * _convScale / 100;
+}
+
+void OneWireSim::updateCrc(Device& d) {
+  d.scratch[8] = dallasCrc8(d.scratch, 8);
+}
+
+uint8_t OneWireSim::resolutionOf(const Device& d) const {
+  return 9 + ((d.scratch[4] >> 5) & 0x03);
+}
+
+// Alarm condition of the last conversion: temperature (whole degrees) at or above TH, or at or below TL
+bool OneWireSim::alarmed(const Device& d) const {
+  int16_t raw = (int16_t)(((uint16_t)d.scratch[1] << 8) | d.scratch[0]);
+  int16_t deg = raw >> 4;
+  return deg >= (int8_t)d.scratch[2] || deg <= (int8_t)d.scratch[3];
+}
+
+bool OneWireSim::chance(uint16_t perMille) {
+  if (perMille == 0) return false;
+  _rand ^= _rand << 13;       // xorshift32
+  _rand ^= _rand >> 17;
+  _rand ^= _rand << 5;
+  return _rand % 1000 < perMille;
+}
+
+// As DallasTemperature::requestTemperatures() without waiting
+void OneWireSimBus::requestConversions() {
+  _wire.reset();
+  _wire.skip();
+  _wire.write(0x44, 1);
+}
+
+// As DallasTemperature::readScratchPad(): the closing reset tells whether the device was still there
+bool OneWireSimBus::readScratchPad(const uint8_t* rom, uint8_t* scratchPad) {
+  if (!_wire.reset()) return false;
+  _wire.select(rom);
+  _wire.write(0xBE);
+  for (uint8_t i = 0; i < SCRATCHPAD_SIZE; i++) scratchPad[i] = _wire.read();
+  return _wire.reset() == 1;
+}
+
+// As DallasTemperature::requestTemperaturesByAddress() without waiting
+bool OneWireSimBus::requestConversion(const uint8_t* rom) {
+  if (!_wire.reset()) return false;
+  _wire.select(rom);
+  _wire.write(0x44, 1);
+  return true;
+}
+
+// As DallasBus::setAlarm() of the firmware: scratchpad read, written back with the new TH/TL and
+// copied to the EEPROM, only if they changed
+bool OneWireSimBus::setAlarm(const uint8_t* rom, int8_t low, int8_t high) {
+  uint8_t sp[SCRATCHPAD_SIZE];
+  int16_t raw;
+  if (!readScratchPad(rom, sp) || decodeScratchPad(sp, raw) != SENSOR_OK) return false;
+  if ((int8_t)sp[2] == high && (int8_t)sp[3] == low) return true;
+  _wire.reset();
+  _wire.select(rom);
+  _wire.write(0x4E);
+  _wire.write((uint8_t)high);
+  _wire.write((uint8_t)low);
+  _wire.write(sp[4]);
+  _wire.reset();
+  _wire.select(rom);
+  _wire.write(0x48, 1);
+  _wire.delay(20);                            // EEPROM write
+  _wire.reset();
+  return true;
+}
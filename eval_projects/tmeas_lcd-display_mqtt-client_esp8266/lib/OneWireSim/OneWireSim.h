@@ -0,0 +1,143 @@
+/*
+  OneWireSim - OneWire bus with virtual DS18B20 sensors and a timing model, for the host
+
+  The bus offers the API of the OneWire library the firmware and DallasTemperature use
+  (reset, select, skip, write, read, read_bit, reset_search, search), the devices answer the
+  DS18B20 commands on the byte level:
+    ROM commands    MATCH ROM, SKIP ROM, SEARCH ROM, ALARM SEARCH (through search())
+    functions       CONVERT T, READ/WRITE/COPY SCRATCHPAD, RECALL E2, READ POWER SUPPLY
+  so a read strategy runs against it exactly as it would against the hardware.
+
+  Modelled behaviour:
+    - ROM search with the bit-wise search algorithm, in the order the hardware would give
+    - scratchpad with CRC-8, undefined low bits below 12 bit resolution
+    - conversion time by resolution (93.75 ms at 9 bit .. 750 ms at 12 bit, scalable); reading
+      before the conversion finished gives the previous value, read slots after CONVERT T
+      return 0 while converting
+    - power-on value 85.00 degree C until the first conversion, and power glitches during a
+      conversion (parasite power, long cables) that reset the sensor back to it
+    - dropouts: a sensor misses a whole transaction (no answer, the bus reads 1s)
+    - bit errors in the bytes read, seen as CRC errors
+  Random effects are drawn from a seeded generator, so a run can be repeated.
+
+  Timing model (standard speed, as timed by the OneWire library): reset and presence 960 us,
+  write-1 slot 65 us, write-0 slot 70 us, read slot 66 us. Bus time only counts the time the
+  bus is driven; waits (delay()) advance the simulated clock without adding bus time.
+*/
+
+#ifndef ONE_WIRE_SIM_H
+#define ONE_WIRE_SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <TmcCore.h>
+
+constexpr uint8_t SIM_DEVICES_MAX = 16;
+constexpr uint32_t SIM_RESET_US = 960;
+constexpr uint32_t SIM_WRITE1_US = 65;
+constexpr uint32_t SIM_WRITE0_US = 70;
+constexpr uint32_t SIM_READ_US = 66;
+constexpr int16_t SIM_POWER_ON_RAW = 0x0550;      // 85.00 degree C
+
+class OneWireSim {
+public:
+  explicit OneWireSim(uint32_t seed = 1);
+
+  // Population; a device starts powered on (85 degree C, resolution from its EEPROM)
+  int8_t add(const uint8_t* rom, int16_t centi, uint8_t resolution = 12, bool parasite = false);   // -1 if full
+  uint8_t devices() const { return _count; }
+  void setTemperature(uint8_t dev, int16_t centi);
+  void setAlarm(uint8_t dev, int8_t th, int8_t tl);      // TH/TL in the EEPROM
+  void powerOn(uint8_t dev);
+  void setDropout(uint8_t dev, uint16_t perMille);       // chance to miss a transaction
+  void setGlitch(uint16_t perMille) { _glitch = perMille; }         // chance a conversion ends in a power-on reset
+  void setBitErrors(uint16_t perMille) { _bitErrors = perMille; }   // chance of a flipped bit per byte read
+  void setConversionScale(uint8_t percent) { _convScale = percent; } // actual conversion time in % of the maximum
+
+  // OneWire API
+  uint8_t reset();                          // 1 if a device answered the presence pulse
+  void select(const uint8_t* rom);          // MATCH ROM
+  void skip();                              // SKIP ROM
+  void write(uint8_t v, uint8_t power = 0);
+  uint8_t read();
+  uint8_t read_bit();                       // status slots: conversion done, externally powered
+  void write_bit(uint8_t v);
+  void reset_search();
+  bool search(uint8_t* rom, bool search_mode = true);   // search_mode false: ALARM SEARCH
+  static uint8_t crc8(const uint8_t* data, uint8_t len);
+
+  // Simulated time
+  uint64_t micros() const { return _nowUs; }
+  void delay(uint32_t ms) { advance(ms * 1000ULL); }
+  void delayMicroseconds(uint32_t us) { advance(us); }
+  uint64_t busUs() const { return _busUs; }            // time the bus was driven since the start
+  static uint32_t conversionMs(uint8_t resolution);     // maximum conversion time
+
+private:
+  enum State : uint8_t { IDLE, ROM_CMD, MATCH, FUNCTION, READ, WRITE_SCRATCH, CONVERTING, POWER, DONE };
+
+  struct Device {
+    uint8_t rom[8];
+    int16_t raw;                            // current temperature in 1/16 degree C
+    uint8_t scratch[9];
+    uint8_t eeprom[3];                      // TH, TL, configuration
+    bool parasite;
+    bool converting;
+    uint64_t convEndUs;
+    uint16_t dropout;
+    bool answering;                         // takes part in the current transaction
+    bool selected;
+  };
+
+  void advance(uint64_t us);
+  void bus(uint64_t us);
+  void finishConversions();
+  void convert(Device& d);
+  void powerOn(Device& d);
+  uint32_t conversionUs(const Device& d) const;
+  uint8_t statusBit() const;
+  void updateCrc(Device& d);
+  uint8_t resolutionOf(const Device& d) const;
+  bool alarmed(const Device& d) const;
+  bool chance(uint16_t perMille);
+
+  Device _dev[SIM_DEVICES_MAX];
+  uint8_t _count;
+  uint64_t _nowUs;
+  uint64_t _busUs;
+  uint32_t _rand;
+  uint16_t _glitch;
+  uint16_t _bitErrors;
+  uint8_t _convScale;
+
+  State _state;
+  uint8_t _romBuf[8];
+  uint8_t _pos;
+  uint8_t _readBuf[9];
+  uint8_t _readLen;
+
+  // search state, as kept by the OneWire library
+  uint8_t _lastDiscrepancy;
+  bool _lastDevice;
+  uint8_t _searchRom[8];
+};
+
+// Sensor bus of the core on the simulated bus, with the bus transactions DallasTemperature uses
+class OneWireSimBus : public SensorBus {
+public:
+  explicit OneWireSimBus(OneWireSim& wire) : _wire(wire) {}
+  void requestConversions() override;
+  bool readScratchPad(const uint8_t* rom, uint8_t* scratchPad) override;
+  void resetSearch() override { _wire.reset_search(); }
+  bool search(uint8_t* rom) override { return _wire.search(rom); }
+  bool requestConversion(const uint8_t* rom) override;
+  void resetAlarmSearch() override { _wire.reset_search(); }
+  bool alarmSearch(uint8_t* rom) override { return _wire.search(rom, false); }
+  bool setAlarm(const uint8_t* rom, int8_t low, int8_t high) override;
+
+private:
+  OneWireSim& _wire;
+};
+
+#endif // ONE_WIRE_SIM_H
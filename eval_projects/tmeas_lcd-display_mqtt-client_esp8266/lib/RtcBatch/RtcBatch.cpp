@@ -0,0 +1,154 @@
+#include "RtcBatch.h"
+
+#include <string.h>
+
+namespace {
+
+const uint32_t BATCH_MAGIC = 0x54424332;          // "TBC2"
+const uint32_t TIME_UNKNOWN = 0xFFFFFFFFUL;       // time offset of a sample without time
+
+// CRC-16/CCITT-FALSE
+uint16_t crc16(const uint8_t* data, size_t len) {
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t b = 0; b < 8; b++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+} // namespace
+
+static_assert(sizeof(RtcBatch) == RTC_BATCH_BYTES, "batch doesn't fill the RTC user memory");
+static_assert(RTC_BATCH_BLOCK * 4 + RTC_BATCH_BYTES <= 512, "batch exceeds the RTC user memory");
+
+void RtcBatch::reset() {
+  memset(&_img, 0, sizeof(_img));
+  _img.magic = BATCH_MAGIC;
+  _img.samplesToConnect = 1;        // connect after the first sample, to announce the client
+}
+
+void RtcBatch::setLayout(uint8_t width, uint8_t bankMask, uint16_t tableFingerprint) {
+  if (width == _img.width && bankMask == _img.bankMask && tableFingerprint == _img.tableFingerprint) return;
+  drop(_img.count);
+  _img.width = width;
+  _img.bankMask = bankMask;
+  _img.tableFingerprint = tableFingerprint;
+  _img.head = 0;
+}
+
+uint16_t RtcBatch::capacity() const {
+  return _img.width ? RTC_BATCH_VALUES / stride() : 0;
+}
+
+bool RtcBatch::push(const int16_t* values, uint64_t timeMs) {
+  if (_img.samplesToConnect) _img.samplesToConnect--;
+  uint16_t cap = capacity();
+  if (!cap) return false;
+  bool kept = true;
+  if (_img.count == cap) {
+    drop(1);
+    kept = false;
+  }
+  // the time is kept as offset to the first sample time known since the batch was empty;
+  // a time before it (clock corrected backwards) or too far behind it is lost
+  uint32_t offset = TIME_UNKNOWN;
+  if (timeMs) {
+    if (!_img.timeBaseMs) _img.timeBaseMs = timeMs;
+    if (timeMs >= _img.timeBaseMs && timeMs - _img.timeBaseMs < TIME_UNKNOWN) offset = (uint32_t)(timeMs - _img.timeBaseMs);
+  }
+  int16_t* sample = &_img.values[(_img.head + _img.count) % cap * stride()];
+  memcpy(sample, &offset, sizeof(offset));
+  memcpy(sample + SAMPLE_TIME_WORDS, values, _img.width * sizeof(int16_t));
+  _img.count++;
+  return kept;
+}
+
+const int16_t* RtcBatch::oldest() const {
+  return _img.count ? &_img.values[_img.head * stride() + SAMPLE_TIME_WORDS] : nullptr;
+}
+
+uint64_t RtcBatch::oldestTime() const {
+  if (!_img.count) return 0;
+  uint32_t offset;
+  memcpy(&offset, &_img.values[_img.head * stride()], sizeof(offset));
+  return offset == TIME_UNKNOWN ? 0 : _img.timeBaseMs + offset;
+}
+
+void RtcBatch::pop() {
+  if (!_img.count) return;
+  for (uint8_t b = 0; b < RTC_BATCH_BANKS; b++) {
+    if (_img.bankMask & (1 << b)) _img.dsNr[b]++;
+  }
+  _img.head = (_img.head + 1) % capacity();
+  _img.count--;
+  if (!_img.count) _img.timeBaseMs = 0;
+}
+
+// Drop the oldest samples unpublished, their ds_nr are skipped
+void RtcBatch::drop(uint16_t samples) {
+  _img.dropped += samples;
+  while (samples--) pop();
+}
+
+uint64_t RtcBatch::wakeClock() const {
+  return _img.clockMs ? _img.clockMs + _img.wakeCorrMs : 0;
+}
+
+void RtcBatch::setSleepClock(uint64_t nextBootMs) {
+  _img.clockMs = nextBootMs;
+  if (!nextBootMs) _img.wakesSinceSync = 0;
+  else if (_img.wakesSinceSync < UINT16_MAX) _img.wakesSinceSync++;
+}
+
+// The error accumulated over the wakes since the last synchronization; half of its share
+// per wake goes into the correction, like the rate tuning of TimeSync
+void RtcBatch::clockSynced(int32_t errorMs) {
+  if (_img.wakesSinceSync) {
+    int32_t corr = _img.wakeCorrMs + errorMs / _img.wakesSinceSync / 2;
+    if (corr > RTC_WAKE_CORR_MAX_MS) corr = RTC_WAKE_CORR_MAX_MS;
+    if (corr < -RTC_WAKE_CORR_MAX_MS) corr = -RTC_WAKE_CORR_MAX_MS;
+    _img.wakeCorrMs = corr;
+  }
+  _img.wakesSinceSync = 0;
+}
+
+size_t RtcBatch::serialize(uint8_t* buf, size_t size) {
+  if (size < sizeof(Image)) return 0;
+  const size_t crcStart = offsetof(Image, tableFingerprint);
+  _img.crc = crc16((const uint8_t*)&_img + crcStart, sizeof(Image) - crcStart);
+  memcpy(buf, &_img, sizeof(Image));
+  return sizeof(Image);
+}
+
+bool RtcBatch::deserialize(const uint8_t* buf, size_t len) {
+  if (len != sizeof(Image)) return false;
+  Image img;
+  memcpy(&img, buf, sizeof(Image));
+  const size_t crcStart = offsetof(Image, tableFingerprint);
+  if (img.magic != BATCH_MAGIC || img.crc != crc16(buf + crcStart, sizeof(Image) - crcStart)) return false;
+  uint16_t cap = img.width ? RTC_BATCH_VALUES / (img.width + SAMPLE_TIME_WORDS) : 0;
+  if (img.count > cap || (cap && img.head >= cap)) return false;
+  _img = img;
+  return true;
+}
+
+#if defined(ARDUINO_ARCH_ESP8266)
+
+#include <Arduino.h>
+
+bool RtcBatch::load() {
+  uint32_t buf[RTC_BATCH_BYTES / 4];
+  if (ESP.rtcUserMemoryRead(RTC_BATCH_BLOCK, buf, sizeof(buf)) &&
+      deserialize((const uint8_t*)buf, sizeof(buf))) return true;
+  reset();
+  return false;
+}
+
+bool RtcBatch::save() {
+  uint32_t buf[RTC_BATCH_BYTES / 4];
+  serialize((uint8_t*)buf, sizeof(buf));
+  return ESP.rtcUserMemoryWrite(RTC_BATCH_BLOCK, buf, sizeof(buf));
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*
+  RtcBatch - sample batch of the deep-sleep batch mode, kept in the RTC user memory
+
+  In deep-sleep batch mode the client is restarted by the RTC for every sample, only the RTC
+  user memory survives the sleep. It holds:
+    - the samples not yet published, each with its sample time and the values of all
+      configured slots of the active banks in centi-degrees, in a ring: when it is full the
+      oldest sample is dropped
+    - the ds_nr of the oldest sample per sensor bank, so ds_nr continues across the sleeps
+      and a dropped sample shows up as a gap in ds_nr
+    - the WiFi fast-connect data of the last connection (BSSID, channel, IP configuration),
+      so WiFi comes up without scan and DHCP
+    - the number of samples until the next connection
+    - the clock: the expected time at the next boot, taken over by the time synchronization
+      of the next wake. The error found by the next NTP synchronization (boot time, rate of
+      the RTC timer) is spread over the wakes since the last one and corrected on every wake.
+
+  The samples are tied to the layout they were taken with (values per sample, active banks,
+  fingerprint of the sensor table); a changed layout drops them. The block carries a magic and
+  a CRC-16, after a power-on the memory content is random and the batch starts empty.
+
+  The first 128 bytes of the RTC user memory are left to the OTA update (eboot), the batch
+  takes the remaining 384 bytes.
+*/
+
+#ifndef RTC_BATCH_H
+#define RTC_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ConnManager.h>              // WifiFastConnect
+
+constexpr uint32_t RTC_BATCH_BLOCK = 32;          // first 4-byte block of the RTC user memory used
+constexpr size_t RTC_BATCH_BYTES = 384;
+constexpr uint8_t RTC_BATCH_BANKS = 2;            // sensor banks with a ds_nr in the batch
+constexpr size_t RTC_BATCH_VALUES = 155;          // sample values and times, fills RTC_BATCH_BYTES
+constexpr int32_t RTC_WAKE_CORR_MAX_MS = 2000;    // limit of the learned clock correction per wake
+
+class RtcBatch {
+public:
+  RtcBatch() { reset(); }
+
+  void reset();                     // state after power-on: no samples, ds_nr 0, no fast-connect data
+
+  // Layout of the samples; if it differs from the one the stored samples were taken with,
+  // they are dropped. ds_nr and fast-connect data are kept.
+  void setLayout(uint8_t width, uint8_t bankMask, uint16_t tableFingerprint);
+
+  uint16_t capacity() const;        // samples fitting into the batch at the current width
+  uint16_t count() const { return _img.count; }
+  // Append a sample of width values taken at timeMs (epoch ms, 0 = unknown); false if the
+  // oldest sample got dropped
+  bool push(const int16_t* values, uint64_t timeMs);
+  const int16_t* oldest() const;    // values of the oldest sample, nullptr if empty
+  uint64_t oldestTime() const;      // sample time of the oldest sample, 0 = unknown
+  void pop();                       // the oldest sample was published, its ds_nr are used up
+  uint32_t dsNr(uint8_t bank) const { return _img.dsNr[bank]; }   // ds_nr of the oldest sample
+  uint32_t dropped() const { return _img.dropped; }
+
+  // Connection schedule, counted in samples: the connection is due after the sample that
+  // brings samplesToConnect to 0
+  bool connectDue() const { return _img.samplesToConnect == 0; }
+  bool connectNext() const { return _img.samplesToConnect <= 1; }     // next wake needs the radio
+  void scheduleConnect(uint16_t samples) { _img.samplesToConnect = samples ? samples : 1; }
+
+  WifiFastConnect& fastConnect() { return _img.fast; }
+
+  // Clock over the deep sleep: time expected at millis() 0 of this boot (0 = unknown) ...
+  uint64_t wakeClock() const;
+  // ... and of the next boot, given before going to sleep
+  void setSleepClock(uint64_t nextBootMs);
+  // The clock taken over at this boot was off by errorMs against NTP: learn the correction
+  void clockSynced(int32_t errorMs);
+
+  size_t serialize(uint8_t* buf, size_t size);      // seals the block, returns RTC_BATCH_BYTES (0 if buf is too small)
+  bool deserialize(const uint8_t* buf, size_t len); // false (batch unchanged) on a wrong size, magic or CRC
+
+  bool load();                      // false: no valid batch in the RTC memory, the batch is reset
+  bool save();
+
+private:
+  void drop(uint16_t samples);
+  uint8_t stride() const { return _img.width + SAMPLE_TIME_WORDS; }
+
+  static constexpr uint8_t SAMPLE_TIME_WORDS = 2;
+
+  struct Image {
+    uint32_t magic;
+    uint16_t crc;                   // CRC-16 of everything behind it
+    uint16_t tableFingerprint;
+    uint64_t clockMs;               // expected time at the next boot, 0 = unknown
+    uint64_t timeBaseMs;            // sample times are kept as offset to it, 0 = not set
+    uint32_t dsNr[RTC_BATCH_BANKS];
+    uint32_t dropped;               // samples dropped since power-on
+    int32_t wakeCorrMs;             // learned clock correction per wake
+    WifiFastConnect fast;
+    uint16_t head;                  // ring position of the oldest sample
+    uint16_t count;
+    uint16_t samplesToConnect;
+    uint16_t wakesSinceSync;        // wakes with the clock taken over since the last NTP synchronization
+    uint8_t width;                  // values per sample
+    uint8_t bankMask;               // banks contributing values, bit n = bank n
+    int16_t values[RTC_BATCH_VALUES];   // per sample: time offset (2 words), then width values
+  };
+  Image _img;
+};
+
+#endif // RTC_BATCH_H
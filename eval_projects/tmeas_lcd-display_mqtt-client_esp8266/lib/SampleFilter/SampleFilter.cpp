@@ -0,0 +1,82 @@
+#include "SampleFilter.h"
+
+#include <string.h>
+
+SampleFilter::SampleFilter(int16_t (*ring)[SLOTS_PER_BANK], uint8_t depth, Mode mode, uint8_t holdMax)
+    : _ring(ring), _depth(depth < 1 ? 1 : depth > DEPTH_MAX ? DEPTH_MAX : depth), _mode(mode), _holdMax(holdMax),
+      _powerOn(0) {
+  memset(_head, 0, sizeof(_head));
+  memset(_fill, 0, sizeof(_fill));
+  memset(_misses, 0, sizeof(_misses));
+  resetStats();
+}
+
+bool SampleFilter::add(uint8_t slot, int16_t raw) {
+  uint8_t bit = 1 << slot;
+  if (raw == POWER_ON_RAW && !(_powerOn & bit)) {
+    int16_t d = valid(slot) ? latest(slot) - POWER_ON_RAW : POWER_ON_NEAR_RAW + 1;
+    if (d < -POWER_ON_NEAR_RAW || d > POWER_ON_NEAR_RAW) {
+      _stats.rejected++;
+      miss(slot);
+      _powerOn |= bit;                // accepted if it is read again next time
+      return false;
+    }
+  }
+  _powerOn &= ~bit;
+  _ring[_head[slot]][slot] = raw;
+  _head[slot] = (_head[slot] + 1) % _depth;
+  if (_fill[slot] < _depth) _fill[slot]++;
+  _misses[slot] = 0;
+  return true;
+}
+
+void SampleFilter::miss(uint8_t slot) {
+  _powerOn &= ~(1 << slot);
+  if (!valid(slot)) return;
+  if (++_misses[slot] <= _holdMax) {
+    _stats.held++;
+    return;
+  }
+  _stats.lost++;
+  clear(slot);
+}
+
+void SampleFilter::clear(uint8_t slot) {
+  _head[slot] = 0;
+  _fill[slot] = 0;
+  _misses[slot] = 0;
+  _powerOn &= ~(1 << slot);
+}
+
+int16_t SampleFilter::latest(uint8_t slot) const {
+  return _ring[(_head[slot] + _depth - 1) % _depth][slot];
+}
+
+// The samples are sorted on the stack, at most DEPTH_MAX of them by insertion
+int16_t SampleFilter::value(uint8_t slot) const {
+  uint8_t n = _fill[slot];
+  int16_t s[DEPTH_MAX];
+  for (uint8_t i = 0; i < n; i++) {
+    int16_t v = _ring[i][slot];       // the order in the ring doesn't matter once sorted
+    uint8_t j = i;
+    for (; j > 0 && s[j - 1] > v; j--) s[j] = s[j - 1];
+    s[j] = v;
+  }
+
+  uint8_t first = 0, count = n;       // samples averaged
+  if (_mode == MEDIAN) {
+    first = (n - 1) / 2;
+    count = 2 - n % 2;
+  } else if (n >= 3) {
+    first = 1;
+    count = n - 2;
+  }
+  int32_t sum = 0;
+  for (uint8_t i = first; i < first + count; i++) sum += s[i];
+  // rounded to the nearest 1/16 degree C, halves away from zero
+  return sum >= 0 ? (sum + count / 2) / count : -((-sum + count / 2) / count);
+}
+
+void SampleFilter::resetStats() {
+  memset(&_stats, 0, sizeof(_stats));
+}
@@ -0,0 +1,76 @@
+/*
+  SampleFilter - spike rejecting filter of the readings of one sensor bank
+
+  DS18B20 readings occasionally glitch: a sensor that lost its supply for a moment answers with
+  its power-on value of 85 degree C, a disturbed read fails its CRC, and long cables pick up
+  single-sample spikes. The filter keeps the latest accepted samples of every slot in a small
+  ring and reports their median or trimmed mean, so a single spike doesn't reach the LCD and
+  the payloads:
+
+    add()     a sample read from the slot goes into its ring. The power-on value is only
+              accepted if the slot's latest sample is near it, or if it is read twice in a row
+              (a sensor that really sits at 85 degree C); otherwise it is rejected like a miss.
+    miss()    a failed read (no answer, CRC error) adds nothing. The slot keeps its filter value
+              for up to holdMax misses in a row, after that its ring is emptied and the slot
+              has no value until it is read again.
+
+    MEDIAN        median of the samples in the ring (mean of the middle two for an even count)
+    TRIMMED_MEAN  mean of the samples without the lowest and the highest one (from 3 samples on)
+
+  The ring depth trades spike rejection against delay: a median of 3 follows a step one sample
+  later. Depth 1 turns the filtering off, the rejection of the power-on value and the holding stay.
+
+  The state is kept as struct of arrays. The ring is provided by the caller as depth rows of
+  SLOTS_PER_BANK samples, so a bank of 8 slots takes 16 bytes per row and about 50 bytes besides.
+  Samples are raw DS18B20 readings in 1/16 degree C.
+*/
+
+#ifndef SAMPLE_FILTER_H
+#define SAMPLE_FILTER_H
+
+#include <stdint.h>
+
+#include <SensorTable.h>
+
+struct FilterStats {
+  uint32_t rejected;                  // power-on values rejected
+  uint32_t held;                      // failed reads bridged by the filter value
+  uint32_t lost;                      // rings emptied after more than holdMax misses in a row
+};
+
+class SampleFilter {
+public:
+  enum Mode : uint8_t { MEDIAN, TRIMMED_MEAN };
+
+  static constexpr uint8_t DEPTH_MAX = 9;
+  static constexpr int16_t POWER_ON_RAW = 0x0550;       // 85.00 degree C, temperature register after power-on
+  static constexpr int16_t POWER_ON_NEAR_RAW = 2 * 16;  // latest sample within 2 degree C: 85 is plausible
+
+  SampleFilter(int16_t (*ring)[SLOTS_PER_BANK], uint8_t depth, Mode mode, uint8_t holdMax);
+
+  // Add a sample read from a slot; false if it got rejected as power-on value
+  bool add(uint8_t slot, int16_t raw);
+  void miss(uint8_t slot);
+  void clear(uint8_t slot);           // e.g. when the slot gets another sensor
+
+  bool valid(uint8_t slot) const { return _fill[slot] > 0; }
+  int16_t value(uint8_t slot) const;  // filter value, if valid()
+
+  const FilterStats& stats() const { return _stats; }
+  void resetStats();
+
+private:
+  int16_t latest(uint8_t slot) const;
+
+  int16_t (*_ring)[SLOTS_PER_BANK];   // _ring[n][slot]: depth rows
+  uint8_t _depth;
+  Mode _mode;
+  uint8_t _holdMax;
+  uint8_t _head[SLOTS_PER_BANK];      // row the next sample of the slot goes into
+  uint8_t _fill[SLOTS_PER_BANK];      // samples in the ring
+  uint8_t _misses[SLOTS_PER_BANK];    // misses in a row
+  uint8_t _powerOn;                   // bit per slot: the latest read was a rejected power-on value
+  FilterStats _stats;
+};
+
+#endif // SAMPLE_FILTER_H
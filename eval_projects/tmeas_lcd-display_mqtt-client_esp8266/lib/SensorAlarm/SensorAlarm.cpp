@@ -0,0 +1,92 @@
+#include "SensorAlarm.h"
+
+#include <string.h>
+
+SensorAlarm::SensorAlarm(const int8_t* low, const int8_t* high, uint8_t clearRounds)
+    : _low(low), _high(high), _clearRounds(clearRounds ? clearRounds : 1), _pending(0), _trips(0) {
+  memset(_state, CLEAR, sizeof(_state));
+  memset(_quiet, 0, sizeof(_quiet));
+  memset(_raw, 0, sizeof(_raw));
+}
+
+uint8_t SensorAlarm::slots() const {
+  uint8_t mask = 0;
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++)
+    if (_low[i] > SENSOR_ALARM_OFF_LOW || _high[i] < SENSOR_ALARM_OFF_HIGH) mask |= 1 << i;
+  return mask;
+}
+
+uint8_t SensorAlarm::update(uint8_t searched, uint8_t found, const int16_t* raw) {
+  uint8_t changed = 0;
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+    uint8_t bit = 1 << i;
+    if (!(searched & bit)) continue;
+    // the sensor compared against its own TL/TH, which may not be the slot's yet
+    State s = CLEAR;
+    if (found & bit) {
+      int16_t deg = raw[i] >> 4;
+      if (deg >= _high[i]) s = TRIP_HIGH;
+      else if (deg <= _low[i]) s = TRIP_LOW;
+    }
+    if (s != CLEAR) {
+      _quiet[i] = 0;
+      _raw[i] = raw[i];
+      if (_state[i] == s) continue;
+      _state[i] = s;
+      _trips++;
+      changed |= bit;
+    } else if (_state[i] != CLEAR && ++_quiet[i] >= _clearRounds) {
+      _state[i] = CLEAR;
+      _quiet[i] = 0;
+      changed |= bit;
+    }
+  }
+  _pending |= changed;
+  return changed;
+}
+
+void SensorAlarm::reset(uint8_t slot) {
+  _state[slot] = CLEAR;
+  _quiet[slot] = 0;
+  _pending &= ~(1 << slot);
+}
+
+const char* alarmStateName(SensorAlarm::State state) {
+  switch (state) {
+    case SensorAlarm::CLEAR:     return "clear";
+    case SensorAlarm::TRIP_LOW:  return "low";
+    case SensorAlarm::TRIP_HIGH: return "high";
+  }
+  return "";
+}
+
+// A blank name is published as "slot<N>" (as in the datasets)
+size_t buildAlertJson(char* buf, size_t size, const char* client, uint8_t sbNr, uint32_t alertNr, uint64_t timeMs,
+                      const SensorAlarm& alarm, uint8_t slots, const int16_t* centi,
+                      const char (*names)[SENSOR_NAME_MAX + 1]) {
+  JsonWriter w(buf, size);
+  w.raw("{\"client\":"); w.str(client);
+  w.raw(",\"sb_nr\":"); w.u32(sbNr);
+  w.raw(",\"alert_nr\":"); w.u32(alertNr);
+  if (timeMs) { w.raw(",\"time_ms\":"); w.u64(timeMs); }
+  w.raw(",\"ts_alert\":{");
+  bool first = true;
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+    if (!(slots & (1 << i))) continue;
+    if (!first) w.raw(",");
+    first = false;
+    w.raw("\"");
+    if (names[i][0]) {
+      w.raw(names[i]);
+    } else {
+      w.raw("slot"); w.u32(i);
+    }
+    w.raw("\":{\"state\":"); w.str(alarmStateName(alarm.state(i)));
+    w.raw(",\"temp\":"); w.centi(centi[i]);
+    w.raw(",\"tl\":"); w.i32(alarm.low(i));
+    w.raw(",\"th\":"); w.i32(alarm.high(i));
+    w.raw("}");
+  }
+  w.raw("}}");
+  return w.ok() ? w.length() : 0;
+}
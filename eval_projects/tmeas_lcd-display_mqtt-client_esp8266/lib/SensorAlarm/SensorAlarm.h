@@ -0,0 +1,81 @@
+/*
+  SensorAlarm - alarm state of the slots of one sensor bank, fed by the DS18B20 alarm search
+
+  Freezers and heatings need an alert faster than the sample period. The DS18B20 compares every
+  conversion with the thresholds in its scratchpad (TL/TH, whole degrees C, kept in its EEPROM)
+  and only answers the ALARM SEARCH if the temperature is at or above TH or at or below TL.
+  Between the measurement cycles the slots with thresholds convert on their own and one alarm
+  search per bus asks for the tripped ones: with none tripped the search ends after the command
+  and two read slots, well below 2 ms of bus time (see searchAlarms() in TmcCore.h).
+
+  A slot found by the search trips at once. It clears after clearRounds searches in a row
+  without it, so a temperature hovering at a threshold doesn't flood the broker. Every change
+  is kept pending until it got published on <client>/sbN/alert (see
+  doc/requirements/payload_alert_json.txt): an alert raised while the broker is not reachable
+  goes out after the reconnect, with the state of that time.
+  State kept as struct of arrays, 4 bytes per slot.
+*/
+
+#ifndef SENSOR_ALARM_H
+#define SENSOR_ALARM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <TmcPayload.h>
+#include <SensorTable.h>
+
+class SensorAlarm {
+public:
+  enum State : uint8_t { CLEAR, TRIP_LOW, TRIP_HIGH };
+
+  // low/high: TL/TH of the bank's slots, SLOTS_PER_BANK entries each
+  SensorAlarm(const int8_t* low, const int8_t* high, uint8_t clearRounds);
+
+  uint8_t slots() const;              // slots with thresholds
+  // Result of one alarm search over the slots searched: found are the hits confirmed by their
+  // readings, raw[] holds the readings of the hits. Returns the slots whose state changed.
+  uint8_t update(uint8_t searched, uint8_t found, const int16_t* raw);
+  void reset(uint8_t slot);           // the slot got another sensor: clear, without an alert
+
+  State state(uint8_t slot) const { return (State)_state[slot]; }
+  int16_t raw(uint8_t slot) const { return _raw[slot]; }         // latest reading of a tripped slot
+  int8_t low(uint8_t slot) const { return _low[slot]; }
+  int8_t high(uint8_t slot) const { return _high[slot]; }
+  uint8_t pending() const { return _pending; }                   // changes not yet published
+  void sent(uint8_t slots) { _pending &= ~slots; }
+  uint32_t trips() const { return _trips; }
+
+private:
+  const int8_t* _low;
+  const int8_t* _high;
+  uint8_t _clearRounds;
+  uint8_t _state[SLOTS_PER_BANK];
+  uint8_t _quiet[SLOTS_PER_BANK];     // searches in a row without the tripped slot
+  int16_t _raw[SLOTS_PER_BANK];
+  uint8_t _pending;
+  uint32_t _trips;
+};
+
+const char* alarmStateName(SensorAlarm::State state);
+
+// Worst case length of one alert payload: longest client name, 3-digit sb_nr, 10-digit alert_nr,
+// 13-digit time_ms and 8 sensors with 8 character names, temperatures like "-327.68" (none) and 4 character
+// thresholds
+constexpr size_t PAYLOAD_ALERT_JSON_MAX =
+    (sizeof("{\"client\":\"") - 1) + CLIENT_NAME_MAX +
+    (sizeof("\",\"sb_nr\":") - 1) + 3 +
+    (sizeof(",\"alert_nr\":") - 1) + 10 +
+    (sizeof(",\"time_ms\":") - 1) + 13 +
+    (sizeof(",\"ts_alert\":{") - 1) +
+    SLOTS_PER_BANK * ((sizeof(",\"\":{\"state\":\"clear\",\"temp\":,\"tl\":,\"th\":}") - 1) + SENSOR_NAME_MAX + 7 + 2 * 4) - 1 +
+    (sizeof("}}") - 1);
+
+// Serialize the state of the given slots into buf: centi[] are their temperatures (calibration offset
+// applied, TEMP_INVALID_CENTI if unknown), names the friendly names of the bank's slots, timeMs the
+// time of the alert in epoch ms (0 = unknown, omitted). Returns the payload length, 0 if buf is too small.
+size_t buildAlertJson(char* buf, size_t size, const char* client, uint8_t sbNr, uint32_t alertNr, uint64_t timeMs,
+                      const SensorAlarm& alarm, uint8_t slots, const int16_t* centi,
+                      const char (*names)[SENSOR_NAME_MAX + 1]);
+
+#endif // SENSOR_ALARM_H
@@ -0,0 +1,251 @@
+#include "SensorTable.h"
+
+#include <string.h>
+
+namespace {
+
+const uint8_t TABLE_MAGIC[4] = { 'T', 'M', 'S', 'T' };
+const uint8_t CACHE_MAGIC[4] = { 'T', 'M', 'R', 'C' };
+const uint8_t FILE_VERSION = 1;
+
+const size_t SLOT_RECORD = ROM_SIZE + SENSOR_NAME_MAX + 1 + 1;     // ROM code, name, resolution
+const size_t TABLE_HEADER = 4 + 3;                                 // magic, version, banks, slots
+const size_t BUS_RECORD = 3 + BUS_ROMS_MAX * ROM_SIZE;             // count, parasite, slowestRes, ROM codes
+const size_t CACHE_HEADER = 4 + 2 + 2;                             // magic, version, banks, table fingerprint
+
+// CRC-16/CCITT-FALSE
+uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF) {
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t b = 0; b < 8; b++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+void putCrc(uint8_t* buf, size_t len) {
+  uint16_t crc = crc16(buf, len);
+  buf[len] = crc >> 8;
+  buf[len + 1] = crc & 0xFF;
+}
+
+bool crcOk(const uint8_t* buf, size_t len) {
+  return len >= 2 && crc16(buf, len - 2) == (uint16_t)((buf[len - 2] << 8) | buf[len - 1]);
+}
+
+int8_t hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+} // namespace
+
+bool parseRom(const char* hex, size_t len, uint8_t* rom) {
+  if (len != 2 * ROM_SIZE) return false;
+  uint8_t tmp[ROM_SIZE];
+  for (uint8_t i = 0; i < ROM_SIZE; i++) {
+    int8_t hi = hexDigit(hex[2 * i]), lo = hexDigit(hex[2 * i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    tmp[i] = (hi << 4) | lo;
+  }
+  if (dallasCrc8(tmp, ROM_SIZE - 1) != tmp[ROM_SIZE - 1]) return false;
+  memcpy(rom, tmp, ROM_SIZE);
+  return true;
+}
+
+void formatRom(const uint8_t* rom, char* out) {
+  static const char digits[] = "0123456789ABCDEF";
+  for (uint8_t i = 0; i < ROM_SIZE; i++) {
+    *out++ = digits[rom[i] >> 4];
+    *out++ = digits[rom[i] & 0x0F];
+  }
+  *out = '\0';
+}
+
+void loadSensorDefs(const SensorDef* defs, size_t count, uint8_t (*rom)[ROM_SIZE], char (*names)[SENSOR_NAME_MAX + 1],
+                    uint8_t* resolution, uint8_t banks) {
+  size_t slots = (size_t)banks * SLOTS_PER_BANK;
+  memset(rom, 0, slots * ROM_SIZE);
+  memset(names, 0, slots * (SENSOR_NAME_MAX + 1));
+  memset(resolution, SENSOR_RESOLUTION_DEFAULT, slots);
+  for (size_t i = 0; i < count; i++) {
+    const SensorDef& d = defs[i];
+    if (d.bank >= banks) continue;
+    size_t n = d.bank * SLOTS_PER_BANK + d.slot;
+    memcpy(rom[n], d.rom, ROM_SIZE);
+    memcpy(names[n], d.name, SENSOR_NAME_MAX + 1);
+    resolution[n] = d.resolution;
+  }
+}
+
+int16_t sensorOffset(const SensorDef* defs, size_t count, const uint8_t* rom) {
+  for (size_t i = 0; i < count; i++)
+    if (memcmp(defs[i].rom, rom, ROM_SIZE) == 0) return defs[i].offsetCenti;
+  return 0;
+}
+
+void loadSensorAlarms(const SensorDef* defs, size_t count, int8_t* low, int8_t* high, uint8_t banks) {
+  size_t slots = (size_t)banks * SLOTS_PER_BANK;
+  memset(low, SENSOR_ALARM_OFF_LOW, slots);
+  memset(high, SENSOR_ALARM_OFF_HIGH, slots);
+  for (size_t i = 0; i < count; i++) {
+    const SensorDef& d = defs[i];
+    if (d.bank >= banks) continue;
+    low[d.bank * SLOTS_PER_BANK + d.slot] = d.alarmLow;
+    high[d.bank * SLOTS_PER_BANK + d.slot] = d.alarmHigh;
+  }
+}
+
+SensorTable::SensorTable(uint8_t (*rom)[ROM_SIZE], char (*names)[SENSOR_NAME_MAX + 1], uint8_t* resolution, uint8_t banks)
+    : _rom(rom), _names(names), _resolution(resolution), _banks(banks) {}
+
+size_t SensorTable::fileSize() const {
+  return TABLE_HEADER + _banks * SLOTS_PER_BANK * SLOT_RECORD + 2;
+}
+
+size_t SensorTable::serialize(uint8_t* buf, size_t size) const {
+  if (size < fileSize()) return 0;
+  uint8_t* p = buf;
+  memcpy(p, TABLE_MAGIC, 4); p += 4;
+  *p++ = FILE_VERSION;
+  *p++ = _banks;
+  *p++ = SLOTS_PER_BANK;
+  for (size_t i = 0; i < _banks * SLOTS_PER_BANK; i++) {
+    memcpy(p, _rom[i], ROM_SIZE); p += ROM_SIZE;
+    memset(p, 0, SENSOR_NAME_MAX + 1);
+    strncpy((char*)p, _names[i], SENSOR_NAME_MAX); p += SENSOR_NAME_MAX + 1;
+    *p++ = _resolution[i];
+  }
+  putCrc(buf, p - buf);
+  return fileSize();
+}
+
+bool SensorTable::deserialize(const uint8_t* buf, size_t len) {
+  if (len != fileSize() || !crcOk(buf, len)) return false;
+  if (memcmp(buf, TABLE_MAGIC, 4) != 0 || buf[4] != FILE_VERSION || buf[5] != _banks || buf[6] != SLOTS_PER_BANK) return false;
+  const uint8_t* p = buf + TABLE_HEADER;
+  for (size_t i = 0; i < _banks * SLOTS_PER_BANK; i++) {
+    memcpy(_rom[i], p, ROM_SIZE); p += ROM_SIZE;
+    memcpy(_names[i], p, SENSOR_NAME_MAX); p += SENSOR_NAME_MAX;
+    _names[i][SENSOR_NAME_MAX] = '\0'; p++;
+    _resolution[i] = *p++;
+  }
+  return true;
+}
+
+uint16_t SensorTable::fingerprint() const {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < _banks * SLOTS_PER_BANK; i++) {
+    char name[SENSOR_NAME_MAX + 1] = {};
+    strncpy(name, _names[i], SENSOR_NAME_MAX);
+    crc = crc16(_rom[i], ROM_SIZE, crc);
+    crc = crc16((const uint8_t*)name, sizeof(name), crc);
+    crc = crc16(&_resolution[i], 1, crc);
+  }
+  return crc;
+}
+
+bool samePopulation(const BusPopulation& a, const BusPopulation& b) {
+  if (a.count != b.count) return false;
+  uint8_t kept = a.count < BUS_ROMS_MAX ? a.count : BUS_ROMS_MAX;
+  return memcmp(a.rom, b.rom, kept * ROM_SIZE) == 0;
+}
+
+size_t RomCache::fileSize(uint8_t banks) {
+  return CACHE_HEADER + banks * BUS_RECORD + 2;
+}
+
+size_t RomCache::serialize(uint8_t* buf, size_t size, uint16_t tableFingerprint, const BusPopulation* buses, uint8_t banks) {
+  if (size < fileSize(banks)) return 0;
+  uint8_t* p = buf;
+  memcpy(p, CACHE_MAGIC, 4); p += 4;
+  *p++ = FILE_VERSION;
+  *p++ = banks;
+  *p++ = tableFingerprint >> 8;
+  *p++ = tableFingerprint & 0xFF;
+  for (uint8_t b = 0; b < banks; b++) {
+    *p++ = buses[b].count;
+    *p++ = buses[b].parasite ? 1 : 0;
+    *p++ = buses[b].slowestRes;
+    memcpy(p, buses[b].rom, BUS_ROMS_MAX * ROM_SIZE); p += BUS_ROMS_MAX * ROM_SIZE;
+  }
+  putCrc(buf, p - buf);
+  return fileSize(banks);
+}
+
+bool RomCache::deserialize(const uint8_t* buf, size_t len, uint16_t tableFingerprint, BusPopulation* buses, uint8_t banks) {
+  if (len != fileSize(banks) || !crcOk(buf, len)) return false;
+  if (memcmp(buf, CACHE_MAGIC, 4) != 0 || buf[4] != FILE_VERSION || buf[5] != banks) return false;
+  if (((buf[6] << 8) | buf[7]) != tableFingerprint) return false;
+  const uint8_t* p = buf + CACHE_HEADER;
+  for (uint8_t b = 0; b < banks; b++) {
+    buses[b].count = *p++;
+    buses[b].parasite = *p++ != 0;
+    buses[b].slowestRes = *p++;
+    memcpy(buses[b].rom, p, BUS_ROMS_MAX * ROM_SIZE); p += BUS_ROMS_MAX * ROM_SIZE;
+  }
+  return true;
+}
+
+#if defined(ARDUINO_ARCH_ESP8266)
+
+#include <LittleFS.h>
+
+namespace {
+
+// Read a whole file of the expected size into buf
+bool readFile(const char* path, uint8_t* buf, size_t size) {
+  File f = LittleFS.open(path, "r");
+  if (!f) return false;
+  bool ok = f.size() == size && f.read(buf, size) == size;
+  f.close();
+  return ok;
+}
+
+bool writeFile(const char* path, const uint8_t* buf, size_t size) {
+  File f = LittleFS.open(path, "w");
+  if (!f) return false;
+  bool ok = f.write(buf, size) == size;
+  f.close();
+  return ok;
+}
+
+} // namespace
+
+// The files are small (a few hundred bytes), they are read and written in one piece
+// through a temporary buffer on the heap, released right away.
+
+bool SensorTable::load(const char* path) {
+  size_t size = fileSize();
+  uint8_t* buf = new uint8_t[size];
+  bool ok = readFile(path, buf, size) && deserialize(buf, size);
+  delete[] buf;
+  return ok;
+}
+
+bool SensorTable::save(const char* path) const {
+  size_t size = fileSize();
+  uint8_t* buf = new uint8_t[size];
+  bool ok = serialize(buf, size) && writeFile(path, buf, size);
+  delete[] buf;
+  return ok;
+}
+
+bool RomCache::load(const char* path, uint16_t tableFingerprint, BusPopulation* buses, uint8_t banks) {
+  size_t size = fileSize(banks);
+  uint8_t* buf = new uint8_t[size];
+  bool ok = readFile(path, buf, size) && deserialize(buf, size, tableFingerprint, buses, banks);
+  delete[] buf;
+  return ok;
+}
+
+bool RomCache::save(const char* path, uint16_t tableFingerprint, const BusPopulation* buses, uint8_t banks) {
+  size_t size = fileSize(banks);
+  uint8_t* buf = new uint8_t[size];
+  bool ok = serialize(buf, size, tableFingerprint, buses, banks) && writeFile(path, buf, size);
+  delete[] buf;
+  return ok;
+}
+
+#endif // ARDUINO_ARCH_ESP8266
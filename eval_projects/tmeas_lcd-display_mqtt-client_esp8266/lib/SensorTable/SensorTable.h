@@ -0,0 +1,174 @@
+/*
+  SensorTable - sensor table and bus population cache on the LittleFS flash file system
+
+  The sensor table assigns a ROM code, a friendly name and a resolution to every slot of
+  every sensor bank. It works on the arrays of the firmware (knownSensors[], knownNames[],
+  knownResolution[]), whose compile-time content serves as default as long as no table
+  file exists. Changes made at runtime (e.g. by MQTT command) are saved to the table file
+  and survive a reset.
+
+  The bus population cache keeps the ROM codes found by the search of each bus at boot,
+  together with what had to be learned from the sensors themselves (slowest resolution of
+  the configured sensors, parasite power). If the next boot finds the same population with
+  an unchanged sensor table, the per-sensor setup is skipped and the cached values are used.
+
+  Both files are written as a header, the records and a CRC-16, a file with a wrong
+  layout or CRC is ignored as a whole. ROM codes are handled in bus order, family code first,
+  as text they are written as 16 hex digits in the same order, e.g. "282C446E000000A6".
+
+  The defaults of a new device come from a compile-time table of SensorDef entries
+  (include/sensor_defs.h), generated from the sbN_tsdat/sbN_sensors sections of the model
+  configuration by mqtt_clients/gen_sensor_defs.py. The table is checked by static_assert
+  (see the sensorDefs...() checks below) and also holds the calibration offset of each
+  sensor. The offset belongs to the sensor, not to the slot: it is looked up by ROM code
+  whenever the table changes, and stays with the sensor if it is moved to another slot.
+  The alarm thresholds (DS18B20 TL/TH, whole degrees C) are the other way round: they belong
+  to the slot (e.g. a freezer), a sensor put into the slot gets them programmed.
+*/
+
+#ifndef SENSOR_TABLE_H
+#define SENSOR_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <TmcPayload.h>
+
+constexpr uint8_t ROM_SIZE = 8;
+constexpr uint8_t BUS_ROMS_MAX = 16;        // ROM codes kept per bus in the population cache
+
+// CRC-8 of the ROM codes and scratchpads (Dallas/Maxim polynomial), usable at compile time
+constexpr uint8_t dallasCrc8(const uint8_t* data, size_t len) {
+  uint8_t crc = 0;
+  while (len--) {
+    uint8_t in = *data++;
+    for (uint8_t b = 0; b < 8; b++) {
+      uint8_t mix = (crc ^ in) & 0x01;
+      crc >>= 1;
+      if (mix) crc ^= 0x8C;
+      in >>= 1;
+    }
+  }
+  return crc;
+}
+
+// 16 hex digits into a ROM code; fails on bad digits or a wrong ROM CRC
+bool parseRom(const char* hex, size_t len, uint8_t* rom);
+// ROM code as 16 hex digits, out holds at least 17 characters
+void formatRom(const uint8_t* rom, char* out);
+
+constexpr uint8_t SENSOR_RESOLUTION_DEFAULT = 12;    // of the slots not in the compile-time table
+constexpr int16_t SENSOR_OFFSET_MAX_CENTI = 500;      // calibration offsets are limited to +-5.00 degree C
+static_assert(-5500 - SENSOR_OFFSET_MAX_CENTI > TEMP_INVALID_CENTI, "a reading plus its offset can reach the missing value");
+constexpr int8_t SENSOR_ALARM_OFF_LOW = -55;          // TL/TH of a slot without alarm: the DS18B20 range,
+constexpr int8_t SENSOR_ALARM_OFF_HIGH = 125;         // the sensor never answers the alarm search
+
+// Entry of the compile-time sensor table
+struct SensorDef {
+  uint8_t bank;
+  uint8_t slot;
+  uint8_t rom[ROM_SIZE];
+  char name[SENSOR_NAME_MAX + 1];           // a longer initializer is a compile error
+  int16_t offsetCenti;                      // calibration offset added to the readings, centi-degrees
+  uint8_t resolution;                       // 9..12 bit
+  int8_t alarmLow = SENSOR_ALARM_OFF_LOW;   // TL: alarm at or below, whole degrees C
+  int8_t alarmHigh = SENSOR_ALARM_OFF_HIGH; // TH: alarm at or above, whole degrees C
+};
+
+// Checks of the compile-time table, for static_assert
+
+constexpr bool sensorDefsInRange(const SensorDef* defs, size_t count, uint8_t banks) {
+  for (size_t i = 0; i < count; i++) {
+    const SensorDef& d = defs[i];
+    if (d.bank >= banks || d.slot >= SLOTS_PER_BANK || d.resolution < 9 || d.resolution > 12) return false;
+    if (d.offsetCenti > SENSOR_OFFSET_MAX_CENTI || d.offsetCenti < -SENSOR_OFFSET_MAX_CENTI) return false;
+    if (d.alarmLow < SENSOR_ALARM_OFF_LOW || d.alarmHigh > SENSOR_ALARM_OFF_HIGH || d.alarmLow >= d.alarmHigh) return false;
+  }
+  return true;
+}
+
+constexpr bool sensorDefsNamesValid(const SensorDef* defs, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    for (size_t c = 0; defs[i].name[c]; c++) if (defs[i].name[c] == ' ') return false;
+  return true;
+}
+
+// ROM code not all zero (an unconfigured slot) and with a valid CRC
+constexpr bool sensorDefsRomsValid(const SensorDef* defs, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    if (defs[i].rom[0] == 0 || dallasCrc8(defs[i].rom, ROM_SIZE - 1) != defs[i].rom[ROM_SIZE - 1]) return false;
+  return true;
+}
+
+constexpr bool sensorDefsSlotsUnique(const SensorDef* defs, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    for (size_t j = i + 1; j < count; j++)
+      if (defs[i].bank == defs[j].bank && defs[i].slot == defs[j].slot) return false;
+  return true;
+}
+
+constexpr bool sensorDefsRomsUnique(const SensorDef* defs, size_t count) {
+  for (size_t i = 0; i < count; i++)
+    for (size_t j = i + 1; j < count; j++) {
+      bool same = true;
+      for (size_t b = 0; b < ROM_SIZE; b++) if (defs[i].rom[b] != defs[j].rom[b]) same = false;
+      if (same) return false;
+    }
+  return true;
+}
+
+// Fill the table arrays (banks * SLOTS_PER_BANK entries each) from the compile-time table,
+// slots not in it are left unconfigured
+void loadSensorDefs(const SensorDef* defs, size_t count, uint8_t (*rom)[ROM_SIZE], char (*names)[SENSOR_NAME_MAX + 1],
+                    uint8_t* resolution, uint8_t banks);
+
+// Calibration offset of a sensor, 0 for a sensor the compile-time table doesn't know
+int16_t sensorOffset(const SensorDef* defs, size_t count, const uint8_t* rom);
+
+// Alarm thresholds of the slots (banks * SLOTS_PER_BANK entries each) from the compile-time table,
+// slots not in it get SENSOR_ALARM_OFF_LOW/HIGH
+void loadSensorAlarms(const SensorDef* defs, size_t count, int8_t* low, int8_t* high, uint8_t banks);
+
+class SensorTable {
+public:
+  // Arrays of banks * SLOTS_PER_BANK entries each
+  SensorTable(uint8_t (*rom)[ROM_SIZE], char (*names)[SENSOR_NAME_MAX + 1], uint8_t* resolution, uint8_t banks);
+
+  size_t fileSize() const;
+  size_t serialize(uint8_t* buf, size_t size) const;     // returns the size written, 0 if buf is too small
+  bool deserialize(const uint8_t* buf, size_t len);      // all or nothing
+  uint16_t fingerprint() const;                          // changes with every change of the table
+
+  bool load(const char* path);              // false: no valid file, the table keeps its content
+  bool save(const char* path) const;
+
+private:
+  uint8_t (*_rom)[ROM_SIZE];
+  char (*_names)[SENSOR_NAME_MAX + 1];
+  uint8_t* _resolution;
+  uint8_t _banks;
+};
+
+// ROM codes found on one bus and what was learned from its sensors
+struct BusPopulation {
+  uint8_t count;                            // ROM codes found (at most BUS_ROMS_MAX are kept)
+  bool parasite;                            // a sensor of the bus runs on parasite power
+  uint8_t slowestRes;                       // slowest resolution of the configured sensors found, 0 = none
+  uint8_t rom[BUS_ROMS_MAX][ROM_SIZE];
+};
+
+// Same ROM codes in the same (search) order?
+bool samePopulation(const BusPopulation& a, const BusPopulation& b);
+
+class RomCache {
+public:
+  static size_t fileSize(uint8_t banks);
+  static size_t serialize(uint8_t* buf, size_t size, uint16_t tableFingerprint, const BusPopulation* buses, uint8_t banks);
+  // false if the layout or CRC is wrong, or the cache was written for another sensor table
+  static bool deserialize(const uint8_t* buf, size_t len, uint16_t tableFingerprint, BusPopulation* buses, uint8_t banks);
+
+  static bool load(const char* path, uint16_t tableFingerprint, BusPopulation* buses, uint8_t banks);
+  static bool save(const char* path, uint16_t tableFingerprint, const BusPopulation* buses, uint8_t banks);
+};
+
+#endif // SENSOR_TABLE_H
@@ -0,0 +1,156 @@
+#include "TimeSync.h"
+
+#include <string.h>
+
+namespace {
+
+const uint32_t NTP_UNIX_OFFSET = 2208988800UL;    // seconds from 1900-01-01 (NTP) to 1970-01-01 (Unix)
+
+uint32_t get32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+void put32(uint8_t* p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+// Days since 1970-01-01 of a date of the proleptic Gregorian calendar
+int32_t daysFromCivil(int32_t y, uint32_t m, uint32_t d) {
+  y -= m <= 2;
+  int32_t era = (y >= 0 ? y : y - 399) / 400;
+  uint32_t yoe = (uint32_t)(y - era * 400);
+  uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+int32_t yearFromDays(int32_t z) {
+  z += 719468;
+  int32_t era = (z >= 0 ? z : z - 146096) / 146097;
+  uint32_t doe = (uint32_t)(z - era * 146097);
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153;
+  return (int32_t)yoe + era * 400 + (mp >= 10);
+}
+
+// 01:00 UTC of the last Sunday of a month with 31 days, in epoch seconds
+uint32_t lastSunday0100(int32_t year, uint32_t month) {
+  int32_t days = daysFromCivil(year, month, 31);
+  int32_t weekday = (days + 4) % 7;               // 1970-01-01 was a Thursday, 0 = Sunday
+  return (uint32_t)(days - weekday) * 86400UL + 3600;
+}
+
+} // namespace
+
+// Request as sent by the OLED clock (LI unsynchronized, version 4, client mode, poll 6,
+// precision 0xEC, reference id "1N14"). The token goes into the transmit timestamp, the
+// server returns it as originate timestamp, so late replies to earlier requests are recognized.
+void ntpRequest(uint8_t* packet, uint32_t token) {
+  memset(packet, 0, NTP_PACKET_SIZE);
+  packet[0] = 0b11100011;
+  packet[1] = 0;
+  packet[2] = 6;
+  packet[3] = 0xEC;
+  packet[12] = 49;
+  packet[13] = 0x4E;
+  packet[14] = 49;
+  packet[15] = 52;
+  put32(&packet[44], token);
+}
+
+bool ntpParse(const uint8_t* packet, size_t len, uint32_t token, uint64_t& epochMs) {
+  if (len < NTP_PACKET_SIZE) return false;
+  uint8_t li = packet[0] >> 6;
+  uint8_t mode = packet[0] & 0x07;
+  uint8_t stratum = packet[1];
+  if (mode != 4 || li == 3 || stratum == 0 || stratum > 15) return false;   // no server reply, or not synchronized
+  if (get32(&packet[28]) != token) return false;
+
+  uint32_t secs = get32(&packet[40]);
+  uint32_t frac = get32(&packet[44]);
+  // NTP era 1 starts 2036-02-07; seconds below 2^31 are taken as era 1
+  uint64_t unixSecs = (uint64_t)secs - NTP_UNIX_OFFSET + ((secs & 0x80000000UL) ? 0 : 0x100000000ULL);
+  epochMs = unixSecs * 1000 + (((uint64_t)frac * 1000) >> 32);
+  return true;
+}
+
+bool isBerlinDst(uint32_t utcEpochSeconds) {
+  int32_t year = yearFromDays((int32_t)(utcEpochSeconds / 86400));
+  return utcEpochSeconds >= lastSunday0100(year, 3) && utcEpochSeconds < lastSunday0100(year, 10);
+}
+
+TimeSync::TimeSync(NtpTransport& transport, uint32_t syncIntervalMs, uint32_t retryMs, uint32_t timeoutMs)
+    : _transport(transport), _syncIntervalMs(syncIntervalMs), _retryMs(retryMs), _timeoutMs(timeoutMs),
+      _valid(false), _synced(false), _due(true), _waiting(false), _sentMs(0), _nextMs(0),
+      _anchorEpochMs(0), _anchorMs(0), _ppm(0), _stats{0, 0, 0} {}
+
+void TimeSync::step(uint32_t nowMs, bool networkUp) {
+  uint8_t packet[NTP_PACKET_SIZE];
+
+  if (_waiting) {
+    uint64_t serverMs;
+    size_t len;
+    while ((len = _transport.receive(packet, sizeof(packet))) > 0) {
+      if (!ntpParse(packet, len, _sentMs, serverMs)) continue;
+      // the server time refers to the middle of the round trip
+      apply(serverMs + (nowMs - _sentMs) / 2, nowMs);
+      _waiting = false;
+      _nextMs = nowMs + _syncIntervalMs;
+      return;
+    }
+    if (nowMs - _sentMs < _timeoutMs) return;
+    _waiting = false;
+    _stats.failures++;
+    _nextMs = nowMs + _retryMs;
+    return;
+  }
+
+  if (!networkUp) return;
+  if (!_due && (int32_t)(nowMs - _nextMs) < 0) return;
+  _due = false;
+  ntpRequest(packet, nowMs);
+  if (_transport.send(packet, sizeof(packet))) {
+    _waiting = true;
+    _sentMs = nowMs;
+  } else {
+    _stats.failures++;
+    _nextMs = nowMs + _retryMs;
+  }
+}
+
+uint64_t TimeSync::epochMs(uint32_t nowMs) const {
+  if (!_valid) return 0;
+  uint32_t elapsed = nowMs - _anchorMs;
+  return _anchorEpochMs + elapsed + (int64_t)elapsed * _ppm / 1000000;
+}
+
+void TimeSync::set(uint64_t epochMs, uint32_t nowMs) {
+  _anchorEpochMs = epochMs;
+  _anchorMs = nowMs;
+  _valid = epochMs != 0;
+  _synced = false;
+}
+
+void TimeSync::apply(uint64_t serverMs, uint32_t nowMs) {
+  if (_valid) {
+    int64_t error = (int64_t)(serverMs - epochMs(nowMs));
+    _stats.lastErrorMs = error > INT32_MAX ? INT32_MAX : error < INT32_MIN ? INT32_MIN : (int32_t)error;
+    uint32_t span = nowMs - _anchorMs;
+    // tune the rate with half of the error found, unless the time jumped
+    if (_synced && span >= TIME_MIN_RATE_SPAN_MS && error >= -(int64_t)TIME_STEP_MS && error <= (int64_t)TIME_STEP_MS) {
+      int64_t ppm = _ppm + error * 1000000 / span / 2;
+      if (ppm > TIME_DRIFT_MAX_PPM) ppm = TIME_DRIFT_MAX_PPM;
+      if (ppm < -TIME_DRIFT_MAX_PPM) ppm = -TIME_DRIFT_MAX_PPM;
+      _ppm = (int32_t)ppm;
+    }
+  }
+  _anchorEpochMs = serverMs;
+  _anchorMs = nowMs;
+  _valid = true;
+  _synced = true;
+  _stats.syncs++;
+}
@@ -0,0 +1,94 @@
+/*
+  TimeSync - non-blocking NTP time synchronization with millis() drift correction
+
+  Derived from the NTP client of the analog OLED clock (sendNTPpacket/syncTime), turned into
+  a component that never waits itself: step() is called from loop(), sends a request when a
+  synchronization is due and evaluates the reply on one of the next calls.
+
+  Between two synchronizations the time is extrapolated from millis(). The rate of millis()
+  against NTP is estimated from the error found at each synchronization (half of the error
+  is corrected per synchronization, limited to +-TIME_DRIFT_MAX_PPM), so the extrapolation
+  gets better the longer the client runs. A jump of more than TIME_STEP_MS (e.g. a new server)
+  resets the time without touching the rate.
+
+  The time is UTC in milliseconds since 1970-01-01 (epoch ms); local time is left to the
+  receivers. isBerlinDst() is kept for clients that show local time, like the OLED clock.
+
+  The UDP socket is accessed through NtpTransport, so the component runs against a simulated
+  server as well.
+*/
+
+#ifndef TIME_SYNC_H
+#define TIME_SYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr size_t NTP_PACKET_SIZE = 48;
+constexpr int32_t TIME_DRIFT_MAX_PPM = 500;       // limit of the rate correction
+constexpr uint32_t TIME_STEP_MS = 1000;           // larger errors reset the time instead of tuning the rate
+constexpr uint32_t TIME_MIN_RATE_SPAN_MS = 60000; // min. time between two synchronizations to tune the rate
+
+// 48-byte NTP client request (version 4, client mode), the token is echoed by the server
+void ntpRequest(uint8_t* packet, uint32_t token);
+// Transmit time of the server reply to the request with the token, in epoch ms;
+// false if it is no valid server reply or the reply to another request
+bool ntpParse(const uint8_t* packet, size_t len, uint32_t token, uint64_t& epochMs);
+
+// Daylight saving time in Germany (last Sunday of March 01:00 UTC .. last Sunday of October 01:00 UTC)
+bool isBerlinDst(uint32_t utcEpochSeconds);
+
+// UDP access to the NTP server, implemented by the firmware (or a simulation)
+class NtpTransport {
+public:
+  virtual ~NtpTransport() {}
+  virtual bool send(const uint8_t* packet, size_t len) = 0;   // send a request to the server
+  virtual size_t receive(uint8_t* packet, size_t size) = 0;   // a received reply, 0 if none
+};
+
+struct TimeSyncStats {
+  uint32_t syncs;                   // successful synchronizations
+  uint32_t failures;                // requests without a valid reply
+  int32_t lastErrorMs;              // error of the extrapolated time at the last synchronization
+};
+
+class TimeSync {
+public:
+  TimeSync(NtpTransport& transport, uint32_t syncIntervalMs = 3600000, uint32_t retryMs = 30000,
+           uint32_t timeoutMs = 2000);
+
+  // Advance: request when due and the network is up, evaluate replies. Never blocks.
+  void step(uint32_t nowMs, bool networkUp);
+
+  bool valid() const { return _valid; }           // time known (synchronized or set)
+  bool synced() const { return _synced; }         // time taken from NTP since the start
+  uint64_t epochMs(uint32_t nowMs) const;         // current time, 0 if not valid
+
+  // Take the time from another source (e.g. kept over a deep sleep); it stays unsynced
+  // and is replaced by the next NTP reply
+  void set(uint64_t epochMs, uint32_t nowMs);
+
+  void requestSync() { _due = true; }             // synchronize on the next step()
+  int32_t driftPpm() const { return _ppm; }
+  const TimeSyncStats& stats() const { return _stats; }
+
+private:
+  void apply(uint64_t serverMs, uint32_t nowMs);
+
+  NtpTransport& _transport;
+  uint32_t _syncIntervalMs;
+  uint32_t _retryMs;
+  uint32_t _timeoutMs;
+  bool _valid;
+  bool _synced;
+  bool _due;                        // a request is to be sent
+  bool _waiting;                    // a request is pending
+  uint32_t _sentMs;                 // time the pending request was sent
+  uint32_t _nextMs;                 // time of the next request
+  uint64_t _anchorEpochMs;          // time at _anchorMs
+  uint32_t _anchorMs;
+  int32_t _ppm;                     // rate correction of millis()
+  TimeSyncStats _stats;
+};
+
+#endif // TIME_SYNC_H
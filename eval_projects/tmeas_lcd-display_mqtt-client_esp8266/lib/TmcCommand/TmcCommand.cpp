@@ -0,0 +1,188 @@
+#include "TmcCommand.h"
+
+#include <string.h>
+
+namespace {
+
+// Members a command requires
+const uint8_t NEEDS_VALUE = 0x01;
+const uint8_t NEEDS_SB    = 0x02;
+const uint8_t NEEDS_SLOT  = 0x04;
+
+struct CommandEntry {
+  const char* name;
+  CommandCode code;
+  uint8_t needs;
+};
+
+const CommandEntry COMMANDS[] = {
+  { "status",   CMD_STATUS,   0 },
+  { "interval", CMD_INTERVAL, NEEDS_VALUE },
+  { "measure",  CMD_MEASURE,  0 },
+  { "deadband", CMD_DEADBAND, NEEDS_VALUE },
+  { "sensor",   CMD_SENSOR,   NEEDS_SB | NEEDS_SLOT },
+  { "scan",     CMD_SCAN,     NEEDS_SB }
+};
+
+// Read position within the payload
+struct Cursor {
+  const uint8_t* p;
+  const uint8_t* end;
+
+  void skipWs() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+  }
+
+  bool take(char c) {
+    skipWs();
+    if (p >= end || *p != (uint8_t)c) return false;
+    p++;
+    return true;
+  }
+
+  // String without escape sequences, returned as pointer and length into the payload
+  bool string(const char*& text, size_t& n) {
+    if (!take('"')) return false;
+    const uint8_t* start = p;
+    while (p < end && *p != '"') {
+      if (*p == '\\' || *p < 0x20) return false;
+      p++;
+    }
+    if (p >= end) return false;
+    text = (const char*)start;
+    n = p - start;
+    p++;
+    return true;
+  }
+
+  // Integer within the int32_t range, fractions and exponents are rejected
+  bool integer(int32_t& value) {
+    skipWs();
+    bool neg = p < end && *p == '-';
+    if (neg) p++;
+    if (p >= end || *p < '0' || *p > '9') return false;
+    int64_t v = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+      v = v * 10 + (*p++ - '0');
+      if (v > 0x80000000LL) return false;
+    }
+    if (p < end && (*p == '.' || *p == 'e' || *p == 'E')) return false;
+    if (neg) v = -v;
+    if (v > INT32_MAX) return false;
+    value = (int32_t)v;
+    return true;
+  }
+
+  bool literal(const char* word) {
+    size_t n = strlen(word);
+    if ((size_t)(end - p) < n || memcmp(p, word, n) != 0) return false;
+    p += n;
+    return true;
+  }
+
+  // Skip the value of a member that is not evaluated
+  bool skipValue() {
+    skipWs();
+    if (p >= end) return false;
+    if (*p == '"') {
+      const char* text;
+      size_t n;
+      return string(text, n);
+    }
+    if (*p == 't') return literal("true");
+    if (*p == 'f') return literal("false");
+    if (*p == 'n') return literal("null");
+    if (*p == '-' || (*p >= '0' && *p <= '9')) {
+      p++;
+      while (p < end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-')) p++;
+      return true;
+    }
+    return false;     // nested object or array
+  }
+};
+
+bool keyIs(const char* key, size_t n, const char* name) {
+  return strlen(name) == n && memcmp(key, name, n) == 0;
+}
+
+} // namespace
+
+CommandResult parseCommand(const uint8_t* payload, size_t len, Command& cmd) {
+  cmd.code = CMD_NONE;
+  cmd.hasId = false;
+  cmd.id = 0;
+  cmd.hasValue = false;
+  cmd.value = 0;
+  cmd.sb = -1;
+  cmd.slot = -1;
+  cmd.res = -1;
+  cmd.rom = nullptr;
+  cmd.romLen = 0;
+  cmd.name = nullptr;
+  cmd.nameLen = 0;
+
+  Cursor c = { payload, payload + len };
+  const char* name = nullptr;
+  size_t nameLen = 0;
+
+  if (!c.take('{')) return CMD_ERR_SYNTAX;
+  if (!c.take('}')) {
+    do {
+      const char* key;
+      size_t keyLen;
+      if (!c.string(key, keyLen) || !c.take(':')) return CMD_ERR_SYNTAX;
+      if (keyIs(key, keyLen, "id")) {
+        int32_t id;
+        if (!c.integer(id) || id < 0) return CMD_ERR_SYNTAX;
+        cmd.hasId = true;
+        cmd.id = (uint32_t)id;
+      } else if (keyIs(key, keyLen, "cmd")) {
+        if (!c.string(name, nameLen)) return CMD_ERR_SYNTAX;
+      } else if (keyIs(key, keyLen, "value")) {
+        if (!c.integer(cmd.value)) return CMD_ERR_VALUE;
+        cmd.hasValue = true;
+      } else if (keyIs(key, keyLen, "sb") || keyIs(key, keyLen, "slot") || keyIs(key, keyLen, "res")) {
+        int32_t& member = keyIs(key, keyLen, "sb") ? cmd.sb : keyIs(key, keyLen, "slot") ? cmd.slot : cmd.res;
+        if (!c.integer(member) || member < 0) return CMD_ERR_VALUE;
+      } else if (keyIs(key, keyLen, "rom")) {
+        if (!c.string(cmd.rom, cmd.romLen)) return CMD_ERR_VALUE;
+      } else if (keyIs(key, keyLen, "name")) {
+        if (!c.string(cmd.name, cmd.nameLen)) return CMD_ERR_VALUE;
+      } else if (!c.skipValue()) {
+        return CMD_ERR_SYNTAX;
+      }
+    } while (c.take(','));
+    if (!c.take('}')) return CMD_ERR_SYNTAX;
+  }
+  c.skipWs();
+  if (c.p != c.end || !name) return CMD_ERR_SYNTAX;
+
+  for (const CommandEntry& e : COMMANDS) {
+    if (!keyIs(name, nameLen, e.name)) continue;
+    cmd.code = e.code;
+    if ((e.needs & NEEDS_VALUE) && !cmd.hasValue) return CMD_ERR_VALUE;
+    if ((e.needs & NEEDS_SB) && cmd.sb < 0) return CMD_ERR_VALUE;
+    if ((e.needs & NEEDS_SLOT) && cmd.slot < 0) return CMD_ERR_VALUE;
+    return CMD_OK;
+  }
+  return CMD_ERR_UNKNOWN;
+}
+
+const char* commandName(CommandCode code) {
+  for (const CommandEntry& e : COMMANDS) {
+    if (e.code == code) return e.name;
+  }
+  return "";
+}
+
+const char* commandResultName(CommandResult rc) {
+  switch (rc) {
+    case CMD_OK:          return "ok";
+    case CMD_ERR_SYNTAX:  return "syntax";
+    case CMD_ERR_UNKNOWN: return "unknown";
+    case CMD_ERR_VALUE:   return "value";
+    case CMD_ERR_BUSY:    return "busy";
+    case CMD_ERR_IN_USE:  return "in_use";
+  }
+  return "";
+}
@@ -0,0 +1,62 @@
+/*
+  TmcCommand - heap free parser of the tmc commands
+
+  Commands are sent by controlling entities on "<client>/cmd" as a flat JSON object,
+  see doc/requirements/command_response.txt:
+    {"id":17,"cmd":"interval","value":2000}
+
+  The parser works on the received bytes in place (no '\0' needed, nothing copied, no
+  allocation). The members "id", "cmd", "value", "sb", "slot", "res", "rom" and "name" are
+  evaluated, other members with string, number or literal values are skipped. Strings with
+  escape sequences and nested objects or arrays are rejected.
+*/
+
+#ifndef TMC_COMMAND_H
+#define TMC_COMMAND_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum CommandCode : uint8_t {
+  CMD_NONE,
+  CMD_STATUS,       // reply with status information
+  CMD_INTERVAL,     // set the sample period, value in ms
+  CMD_MEASURE,      // start a measurement right away, reply once its datasets are published
+  CMD_DEADBAND,     // set the publishing dead-band, value in centi-degrees
+  CMD_SENSOR,       // show or change the sensor table entry of sb/slot
+  CMD_SCAN          // search the bus of sb and report the ROM codes not in the sensor table
+};
+
+// Result of a command, returned as "rc" in the response
+enum CommandResult : uint8_t {
+  CMD_OK,
+  CMD_ERR_SYNTAX,     // not a flat JSON object, or "cmd" missing
+  CMD_ERR_UNKNOWN,    // unknown command
+  CMD_ERR_VALUE,      // a member required by the command missing or out of range
+  CMD_ERR_BUSY,       // a measurement or sensor change requested before is still pending
+  CMD_ERR_IN_USE      // the ROM code is already assigned to another slot
+};
+
+struct Command {
+  CommandCode code;
+  bool hasId;         // "id" given, to be echoed in the response
+  uint32_t id;        // correlation id
+  bool hasValue;
+  int32_t value;
+  int32_t sb;         // sensor bank, -1 if not given
+  int32_t slot;       // slot, -1 if not given
+  int32_t res;        // resolution in bits, -1 if not given
+  const char* rom;    // ROM code as hex digits, nullptr if not given (points into the payload)
+  size_t romLen;
+  const char* name;   // friendly name, nullptr if not given (points into the payload)
+  size_t nameLen;
+};
+
+// Parse a command payload of len bytes. On CMD_OK cmd holds the command; on errors
+// cmd.hasId/id are still valid if the id was parsed, so the error can be correlated.
+CommandResult parseCommand(const uint8_t* payload, size_t len, Command& cmd);
+
+const char* commandName(CommandCode code);          // "status", "interval", ...
+const char* commandResultName(CommandResult rc);    // "ok", "syntax", ...
+
+#endif // TMC_COMMAND_H
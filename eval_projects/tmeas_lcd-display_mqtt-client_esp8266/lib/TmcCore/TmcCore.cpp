@@ -0,0 +1,242 @@
+#include "TmcCore.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+// Temperature as shown on the LCD: 5 characters, right aligned. 2 decimals from -9.99 to 99.99,
+// 1 decimal (rounded) below and above, so -55.00 .. 125.00 plus any offset fits: "-55.3", "125.0"
+void formatLcdValue(int16_t centi, char* out, size_t size) {
+  if (centi > -1000 && centi < 10000) {
+    char num[8];
+    JsonWriter w(num, sizeof(num));
+    w.centi(centi);
+    snprintf(out, size, "%5s", num);
+    return;
+  }
+  int deci = (centi + (centi < 0 ? -5 : 5)) / 10;
+  snprintf(out, size, "%s%d.%d", deci < 0 ? "-" : "", abs(deci) / 10, abs(deci) % 10);
+}
+
+} // namespace
+
+bool isAddressZero(const uint8_t* rom) {
+  for (uint8_t i = 0; i < ROM_SIZE; i++) if (rom[i] != 0) return false;
+  return true;
+}
+
+uint8_t configuredSlots(const BankSlots* const* banks, uint8_t count) {
+  uint8_t cnt = 0;
+  for (uint8_t b = 0; b < count; b++)
+    for (size_t i = 0; i < SLOTS_PER_BANK; i++) if (!isAddressZero(banks[b]->rom[i])) cnt++;
+  return cnt;
+}
+
+SensorStatus decodeScratchPad(const uint8_t* sp, int16_t& raw) {
+  // A missing device leaves the bus idle (all 0xFF), a shorted bus reads all 0x00
+  bool allFF = true, all00 = true;
+  for (uint8_t b = 0; b < SCRATCHPAD_SIZE; b++) {
+    if (sp[b] != 0xFF) allFF = false;
+    if (sp[b] != 0x00) all00 = false;
+  }
+  if (allFF || all00) return SENSOR_ABSENT;
+  if (dallasCrc8(sp, SCRATCHPAD_SIZE - 1) != sp[SCRATCHPAD_SIZE - 1]) return SENSOR_CRC_ERROR;
+
+  raw = (int16_t)(((uint16_t)sp[1] << 8) | sp[0]);
+  // The low bits are undefined below 12 bit resolution (config register bits 5-6: 0 = 9 bit .. 3 = 12 bit)
+  uint8_t undefinedBits = 3 - ((sp[4] >> 5) & 0x03);
+  raw &= ~((1 << undefinedBits) - 1);
+  return SENSOR_OK;
+}
+
+// Reading the scratchpad once replaces the isConnected() + getTempC() pair of DallasTemperature,
+// which read the scratchpad twice per sensor
+SensorStatus readSlot(SensorBus& bus, BankSlots& bank, uint8_t slot) {
+  if (isAddressZero(bank.rom[slot])) return bank.state[slot] = SENSOR_NOT_CONFIGURED;
+  uint8_t sp[SCRATCHPAD_SIZE];
+  if (!bus.readScratchPad(bank.rom[slot], sp)) return bank.state[slot] = SENSOR_ABSENT;   // no presence pulse at all
+  return bank.state[slot] = decodeScratchPad(sp, bank.tempRaw[slot]);
+}
+
+SensorStatus filterSlot(SampleFilter& filter, BankSlots& bank, uint8_t slot) {
+  SensorStatus read = bank.state[slot];
+  if (read == SENSOR_NOT_CONFIGURED) {
+    filter.clear(slot);
+    return read;
+  }
+  if (read != SENSOR_OK) filter.miss(slot);
+  else if (!filter.add(slot, bank.tempRaw[slot])) read = SENSOR_RESET;
+
+  if (!filter.valid(slot)) {
+    bank.state[slot] = read;
+  } else {
+    bank.tempRaw[slot] = filter.value(slot);
+    bank.state[slot] = SENSOR_OK;
+  }
+  return read;
+}
+
+bool ReadRetry::again(SensorStatus read, uint32_t us) {
+  if (read == SENSOR_CRC_ERROR && _tries < _maxPerSlot && us <= _budgetUs) {
+    _tries++;
+    _budgetUs -= us;
+    return true;
+  }
+  _tries = 0;
+  return false;
+}
+
+// The search order is given by the ROM codes, so an unchanged bus population is found in the same order
+void searchBus(SensorBus& bus, BusPopulation& pop) {
+  uint8_t rom[ROM_SIZE];
+  pop.count = 0;
+  bus.resetSearch();
+  while (bus.search(rom)) {
+    if (dallasCrc8(rom, ROM_SIZE - 1) != rom[ROM_SIZE - 1]) continue;
+    if (pop.count < BUS_ROMS_MAX) memcpy(pop.rom[pop.count], rom, ROM_SIZE);
+    if (pop.count < 0xFF) pop.count++;
+  }
+}
+
+// The alarm flag is only a hint: the sensor sets it at the end of a conversion and keeps it until the
+// next one, so the scratchpad read right after confirms the temperature against its TL/TH
+uint8_t searchAlarms(SensorBus& bus, const BankSlots& bank, uint8_t slots, int16_t* raw) {
+  uint8_t rom[ROM_SIZE], found = 0;
+  bus.resetAlarmSearch();
+  for (uint8_t n = 0; n < BUS_ROMS_MAX && bus.alarmSearch(rom); n++) {
+    uint8_t slot = 0;
+    while (slot < SLOTS_PER_BANK && !((slots & (1 << slot)) && memcmp(bank.rom[slot], rom, ROM_SIZE) == 0)) slot++;
+    if (slot == SLOTS_PER_BANK) continue;       // a sensor without thresholds, or a disturbed search
+
+    uint8_t sp[SCRATCHPAD_SIZE];
+    int16_t value;
+    if (!bus.readScratchPad(rom, sp) || decodeScratchPad(sp, value) != SENSOR_OK) continue;
+    if (value == SampleFilter::POWER_ON_RAW) continue;
+    int16_t deg = value >> 4;                   // the sensor compares whole degrees, rounded down
+    if (deg < (int8_t)sp[2] && deg > (int8_t)sp[3]) continue;
+    raw[slot] = value;
+    found |= 1 << slot;
+  }
+  return found;
+}
+
+// - only sensors configured are shown, 4 sensors on one LCD page, ordered by bank and slot index.
+// - sensors are numbered across the banks: S0..S7 for bank 0, S8..S15 for bank 1
+//
+// Example of one LCD page with 4 configured sensors (slots 0,1,2,7) and 4 unconfigured slots (3,4,5,6):
+// |12345678901234567890|
+// +--------------------+
+// !S0: Sensor_1 23.45°C!
+// !S1: Sensor_2 23.45°C!
+// !S4: Sensor_5 23.45°C!
+// !S12:Sensor_6 23.45°C!
+// +--------------------+
+//
+// Note: Sensor names are truncated to 7 Characters to fit the display,
+//       if a sensor is configured but not connected, the display shows "--.--"
+void renderLcdPage(LcdFrameBuffer& fb, const BankSlots* const* banks, uint8_t count, uint8_t page, char indicator) {
+  fb.clear();
+  uint8_t rowcnt = 0;             // row on the current page
+  uint8_t shown = 0;              // configured sensors seen so far, used to skip previous pages
+
+  for (uint8_t b = 0; b < count && rowcnt < LcdFrameBuffer::ROWS; b++) {
+    const BankSlots& bank = *banks[b];
+    for (size_t i = 0; i < SLOTS_PER_BANK && rowcnt < LcdFrameBuffer::ROWS; i++) {
+      if (isAddressZero(bank.rom[i])) continue;
+      if (shown++ < page * LcdFrameBuffer::ROWS) continue;   // sensor belongs to a previous page
+
+      // The value is always 5 characters long to keep the layout and the indicator off the "C",
+      // "--.--" is shown if the sensor is configured but not connected.
+      char value[9] = "--.--";
+      if (bank.state[i] == SENSOR_OK) formatLcdValue(slotCenti(bank, i), value, sizeof(value));
+
+      // Sensor names are padded/truncated to 7 characters, the value is followed by the degree symbol and C
+      char line[LcdFrameBuffer::COLS + 1];
+      int sensorNr = bank.sbNr * SLOTS_PER_BANK + i;
+      snprintf(line, sizeof(line), "S%d:%s%-7.7s %s\xDF" "C", sensorNr, sensorNr < 10 ? " " : "", bank.names[i], value);
+
+      fb.setCursor(0, rowcnt);
+      fb.print(line);
+      rowcnt++;
+    }
+  }
+  fb.setCursor(LcdFrameBuffer::COLS - 1, 0);
+  fb.print(indicator);
+}
+
+void makeRecord(const BankSlots& bank, uint32_t dsNr, uint64_t timeMs, DatasetRecord& rec) {
+  rec.timeMs = timeMs;
+  rec.dsNr = dsNr;
+  rec.sbNr = bank.sbNr;
+  rec.slotMask = 0;
+  for (size_t i = 0; i < SLOTS_PER_BANK; i++) {
+    rec.centi[i] = TEMP_INVALID_CENTI;
+    if (isAddressZero(bank.rom[i])) continue;
+    rec.slotMask |= 1 << i;
+    if (bank.state[i] == SENSOR_OK) rec.centi[i] = slotCenti(bank, i);
+  }
+}
+
+bool publishDue(const DatasetRecord& rec, const int16_t* lastCenti, int16_t deadbandCenti, uint32_t sinceMs,
+                uint32_t heartbeatMs) {
+  if (deadbandCenti <= 0 || sinceMs >= heartbeatMs) return true;
+  for (size_t i = 0; i < SLOTS_PER_BANK; i++) {
+    if (!(rec.slotMask & (1 << i))) continue;
+    int16_t last = lastCenti[i];
+    if ((rec.centi[i] == TEMP_INVALID_CENTI) != (last == TEMP_INVALID_CENTI)) return true;   // lost or found
+    if (abs(rec.centi[i] - last) > deadbandCenti) return true;
+  }
+  return false;
+}
+
+DatasetPublisher::DatasetPublisher(MqttSink& mqtt, const char* client, uint8_t formats)
+    : _mqtt(mqtt), _client(client), _formats(formats), _clock(nullptr), _build(nullptr), _pub(nullptr) {}
+
+void DatasetPublisher::setTiming(Clock& clock, PhaseStats& build, PhaseStats& pub) {
+  _clock = &clock;
+  _build = &build;
+  _pub = &pub;
+}
+
+// The payloads are built on the stack, no heap is used per dataset. Unconfigured slots are
+// omitted, a blank name is published as "slot<N>".
+bool DatasetPublisher::publish(const char* jsonTopic, const char* cborTopic, const char (*names)[SENSOR_NAME_MAX + 1],
+                               const DatasetRecord& rec) {
+  PayloadEntry entries[SLOTS_PER_BANK];
+  uint8_t count = 0;
+  for (size_t i = 0; i < SLOTS_PER_BANK; i++) {
+    if (!(rec.slotMask & (1 << i))) continue;
+    entries[count].name = names[i];
+    entries[count].slot = i;
+    entries[count].centi = rec.centi[i];
+    count++;
+  }
+
+  bool ok = true;
+  uint32_t startUs = 0;
+  if (_formats & JSON) {
+    char payload[PAYLOAD_JSON_MAX + 1];
+    if (_clock) startUs = _clock->micros();
+    size_t len = buildPayloadJson(payload, sizeof(payload), _client, rec.sbNr, rec.dsNr, rec.timeMs, entries, count);
+    if (_clock) {
+      _build->add(_clock->micros() - startUs);
+      startUs = _clock->micros();
+    }
+    ok = _mqtt.publish(jsonTopic, (const uint8_t*)payload, len, false);
+    if (_clock) _pub->add(_clock->micros() - startUs);
+  }
+  if (_formats & CBOR) {
+    uint8_t payload[PAYLOAD_CBOR_MAX];
+    if (_clock) startUs = _clock->micros();
+    size_t len = buildPayloadCbor(payload, sizeof(payload), _client, rec.sbNr, rec.dsNr, rec.timeMs, entries, count);
+    if (_clock) {
+      _build->add(_clock->micros() - startUs);
+      startUs = _clock->micros();
+    }
+    ok = _mqtt.publish(cborTopic, payload, len, false) && ok;
+    if (_clock) _pub->add(_clock->micros() - startUs);
+  }
+  return ok;
+}
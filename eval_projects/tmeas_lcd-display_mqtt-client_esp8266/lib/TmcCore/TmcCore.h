@@ -0,0 +1,178 @@
+/*
+  TmcCore - hardware independent core of the measurement client
+
+  The slot table handling, the reading and checking of the sensors, the LCD pages and the
+  assembly of the datasets don't depend on the ESP8266. They live here and reach the hardware
+  through four small interfaces:
+    SensorBus     one OneWire bus with DS18B20 sensors (DallasTemperature/OneWire)
+    CharDisplay   a character LCD (LiquidCrystal_I2C)
+    Clock         millis()/micros()
+    MqttSink      publishing of a message (PubSubClient)
+  The firmware implements them on top of the Arduino libraries (main.cpp). The benchmark runner
+  of the native environment (platformio.ini, src/native) implements them on the host, so the
+  core paths can be measured without hardware.
+
+  A sensor bank is seen by the core as BankSlots: the configuration of its slots and their
+  latest readings. The firmware's SensorBank adds the bus, topics and publishing state to it.
+*/
+
+#ifndef TMC_CORE_H
+#define TMC_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <TmcPayload.h>
+#include <SensorTable.h>
+#include <DatasetBuffer.h>
+#include <LcdFrameBuffer.h>
+#include <CycleStats.h>
+#include <SampleFilter.h>
+
+// Result of reading a sensor slot, kept per slot next to its temperature value
+enum SensorStatus : uint8_t {
+  SENSOR_NOT_CONFIGURED,    // slot has no ROM code assigned
+  SENSOR_OK,                // scratchpad read and CRC valid
+  SENSOR_ABSENT,            // no device answered for the ROM code
+  SENSOR_CRC_ERROR,         // device answered, but the scratchpad CRC did not match
+  SENSOR_RESET              // device answered with its 85 degree C power-on value, the conversion got lost
+};
+
+constexpr uint8_t SCRATCHPAD_SIZE = 9;
+
+// One OneWire bus with DS18B20 sensors
+class SensorBus {
+public:
+  virtual ~SensorBus() {}
+  virtual void requestConversions() = 0;                        // start a conversion on all sensors, doesn't wait
+  virtual bool readScratchPad(const uint8_t* rom, uint8_t* scratchPad) = 0;   // false: no presence pulse
+  virtual void resetSearch() = 0;
+  virtual bool search(uint8_t* rom) = 0;                        // next ROM code of the bus, false at the end
+  virtual bool requestConversion(const uint8_t* rom) = 0;       // start a conversion on one sensor, doesn't wait
+  virtual void resetAlarmSearch() = 0;
+  virtual bool alarmSearch(uint8_t* rom) = 0;                   // next ROM code with its alarm flag set, false at the end
+  // Program the alarm thresholds (TL/TH, whole degrees C) into the sensor's scratchpad and EEPROM,
+  // only if they differ from the ones set; false: the sensor didn't answer
+  virtual bool setAlarm(const uint8_t* rom, int8_t low, int8_t high) = 0;
+};
+
+// Character display, as used by LcdFrameBuffer::flush()
+class CharDisplay {
+public:
+  virtual ~CharDisplay() {}
+  virtual void setCursor(uint8_t col, uint8_t row) = 0;
+  virtual size_t write(uint8_t c) = 0;
+};
+
+class Clock {
+public:
+  virtual ~Clock() {}
+  virtual uint32_t millis() = 0;
+  virtual uint32_t micros() = 0;
+};
+
+class MqttSink {
+public:
+  virtual ~MqttSink() {}
+  virtual bool publish(const char* topic, const uint8_t* payload, size_t len, bool retained) = 0;
+};
+
+// Configuration and latest readings of the slots of one sensor bank
+struct BankSlots {
+  uint8_t sbNr;                                 // sensor bank number used in topic and payload
+  uint8_t (*rom)[ROM_SIZE];                     // ROM table, SLOTS_PER_BANK entries
+  const char (*names)[SENSOR_NAME_MAX + 1];     // friendly names, SLOTS_PER_BANK entries
+  const uint8_t* resolution;                    // configured resolution in bits, SLOTS_PER_BANK entries
+  const int16_t* offsetCenti;                   // calibration offset in centi-degrees, SLOTS_PER_BANK entries
+  int16_t tempRaw[SLOTS_PER_BANK];              // raw DS18B20 reading in 1/16 degree C, valid if state is SENSOR_OK
+  SensorStatus state[SLOTS_PER_BANK];           // result of the latest read per slot
+};
+
+// Latest reading of a slot in centi-degrees, calibration offset applied; valid if state is SENSOR_OK
+inline int16_t slotCenti(const BankSlots& bank, uint8_t slot) {
+  return rawToCenti(bank.tempRaw[slot]) + bank.offsetCenti[slot];
+}
+
+bool isAddressZero(const uint8_t* rom);
+
+// Configured slots of all given banks, e.g. to know how many LCD pages there are
+uint8_t configuredSlots(const BankSlots* const* banks, uint8_t count);
+
+// Check a scratchpad read and take the temperature from it (raw, 1/16 degree C)
+SensorStatus decodeScratchPad(const uint8_t* scratchPad, int16_t& raw);
+
+// Read one slot of a bank into its tempRaw[] and state[], one bus transaction per sensor
+SensorStatus readSlot(SensorBus& bus, BankSlots& bank, uint8_t slot);
+
+// Pass the latest read of a slot (readSlot) through the bank's sample filter: tempRaw[] and state[]
+// get the filter value, or the failure of the read if the filter has no value to hold. Returns the
+// status of the read itself, SENSOR_RESET for a rejected power-on value.
+SensorStatus filterSlot(SampleFilter& filter, BankSlots& bank, uint8_t slot);
+
+// Re-reads of a slot after a CRC error: at most maxPerSlot per slot, and only while the bus time of
+// the failed reads is left in the budget of the cycle, so a disturbed bus doesn't stretch the cycle
+class ReadRetry {
+public:
+  ReadRetry(uint8_t maxPerSlot, uint32_t cycleBudgetUs)
+      : _maxPerSlot(maxPerSlot), _cycleBudgetUs(cycleBudgetUs), _budgetUs(0), _tries(0) {}
+
+  void startCycle() { _budgetUs = _cycleBudgetUs; _tries = 0; }
+  // After a read of a slot (readSlot) that took us of bus time: true if it failed its CRC and is to
+  // be repeated, false moves on to the next slot
+  bool again(SensorStatus read, uint32_t us);
+  uint32_t budgetUs() const { return _budgetUs; }
+
+private:
+  uint8_t _maxPerSlot;
+  uint32_t _cycleBudgetUs;
+  uint32_t _budgetUs;               // bus time left for re-reads in the current cycle
+  uint8_t _tries;                   // re-reads of the current slot
+};
+
+// Search a bus once, ROM codes with a wrong CRC are skipped
+void searchBus(SensorBus& bus, BusPopulation& pop);
+
+// Alarm search on a bus, limited to the given slots of the bank: the slots whose sensor answered the
+// search and whose scratchpad, read right after, confirms the alarm (temperature at or above its TH,
+// or at or below its TL). Their raw readings go into raw[]. A sensor showing its power-on value
+// doesn't count, nor does one that fails its CRC. At most BUS_ROMS_MAX hits are taken per search.
+uint8_t searchAlarms(SensorBus& bus, const BankSlots& bank, uint8_t slots, int16_t* raw);
+
+// Render one page of the latest readings into the framebuffer, see renderLcdPage() in the .cpp;
+// the indicator goes into the last column of the first row
+void renderLcdPage(LcdFrameBuffer& fb, const BankSlots* const* banks, uint8_t count, uint8_t page, char indicator);
+
+// Take the latest readings of a bank as a dataset record
+void makeRecord(const BankSlots& bank, uint32_t dsNr, uint64_t timeMs, DatasetRecord& rec);
+
+// Dead-band check of a bank's dataset against the last one published (lastCenti, SLOTS_PER_BANK entries):
+// true if a configured slot moved by more than deadbandCenti or got lost or found, or if heartbeatMs
+// passed since the last publish (sinceMs). A dead-band of 0 publishes every dataset.
+bool publishDue(const DatasetRecord& rec, const int16_t* lastCenti, int16_t deadbandCenti, uint32_t sinceMs,
+                uint32_t heartbeatMs);
+
+// Builds the payloads of dataset records and publishes them
+class DatasetPublisher {
+public:
+  enum Format : uint8_t { JSON = 1, CBOR = 2 };
+
+  DatasetPublisher(MqttSink& mqtt, const char* client, uint8_t formats);
+
+  // Time payload building and publishing in the given phase statistics
+  void setTiming(Clock& clock, PhaseStats& build, PhaseStats& pub);
+
+  // Publish one record in all formats, names are the friendly names of the record's bank.
+  // False if any of the publishes failed.
+  bool publish(const char* jsonTopic, const char* cborTopic, const char (*names)[SENSOR_NAME_MAX + 1],
+               const DatasetRecord& rec);
+
+private:
+  MqttSink& _mqtt;
+  const char* _client;
+  uint8_t _formats;
+  Clock* _clock;
+  PhaseStats* _build;
+  PhaseStats* _pub;
+};
+
+#endif // TMC_CORE_H
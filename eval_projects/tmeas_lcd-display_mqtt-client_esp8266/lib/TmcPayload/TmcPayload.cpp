@@ -0,0 +1,169 @@
+#include "TmcPayload.h"
+
+int16_t rawToCenti(int16_t raw) {
+  // centi = raw * 100 / 16 = raw * 25 / 4, rounded half to even
+  int32_t n = (int32_t)raw * 25;
+  bool neg = n < 0;
+  if (neg) n = -n;
+  int32_t q = n / 4;
+  int32_t r = n % 4;
+  if (r > 2 || (r == 2 && (q & 1))) q++;
+  return (int16_t)(neg ? -q : q);
+}
+
+JsonWriter::JsonWriter(char* buf, size_t size) : _buf(buf), _size(size), _len(0), _overflow(size == 0) {
+  if (size) _buf[0] = '\0';
+}
+
+void JsonWriter::put(char c) {
+  if (_len + 1 >= _size) {
+    _overflow = true;
+    return;
+  }
+  _buf[_len++] = c;
+  _buf[_len] = '\0';
+}
+
+void JsonWriter::raw(const char* text) {
+  while (*text) put(*text++);
+}
+
+void JsonWriter::str(const char* text) {
+  put('"');
+  raw(text);
+  put('"');
+}
+
+void JsonWriter::u32(uint32_t value) {
+  char digits[10];
+  uint8_t n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  while (n) put(digits[--n]);
+}
+
+// 64-bit division is expensive on the ESP8266: only the digits above the lower 9 need it
+void JsonWriter::u64(uint64_t value) {
+  if (value <= 0xFFFFFFFFULL) {
+    u32((uint32_t)value);
+    return;
+  }
+  u64(value / 1000000000ULL);
+  uint32_t low = (uint32_t)(value % 1000000000ULL);
+  for (uint32_t div = 100000000; div; div /= 10) put('0' + (low / div) % 10);
+}
+
+void JsonWriter::i32(int32_t value) {
+  if (value < 0) {
+    put('-');
+    u32((uint32_t)0 - (uint32_t)value);
+  } else {
+    u32((uint32_t)value);
+  }
+}
+
+void JsonWriter::centi(int32_t value) {
+  uint32_t mag = value < 0 ? (uint32_t)0 - (uint32_t)value : (uint32_t)value;
+  if (value < 0) put('-');
+  u32(mag / 100);
+  put('.');
+  put('0' + (mag / 10) % 10);
+  put('0' + mag % 10);
+}
+
+size_t buildPayloadJson(char* buf, size_t size, const char* client, uint8_t sbNr, uint32_t dsNr,
+                        uint64_t timeMs, const PayloadEntry* entries, uint8_t count) {
+  JsonWriter w(buf, size);
+  w.raw("{\"client\":"); w.str(client);
+  w.raw(",\"sb_nr\":"); w.u32(sbNr);
+  w.raw(",\"ds_nr\":"); w.u32(dsNr);
+  if (timeMs) { w.raw(",\"time_ms\":"); w.u64(timeMs); }
+  w.raw(",\"ts_dat\":{");
+  for (uint8_t i = 0; i < count; i++) {
+    if (i) w.raw(",");
+    w.raw("\"");
+    if (entries[i].name && entries[i].name[0]) {
+      w.raw(entries[i].name);
+    } else {
+      w.raw("slot"); w.u32(entries[i].slot);
+    }
+    w.raw("\":");
+    w.centi(entries[i].centi);
+  }
+  w.raw("}}");
+  return w.ok() ? w.length() : 0;
+}
+
+CborWriter::CborWriter(uint8_t* buf, size_t size) : _buf(buf), _size(size), _len(0), _overflow(false) {}
+
+void CborWriter::put(uint8_t b) {
+  if (_len >= _size) {
+    _overflow = true;
+    return;
+  }
+  _buf[_len++] = b;
+}
+
+// Initial byte of a data item: major type in the upper 3 bits, the value in the lower 5 bits
+// if below 24, otherwise in the following 1, 2, 4 or 8 bytes (big endian)
+void CborWriter::head(uint8_t major, uint64_t value) {
+  major <<= 5;
+  if (value < 24) {
+    put(major | value);
+  } else if (value <= 0xFF) {
+    put(major | 24);
+    put(value);
+  } else if (value <= 0xFFFF) {
+    put(major | 25);
+    put(value >> 8);
+    put(value);
+  } else if (value <= 0xFFFFFFFFULL) {
+    put(major | 26);
+    put(value >> 24);
+    put(value >> 16);
+    put(value >> 8);
+    put(value);
+  } else {
+    put(major | 27);
+    for (int8_t shift = 56; shift >= 0; shift -= 8) put(value >> shift);
+  }
+}
+
+void CborWriter::map(uint32_t pairs) { head(5, pairs); }
+
+void CborWriter::array(uint32_t items) { head(4, items); }
+
+void CborWriter::u32(uint32_t value) { head(0, value); }
+
+void CborWriter::u64(uint64_t value) { head(0, value); }
+
+void CborWriter::i32(int32_t value) {
+  // negative integers are encoded as major type 1 with the value -1 - n
+  if (value < 0) head(1, (uint32_t)(-1 - value));
+  else head(0, (uint32_t)value);
+}
+
+void CborWriter::text(const char* text) {
+  uint32_t n = 0;
+  while (text[n]) n++;
+  head(3, n);
+  for (uint32_t i = 0; i < n; i++) put(text[i]);
+}
+
+size_t buildPayloadCbor(uint8_t* buf, size_t size, const char* client, uint8_t sbNr, uint32_t dsNr,
+                        uint64_t timeMs, const PayloadEntry* entries, uint8_t count) {
+  CborWriter w(buf, size);
+  w.map(timeMs ? 5 : 4);
+  w.u32(0); w.text(client);
+  w.u32(1); w.u32(sbNr);
+  w.u32(2); w.u32(dsNr);
+  if (timeMs) { w.u32(4); w.u64(timeMs); }
+  w.u32(3); w.map(count);
+  for (uint8_t i = 0; i < count; i++) {
+    w.u32(entries[i].slot);
+    w.i32(entries[i].centi);
+  }
+  return w.ok() ? w.length() : 0;
+}
@@ -0,0 +1,131 @@
+/*
+  TmcPayload - heap free serialization of the tmc measurement payloads
+
+  The payload is written into a caller provided buffer whose worst case size is known at
+  compile time (see PAYLOAD_JSON_MAX), no String objects or other dynamic allocations are used.
+  Temperatures are handled as signed centi-degrees (2345 = 23.45 degree C) and formatted
+  with integer arithmetic only.
+
+  The JSON layout follows payload spec v1.6 (doc/requirements/payload_json.txt):
+    {"client":"tmc0","sb_nr":0,"ds_nr":0,"time_ms":1760612345678,"ts_dat":{"Indoor0":20.00,"Outdoor":22.20}}
+  time_ms is the sample time in epoch ms (UTC), omitted while the client's clock is not set.
+
+  The compact binary alternative is CBOR (RFC 8949), see doc/requirements/payload_cbor.txt:
+    {0: "tmc0", 1: 0, 2: 0, 4: 1760612345678, 3: {0: 2000, 2: 2220}}
+  with integer keys and ts_dat keyed by slot index, values in centi-degrees.
+*/
+
+#ifndef TMC_PAYLOAD_H
+#define TMC_PAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Version of the JSON payload spec implemented, reported by the "status" command
+constexpr const char* PAYLOAD_JSON_VERSION = "1.6";
+
+// Limits given by the payload spec
+constexpr size_t CLIENT_NAME_MAX = 8;       // max. length of the client name, e.g. "tmc0"
+constexpr size_t SENSOR_NAME_MAX = 8;       // max. length of a friendly sensor name
+constexpr size_t SLOTS_PER_BANK = 8;        // max. number of sensors in one sensor bank
+
+// Value published for a configured sensor that did not deliver data: -327.68 in the JSON payloads,
+// -32768 in the CBOR payload. It lies below the sensor range (-55.00) minus the largest calibration
+// offset (5.00), so no reading can produce it.
+constexpr int16_t TEMP_INVALID_CENTI = INT16_MIN;
+
+// Worst case length of one JSON payload (without terminating '\0'): longest client name,
+// 3-digit sb_nr, 10-digit ds_nr, 13-digit time_ms and 8 sensors with 8 character names and values like "-327.68" (no data)
+constexpr size_t PAYLOAD_JSON_MAX =
+    (sizeof("{\"client\":\"") - 1) + CLIENT_NAME_MAX +
+    (sizeof("\",\"sb_nr\":") - 1) + 3 +
+    (sizeof(",\"ds_nr\":") - 1) + 10 +
+    (sizeof(",\"time_ms\":") - 1) + 13 +
+    (sizeof(",\"ts_dat\":{") - 1) +
+    SLOTS_PER_BANK * ((sizeof(",\"\":") - 1) + SENSOR_NAME_MAX + 7) - 1 +
+    (sizeof("}}") - 1);
+
+// Worst case length of one CBOR payload: map header, client name (text header + name),
+// sb_nr (1 byte argument), ds_nr (4 byte argument), time_ms (8 byte argument), and the ts_dat map with
+// 8 entries of slot index (1 byte) and int16 value (2 byte argument)
+constexpr size_t PAYLOAD_CBOR_MAX =
+    1 +
+    1 + 1 + CLIENT_NAME_MAX +
+    1 + 2 +
+    1 + 5 +
+    1 + 9 +
+    1 + 1 + SLOTS_PER_BANK * (1 + 3);
+
+// One sensor of a sensor bank as it appears in the payload
+struct PayloadEntry {
+  const char* name;       // friendly name; an empty name is published as "slot<slot>"
+  uint8_t slot;           // slot index within the sensor bank
+  int16_t centi;          // temperature in centi-degrees, TEMP_INVALID_CENTI if not available
+};
+
+// Convert a raw DS18B20 reading (1/16 degree C) into centi-degrees.
+// Ties are rounded to even, which gives the same digits as the printf based String(value, 2).
+int16_t rawToCenti(int16_t raw);
+
+// Minimal JSON text writer on a fixed buffer. Callers take care of commas and nesting.
+// If the buffer is too small the output is truncated (but always terminated) and ok() returns false.
+class JsonWriter {
+public:
+  JsonWriter(char* buf, size_t size);
+
+  void raw(const char* text);             // append text as is
+  void str(const char* text);             // append text enclosed in double quotes
+  void u32(uint32_t value);               // append unsigned decimal number
+  void u64(uint64_t value);               // append unsigned decimal number
+  void i32(int32_t value);                // append signed decimal number
+  void centi(int32_t value);              // append centi-value as fixed point number with 2 decimals
+
+  size_t length() const { return _len; }
+  bool ok() const { return !_overflow; }
+
+private:
+  void put(char c);
+
+  char* _buf;
+  size_t _size;
+  size_t _len;
+  bool _overflow;
+};
+
+// Minimal CBOR writer on a fixed buffer, supporting the item types used by the payloads.
+// If the buffer is too small the output is truncated and ok() returns false.
+class CborWriter {
+public:
+  CborWriter(uint8_t* buf, size_t size);
+
+  void map(uint32_t pairs);               // start a map of the given number of key/value pairs
+  void array(uint32_t items);             // start an array of the given number of items
+  void u32(uint32_t value);               // unsigned integer
+  void u64(uint64_t value);               // unsigned integer, 8 byte argument above 32 bit
+  void i32(int32_t value);                // signed integer
+  void text(const char* text);            // UTF-8 text string
+
+  size_t length() const { return _len; }
+  bool ok() const { return !_overflow; }
+
+private:
+  void head(uint8_t major, uint64_t value);
+  void put(uint8_t b);
+
+  uint8_t* _buf;
+  size_t _size;
+  size_t _len;
+  bool _overflow;
+};
+
+// Serialize one sensor bank dataset (payload spec v1.5) into buf, timeMs 0 = sample time unknown.
+// Returns the payload length, or 0 if buf is too small.
+size_t buildPayloadJson(char* buf, size_t size, const char* client, uint8_t sbNr, uint32_t dsNr,
+                        uint64_t timeMs, const PayloadEntry* entries, uint8_t count);
+
+// Serialize one sensor bank dataset as CBOR into buf, timeMs 0 = sample time unknown.
+// Returns the payload length, or 0 if buf is too small.
+size_t buildPayloadCbor(uint8_t* buf, size_t size, const char* client, uint8_t sbNr, uint32_t dsNr,
+                        uint64_t timeMs, const PayloadEntry* entries, uint8_t count);
+
+#endif // TMC_PAYLOAD_H
@@ -0,0 +1,74 @@
+#include "WindowAgg.h"
+
+#include <string.h>
+
+WindowAgg::WindowAgg(uint32_t windowMs) : _windowMs(windowMs ? windowMs : 1) {
+  start(0, false);
+}
+
+void WindowAgg::start(uint64_t index, bool epoch) {
+  _index = index;
+  _epoch = epoch;
+  _samples = 0;
+  _slotMask = 0;
+  memset(_sum, 0, sizeof(_sum));
+  memset(_count, 0, sizeof(_count));
+}
+
+bool WindowAgg::ends(uint64_t t, bool epoch) const {
+  return _samples && (epoch != _epoch || t / _windowMs != _index);
+}
+
+void WindowAgg::add(const DatasetRecord& rec, uint64_t t, bool epoch) {
+  if (!_samples || ends(t, epoch)) start(t / _windowMs, epoch);
+  _samples++;
+  _slotMask |= rec.slotMask;
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+    if (!(rec.slotMask & (1 << i)) || rec.centi[i] == TEMP_INVALID_CENTI) continue;
+    int16_t v = rec.centi[i];
+    if (!_count[i] || v < _min[i]) _min[i] = v;
+    if (!_count[i] || v > _max[i]) _max[i] = v;
+    _sum[i] += v;
+    _count[i]++;
+  }
+}
+
+// Rounded to the nearest centi-degree, halves away from zero
+int16_t WindowAgg::mean(uint8_t slot) const {
+  int64_t n = _count[slot];
+  if (!n) return TEMP_INVALID_CENTI;
+  int64_t sum = _sum[slot];
+  return (int16_t)(sum >= 0 ? (sum + n / 2) / n : -((-sum + n / 2) / n));
+}
+
+// Unconfigured slots are omitted, a blank name is published as "slot<N>" (as in the datasets)
+size_t buildAggJson(char* buf, size_t size, const char* client, uint8_t sbNr, uint32_t aggNr, const WindowAgg& agg,
+                    const char (*names)[SENSOR_NAME_MAX + 1]) {
+  JsonWriter w(buf, size);
+  w.raw("{\"client\":"); w.str(client);
+  w.raw(",\"sb_nr\":"); w.u32(sbNr);
+  w.raw(",\"agg_nr\":"); w.u32(aggNr);
+  if (agg.startMs()) { w.raw(",\"time_ms\":"); w.u64(agg.startMs()); }
+  w.raw(",\"window_s\":"); w.u32(agg.windowMs() / 1000);
+  w.raw(",\"ts_agg\":{");
+  bool first = true;
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+    if (!(agg.slotMask() & (1 << i))) continue;
+    if (!first) w.raw(",");
+    first = false;
+    w.raw("\"");
+    if (names[i][0]) {
+      w.raw(names[i]);
+    } else {
+      w.raw("slot"); w.u32(i);
+    }
+    w.raw("\":[");
+    w.centi(agg.min(i));
+    w.raw(","); w.centi(agg.max(i));
+    w.raw(","); w.centi(agg.mean(i));
+    w.raw(","); w.u32(agg.count(i));
+    w.raw("]");
+  }
+  w.raw("}}");
+  return w.ok() ? w.length() : 0;
+}
@@ -0,0 +1,77 @@
+/*
+  WindowAgg - windowed aggregates of the readings of one sensor bank
+
+  Long-term storage doesn't need every sample. Per configured slot the minimum, maximum and mean
+  of the valid values and their count are kept over a window (e.g. 1 or 15 minutes) and
+  published once per window on <client>/sbN/agg, independent of the dead-band, see
+  doc/requirements/payload_agg_json.txt:
+    {"client":"tmc0","sb_nr":0,"agg_nr":12,"time_ms":1760612340000,"window_s":60,
+     "ts_agg":{"Indoor0":[20.01,20.45,20.22,15],"Outdoor":[-327.68,-327.68,-327.68,0]}}
+
+  The windows are aligned to multiples of their length on the sample time: on epoch ms once the
+  client has the time, so the windows of all clients line up (12:00, 12:15, ...), on millis()
+  before. A window ends with the first sample of a later window, or when the time base changes.
+  Values kept in centi-degrees, struct of arrays: 16 bytes per slot. The sum is 64 bit, a day of
+  200 ms samples at 125 degree C (432000 * 12500) doesn't fit into 32 bits.
+*/
+
+#ifndef WINDOW_AGG_H
+#define WINDOW_AGG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <TmcPayload.h>
+#include <DatasetBuffer.h>
+
+class WindowAgg {
+public:
+  explicit WindowAgg(uint32_t windowMs);
+
+  // Does a sample taken at t (epoch ms if epoch, else millis()) end the current window?
+  bool ends(uint64_t t, bool epoch) const;
+  // Add the values of a dataset record, a sample outside the current window starts a new one
+  void add(const DatasetRecord& rec, uint64_t t, bool epoch);
+
+  bool empty() const { return _samples == 0; }
+  uint32_t windowMs() const { return _windowMs; }
+  uint64_t startMs() const { return _epoch ? _index * _windowMs : 0; }   // epoch ms, 0 = unknown
+  uint8_t slotMask() const { return _slotMask; }                         // slots configured in the window
+  uint32_t count(uint8_t slot) const { return _count[slot]; }            // valid values of a slot
+  int16_t min(uint8_t slot) const { return _count[slot] ? _min[slot] : TEMP_INVALID_CENTI; }
+  int16_t max(uint8_t slot) const { return _count[slot] ? _max[slot] : TEMP_INVALID_CENTI; }
+  int16_t mean(uint8_t slot) const;
+
+private:
+  void start(uint64_t index, bool epoch);
+
+  uint32_t _windowMs;
+  uint64_t _index;                      // window number: sample time / window length
+  bool _epoch;                          // time base of _index
+  uint32_t _samples;                    // datasets added to the window
+  uint8_t _slotMask;
+  int16_t _min[SLOTS_PER_BANK];
+  int16_t _max[SLOTS_PER_BANK];
+  int64_t _sum[SLOTS_PER_BANK];
+  uint32_t _count[SLOTS_PER_BANK];
+};
+
+// Worst case length of one aggregate payload: longest client name, 3-digit sb_nr, 10-digit agg_nr,
+// 13-digit time_ms, 5-digit window_s and 8 sensors with 8 character names, values like "-60.00" and
+// a 10-digit count (a sensor without valid values reports "-327.68" with a count of 0, which is shorter)
+constexpr size_t PAYLOAD_AGG_JSON_MAX =
+    (sizeof("{\"client\":\"") - 1) + CLIENT_NAME_MAX +
+    (sizeof("\",\"sb_nr\":") - 1) + 3 +
+    (sizeof(",\"agg_nr\":") - 1) + 10 +
+    (sizeof(",\"time_ms\":") - 1) + 13 +
+    (sizeof(",\"window_s\":") - 1) + 5 +
+    (sizeof(",\"ts_agg\":{") - 1) +
+    SLOTS_PER_BANK * ((sizeof(",\"\":[,,,]") - 1) + SENSOR_NAME_MAX + 3 * 6 + 10) - 1 +
+    (sizeof("}}") - 1);
+
+// Serialize the aggregates of a window into buf, names are the friendly names of the bank's slots.
+// Returns the payload length, or 0 if buf is too small.
+size_t buildAggJson(char* buf, size_t size, const char* client, uint8_t sbNr, uint32_t aggNr, const WindowAgg& agg,
+                    const char (*names)[SENSOR_NAME_MAX + 1]);
+
+#endif // WINDOW_AGG_H
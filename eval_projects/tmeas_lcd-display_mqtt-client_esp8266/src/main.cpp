@@ -6,7 +6,7 @@
   Hardware:
   - ESP3266 microcontroller board (NodeMCU)
   - 20x4 LCD-Matrix display with I2C interface
-  - DS18B20, one wire temperature sensor
+  - DS18B20, one wire temperature sensor, up to 8 sensors on each of the 2 OneWire buses (sensor banks sb0, sb1)
 
   Firmware:
   - coded in C/C++ using the Arduino/Platformio framework and the following libraries:
@@ -14,23 +14,52 @@
     - OneWire by Paul Stoffregen (for one-wire communication)
     - DallasTemperature by Miles Burton (for DS18B20 sensor control)
     - ESP8266WiFi and PubSubClient (for WiFi and MQTT communication)
+  - the hardware independent parts (slot table, sensor reading, LCD pages, datasets) are in
+    lib/TmcCore, reached through small interfaces also implemented on the host ([env:native])
 
   - Firmware flow:
     - initialize firmware
     - based on the state of an identification-mode jumper, enter
-      - identification mode: runs until reset, allows to identify the ROM codes of connected sensors and copy them into the knownSensors[] array for later use in normal operation mode
+      - identification mode: runs until reset, allows to identify the ROM codes of connected sensors and copy them into the sensor table (include/sensor_defs.h) for later use in normal operation mode
         or
-      - normal operation mode: in an endless loop do the following:
-        - start a temperature measurement
+      - normal operation mode: loop() ticks a cooperative scheduler (lib/CoopScheduler), the following runs as its tasks:
+        - start a temperature measurement (asynchronously, every SAMPLE_PERIOD_MS)
         - display the result on the LCD-Matrix display
+        - publish the result via MQTT, and min/max/mean per AGG_WINDOW_S on <client>/sbN/agg
+        - between the measurements, search the buses for sensors beyond their alarm thresholds
+          (DS18B20 TL/TH) and publish an alert on <client>/sbN/alert
+        Note: no task blocks on the measurement, see the measurement engine and the tasks below
+        - keep WiFi and broker connection up (ConnManager), buffer datasets while offline
+        - execute commands received on <client>/cmd, reply on <client>/rsp
+        - publish timing statistics of the cycle phases on <client>/stats
+        - publish heap and stack diagnostics with low-water marks on <client>/diag
+        - keep the time synchronized by NTP, every dataset carries its sample time
+    - deep-sleep batch mode (build flag SLEEP_BATCH): one measurement per boot, deep sleep in between,
+      the accumulated samples are published every SLEEP_BATCH samples in one WiFi connection
 */
 
 #include <Arduino.h>
 #include <LiquidCrystal_I2C.h>       // make sure to include the LCD I2C library from Frank de Brabander (others may not work)
 #include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
 #include <PubSubClient.h>
 #include <OneWire.h>
 #include <DallasTemperature.h>
+#include <TmcPayload.h>
+#include <DatasetBuffer.h>
+#include <LittleFsSpill.h>
+#include <ConnManager.h>
+#include <LcdFrameBuffer.h>
+#include <TmcCommand.h>
+#include <SensorTable.h>
+#include <CycleStats.h>
+#include <RtcBatch.h>
+#include <TimeSync.h>
+#include <TmcCore.h>
+#include <CoopScheduler.h>
+#include <WindowAgg.h>
+#include <SensorAlarm.h>
+#include <LittleFS.h>
 
 // Credentials and sensitive data handling:
 //   copy secrets_template.h to secrets.h and fill in your WiFi and MQTT credentials  -or-
@@ -48,13 +77,17 @@
 // Use an INPUT_PULLUP so the normal state is HIGH when jumper is open.
 #define ID_PIN D2 // GPIO4 - safe to use, non-boot pin
 
-typedef float TemparatureValue[8];
-TemparatureValue TempValue;
-
 LiquidCrystal_I2C lcd(0x27, 16, 4);  // set the LCD address to 0x27 for the 16 chars and 4 line display
 
-// oneWire instance pin (not limited to Maxim/Dallas temperature ICs)
-OneWire oneWire(D1);
+// In normal operation mode the LCD content is rendered into this shadow framebuffer,
+// only changed characters are sent to the LCD (see LcdFrameBuffer.h)
+LcdFrameBuffer fb;
+
+// oneWire instances, one bus per sensor bank (not limited to Maxim/Dallas temperature ICs)
+#define ONEWIRE_PIN_SB0 D1 // GPIO5
+#define ONEWIRE_PIN_SB1 D7 // GPIO13 - safe to use, non-boot pin
+OneWire oneWire0(ONEWIRE_PIN_SB0);
+OneWire oneWire1(ONEWIRE_PIN_SB1);
 
 // ------------------------------------------------------------------
 // build-time configuration ------------------------------------------------
@@ -79,59 +112,305 @@ OneWire oneWire(D1);
 // ------------------------------------------------------------------
 // Configuration constants for MQTT and sensor bank handling
 #define CLIENT_NAME "tmc0"      // client identifier used in topics and broker connection
-#define SB_NUMBER 0              // current sensor bank (0 = first bank)
+#define FW_VERSION "2026-03-08"  // firmware version, shown on the splash screen and published with the diagnostics
+#define SB_COUNT 2               // number of sensor banks (one OneWire bus each)
 
-// dataset counter increments with each published payload
-static unsigned long dataset_nr = 0;
+#define SB0_TOPIC CLIENT_NAME "/sb0"     // topic the datasets of sensor bank 0 are published on
+#define SB1_TOPIC CLIENT_NAME "/sb1"     // topic the datasets of sensor bank 1 are published on
+
+// Payload encoding, selected at build time (-DPAYLOAD_CBOR=n):
+//   0: JSON only (payload spec v1.3)
+//   1: JSON, plus the same dataset as CBOR on the parallel topic <bank topic>/cbor
+//   2: CBOR only
+// With CBOR the slot names are published retained on <bank topic>/names, so that
+// receivers can map the slot indices of the binary payload to the friendly names.
+#ifndef PAYLOAD_CBOR
+#define PAYLOAD_CBOR 0
+#endif
+#define CBOR_SUBTOPIC "/cbor"
+#define NAMES_SUBTOPIC "/names"
+
+// topic and payload have to fit into the PubSubClient buffer (topic, payload plus 5 bytes MQTT header)
+static_assert(sizeof(SB0_TOPIC) - 1 + PAYLOAD_JSON_MAX + MQTT_MAX_HEADER_SIZE + 2 <= MQTT_MAX_PACKET_SIZE, "payload exceeds the MQTT packet size");
+static_assert(sizeof(CLIENT_NAME) - 1 <= CLIENT_NAME_MAX, "CLIENT_NAME too long");
+
+// Dead-band publishing: a bank's dataset is only published if a sensor moved by more than
+// publishDeadband centi-degrees (or got lost/found) since the last published dataset, or if
+// PUBLISH_HEARTBEAT_MS passed without publishing. A dead-band of 0 publishes every cycle.
+// The ds_nr of a bank increments with each dataset actually published, so suppressed datasets
+// leave no gap in ds_nr and every gap seen by a receiver is a lost dataset.
+#ifndef PUBLISH_DEADBAND_CENTI
+#define PUBLISH_DEADBAND_CENTI 0        // e.g. -DPUBLISH_DEADBAND_CENTI=10 for 0.10 degree C
+#endif
+#ifndef PUBLISH_HEARTBEAT_MS
+#define PUBLISH_HEARTBEAT_MS 60000UL    // max. time between two published datasets of a bank
+#endif
+static int16_t publishDeadband = PUBLISH_DEADBAND_CENTI;
+
+// Windowed aggregates: min, max, mean and count of every configured slot over AGG_WINDOW_S seconds,
+// published once per window on <bank topic>/agg (see WindowAgg.h and doc/requirements/payload_agg_json.txt).
+// They take all samples, also the ones the dead-band suppresses, so a recorder only interested in the
+// long-term course can subscribe to them instead of the datasets. Windows are aligned to the clock
+// (12:00, 12:15, ...) once the client has the time. A window ending while the broker is not reachable
+// is dropped, its agg_nr is left as a gap. 0 turns the aggregates off.
+#ifndef AGG_WINDOW_S
+#define AGG_WINDOW_S 60                 // e.g. -DAGG_WINDOW_S=900 for 15 minutes
+#endif
+#define AGG_SUBTOPIC "/agg"
+static_assert(AGG_WINDOW_S <= 86400UL, "AGG_WINDOW_S: at most a day");
+
+WindowAgg aggs[SB_COUNT] = { WindowAgg(AGG_WINDOW_S * 1000UL), WindowAgg(AGG_WINDOW_S * 1000UL) };
+
+// Hardware alarms (see SensorAlarm.h): the alarm thresholds of the slots (TL/TH in the sensor table, whole
+// degrees C) are programmed into their sensors. Between the measurement cycles only the slots with
+// thresholds convert (CONVERT T by MATCH ROM, the other sensors stay idle), then one alarm search per bus
+// asks for the tripped sensors; the conversion of every cycle is searched as well. A trip is published at
+// once on <bank topic>/alert, so the alert latency is about the conversion time of the alarm slots: give
+// them 10 or 11 bit (190/375 ms) for alerts within a few hundred ms. A round starts at most every
+// ALARM_ROUND_MS and only if it ends before the next sample point. The alarm sensors convert most of the
+// time and warm up a little by it (self-heating), the others don't. Other sensors on the bus get TL/TH
+// at the ends of the DS18B20 range, so they don't answer the alarm search.
+// Not available in the deep-sleep batch mode.
+#ifndef ALARM_ROUND_MS
+#define ALARM_ROUND_MS 250UL            // shortest time between the starts of two alarm rounds
+#endif
+#define ALARM_CLEAR_ROUNDS 3            // searches in a row without a tripped slot until it clears
+#define ALARM_GUARD_MS 20UL             // an alarm round ends at least this long before the next sample point
+#define ALARM_SUBTOPIC "/alert"
 
-// Pass our oneWire reference to Dallas Temperature.
-DallasTemperature sensors(&oneWire);
+// Pass our oneWire references to Dallas Temperature, one instance per bus
+DallasTemperature sensors0(&oneWire0);
+DallasTemperature sensors1(&oneWire1);
+
+// Sensor bus of the core (TmcCore.h) on top of DallasTemperature and OneWire
+class DallasBus : public SensorBus {
+public:
+  DallasBus(OneWire &wire, DallasTemperature &sensors) : _wire(wire), _sensors(sensors) {}
+  void requestConversions() override { _sensors.requestTemperatures(); }
+  bool readScratchPad(const uint8_t *rom, uint8_t *scratchPad) override { return _sensors.readScratchPad(rom, scratchPad); }
+  void resetSearch() override { _wire.reset_search(); }
+  bool search(uint8_t *rom) override { return _wire.search(rom); }
+  // CONVERT T by MATCH ROM: requestTemperaturesByAddress() of the library reads the scratchpad
+  // first (for the resolution), which would triple the bus time of an alarm round
+  bool requestConversion(const uint8_t *rom) override {
+    if (!_wire.reset()) return false;
+    _wire.select(rom);
+    _wire.write(0x44, _sensors.isParasitePowerMode());
+    return true;
+  }
+  void resetAlarmSearch() override { _sensors.resetAlarmSearch(); }
+  bool alarmSearch(uint8_t *rom) override { return _sensors.alarmSearch(rom); }
+  // setLowAlarmTemp()/setHighAlarmTemp() of the library write the scratchpad and copy it to the
+  // EEPROM on every call, so TH/TL are compared first and written together, only if they differ
+  bool setAlarm(const uint8_t *rom, int8_t low, int8_t high) override {
+    uint8_t sp[SCRATCHPAD_SIZE];
+    int16_t raw;
+    if (!_sensors.readScratchPad(rom, sp) || decodeScratchPad(sp, raw) != SENSOR_OK) return false;
+    if ((int8_t)sp[2] == high && (int8_t)sp[3] == low) return true;
+    sp[2] = (uint8_t)high;
+    sp[3] = (uint8_t)low;
+    _sensors.writeScratchPad(rom, sp);       // TH, TL and configuration, then COPY SCRATCHPAD
+    return true;
+  }
+
+private:
+  OneWire &_wire;
+  DallasTemperature &_sensors;
+};
+
+DallasBus bus0(oneWire0, sensors0);
+DallasBus bus1(oneWire1, sensors1);
 
 WiFiClient espClient;
 PubSubClient client(espClient);
 long lastMsg = 0;
 IPAddress mqtt_ip;
 
+// Connection handling, see ConnManager.h: WiFi join timeout and the backoff range between attempts
+#define WIFI_CONNECT_TIMEOUT_MS 10000UL
+#define CONN_MIN_BACKOFF_MS 500UL
+#define CONN_MAX_BACKOFF_MS 60000UL
+#define MQTT_CONNECT_TIMEOUT_MS 1500     // bounds the time a single broker connection attempt may block
+
+// Fast connect: BSSID, channel and IP configuration of the last connection are kept in WIFI_FAST_PATH
+// on LittleFS (in the RTC memory in deep-sleep batch mode), the next join uses them and skips the scan
+// for the access point and DHCP. A fast join failing within WIFI_FAST_TIMEOUT_MS falls back to both.
+#define WIFI_FAST_PATH "/wifi.bin"
+#define WIFI_FAST_TIMEOUT_MS 3000UL
+
+// Connection status is published retained on this topic, the broker publishes "offline" as last will
+#define STATUS_TOPIC CLIENT_NAME "/status"
+#define STATUS_OFFLINE "{\"client\":\"" CLIENT_NAME "\",\"conn\":\"offline\"}"
+
+// Command and response topics of controlling entities, see doc/requirements/command_response.txt
+#define CMD_TOPIC CLIENT_NAME "/cmd"
+#define RSP_TOPIC CLIENT_NAME "/rsp"
+
+// Timing statistics of the measurement cycle, see doc/requirements/stats_json.txt
+#define STATS_TOPIC CLIENT_NAME "/stats"
+
+// Heap and stack diagnostics, see doc/requirements/diag_json.txt
+#define DIAG_TOPIC CLIENT_NAME "/diag"
+
+// NTP time synchronization: the sample time of every dataset is taken from it ("time_ms" of
+// the payload), so the receivers don't depend on the arrival time. Until the first
+// synchronization the datasets carry no time.
+#ifndef NTP_SERVER
+#define NTP_SERVER "pool.ntp.org"
+#endif
+#define NTP_LOCAL_PORT 2390
+#define NTP_DNS_TIMEOUT_MS 1000         // bounds the time a name lookup of the server may block
+#define NTP_SYNC_INTERVAL_MS 3600000UL
+#define NTP_RETRY_MS 30000UL
+#define NTP_TIMEOUT_MS 2000UL
+
 // ------------------------------------------------------------------
-// Configure known/expected sensors by their 8-byte ROM codes (one-wire ID)
-// Replace the 0x00 entries with the actual ROM bytes shown by identificationMode.
-// Example format: {0x28, 0xFF, 0x4C, 0x3C, 0x92, 0x16, 0x03, 0x4F}
-// Fill the corresponding name in `knownNames` so a slot can get consistently referred to by index.
-DeviceAddress knownSensors[] = {
-  {0x28,0xD0,0x08,0x9F,0x00,0x00,0x00,0x9F}, // slot 0 - Indoor Sensor 0  (Sensor directly connected)
-  {0x28,0xEC,0x67,0x9F,0x00,0x00,0x00,0x71}, // slot 1 - Indoor Sensor 1  (Sensor on pin header)
-  {0x28,0x2C,0x44,0x6E,0x00,0x00,0x00,0xA6}, // slot 2 - Outdoor Sensor 0 (Sensor with cable)
-  {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}, // slot 3 - replace with ROM for "sensor 3"
-  {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}, // slot 4 - replace with ROM for "sensor 4"
-  {0x28,0xD0,0x08,0x9F,0x00,0x00,0x00,0x9F}, // slot 5 - replace with ROM for "sensor 5"
-  {0x28,0xEC,0x67,0x9F,0x00,0x00,0x00,0x71}, // slot 6 - replace with ROM for "sensor 6"
-  {0x28,0x2C,0x44,0x6E,0x00,0x00,0x00,0xA6}  // slot 7 - replace with ROM for "sensor 7"
-};
+// Store-and-forward buffer: datasets measured while the broker is unreachable are kept in
+// a RAM ring, spilling over into a file on LittleFS, and forwarded in rate limited bursts
+// after the reconnect.
+#define DATASET_RAM_RECORDS 64          // RAM ring capacity (32 bytes per record)
+#define SPILL_MAX_RECORDS 4096          // flash spill capacity (about 130 kB, 195 kB with the records read)
+#define DRAIN_BURST 8                   // datasets forwarded per burst
+#define DRAIN_INTERVAL_MS 250UL         // time between two bursts
+
+static DatasetRecord datasetRam[DATASET_RAM_RECORDS];
+LittleFsSpill datasetSpill("/spill3.bin", "/spill3.pos", SPILL_MAX_RECORDS);   // missing value -32768
+DatasetBuffer datasetBuffer(datasetRam, DATASET_RAM_RECORDS, &datasetSpill);
 
-// Friendly names for the sensors, limited to 8 characters for MQTT protocol efficiency.
-// Note: For the LCD display sensor names get truncated in the display section to 7 characters to fit the display
+// ------------------------------------------------------------------
+// Deep-sleep batch mode for battery powered clients (-DSLEEP_BATCH=n, n > 0)
+//
+// Keeping WiFi up between the samples is what drains a battery. In this mode setup() takes one
+// sample and the client deep-sleeps until the next sample point (GPIO16/D0 wired to RST, so the
+// RTC can wake it). The samples, the ds_nr per bank and the WiFi fast-connect data are kept in
+// the RTC user memory (see RtcBatch.h). Only every n-th wake brings up WiFi, reusing BSSID,
+// channel and IP configuration of the last connection, and publishes the accumulated datasets
+// in one connection; all other wakes run with the radio disabled.
+// Not available in this mode: LCD, commands, dead-band, aggregates, alarms, statistics and the flash spill. The
+// batch itself is the buffer, when it is full the oldest sample is dropped (a gap in ds_nr).
+#ifndef SLEEP_BATCH
+#define SLEEP_BATCH 0
+#endif
+#define SLEEP_WIFI_TIMEOUT_MS 5000UL    // WiFi join of a batch connection, per attempt
+#define SLEEP_MIN_MS 100UL              // shortest deep sleep, if a wake overran the sample period
+#define STATUS_SLEEP "{\"client\":\"" CLIENT_NAME "\",\"conn\":\"sleep\"}"
+
+#if SLEEP_BATCH
+static_assert(SB_COUNT <= RTC_BATCH_BANKS, "ds_nr of all banks have to fit into the RTC batch");
+RtcBatch rtcBatch;
+#endif
+
+// ------------------------------------------------------------------
+// Known/expected sensors: ROM code (one-wire ID), friendly name and resolution per slot, one table per
+// sensor bank. A bank without any configured slot is neither measured nor published.
+//
+// The defaults of a new device come from the compile-time table SENSOR_DEFS in include/sensor_defs.h
+// (bank, slot, ROM code, name, calibration offset, resolution, alarm thresholds), generated from the sb0_tsdat/sb0_sensors
+// sections of the model configuration by mqtt_clients/gen_sensor_defs.py, so model and firmware share
+// one sensor table. The ROM codes are shown by identificationMode.
+// Once a slot got changed by the "sensor" command, the whole table is stored in SENSOR_TABLE_PATH on
+// LittleFS and loaded from there at startup, so swapping a sensor doesn't need a re-flash
+// (see doc/requirements/command_response.txt).
+//
+// Friendly names are limited to 8 characters for MQTT protocol efficiency, a longer name in
+// SENSOR_DEFS is a compile error. For the LCD they get truncated to 7 characters to fit the display.
 //
-// Use fixed-size char arrays so any initializer longer than NAME_MAX triggers a compile-time error.
-constexpr size_t NAME_MAX = 8;
-// Each entry holds up to NAME_MAX characters plus terminating '\0'.
-const char knownNames[][NAME_MAX + 1] = {
-  "ID",             // friendly name for slot 0
-  "ID1",            // friendly name for slot 1
-  "OD",             // friendly name for slot 2
-  "",               // friendly name for slot 3
-  "",               // friendly name for slot 4
-  "Indr_0",         // friendly name for slot 5
-  "Indr_1",         // friendly name for slot 6
-  "Outd_0"          // friendly name for slot 7
+// Resolution in bits (9..12), written to the sensors at startup.
+// Conversion time: 9 bit 94 ms (0.5 degree C), 10 bit 188 ms (0.25), 11 bit 375 ms (0.125), 12 bit 750 ms (0.0625).
+// The payload carries 2 decimals, so 12 bit is only worth its conversion time where 0.0625 degree C matters.
+// The value is stored in the sensor's EEPROM, it is only written if it differs from the current setting.
+//
+// The calibration offset compensates the differences between sensors, it is added to every reading
+// (in centi-degrees, before the LCD, the dead-band and the payloads). It belongs to the sensor: the
+// offsets of the slots are looked up by ROM code in SENSOR_DEFS whenever the table changes.
+//
+// The alarm thresholds (TL/TH, see "Hardware alarms") belong to the slot: a sensor put into the slot by
+// the "sensor" command gets them. Like the resolution they are kept in the sensor's EEPROM and only
+// written if they differ.
+#include "../include/sensor_defs.h"
+static_assert(SENSOR_DEF_COUNT <= SB_COUNT * SLOTS_PER_BANK, "sensor table: more sensors than slots");
+static_assert(sensorDefsInRange(SENSOR_DEFS, SENSOR_DEF_COUNT, SB_COUNT), "sensor table: bank, slot, offset, resolution or alarm out of range");
+static_assert(sensorDefsNamesValid(SENSOR_DEFS, SENSOR_DEF_COUNT), "sensor table: names must not contain spaces");
+static_assert(sensorDefsRomsValid(SENSOR_DEFS, SENSOR_DEF_COUNT), "sensor table: ROM code zero or with wrong CRC");
+static_assert(sensorDefsSlotsUnique(SENSOR_DEFS, SENSOR_DEF_COUNT), "sensor table: slot assigned twice");
+static_assert(sensorDefsRomsUnique(SENSOR_DEFS, SENSOR_DEF_COUNT), "sensor table: ROM code assigned twice");
+
+constexpr size_t NAME_MAX = SENSOR_NAME_MAX;    // given by the payload spec, see TmcPayload.h
+DeviceAddress knownSensors[SB_COUNT][SLOTS_PER_BANK];
+char knownNames[SB_COUNT][SLOTS_PER_BANK][NAME_MAX + 1];
+uint8_t knownResolution[SB_COUNT][SLOTS_PER_BANK];
+int16_t knownOffset[SB_COUNT][SLOTS_PER_BANK];       // calibration offset of the slot's sensor, centi-degrees
+int8_t knownAlarmLow[SB_COUNT][SLOTS_PER_BANK];      // alarm thresholds of the slot (TL/TH), whole degrees C
+int8_t knownAlarmHigh[SB_COUNT][SLOTS_PER_BANK];
+const size_t KNOWN_SENSORS = SLOTS_PER_BANK;
+
+// Sensor table on flash, and the bus population found at boot (cached for the next boot, see SensorTable.h)
+#define SENSOR_TABLE_PATH "/sensors.bin"
+#define ROM_CACHE_PATH "/romcache.bin"
+SensorTable sensorTable(knownSensors[0], knownNames[0], knownResolution[0], SB_COUNT);
+BusPopulation busPopulation[SB_COUNT];
+
+// ------------------------------------------------------------------
+// Filtering of the readings (see SampleFilter.h): every slot keeps its latest FILTER_DEPTH accepted
+// samples, the LCD, the dead-band and the payloads get their median (or trimmed mean, FILTER_MODE).
+// The 85 degree C power-on value of a sensor that lost its supply is rejected, a failed read is
+// bridged by the filter value for FILTER_HOLD cycles. A read failing its CRC is repeated right away,
+// at most READ_RETRIES times per slot and only while the cycle's READ_RETRY_BUDGET_US of bus time
+// lasts, so a disturbed bus doesn't stretch the cycle.
+// The rings take FILTER_DEPTH * 16 bytes per bank. In the deep-sleep batch mode they don't survive
+// the sleep, each wake only gets the rejection and the retries.
+#ifndef FILTER_DEPTH
+#define FILTER_DEPTH 3                  // samples per slot, 1 = no filtering (a median of 3 lags one sample)
+#endif
+#ifndef FILTER_MODE
+#define FILTER_MODE SampleFilter::MEDIAN   // or SampleFilter::TRIMMED_MEAN (with FILTER_DEPTH 4 and up)
+#endif
+#define FILTER_HOLD 1                   // failed reads in a row bridged by the filter value
+#define READ_RETRIES 2                  // re-reads of a slot after a CRC error
+#define READ_RETRY_BUDGET_US 40000UL    // bus time for re-reads per cycle, about 3 scratchpad reads
+static_assert(FILTER_DEPTH >= 1 && FILTER_DEPTH <= SampleFilter::DEPTH_MAX, "FILTER_DEPTH out of range");
+
+static int16_t filterRing[SB_COUNT][FILTER_DEPTH][SLOTS_PER_BANK];
+SampleFilter filters[SB_COUNT] = {
+  SampleFilter(filterRing[0], FILTER_DEPTH, FILTER_MODE, FILTER_HOLD),
+  SampleFilter(filterRing[1], FILTER_DEPTH, FILTER_MODE, FILTER_HOLD)
 };
-static_assert(sizeof(knownNames) / sizeof(knownNames[0]) == 8, "knownNames must contain exactly 8 entries");
-const size_t KNOWN_SENSORS = sizeof(knownSensors) / sizeof(knownSensors[0]);
+
+SensorAlarm alarms[SB_COUNT] = {
+  SensorAlarm(knownAlarmLow[0], knownAlarmHigh[0], ALARM_CLEAR_ROUNDS),
+  SensorAlarm(knownAlarmLow[1], knownAlarmHigh[1], ALARM_CLEAR_ROUNDS)
+};
+
+// Runtime state of one sensor bank: its slots and latest readings (BankSlots, see TmcCore.h),
+// its bus and publishing state
+struct SensorBank : BankSlots {
+  SensorBus &bus;                           // bus access of the core
+  DallasTemperature &sensors;               // DallasTemperature instance of the bank's OneWire bus
+  SampleFilter &filter;                     // sample rings of the bank's slots
+  WindowAgg &agg;                           // aggregates of the current window
+  SensorAlarm &alarm;                       // alarm state of the slots
+  const char *topic;                        // topic the bank's datasets are published on
+  const char *cborTopic;                    // topic of the CBOR encoded datasets
+  const char *namesTopic;                   // topic of the slot names (retained)
+  const char *aggTopic;                     // topic of the windowed aggregates
+  const char *alertTopic;                   // topic of the alarm alerts
+  bool active;                              // at least one slot configured, set in setup()
+  uint32_t dsNr;                            // ds_nr of the next published dataset
+  bool published;                           // a dataset was published since startup
+  unsigned long lastPublishMs;              // time of the last published dataset
+  int16_t lastCenti[SLOTS_PER_BANK];        // values of the last published dataset
+  uint32_t suppressed;                      // datasets suppressed by the dead-band
+  uint32_t aggNr;                           // agg_nr of the next window
+  uint32_t alertNr;                         // alert_nr of the next alert
+};
+
+SensorBank banks[SB_COUNT] = {
+  { { 0, knownSensors[0], knownNames[0], knownResolution[0], knownOffset[0], {}, {} }, bus0, sensors0, filters[0], aggs[0], alarms[0], SB0_TOPIC, SB0_TOPIC CBOR_SUBTOPIC, SB0_TOPIC NAMES_SUBTOPIC, SB0_TOPIC AGG_SUBTOPIC, SB0_TOPIC ALARM_SUBTOPIC, false, 0, false, 0, {}, 0, 0, 0 },
+  { { 1, knownSensors[1], knownNames[1], knownResolution[1], knownOffset[1], {}, {} }, bus1, sensors1, filters[1], aggs[1], alarms[1], SB1_TOPIC, SB1_TOPIC CBOR_SUBTOPIC, SB1_TOPIC NAMES_SUBTOPIC, SB1_TOPIC AGG_SUBTOPIC, SB1_TOPIC ALARM_SUBTOPIC, false, 0, false, 0, {}, 0, 0, 0 }
+};
+const BankSlots *const bankSlots[SB_COUNT] = { &banks[0], &banks[1] };   // the banks as seen by the core
 
 // Helpers
-bool isAddressZero(const DeviceAddress addr) {
-  for (uint8_t i = 0; i < 8; i++) if (addr[i] != 0) return false;
-  return true;
-}
 
 void printAddress(const DeviceAddress deviceAddress) {
   for (uint8_t i = 0; i < 8; i++) {
@@ -149,67 +428,10 @@ void displayAddressLines(const DeviceAddress addr) {
   lcd.setCursor(0, 3); lcd.print(line);
 }
 
-void setup_wifi() {
-  // Connect to a WiFi network
-  delay(10);
-  lcd.clear();
-  Serial.println();
-  lcd.print("Connecting to WiFi");
-  lcd.setCursor(0, 1);
-  Serial.print("Connecting to ");
-  lcd.print(ssid);
-  Serial.println(ssid);
-
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(ssid, password);
-
-  int attempts = 0;
-  lcd.setCursor(0, 2);
-  while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-    delay(500);
-    lcd.print(".");
-    Serial.print(".");
-    attempts++;
-  }
-  delay(2000);    // wait to allow reading before switching display
-
-  if (WiFi.status() == WL_CONNECTED) {
-    lcd.clear();
-    lcd.print("Connected to WiFi");
-    lcd.setCursor(0, 1);
-    lcd.print(ssid);
-    lcd.setCursor(0, 2);
-    lcd.print("IP address: ");
-    lcd.setCursor(0, 3);
-    lcd.print(WiFi.localIP());
-    Serial.println("");
-    Serial.println("WiFi connected");
-    Serial.println("IP address: ");
-    Serial.println(WiFi.localIP());
-  } else {
-
-    lcd.setCursor(0, 2);
-    lcd.print("Failed to connect to");
-    lcd.print("WiFi ");
-    lcd.print(ssid);
-    Serial.println("Failed to connect to WiFi");
-  }
-  delay(3000);    // wait to allow reading before switching display
-
-  // Activate the following code if you want to check the MQTT broker connectivity at this point
-  // Serial.print("Pinging MQTT broker at ");
-  // Serial.println(mqtt_server);
-  // if (WiFi.hostByName(mqtt_server, mqtt_ip)) {
-  //   Serial.print("Broker found at IP: ");
-  //   Serial.println(mqtt_ip);
-  // } else {
-  //   Serial.println("Cannot resolve broker address");
-  // }
-}
+void handleCommand(const byte* payload, unsigned int length);
 
 void callback(char* topic, byte* payload, unsigned int length) {
-  // simple message callback: log everything received to the serial monitor
-  // but only when debugging is enabled.
+  // log everything received to the serial monitor, but only when debugging is enabled.
 #if APP_DEBUG
   Serial.print("Msg recv [");
   Serial.print(topic);
@@ -219,49 +441,264 @@ void callback(char* topic, byte* payload, unsigned int length) {
   }
   Serial.println();
 #endif
+  if (strcmp(topic, CMD_TOPIC) == 0) handleCommand(payload, length);
 }
 
-void reconnect() {
-  // Loop until we're connected or reconnected
-  while (!client.connected()) {
-    lcd.clear();
-    lcd.print("Calling MQTT Broker:");
+// Fast-connect data of the last WiFi connection
+WifiFastConnect &wifiFast() {
+#if SLEEP_BATCH
+  return rtcBatch.fastConnect();
+#else
+  static WifiFastConnect fc = {};     // loaded from WIFI_FAST_PATH in setup()
+  return fc;
+#endif
+}
+
+// Take over the data of the current WiFi connection as fast-connect data; true if it changed
+bool rememberWifi() {
+  WifiFastConnect &fc = wifiFast();
+  WifiFastConnect now = {};
+  memcpy(now.bssid, WiFi.BSSID(), sizeof(now.bssid));
+  now.channel = WiFi.channel();
+  now.ip = WiFi.localIP();
+  now.gateway = WiFi.gatewayIP();
+  now.subnet = WiFi.subnetMask();
+  now.dns = WiFi.dnsIP();
+  if (memcmp(&now, &fc, sizeof(now)) == 0) return false;
+  fc = now;
+  return true;
+}
+
+// Network access for the connection manager on top of ESP8266WiFi and PubSubClient
+class Esp8266Link : public ConnLink {
+public:
+  bool wifiBegin(bool fast) override {
+    Serial.print("Connecting to WiFi "); Serial.println(ssid);
+    WiFi.persistent(false);             // nothing to write to flash on every connection
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false);       // reconnects are paced by the connection manager
+    const WifiFastConnect &fc = wifiFast();
+    if (fast && fc.channel) {
+      // fast connect: no scan for the access point, no DHCP
+      WiFi.config(IPAddress(fc.ip), IPAddress(fc.gateway), IPAddress(fc.subnet), IPAddress(fc.dns));
+      WiFi.begin(ssid, password, fc.channel, fc.bssid);
+      return true;
+    }
+    WiFi.disconnect();                  // drops a failed fast join
+    WiFi.config(IPAddress(), IPAddress(), IPAddress());     // back to DHCP
+    WiFi.begin(ssid, password);
+    return false;
+  }
+
+  bool wifiConnected() override {
+    return WiFi.status() == WL_CONNECTED;
+  }
+
+  BrokerResult mqttConnect() override {
     Serial.print("Attempting MQTT connection...");
-    // Attempt to (re)connect using client identifier constant
-    if (client.connect(CLIENT_NAME)) {
-      lcd.setCursor(0, 1);
-      lcd.print("Broker connected.");
+    // Attempt to (re)connect using client identifier constant, the broker announces "offline" if we drop out
+    if (client.connect(CLIENT_NAME, STATUS_TOPIC, 0, true, STATUS_OFFLINE)) {
       Serial.println("connected.");
-      delay(3000);    // wait to allow reading before switching display
-
-      // Once connected, (re)subscribe to the topics we care about.  The broker
-      // will happily accept any subscription, but we only ask for the bank we
-      // actually support so we don't receive messages for nonexistent hardware.
-      String baseTopic = String(CLIENT_NAME) + "/sb" + String(SB_NUMBER);
-      client.subscribe((baseTopic + "/#").c_str());
-    } 
-    else {
-      lcd.setCursor(0, 1);
-      lcd.print("Connection failed");
-      lcd.setCursor(0, 2);
-      int rc = client.state();
-      lcd.print("rc=");
-      lcd.print(rc);
-      Serial.print("failed, rc=");
-      Serial.print(rc);
-      lcd.setCursor(0, 3);
-      lcd.print("Retrying in 5 sec.");
-      Serial.println(" trying again in 5 seconds");
-      delay(5000);      // Wait before retrying
+      return BROKER_CONNECTED;
     }
+    Serial.print("failed, rc=");
+    Serial.println(client.state());
+    // MQTT_CONNECT_FAILED: no TCP connection; a timeout or a CONNACK return code came from the broker
+    return client.state() == MQTT_CONNECT_FAILED ? BROKER_UNREACHABLE : BROKER_REFUSED;
   }
-  client.setCallback(callback);
+
+  bool mqttConnected() override {
+    return client.connected();
+  }
+
+  void onOnline() override;
+};
+
+Esp8266Link netLink;
+ConnManager conn(netLink, ESP.random(), WIFI_CONNECT_TIMEOUT_MS, CONN_MIN_BACKOFF_MS, CONN_MAX_BACKOFF_MS,
+                 WIFI_FAST_TIMEOUT_MS);
+
+// UDP access of the time synchronization on top of WiFiUDP. The server name is looked up for
+// every request, a pool hands out a different server each time.
+class Esp8266Ntp : public NtpTransport {
+public:
+  bool send(const uint8_t *packet, size_t len) override {
+    if (!_open) _open = _udp.begin(NTP_LOCAL_PORT);
+    IPAddress server;
+    if (!_open || !WiFi.hostByName(NTP_SERVER, server, NTP_DNS_TIMEOUT_MS)) return false;
+    return _udp.beginPacket(server, 123) && _udp.write(packet, len) == len && _udp.endPacket();
+  }
+
+  size_t receive(uint8_t *packet, size_t size) override {
+    if (!_open || _udp.parsePacket() <= 0) return 0;
+    int len = _udp.read(packet, size);
+    return len > 0 ? len : 0;
+  }
+
+private:
+  WiFiUDP _udp;
+  bool _open = false;
+};
+
+Esp8266Ntp ntpLink;
+TimeSync timeSync(ntpLink, NTP_SYNC_INTERVAL_MS, NTP_RETRY_MS, NTP_TIMEOUT_MS);
+
+// ------------------------------------------------------------------
+// Memory diagnostics
+//
+// Fragmentation of the heap shows up as publish failures after days of uptime, long before the
+// heap runs out. Free heap, largest free block and fragmentation are therefore tracked with their
+// low-water (fragmentation: high-water) marks since the start, together with the lowest free stack
+// and the failed publishes, and published every DIAG_PERIOD_MS on DIAG_TOPIC (retained).
+// The free heap is sampled on every loop() pass; the largest free block and the fragmentation
+// need a walk over the heap and are sampled once per measurement cycle and before publishing.
+#define DIAG_PERIOD_MS 300000UL
+#define DIAG_JSON_MAX 352
+
+struct HeapDiag {
+  uint32_t heapMin = UINT32_MAX;    // low-water mark of the free heap in bytes
+  uint16_t blockMin = UINT16_MAX;   // low-water mark of the largest free block in bytes
+  uint8_t fragMax = 0;              // high-water mark of the heap fragmentation in %
+  uint32_t pubFail = 0;             // publishes rejected by PubSubClient or the connection
+  uint32_t pubOversize = 0;         // publishes not fitting into the PubSubClient buffer
+};
+
+HeapDiag diag;
+static unsigned long diagLastMs = 0;     // time of the last diagnostics message
+
+// Startup times in ms since the start (0 = not yet): WiFi joined, broker connected and first dataset
+// published; published with the diagnostics. The time the boot ROM and the SDK take before setup()
+// is not included.
+struct BootTimes {
+  uint32_t wifiMs = 0;
+  uint32_t mqttMs = 0;
+  uint32_t pubMs = 0;
+  bool fast = false;                // WiFi joined by fast connect
+};
+
+BootTimes bootTimes;
+
+// Cheap sample of the free heap, on every loop() pass
+void diagSampleHeap() {
+  uint32_t heap = ESP.getFreeHeap();
+  if (heap < diag.heapMin) diag.heapMin = heap;
+}
+
+// Full sample including the largest free block and the fragmentation (walks the heap)
+void diagSample(uint32_t &heap, uint16_t &block, uint8_t &frag) {
+  ESP.getHeapStats(&heap, &block, &frag);
+  if (heap < diag.heapMin) diag.heapMin = heap;
+  if (block < diag.blockMin) diag.blockMin = block;
+  if (frag > diag.fragMax) diag.fragMax = frag;
+}
+
+void diagSample() {
+  uint32_t heap;
+  uint16_t block;
+  uint8_t frag;
+  diagSample(heap, block, frag);
+}
+
+// Publish through the PubSubClient buffer and count the failures for the diagnostics. A message
+// that doesn't fit into the buffer is counted separately, it will fail on every attempt.
+bool publishMsg(const char *topic, const uint8_t *payload, size_t len, bool retained) {
+  if (MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + len > client.getBufferSize()) {
+    diag.pubOversize++;
+    return false;
+  }
+  if (client.publish(topic, payload, len, retained)) return true;
+  diag.pubFail++;
+  return false;
+}
+
+bool publishMsg(const char *topic, const char *msg, bool retained) {
+  return publishMsg(topic, (const uint8_t *)msg, strlen(msg), retained);
+}
+
+// Publishing of the core (TmcCore.h)
+class PubSubSink : public MqttSink {
+public:
+  bool publish(const char *topic, const uint8_t *payload, size_t len, bool retained) override {
+    // debugging output; double-guarded in case macros were misconfigured
+#if APP_DEBUG
+    Serial.print("Publish topic: "); Serial.print(topic);
+    Serial.print(", bytes: "); Serial.println(len);
+    if (len && payload[0] == '{') { Serial.print("Payload: "); Serial.write(payload, len); Serial.println(); }
+#endif
+    return publishMsg(topic, payload, len, retained);
+  }
+};
+
+class ArduinoClock : public Clock {
+public:
+  uint32_t millis() override { return ::millis(); }
+  uint32_t micros() override { return ::micros(); }
+};
+
+PubSubSink mqttSink;
+ArduinoClock sysClock;
+DatasetPublisher datasetPublisher(mqttSink, CLIENT_NAME,
+                                  (PAYLOAD_CBOR != 2 ? DatasetPublisher::JSON : 0) | (PAYLOAD_CBOR ? DatasetPublisher::CBOR : 0));
+
+// Publish the connection state and counters of the connection manager (retained)
+void publishStatus() {
+  const ConnStats &st = conn.stats();
+  char msg[192];
+  JsonWriter w(msg, sizeof(msg));
+  w.raw("{\"client\":"); w.str(CLIENT_NAME);
+  w.raw(",\"conn\":"); w.str(ConnManager::stateName(conn.state()));
+  w.raw(",\"connects\":"); w.u32(st.connects);
+  w.raw(",\"losses\":"); w.u32(st.connectionLosses);
+  w.raw(",\"wifi_fail\":"); w.u32(st.wifiFailures);
+  w.raw(",\"mqtt_fail\":"); w.u32(st.mqttFailures);
+  w.raw(",\"fast_fail\":"); w.u32(st.fastFailures);
+  w.raw(",\"rssi\":"); w.i32(WiFi.RSSI());
+  w.raw("}");
+  publishMsg(STATUS_TOPIC, msg, true);
+}
+
+#if PAYLOAD_CBOR
+// Publish the slot names of a sensor bank (retained) for the receivers of the CBOR payload:
+// {"client":"tmc0","sb_nr":0,"names":["ID","ID1","OD","","",...]}, indexed by slot, "" = not configured
+void publishNames(const SensorBank &bank) {
+  char msg[PAYLOAD_JSON_MAX + 1];
+  JsonWriter w(msg, sizeof(msg));
+  w.raw("{\"client\":"); w.str(CLIENT_NAME);
+  w.raw(",\"sb_nr\":"); w.u32(bank.sbNr);
+  w.raw(",\"names\":[");
+  for (size_t i = 0; i < KNOWN_SENSORS; i++) {
+    if (i) w.raw(",");
+    w.str(isAddressZero(bank.rom[i]) ? "" : bank.names[i]);
+  }
+  w.raw("]}");
+  publishMsg(bank.namesTopic, msg, true);
+}
+#endif
+
+void Esp8266Link::onOnline() {
+  if (!bootTimes.mqttMs) bootTimes.mqttMs = millis();
+#if !SLEEP_BATCH
+  // the data of a join by scan and DHCP makes the next join fast, also after a power cycle
+  if (rememberWifi() && !FastConnectFile::save(WIFI_FAST_PATH, wifiFast())) Serial.println("Fast-connect data not saved");
+#endif
+  // Once connected, (re)subscribe to the command topic. The bank topics are not subscribed,
+  // the broker would only echo our own datasets back to us.
+  client.subscribe(CMD_TOPIC);
+#if PAYLOAD_CBOR
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    if (banks[b].active) publishNames(banks[b]);
+  }
+#endif
+  publishStatus();
 }
 
 // Identification mode: once entered, runs until reset.
 void identificationMode() {
   Serial.println("Entering Sensor ID Mode until powerdown/reset");
-  Serial.println("Copy the ROM codes for each sensor into knownSensors[] and re-flash");
+  Serial.println("Copy the ROM codes for each sensor into the sensor table (include/sensor_defs.h) and re-flash,");
+  Serial.println("or assign them in normal operation mode with the \"scan\" and \"sensor\" commands");
+  // Sensors get identified on the bus of sensor bank 0, ROM codes are independent of the bus
+  DallasTemperature &sensors = sensors0;
   while (true) {
     sensors.begin();
     delay(300);
@@ -307,6 +744,1150 @@ void identificationMode() {
   }
 }
 
+// ------------------------------------------------------------------
+// Measurement engine
+//
+// The DS18B20 conversion is started asynchronously (setWaitForConversion(false)) and the
+// measurement cycle runs as tasks of the scheduler (see Tasks below), its state kept in measState:
+//
+//   MEAS_IDLE        the periodic "sample" task starts the conversion on all buses at the sample point
+//   MEAS_CONVERTING  the one-shot "read" task is armed for the end of the conversion time (no bus traffic)
+//   MEAS_READING     "read" reads one slot per run and arms itself for the next tick, so the bus never
+//                    stalls the other tasks for long; a read failing its CRC is repeated on the next run
+//                    and every reading passes the sample filter (see Filtering above)
+//   MEAS_PUBLISHING  the one-shot "publish" task updates the LCD and publishes the datasets of all banks
+//
+// The conversions of all sensor banks are started back to back, so their conversion times
+// overlap and a cycle over both banks takes about as long as a cycle over one bank.
+//
+// No task blocks on the measurement, so the "net" task keeps servicing the MQTT connection.
+// The sample points are kept on the fixed grid of the "sample" task, independent of the time the
+// bus and the publishing take. The "interval" command changes the period, the "measure" command
+// starts a cycle right away and restarts the grid from there.
+#define SAMPLE_PERIOD_MS 4000UL   // time between two sample points after startup
+#define SAMPLE_PERIOD_MIN_MS 200UL        // limits of the "interval" command
+#define SAMPLE_PERIOD_MAX_MS 3600000UL
+#define PAGE_PERIOD_MS   4000UL   // time an LCD page is shown if more than 4 sensors are configured
+#define SPLASH_MS        3000UL   // time the splash screen is shown, the client starts up meanwhile
+
+enum MeasState : uint8_t { MEAS_IDLE, MEAS_CONVERTING, MEAS_READING, MEAS_PUBLISHING };
+static MeasState measState = MEAS_IDLE;
+static unsigned long samplePeriodMs = SAMPLE_PERIOD_MS;
+static unsigned long sampleStartMs = 0;     // sample point of the current cycle
+static unsigned long sampleRunMs = 0;       // start of the current cycle (behind its sample point by the lag)
+static uint64_t sampleTimeMs = 0;           // time of the current conversion in epoch ms, 0 = not synchronized yet
+static unsigned long convWaitMs = 750;      // conversion time of the slowest sensor present, set in setup()
+static size_t readIdx = 0;                  // next slot to read in MEAS_READING, bank * SLOTS_PER_BANK + slot
+static unsigned long alarmConvMs = 0;       // conversion time of the slowest alarm slot, 0 = no alarm rounds
+
+// LCD page handling: pages get switched by a timer instead of a blocking delay
+static uint8_t lcdPage = 0;                 // page currently shown (4 sensors per page, all banks)
+static unsigned long pageStartMs = 0;       // time the current page was switched to
+static bool splashShown = false;            // the splash screen is up, the pages wait for it
+
+// ------------------------------------------------------------------
+// Cycle telemetry
+//
+// The durations of the hot-path phases are measured with micros() and published every
+// STATS_PERIOD_MS on STATS_TOPIC, then reset:
+//   conv   conversion wait, from starting the conversions to the first scratchpad read
+//   read   scratchpad read of one sensor
+//   lcd    LCD update (render and I2C writes of the changed characters)
+//   build  serialization of one payload
+//   pub    publish of one dataset payload
+//   loop   one pass of loop()
+//   lag    delay of a cycle start behind its sample point (jitter of the sample grid)
+//   alarm  alarm search of all buses with alarm slots, including the alerts published
+// A cycle counts as missed if it did not finish within the sample period, or if the sample
+// grid had to be restarted because the loop fell behind by more than a period.
+#define STATS_PERIOD_MS 60000UL
+#define STATS_JSON_MAX 1280         // worst case: all numbers with 10 digits
+
+enum Phase : uint8_t { PH_CONV, PH_READ, PH_LCD, PH_BUILD, PH_PUB, PH_LOOP, PH_LAG, PH_ALARM, PH_COUNT };
+const char *const PHASE_NAMES[PH_COUNT] = { "conv", "read", "lcd", "build", "pub", "loop", "lag", "alarm" };
+PhaseStats phaseStats[PH_COUNT];
+static uint32_t statsCycles = 0;            // measurement cycles completed in the current period
+static uint32_t statsMissed = 0;            // missed cycles in the current period
+static unsigned long statsStartMs = 0;      // start of the current period
+static uint32_t convStartUs = 0;            // start of the current conversion, for PH_CONV
+
+// Adds the time from construction to destruction to the statistics of a phase
+struct PhaseTimer {
+  PhaseStats &stats;
+  uint32_t startUs;
+  explicit PhaseTimer(Phase phase) : stats(phaseStats[phase]), startUs(micros()) {}
+  ~PhaseTimer() { stats.add(micros() - startUs); }
+};
+
+// Apply the configured resolution to the sensors of a bank present on the bus and return the
+// resolution of the slowest of them (0 if none is present). Sensors missing at startup keep
+// their stored resolution, so a sensor plugged in later must not be slower than the bank's
+// configured maximum to be read completely.
+uint8_t applyResolution(SensorBank &bank) {
+  uint8_t slowest = 0;
+  for (size_t i = 0; i < KNOWN_SENSORS; i++) {
+    if (isAddressZero(bank.rom[i])) continue;
+    if (!bank.sensors.setResolution(bank.rom[i], bank.resolution[i], true)) {
+      Serial.print("SB"); Serial.print(bank.sbNr); Serial.print(" slot "); Serial.print(i);
+      Serial.println(": sensor not found, resolution not set");
+      continue;
+    }
+    uint8_t res = bank.sensors.getResolution(bank.rom[i]);   // DS18S20 has a fixed resolution
+    if (res > slowest) slowest = res;
+  }
+  return slowest;
+}
+
+// Program the alarm thresholds of the slots into the sensors of a bank present on the bus. Once a slot
+// of the bank has thresholds, the other sensors found on the bus get the off thresholds: with the
+// factory setting (TH 75, TL 70) they would answer every alarm search.
+void applyAlarms(SensorBank &bank) {
+  if (SLEEP_BATCH || !bank.alarm.slots()) return;
+  for (size_t i = 0; i < KNOWN_SENSORS; i++) {
+    if (isAddressZero(bank.rom[i])) continue;
+    if (!bank.bus.setAlarm(bank.rom[i], bank.alarm.low(i), bank.alarm.high(i))) {
+      Serial.print("SB"); Serial.print(bank.sbNr); Serial.print(" slot "); Serial.print(i);
+      Serial.println(": sensor not found, alarm not set");
+    }
+  }
+  const BusPopulation &pop = busPopulation[bank.sbNr];
+  for (uint8_t n = 0; n < pop.count && n < BUS_ROMS_MAX; n++) {
+    bool known = false;
+    for (size_t i = 0; i < KNOWN_SENSORS; i++) if (memcmp(bank.rom[i], pop.rom[n], ROM_SIZE) == 0) known = true;
+    if (!known) bank.bus.setAlarm(pop.rom[n], SENSOR_ALARM_OFF_LOW, SENSOR_ALARM_OFF_HIGH);
+  }
+}
+
+// Slots of a bank taking part in the alarm rounds: configured and with thresholds
+uint8_t alarmSlots(const SensorBank &bank) {
+  uint8_t mask = 0;
+  if (!bank.active) return 0;
+  for (size_t i = 0; i < KNOWN_SENSORS; i++) if (!isAddressZero(bank.rom[i])) mask |= 1 << i;
+  return mask & bank.alarm.slots();
+}
+
+// As the conversions of all banks overlap, the slowest sensor present on any bus determines the wait
+void updateConvWait() {
+  convWaitMs = 0;
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    uint8_t res = busPopulation[b].slowestRes;
+    if (!banks[b].active || !res) continue;
+    unsigned long wait = banks[b].sensors.millisToWaitForConversion(res);
+    if (wait > convWaitMs) convWaitMs = wait;
+  }
+  if (convWaitMs == 0) convWaitMs = 750;   // no sensor found: assume 12 bit for sensors plugged in later
+
+  // the alarm rounds only wait for the alarm slots, by their configured resolution
+  alarmConvMs = 0;
+  for (uint8_t b = 0; b < SB_COUNT && !SLEEP_BATCH; b++) {
+    uint8_t slots = alarmSlots(banks[b]);
+    for (size_t i = 0; i < KNOWN_SENSORS; i++) {
+      if (!(slots & (1 << i))) continue;
+      unsigned long wait = banks[b].sensors.millisToWaitForConversion(banks[b].resolution[i]);
+      if (wait > alarmConvMs) alarmConvMs = wait;
+    }
+  }
+}
+
+// Fingerprint the bus population cache is kept for: the sensor table and the alarm thresholds, so a
+// change of either sets the sensors up again
+uint16_t setupFingerprint() {
+  uint16_t fp = sensorTable.fingerprint();
+  for (uint8_t b = 0; b < SB_COUNT; b++)
+    for (size_t i = 0; i < KNOWN_SENSORS; i++)
+      fp = (uint16_t)((fp << 3) | (fp >> 13)) ^ (uint8_t)knownAlarmLow[b][i] ^ ((uint16_t)(uint8_t)knownAlarmHigh[b][i] << 8);
+  return fp;
+}
+
+// Calibration offsets of the slots of a bank, by the ROM codes now in its table
+void updateOffsets(SensorBank &bank) {
+  for (size_t i = 0; i < KNOWN_SENSORS; i++) knownOffset[bank.sbNr][i] = sensorOffset(SENSOR_DEFS, SENSOR_DEF_COUNT, bank.rom[i]);
+}
+
+// Bring up the sensor banks: load the sensor table (the compile-time defaults if there is no
+// table file), search every bus once and compare the
+// population with the one cached at the last boot. If neither the population nor the table
+// changed, the per-sensor setup (resolution, power supply check) is skipped and the cached
+// results are used. Otherwise the sensors are set up and the cache is written anew.
+void setupSensors() {
+  loadSensorDefs(SENSOR_DEFS, SENSOR_DEF_COUNT, knownSensors[0], knownNames[0], knownResolution[0], SB_COUNT);
+  loadSensorAlarms(SENSOR_DEFS, SENSOR_DEF_COUNT, knownAlarmLow[0], knownAlarmHigh[0], SB_COUNT);
+  if (sensorTable.load(SENSOR_TABLE_PATH)) Serial.println("Sensor table loaded from flash");
+  uint16_t fingerprint = setupFingerprint();
+  BusPopulation cached[SB_COUNT];
+  bool unchanged = RomCache::load(ROM_CACHE_PATH, fingerprint, cached, SB_COUNT);
+
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    SensorBank &bank = banks[b];
+    bank.active = false;
+    for (size_t i = 0; i < KNOWN_SENSORS; i++) if (!isAddressZero(bank.rom[i])) bank.active = true;
+    updateOffsets(bank);
+    bank.sensors.setWaitForConversion(false);
+    searchBus(bank.bus, busPopulation[b]);
+    if (!unchanged || !samePopulation(cached[b], busPopulation[b]) || cached[b].parasite) unchanged = false;
+  }
+
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    SensorBank &bank = banks[b];
+    BusPopulation &pop = busPopulation[b];
+    if (unchanged) {
+      pop.parasite = false;
+      pop.slowestRes = cached[b].slowestRes;
+      continue;
+    }
+    // Parasite powered sensors need the strong pull-up set up by the library's full enumeration
+    pop.parasite = pop.count && bank.sensors.readPowerSupply();
+    if (pop.parasite) bank.sensors.begin();
+    pop.slowestRes = bank.active ? applyResolution(bank) : 0;
+    if (bank.active) applyAlarms(bank);
+  }
+  if (!unchanged) RomCache::save(ROM_CACHE_PATH, fingerprint, busPopulation, SB_COUNT);
+  updateConvWait();
+
+  Serial.print(unchanged ? "Sensor buses unchanged" : "Sensor buses set up");
+  Serial.print(", conversion time: "); Serial.print(convWaitMs); Serial.print(" ms");
+  if (alarmConvMs) { Serial.print(", alarm rounds: "); Serial.print(alarmConvMs); Serial.print(" ms"); }
+  Serial.println();
+}
+
+static ReadRetry readRetry(READ_RETRIES, READ_RETRY_BUDGET_US);
+static uint32_t statsRetries = 0;           // re-reads in the current statistics period
+
+const char *sensorStateName(SensorStatus state);
+
+// Read the temperature of one slot of a sensor bank and pass it through the bank's sample filter
+// into tempRaw[] and state[]. The values stay fixed point (raw 1/16 degree C, centi-degrees from
+// rawToCenti()) up to the LCD and the payloads.
+// Returns false if the read failed its CRC and should be repeated: a re-read is only granted while
+// the time the failed read took is left in the cycle's retry budget (readRetry).
+bool readSensorSlot(SensorBank &bank, size_t i) {
+  if (isAddressZero(bank.rom[i])) {
+    bank.state[i] = SENSOR_NOT_CONFIGURED;
+  } else {
+    uint32_t startUs = micros();
+    SensorStatus st = readSlot(bank.bus, bank, i);
+    uint32_t us = micros() - startUs;
+    phaseStats[PH_READ].add(us);
+    if (readRetry.again(st, us)) {
+      statsRetries++;
+      return false;
+    }
+  }
+  SensorStatus read = filterSlot(bank.filter, bank, i);
+
+  // Simple logging to the Serial Monitor for all slots (only in debug builds)
+#if APP_DEBUG
+  Serial.print("SB"); Serial.print(bank.sbNr); Serial.print(" Slot "); Serial.print(i); Serial.print(" ");
+  if (bank.names[i][0]) { Serial.print(bank.names[i]); Serial.print(" "); }
+  if (isAddressZero(bank.rom[i])) {
+    Serial.println("- not configured");
+  } else {
+    Serial.print("-> "); printAddress(bank.rom[i]); Serial.print(" : ");
+    if (bank.state[i] == SENSOR_OK) {
+      char value[8];
+      JsonWriter w(value, sizeof(value));
+      w.centi(slotCenti(bank, i));
+      Serial.print(value);
+    } else {
+      Serial.print(sensorStateName(bank.state[i]));
+    }
+    if (read != SENSOR_OK) { Serial.print(" (read: "); Serial.print(sensorStateName(read)); Serial.print(")"); }
+    Serial.println();
+  }
+#else
+  (void)read;
+#endif
+  return true;
+}
+
+// Network state indicator in the last column of the first LCD row (left free by the sensor rows):
+// ' ' online, 'W' WiFi not connected, 'M' WiFi up but broker not connected
+char connIndicator() {
+  if (conn.online()) return ' ';
+  return conn.wifiUp() ? 'M' : 'W';
+}
+
+// Render the current page and send the changes to the LCD. If more than 4 sensors are
+// configured, the pages get switched by a timer in displayStep().
+void refreshDisplay() {
+  if (splashShown) return;
+  PhaseTimer timer(PH_LCD);
+  renderLcdPage(fb, bankSlots, SB_COUNT, lcdPage, connIndicator());
+  fb.flush(lcd);
+}
+
+// Publish a dataset record of a bank in the payload formats configured (PAYLOAD_CBOR)
+bool publishRecord(const DatasetRecord &rec) {
+  const SensorBank &bank = banks[rec.sbNr];
+  if (!datasetPublisher.publish(bank.topic, bank.cborTopic, bank.names, rec)) return false;
+  if (!bootTimes.pubMs) {
+    bootTimes.pubMs = millis();
+    Serial.print("First dataset published after "); Serial.print(bootTimes.pubMs); Serial.println(" ms");
+    diagLastMs = millis() - DIAG_PERIOD_MS;     // diagnostics with the complete startup times
+  }
+  return true;
+}
+
+// Dead-band check: does the dataset differ enough from the last published one?
+// A forced dataset (requested by the "measure" command) is always published.
+bool needsPublish(const SensorBank &bank, const DatasetRecord &rec, bool forced) {
+  if (forced || !bank.published) return true;
+  return publishDue(rec, bank.lastCenti, publishDeadband, millis() - bank.lastPublishMs, PUBLISH_HEARTBEAT_MS);
+}
+
+// Publish the latest dataset of a sensor bank unless suppressed by the dead-band. If the broker is
+// not reachable, or older datasets are still waiting to be forwarded, the dataset goes into the
+// store-and-forward buffer.
+void publishDataset(SensorBank &bank, bool forced) {
+  DatasetRecord rec;
+  makeRecord(bank, bank.dsNr, sampleTimeMs, rec);
+  if (!needsPublish(bank, rec, forced)) {
+    bank.suppressed++;
+    return;
+  }
+  bank.dsNr++;
+  bank.published = true;
+  bank.lastPublishMs = millis();
+  for (size_t i = 0; i < KNOWN_SENSORS; i++) bank.lastCenti[i] = rec.centi[i];
+
+  if (client.connected() && datasetBuffer.pending() == 0 && publishRecord(rec)) return;
+  datasetBuffer.push(rec);
+}
+
+// Publish the aggregates of a bank's window that just ended. The payload is streamed, so it
+// doesn't depend on the PubSubClient buffer. agg_nr counts every window, also the dropped ones.
+void publishAggregates(SensorBank &bank) {
+  char msg[PAYLOAD_AGG_JSON_MAX + 1];
+  size_t len = buildAggJson(msg, sizeof(msg), CLIENT_NAME, bank.sbNr, bank.aggNr++, bank.agg, bank.names);
+  if (!len || !client.connected()) return;
+  if (!client.beginPublish(bank.aggTopic, len, false) || client.write((const uint8_t *)msg, len) != len ||
+      !client.endPublish()) {
+    diag.pubFail++;
+  }
+}
+
+// Add the latest readings of a bank to its window; the sample time decides the window, millis()
+// of the sample point until the client has the time
+void aggregateDataset(SensorBank &bank) {
+  if (AGG_WINDOW_S == 0) return;
+  DatasetRecord rec;
+  makeRecord(bank, 0, sampleTimeMs, rec);
+  bool epoch = sampleTimeMs != 0;
+  uint64_t t = epoch ? sampleTimeMs : sampleStartMs;
+  if (bank.agg.ends(t, epoch)) publishAggregates(bank);
+  bank.agg.add(rec, t, epoch);
+}
+
+// Forward buffered datasets after a reconnect: at most DRAIN_BURST datasets every
+// DRAIN_INTERVAL_MS (period of the "drain" task), oldest first, so the backlog doesn't flood the broker.
+void drainStep() {
+  if (!client.connected() || datasetBuffer.pending() == 0) return;
+
+  DatasetRecord rec;
+  for (uint8_t n = 0; n < DRAIN_BURST && datasetBuffer.peek(rec); n++) {
+    if (!publishRecord(rec)) break;       // keep the record, retry with the next burst
+    datasetBuffer.pop();
+  }
+}
+
+// Publish the pending alarm changes of a bank, with the state of that time: a tripped slot reports the
+// reading that tripped it, a cleared one its latest reading. Streamed like the aggregates; kept pending
+// while the broker is not reachable, alert_nr only counts the alerts published.
+void publishAlert(SensorBank &bank) {
+  uint8_t slots = bank.alarm.pending();
+  if (!slots || !client.connected()) return;
+  int16_t centi[SLOTS_PER_BANK];
+  for (uint8_t i = 0; i < KNOWN_SENSORS; i++) {
+    if (bank.alarm.state(i) != SensorAlarm::CLEAR) centi[i] = rawToCenti(bank.alarm.raw(i)) + bank.offsetCenti[i];
+    else centi[i] = bank.state[i] == SENSOR_OK ? slotCenti(bank, i) : TEMP_INVALID_CENTI;
+  }
+  char msg[PAYLOAD_ALERT_JSON_MAX + 1];
+  size_t len = buildAlertJson(msg, sizeof(msg), CLIENT_NAME, bank.sbNr, bank.alertNr, timeSync.epochMs(millis()),
+                              bank.alarm, slots, centi, bank.names);
+  if (!len) return;
+  if (!client.beginPublish(bank.alertTopic, len, false) || client.write((const uint8_t *)msg, len) != len ||
+      !client.endPublish()) {
+    diag.pubFail++;
+    return;
+  }
+  bank.alarm.sent(slots);
+  bank.alertNr++;
+  for (uint8_t i = 0; i < KNOWN_SENSORS; i++) {
+    if (!(slots & (1 << i))) continue;
+    Serial.print("Alert SB"); Serial.print(bank.sbNr); Serial.print(" ");
+    Serial.print(bank.names[i]); Serial.print(": "); Serial.println(alarmStateName(bank.alarm.state(i)));
+  }
+}
+
+// Alarm search on all buses with alarm slots, after a conversion of them (alarm round or measurement cycle)
+void checkAlarms() {
+  PhaseTimer timer(PH_ALARM);
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    SensorBank &bank = banks[b];
+    uint8_t searched = alarmSlots(bank);
+    if (!searched) continue;
+    int16_t raw[SLOTS_PER_BANK];
+    uint8_t found = searchAlarms(bank.bus, bank, searched, raw);
+    if (bank.alarm.update(searched, found, raw) || bank.alarm.pending()) publishAlert(bank);
+  }
+}
+
+// Pending "measure" command: answered once the datasets of the cycle are published
+static bool measureRequested = false;
+static bool measureHasId = false;
+static uint32_t measureId = 0;
+
+void sendMeasureResponse();
+
+// Pending "sensor" command that changes the table: applied by the read task once the measurement
+// is idle, so its writes to the sensors don't land in a conversion or a read
+struct SensorChange {
+  bool pending;
+  bool hasId;
+  uint32_t id;
+  uint8_t sb;
+  uint8_t slot;
+  DeviceAddress rom;
+  bool hasName;
+  char name[NAME_MAX + 1];
+  int8_t res;                       // -1: unchanged
+};
+static SensorChange sensorChange = {};
+
+void applySensorChange();
+void sendSensorResponse(bool hasId, uint32_t id, uint8_t sb, uint8_t slot, bool saved);
+
+// Pending "scan" command: run by the read task once the measurement is idle too, the search holds
+// the bus for about 100 ms and refreshes the bus population the setup of the sensors relies on
+struct ScanRequest {
+  bool pending;
+  bool hasId;
+  uint32_t id;
+  uint8_t sb;
+};
+static ScanRequest scanRequest = {};
+
+void runScan();
+
+// ------------------------------------------------------------------
+// Tasks
+//
+// Everything loop() does runs as a task of the cooperative scheduler (see CoopScheduler.h),
+// ticked once per loop() pass:
+//   task      runs                   budget   work
+//   net       every tick             20 ms    WiFi/broker connection, MQTT input (commands), NTP
+//   sample    every samplePeriodMs    2 ms    start of the conversions on the sample grid
+//   read      one-shot               15 ms    one scratchpad read per run
+//   publish   one-shot               40 ms    LCD update, the datasets and aggregates of all banks
+//   alarm     one-shot               15 ms    alarm rounds between the cycles (see Hardware alarms)
+//   drain     DRAIN_INTERVAL_MS      40 ms    forwarding of buffered datasets
+//   display   every 100 ms           10 ms    LCD page switching and the network state indicator
+//   stats     every 1 s              10 ms    timing statistics, once per STATS_PERIOD_MS
+//   diag      every 1 s              10 ms    memory diagnostics, once per DIAG_PERIOD_MS
+// A second sensor bank only adds read runs, a command only a net run, so neither stretches the
+// sample period. Runs over budget are counted per task and reported with the statistics.
+// The net task overruns while a connection attempt blocks (up to MQTT_CONNECT_TIMEOUT_MS).
+#define TASK_NET_BUDGET_US      20000UL
+#define TASK_SAMPLE_BUDGET_US    2000UL
+#define TASK_READ_BUDGET_US     15000UL
+#define TASK_PUBLISH_BUDGET_US  40000UL
+#define TASK_ALARM_BUDGET_US    15000UL
+#define TASK_DRAIN_BUDGET_US    40000UL
+#define TASK_DISPLAY_BUDGET_US  10000UL
+#define TASK_REPORT_BUDGET_US   10000UL
+#define DISPLAY_TASK_MS 100UL
+#define REPORT_TASK_MS 1000UL
+
+CoopScheduler scheduler(sysClock);
+static int8_t sampleTask = -1;
+static int8_t readTask = -1;
+static int8_t publishTask = -1;
+static int8_t alarmTask = -1;
+static bool alarmConverting = false;        // an alarm round waits for its conversions
+static unsigned long alarmRoundMs = 0;      // start of the last alarm round
+
+void netRun() {
+  static ConnState lastConnState = CONN_WIFI_START;
+  conn.step(millis());                // (re)connect WiFi and broker without blocking
+  if (!bootTimes.wifiMs && conn.wifiUp()) {
+    bootTimes.wifiMs = millis();
+    bootTimes.fast = conn.fast();
+  }
+  if (conn.state() != lastConnState) {
+    lastConnState = conn.state();
+    Serial.print("Connection state: "); Serial.println(ConnManager::stateName(lastConnState));
+  }
+  if (conn.online()) {
+    client.loop();    // maintain the MQTT connection and process incoming messages
+  }
+  timeSync.step(millis(), conn.wifiUp());   // sends a request when due, never waits for the reply
+}
+
+// Sample point: start the conversions on all buses back to back, they return immediately and run in parallel
+void sampleRun() {
+  unsigned long now = millis();
+  if (measState != MEAS_IDLE) {
+    statsMissed++;              // the previous cycle is still running, this sample point is dropped
+    return;
+  }
+  if (alarmConverting) {        // the cycle's conversion is searched instead
+    alarmConverting = false;
+    scheduler.cancel(alarmTask);
+  }
+  // the scheduler restarts the grid if we fell behind by a whole period or more
+  phaseStats[PH_LAG].add(scheduler.lagMs() * 1000UL);
+  if (scheduler.lagMs() >= samplePeriodMs) statsMissed++;
+  sampleStartMs = now - scheduler.lagMs();
+  sampleRunMs = now;
+
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    if (banks[b].active) banks[b].bus.requestConversions();
+  }
+  convStartUs = micros();
+  readRetry.startCycle();
+  sampleTimeMs = timeSync.epochMs(now);
+  measState = MEAS_CONVERTING;
+  scheduler.runAfter(readTask, convWaitMs);
+}
+
+void readRun() {
+  if (measState == MEAS_IDLE) {             // between the cycles: a queued sensor change or scan
+    if (!sensorChange.pending && !scanRequest.pending) return;
+    if (alarmConverting) {
+      scheduler.runAfter(readTask, 1);      // after the alarm round's conversion
+      return;
+    }
+    if (sensorChange.pending) applySensorChange();
+    else runScan();
+    if (scanRequest.pending) scheduler.runAfter(readTask, 0);     // one per run
+    return;
+  }
+  if (measState == MEAS_CONVERTING) {
+    phaseStats[PH_CONV].add(micros() - convStartUs);
+    if (alarmConvMs) checkAlarms();
+    readIdx = 0;
+    measState = MEAS_READING;
+  }
+  SensorBank &bank = banks[readIdx / SLOTS_PER_BANK];
+  if (bank.active && !readSensorSlot(bank, readIdx % SLOTS_PER_BANK)) {
+    scheduler.runAfter(readTask, 0);        // CRC error, the slot is read again on the next run
+    return;
+  }
+  if (++readIdx < SB_COUNT * SLOTS_PER_BANK) {
+    scheduler.runAfter(readTask, 0);
+  } else {
+    measState = MEAS_PUBLISHING;
+    scheduler.runAfter(publishTask, 0);
+  }
+}
+
+void publishRun() {
+  refreshDisplay();                   // show the new values on the page currently visible
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    if (!banks[b].active) continue;
+    publishDataset(banks[b], measureRequested);
+    aggregateDataset(banks[b]);
+  }
+  if (measureRequested) sendMeasureResponse();
+  diagSample();
+  statsCycles++;
+  if (millis() - sampleRunMs > samplePeriodMs) statsMissed++;
+  measState = MEAS_IDLE;
+  if (sensorChange.pending || scanRequest.pending) scheduler.runAfter(readTask, 0);
+  if (alarmConvMs) scheduler.runAfter(alarmTask, 0);
+}
+
+// Alarm round: convert the alarm slots only, then search them. Rounds run while the measurement is
+// idle, at most every ALARM_ROUND_MS, and only if they end before the next sample point.
+void alarmRun() {
+  unsigned long now = millis();
+  if (alarmConverting) {
+    alarmConverting = false;
+    checkAlarms();
+  }
+  // publishRun re-arms the task, as does a sensor change once applied or a scan once run
+  if (!alarmConvMs || measState != MEAS_IDLE || sensorChange.pending || scanRequest.pending) return;
+  unsigned long sinceRound = now - alarmRoundMs;
+  if (sinceRound < ALARM_ROUND_MS) {
+    scheduler.runAfter(alarmTask, ALARM_ROUND_MS - sinceRound);
+    return;
+  }
+  long untilSample = (long)(sampleStartMs + samplePeriodMs - now);
+  if (untilSample < (long)(alarmConvMs + ALARM_GUARD_MS)) return;
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    uint8_t slots = alarmSlots(banks[b]);
+    for (uint8_t i = 0; i < KNOWN_SENSORS; i++) {
+      if (slots & (1 << i)) banks[b].bus.requestConversion(banks[b].rom[i]);
+    }
+  }
+  alarmRoundMs = now;
+  alarmConverting = true;
+  scheduler.runAfter(alarmTask, alarmConvMs);
+}
+
+void displayStep();
+void statsStep();
+void diagStep();
+
+void setupTasks() {
+  scheduler.addPeriodic("net", netRun, CoopScheduler::EVERY_TICK, TASK_NET_BUDGET_US);
+  sampleTask = scheduler.addPeriodic("sample", sampleRun, samplePeriodMs, TASK_SAMPLE_BUDGET_US);   // first cycle right away
+  readTask = scheduler.addOneShot("read", readRun, TASK_READ_BUDGET_US);
+  publishTask = scheduler.addOneShot("publish", publishRun, TASK_PUBLISH_BUDGET_US);
+  alarmTask = scheduler.addOneShot("alarm", alarmRun, TASK_ALARM_BUDGET_US);
+  scheduler.addPeriodic("drain", drainStep, DRAIN_INTERVAL_MS, TASK_DRAIN_BUDGET_US);
+  scheduler.addPeriodic("display", displayStep, DISPLAY_TASK_MS, TASK_DISPLAY_BUDGET_US);
+  scheduler.addPeriodic("stats", statsStep, REPORT_TASK_MS, TASK_REPORT_BUDGET_US);
+  scheduler.addPeriodic("diag", diagStep, REPORT_TASK_MS, TASK_REPORT_BUDGET_US);
+}
+
+// ------------------------------------------------------------------
+// Commands of controlling entities
+//
+// Commands arrive on CMD_TOPIC and are answered on RSP_TOPIC, echoing the correlation id:
+//   {"id":17,"cmd":"interval","value":2000}  ->  {"id":17,"cmd":"interval","rc":"ok","interval":2000}
+// They are executed right in the MQTT callback, except "measure": it starts a measurement
+// cycle (or joins the one already running) and is answered after the cycle's datasets
+// have been published, bypassing the dead-band. The response lists the ds_nr per bank.
+//
+// Note: PubSubClient uses the same buffer for receiving and sending, so the payload must
+// not be accessed any more once a response (or any other message) got published.
+
+#define SCAN_REPORT_MAX 8       // unassigned ROM codes listed in the "scan" response
+#define RSP_MAX 240             // longest response ("scan" with SCAN_REPORT_MAX ROM codes)
+static_assert(sizeof(RSP_TOPIC) + RSP_MAX + 5 <= MQTT_MAX_PACKET_SIZE, "response exceeds the MQTT packet size");
+
+const char *sensorStateName(SensorStatus state) {
+  switch (state) {
+    case SENSOR_NOT_CONFIGURED: return "unused";
+    case SENSOR_OK:             return "ok";
+    case SENSOR_ABSENT:         return "absent";
+    case SENSOR_CRC_ERROR:      return "crc";
+    case SENSOR_RESET:          return "reset";
+  }
+  return "";
+}
+
+// Check a change of the sensor table entry of a slot and queue it: all given members are checked
+// before anything gets changed. A ROM code can only be in one slot, to move a sensor its old slot
+// is cleared first. The change writes to the sensors (resolution, alarm thresholds), so it waits
+// for the measurement to be idle, see applySensorChange().
+CommandResult queueSensorChange(const Command &cmd) {
+  if (sensorChange.pending) return CMD_ERR_BUSY;
+  SensorChange &change = sensorChange;
+  memcpy(change.rom, banks[cmd.sb].rom[cmd.slot], ROM_SIZE);
+  if (cmd.rom) {
+    if (cmd.romLen == 0) memset(change.rom, 0, ROM_SIZE);   // "" clears the slot
+    else if (!parseRom(cmd.rom, cmd.romLen, change.rom)) return CMD_ERR_VALUE;
+  }
+  if (cmd.name && (cmd.nameLen > NAME_MAX || memchr(cmd.name, ' ', cmd.nameLen))) return CMD_ERR_VALUE;
+  if (cmd.res >= 0 && (cmd.res < 9 || cmd.res > 12)) return CMD_ERR_VALUE;
+  if (!isAddressZero(change.rom)) {
+    for (uint8_t b = 0; b < SB_COUNT; b++)
+      for (size_t i = 0; i < KNOWN_SENSORS; i++)
+        if ((b != cmd.sb || i != (size_t)cmd.slot) && memcmp(knownSensors[b][i], change.rom, ROM_SIZE) == 0)
+          return CMD_ERR_IN_USE;
+  }
+
+  change.sb = cmd.sb;
+  change.slot = cmd.slot;
+  change.hasName = cmd.name != nullptr;
+  if (cmd.name) {
+    memcpy(change.name, cmd.name, cmd.nameLen);
+    change.name[cmd.nameLen] = '\0';
+  }
+  change.res = cmd.res;
+  change.hasId = cmd.hasId;
+  change.id = cmd.id;
+  change.pending = true;
+  if (measState == MEAS_IDLE) scheduler.runAfter(readTask, 0);    // else publishRun() hands it over
+  return CMD_OK;
+}
+
+// Apply the queued sensor change, run by the read task while the measurement is idle: the table is
+// saved to flash, the sensors of the bank are set up again and the command gets its response.
+void applySensorChange() {
+  SensorChange &change = sensorChange;
+  SensorBank &bank = banks[change.sb];
+  memcpy(knownSensors[change.sb][change.slot], change.rom, ROM_SIZE);
+  if (change.hasName) strcpy(knownNames[change.sb][change.slot], change.name);
+  if (change.res >= 0) knownResolution[change.sb][change.slot] = change.res;
+  updateOffsets(bank);
+  bool saved = sensorTable.save(SENSOR_TABLE_PATH);
+
+  bank.active = false;
+  for (size_t i = 0; i < KNOWN_SENSORS; i++) if (!isAddressZero(bank.rom[i])) bank.active = true;
+  busPopulation[change.sb].slowestRes = bank.active ? applyResolution(bank) : 0;
+  if (bank.active) applyAlarms(bank);
+  updateConvWait();
+  RomCache::save(ROM_CACHE_PATH, setupFingerprint(), busPopulation, SB_COUNT);
+
+  bank.state[change.slot] = SENSOR_NOT_CONFIGURED;  // until read in the next cycle
+  bank.filter.clear(change.slot);                   // the samples belong to the previous sensor
+  bank.alarm.reset(change.slot);
+  bank.published = false;                           // next dataset bypasses the dead-band
+  lcdPage = 0;
+  refreshDisplay();
+#if PAYLOAD_CBOR
+  publishNames(bank);
+#endif
+  change.pending = false;
+  sendSensorResponse(change.hasId, change.id, change.sb, change.slot, saved);
+  if (alarmConvMs) scheduler.runAfter(alarmTask, 0);
+}
+
+// Start a response: {"id":17,"cmd":"status","rc":"ok"  (continued by the caller)
+void beginResponse(JsonWriter &w, bool hasId, uint32_t id, CommandCode code, CommandResult rc) {
+  w.raw("{");
+  if (hasId) { w.raw("\"id\":"); w.u32(id); w.raw(","); }
+  w.raw("\"cmd\":"); w.str(commandName(code));
+  w.raw(",\"rc\":"); w.str(commandResultName(rc));
+}
+
+// Members of the "sensor" response: the table entry of sb/slot and the state of its value
+void writeSensorEntry(JsonWriter &w, uint8_t sb, uint8_t slot, bool saved) {
+  char hex[2 * ROM_SIZE + 1];
+  SensorBank &bank = banks[sb];
+  formatRom(bank.rom[slot], hex);
+  w.raw(",\"sb\":"); w.u32(sb);
+  w.raw(",\"slot\":"); w.u32(slot);
+  w.raw(",\"rom\":"); w.str(isAddressZero(bank.rom[slot]) ? "" : hex);
+  w.raw(",\"name\":"); w.str(bank.names[slot]);
+  w.raw(",\"res\":"); w.u32(bank.resolution[slot]);
+  w.raw(",\"state\":"); w.str(sensorStateName(bank.state[slot]));
+  if (!saved) w.raw(",\"saved\":false");
+}
+
+void sendSensorResponse(bool hasId, uint32_t id, uint8_t sb, uint8_t slot, bool saved) {
+  char msg[RSP_MAX];
+  JsonWriter w(msg, sizeof(msg));
+  beginResponse(w, hasId, id, CMD_SENSOR, CMD_OK);
+  writeSensorEntry(w, sb, slot, saved);
+  w.raw("}");
+  publishMsg(RSP_TOPIC, msg, false);
+}
+
+void sendMeasureResponse() {
+  char msg[128];
+  JsonWriter w(msg, sizeof(msg));
+  beginResponse(w, measureHasId, measureId, CMD_MEASURE, CMD_OK);
+  w.raw(",\"ds_nr\":[");
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    if (b) w.raw(",");
+    if (banks[b].active) w.u32(banks[b].dsNr - 1);     // ds_nr of the dataset just published
+    else w.raw("null");
+  }
+  w.raw("]}");
+  publishMsg(RSP_TOPIC, msg, false);
+  measureRequested = false;
+}
+
+// Run the queued scan, by the read task while the measurement is idle, and answer it with the ROM
+// codes found on the bus that are not assigned to a slot of the bank
+void runScan() {
+  ScanRequest &scan = scanRequest;
+  const SensorBank &bank = banks[scan.sb];
+  const BusPopulation &pop = busPopulation[scan.sb];
+  searchBus(banks[scan.sb].bus, busPopulation[scan.sb]);
+
+  char msg[RSP_MAX];
+  JsonWriter w(msg, sizeof(msg));
+  beginResponse(w, scan.hasId, scan.id, CMD_SCAN, CMD_OK);
+  w.raw(",\"sb\":"); w.u32(scan.sb);
+  w.raw(",\"found\":"); w.u32(pop.count);
+  w.raw(",\"unassigned\":[");
+  uint8_t listed = 0;
+  for (uint8_t r = 0; r < pop.count && r < BUS_ROMS_MAX && listed < SCAN_REPORT_MAX; r++) {
+    bool assigned = false;
+    for (size_t i = 0; i < KNOWN_SENSORS; i++) {
+      if (memcmp(bank.rom[i], pop.rom[r], ROM_SIZE) == 0) assigned = true;
+    }
+    if (assigned) continue;
+    char hex[2 * ROM_SIZE + 1];
+    formatRom(pop.rom[r], hex);
+    if (listed++) w.raw(",");
+    w.str(hex);
+  }
+  w.raw("]}");
+  scan.pending = false;
+  publishMsg(RSP_TOPIC, msg, false);
+  if (alarmConvMs) scheduler.runAfter(alarmTask, 0);
+}
+
+void handleCommand(const byte* payload, unsigned int length) {
+  Command cmd;
+  CommandResult rc = parseCommand(payload, length, cmd);
+
+  if (rc == CMD_OK) {
+    switch (cmd.code) {
+      case CMD_INTERVAL:
+        if (cmd.value < (int32_t)SAMPLE_PERIOD_MIN_MS || cmd.value > (int32_t)SAMPLE_PERIOD_MAX_MS) rc = CMD_ERR_VALUE;
+        else {
+          samplePeriodMs = cmd.value;
+          scheduler.setPeriod(sampleTask, samplePeriodMs);
+        }
+        break;
+      case CMD_DEADBAND:
+        if (cmd.value < 0 || cmd.value > 1000) rc = CMD_ERR_VALUE;
+        else publishDeadband = cmd.value;
+        break;
+      case CMD_MEASURE:
+        if (measureRequested) {
+          rc = CMD_ERR_BUSY;
+          break;
+        }
+        measureRequested = true;      // answered by sendMeasureResponse()
+        if (measState == MEAS_IDLE) scheduler.runAfter(sampleTask, 0);   // else joins the running cycle
+        measureHasId = cmd.hasId;
+        measureId = cmd.id;
+        return;
+      case CMD_SENSOR:
+        if (cmd.sb >= SB_COUNT || cmd.slot >= (int32_t)SLOTS_PER_BANK) rc = CMD_ERR_VALUE;
+        else if (cmd.rom || cmd.name || cmd.res >= 0) {
+          rc = queueSensorChange(cmd);
+          if (rc == CMD_OK) return;     // answered by applySensorChange()
+        }
+        break;
+      case CMD_SCAN:
+        if (cmd.sb >= SB_COUNT) rc = CMD_ERR_VALUE;
+        else if (scanRequest.pending) rc = CMD_ERR_BUSY;
+        else {
+          scanRequest = { true, cmd.hasId, cmd.id, (uint8_t)cmd.sb };
+          if (measState == MEAS_IDLE) scheduler.runAfter(readTask, 0);    // else publishRun() hands it over
+          return;                       // answered by runScan()
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  char msg[RSP_MAX];
+  JsonWriter w(msg, sizeof(msg));
+  beginResponse(w, cmd.hasId, cmd.id, cmd.code, rc);
+  if (rc == CMD_OK) {
+    switch (cmd.code) {
+      case CMD_STATUS:
+        w.raw(",\"uptime\":"); w.u32(millis() / 1000);
+        w.raw(",\"plv\":"); w.str(PAYLOAD_JSON_VERSION);
+        w.raw(",\"interval\":"); w.u32(samplePeriodMs);
+        w.raw(",\"deadband\":"); w.i32(publishDeadband);
+        w.raw(",\"conv_ms\":"); w.u32(convWaitMs);
+        w.raw(",\"backlog\":"); w.u32(datasetBuffer.pending());
+        if (timeSync.synced()) {
+          w.raw(",\"time_ms\":"); w.u64(timeSync.epochMs(millis()));
+        }
+        w.raw(",\"sensors\":[");
+        for (uint8_t b = 0; b < SB_COUNT; b++) {
+          uint8_t cnt = 0;
+          for (size_t i = 0; i < KNOWN_SENSORS; i++) if (!isAddressZero(banks[b].rom[i])) cnt++;
+          if (b) w.raw(",");
+          w.u32(cnt);
+        }
+        w.raw("]");
+        break;
+      case CMD_INTERVAL:
+        w.raw(",\"interval\":"); w.u32(samplePeriodMs);
+        break;
+      case CMD_DEADBAND:
+        w.raw(",\"deadband\":"); w.i32(publishDeadband);
+        break;
+      case CMD_SENSOR:
+        writeSensorEntry(w, cmd.sb, cmd.slot, true);
+        break;
+      default:
+        break;
+    }
+  }
+  w.raw("}");
+  publishMsg(RSP_TOPIC, msg, false);
+}
+
+// Publish the timing statistics every STATS_PERIOD_MS and start a new period. While the broker
+// is not reachable the statistics keep accumulating.
+// {"client":"tmc0","uptime":3600,"period_ms":60004,"cycles":15,"missed":0,
+//  "filter":{"retries":3,"rejected":1,"held":2,"lost":0},
+//  "us":{"conv":[15,750113,750342,751208,751615],"read":[45,5421,5466,5530,5631],...},
+//  "tasks":{"net":[412300,2,1502113,0],"sample":[15,0,180,0],...}}
+// with [count,min,avg,max,p99] per phase in microseconds and [runs,overruns,max_us,skipped] per task.
+void statsStep() {
+  if (millis() - statsStartMs < STATS_PERIOD_MS || !client.connected()) return;
+
+  char msg[STATS_JSON_MAX];
+  JsonWriter w(msg, sizeof(msg));
+  w.raw("{\"client\":"); w.str(CLIENT_NAME);
+  w.raw(",\"uptime\":"); w.u32(millis() / 1000);
+  w.raw(",\"period_ms\":"); w.u32(millis() - statsStartMs);
+  w.raw(",\"cycles\":"); w.u32(statsCycles);
+  w.raw(",\"missed\":"); w.u32(statsMissed);
+  FilterStats fs = {};
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    fs.rejected += banks[b].filter.stats().rejected;
+    fs.held += banks[b].filter.stats().held;
+    fs.lost += banks[b].filter.stats().lost;
+  }
+  w.raw(",\"filter\":{\"retries\":"); w.u32(statsRetries);
+  w.raw(",\"rejected\":"); w.u32(fs.rejected);
+  w.raw(",\"held\":"); w.u32(fs.held);
+  w.raw(",\"lost\":"); w.u32(fs.lost);
+  w.raw("}");
+  w.raw(",\"us\":{");
+  for (uint8_t p = 0; p < PH_COUNT; p++) {
+    const PhaseStats &ps = phaseStats[p];
+    if (p) w.raw(",");
+    w.str(PHASE_NAMES[p]);
+    w.raw(":["); w.u32(ps.count());
+    w.raw(","); w.u32(ps.min());
+    w.raw(","); w.u32(ps.avg());
+    w.raw(","); w.u32(ps.max());
+    w.raw(","); w.u32(ps.percentile(99));
+    w.raw("]");
+  }
+  w.raw("},\"tasks\":{");
+  for (uint8_t t = 0; t < scheduler.count(); t++) {
+    const TaskStats &ts = scheduler.stats(t);
+    if (t) w.raw(",");
+    w.str(scheduler.name(t));
+    w.raw(":["); w.u32(ts.runs);
+    w.raw(","); w.u32(ts.overruns);
+    w.raw(","); w.u32(ts.maxUs);
+    w.raw(","); w.u32(ts.skipped);
+    w.raw("]");
+  }
+  w.raw("}}");
+
+  // The message exceeds the PubSubClient buffer, it is streamed to the broker instead
+  if (!w.ok() || !client.beginPublish(STATS_TOPIC, w.length(), false) ||
+      client.write((const uint8_t *)msg, w.length()) != w.length() || !client.endPublish()) {
+    diag.pubFail++;
+  }
+
+  for (uint8_t p = 0; p < PH_COUNT; p++) phaseStats[p].reset();
+  scheduler.resetStats();
+  for (uint8_t b = 0; b < SB_COUNT; b++) banks[b].filter.resetStats();
+  statsRetries = 0;
+  statsCycles = 0;
+  statsMissed = 0;
+  statsStartMs = millis();
+}
+
+// Publish the memory diagnostics every DIAG_PERIOD_MS (retained):
+// {"client":"tmc0","fw":"2026-03-08","uptime":86400,"reset":6,"heap":[31200,28744],"block":[30904,26208],
+//  "frag":[2,11],"stack":3152,"pub_fail":0,"pub_oversize":0,"backlog":0,
+//  "boot":{"wifi_ms":412,"mqtt_ms":498,"pub_ms":1204,"fast":true}}
+// with [current, low-water mark] of heap and block, [current, high-water mark] of frag.
+// The message is streamed, so it doesn't depend on the PubSubClient buffer it reports on.
+void diagStep() {
+  if (millis() - diagLastMs < DIAG_PERIOD_MS || !client.connected()) return;
+
+  uint32_t heap;
+  uint16_t block;
+  uint8_t frag;
+  diagSample(heap, block, frag);
+
+  char msg[DIAG_JSON_MAX];
+  JsonWriter w(msg, sizeof(msg));
+  w.raw("{\"client\":"); w.str(CLIENT_NAME);
+  w.raw(",\"fw\":"); w.str(FW_VERSION);
+  w.raw(",\"uptime\":"); w.u32(millis() / 1000);
+  w.raw(",\"reset\":"); w.u32(ESP.getResetInfoPtr()->reason);
+  w.raw(",\"heap\":["); w.u32(heap); w.raw(","); w.u32(diag.heapMin);
+  w.raw("],\"block\":["); w.u32(block); w.raw(","); w.u32(diag.blockMin);
+  w.raw("],\"frag\":["); w.u32(frag); w.raw(","); w.u32(diag.fragMax);
+  w.raw("],\"stack\":"); w.u32(ESP.getFreeContStack());     // lowest free stack since the start
+  w.raw(",\"pub_fail\":"); w.u32(diag.pubFail);
+  w.raw(",\"pub_oversize\":"); w.u32(diag.pubOversize);
+  w.raw(",\"backlog\":"); w.u32(datasetBuffer.pending());
+  w.raw(",\"boot\":{\"wifi_ms\":"); w.u32(bootTimes.wifiMs);
+  w.raw(",\"mqtt_ms\":"); w.u32(bootTimes.mqttMs);
+  w.raw(",\"pub_ms\":"); w.u32(bootTimes.pubMs);
+  w.raw(",\"fast\":"); w.raw(bootTimes.fast ? "true" : "false");
+  w.raw("}}");
+
+  if (!w.ok() || !client.beginPublish(DIAG_TOPIC, w.length(), true) ||
+      client.write((const uint8_t *)msg, w.length()) != w.length() || !client.endPublish()) {
+    diag.pubFail++;
+  }
+  diagLastMs = millis();
+}
+
+#if SLEEP_BATCH
+// Connect for a batch: WiFi with the fast-connect data first, by scan and DHCP if that fails
+// (the access point may have changed its channel) or the broker can't be reached over it (the
+// IP configuration may be stale), then the broker.
+bool batchConnect() {
+  for (bool fast = true;; fast = false) {
+    fast = netLink.wifiBegin(fast);
+    unsigned long startMs = millis();
+    while (!netLink.wifiConnected() && millis() - startMs < SLEEP_WIFI_TIMEOUT_MS) delay(10);
+    if (!netLink.wifiConnected()) {
+      if (!fast) return false;
+      Serial.println("Fast connect failed");
+      continue;
+    }
+    rememberWifi();
+
+    BrokerResult result = netLink.mqttConnect();
+    if (result == BROKER_CONNECTED) break;
+    if (!fast || result != BROKER_UNREACHABLE) return false;
+    Serial.println("Broker unreachable after fast connect");
+  }
+  netLink.onOnline();
+  return true;
+}
+
+// Synchronize the time while connected for a batch. The error of the clock taken over from
+// the previous wakes tunes the clock correction per wake.
+void batchSyncTime() {
+  unsigned long startMs = millis();
+  timeSync.requestSync();
+  while (!timeSync.synced() && millis() - startMs < NTP_TIMEOUT_MS) {
+    timeSync.step(millis(), true);
+    delay(10);
+  }
+  if (!timeSync.synced()) {
+    Serial.println("No NTP reply");
+    return;
+  }
+  rtcBatch.clockSynced(timeSync.stats().lastErrorMs);
+  Serial.print("Time synchronized, clock error "); Serial.print(timeSync.stats().lastErrorMs); Serial.println(" ms");
+}
+
+// Publish the samples of the batch oldest first, one dataset per active bank and sample.
+// A sample is removed once all of its datasets are published.
+void publishBatch() {
+  unsigned long startMs = millis();
+  if (!batchConnect()) {
+    Serial.println("No connection, batch kept for the next connection");
+    return;
+  }
+  batchSyncTime();
+  uint16_t published = 0;
+  while (const int16_t *values = rtcBatch.oldest()) {
+    bool ok = true;
+    for (uint8_t b = 0; b < SB_COUNT && ok; b++) {
+      const SensorBank &bank = banks[b];
+      if (!bank.active) continue;
+      DatasetRecord rec;
+      rec.timeMs = rtcBatch.oldestTime();
+      rec.dsNr = rtcBatch.dsNr(b);
+      rec.sbNr = bank.sbNr;
+      rec.slotMask = 0;
+      for (size_t i = 0; i < KNOWN_SENSORS; i++) {
+        rec.centi[i] = TEMP_INVALID_CENTI;
+        if (isAddressZero(bank.rom[i])) continue;
+        rec.slotMask |= 1 << i;
+        rec.centi[i] = *values++;
+      }
+      ok = publishRecord(rec);
+    }
+    if (!ok) break;
+    rtcBatch.pop();
+    published++;
+  }
+  publishMsg(STATUS_TOPIC, STATUS_SLEEP, true);     // a clean disconnect doesn't trigger the last will
+  client.disconnect();
+  Serial.print("Published "); Serial.print(published); Serial.print(" samples in ");
+  Serial.print(millis() - startMs); Serial.println(" ms");
+}
+
+// Deep sleep until the next sample point; the radio is only calibrated and powered on the wakes that connect
+void sleepUntilNextSample() {
+  unsigned long awakeMs = millis();
+  unsigned long sleepMs = awakeMs + SLEEP_MIN_MS < samplePeriodMs ? samplePeriodMs - awakeMs : SLEEP_MIN_MS;
+  rtcBatch.setSleepClock(timeSync.valid() ? timeSync.epochMs(awakeMs) + sleepMs : 0);
+  rtcBatch.save();
+  Serial.print("Samples in batch: "); Serial.print(rtcBatch.count());
+  Serial.print(", awake "); Serial.print(awakeMs); Serial.print(" ms, sleeping "); Serial.print(sleepMs); Serial.println(" ms");
+  ESP.deepSleep(sleepMs * 1000ULL, rtcBatch.connectNext() ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+}
+
+// One wake of the deep-sleep batch mode: take a sample, append it to the batch, publish the batch
+// if due and deep-sleep until the next sample point. Never returns.
+// The time runs on across the sleeps: the clock handed over by the previous wake refers to
+// millis() 0 of this boot, the NTP synchronization of the connecting wakes keeps it on track.
+void sleepBatchCycle() {
+  if (!rtcBatch.load()) Serial.println("No batch in RTC memory, starting a new one");
+  timeSync.set(rtcBatch.wakeClock(), 0);
+  if (!LittleFS.begin()) Serial.println("LittleFS not available, using the built-in sensor table");
+  setupSensors();
+
+  // one value per configured slot of the active banks, in bank and slot order
+  int16_t values[SB_COUNT * SLOTS_PER_BANK];
+  uint8_t width = 0, bankMask = 0;
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    if (banks[b].active) banks[b].bus.requestConversions();
+  }
+  sampleTimeMs = timeSync.epochMs(millis());
+  delay(convWaitMs);
+  readRetry.startCycle();
+  for (uint8_t b = 0; b < SB_COUNT; b++) {
+    SensorBank &bank = banks[b];
+    if (!bank.active) continue;
+    bankMask |= 1 << b;
+    DatasetRecord rec;
+    for (size_t i = 0; i < KNOWN_SENSORS; i++) while (!readSensorSlot(bank, i)) {}
+    // A sensor answering with its power-on value lost the conversion: convert once more, a second
+    // 85 degree C in a row is taken as the real temperature (see SampleFilter.h)
+    bool reset = false;
+    for (size_t i = 0; i < KNOWN_SENSORS; i++) if (bank.state[i] == SENSOR_RESET) reset = true;
+    if (reset) {
+      bank.bus.requestConversions();
+      delay(convWaitMs);
+      for (size_t i = 0; i < KNOWN_SENSORS; i++)
+        if (bank.state[i] == SENSOR_RESET) while (!readSensorSlot(bank, i)) {}
+    }
+    makeRecord(bank, bank.dsNr, sampleTimeMs, rec);
+    for (size_t i = 0; i < KNOWN_SENSORS; i++) {
+      if (rec.slotMask & (1 << i)) values[width++] = rec.centi[i];
+    }
+  }
+  if (!width) {
+    // no active bank: nothing to sample, the batch is kept as it is
+    Serial.println("No sensor configured, nothing to sample");
+    sleepUntilNextSample();
+    return;
+  }
+  rtcBatch.setLayout(width, bankMask, sensorTable.fingerprint());
+  if (!rtcBatch.push(values, sampleTimeMs)) Serial.println("Batch full, oldest sample dropped");
+
+  if (rtcBatch.connectDue()) {
+    publishBatch();
+    // at most a full batch between two connections
+    uint16_t samples = SLEEP_BATCH;
+    if (rtcBatch.capacity() && samples > rtcBatch.capacity()) samples = rtcBatch.capacity();
+    rtcBatch.scheduleConnect(samples);
+  }
+  sleepUntilNextSample();
+}
+#endif
+
+// Switch LCD pages if more sensors are configured than fit on one page,
+// and keep the network state indicator up to date
+void displayStep() {
+  static char shownIndicator = ' ';
+  if (splashShown) {
+    if (millis() < SPLASH_MS) return;
+    splashShown = false;
+    lcd.clear();
+    fb.invalidate();                  // LCD content is unknown to the framebuffer after the splash
+    pageStartMs = millis();
+    refreshDisplay();
+  }
+  if (connIndicator() != shownIndicator) {
+    shownIndicator = connIndicator();
+    refreshDisplay();
+  }
+
+  uint8_t pages = (configuredSlots(bankSlots, SB_COUNT) + 3) / 4;
+  if (pages <= 1) return;
+  if (millis() - pageStartMs < PAGE_PERIOD_MS) return;
+
+  pageStartMs = millis();
+  lcdPage = (lcdPage + 1) % pages;
+  refreshDisplay();
+}
+
 void setup()
 {
   // Start serial (for discovery and debugging)
@@ -323,146 +1904,58 @@ void setup()
   lcd.backlight();                    // Make sure backlight is on
   lcd.begin(20, 4);                   // Init LCD (20 col. by 4 rows), cursor is at top-left
   
-  // Start up the sensor library
-  sensors.begin();
-  delay(50);
-
   // Enter identification mode if identification-mode jumper is pulled to ground
   if (digitalRead(ID_PIN) == LOW) {
     identificationMode();
     // never reached: identificationMode loops forever until reset
   }
+#if SLEEP_BATCH
+  lcd.noBacklight();                  // no display in batch mode, the backlight would drain the battery
+#else
   lcd.print("MQTT MC-TempM Client");  // Line 0: print a message to the LCD
-  lcd.print("Vers. 2026-03-08    ");  // no cursor repositioning as previous line is fully used
+  lcd.print("Vers. " FW_VERSION "    ");  // no cursor repositioning as previous line is fully used
   lcd.print("--------------------");
-  delay(500);
-  lcd.print("Setting up client...");  
-  delay(3000);                        // wait to allow reading before switching display
+  lcd.print("Setting up client...");
+  splashShown = true;                 // shown until SPLASH_MS, the client starts up meanwhile
+#endif
 
-  setup_wifi(); 
+  // WiFi and broker connections are established by the connection manager from loop()
+  espClient.setTimeout(MQTT_CONNECT_TIMEOUT_MS);
   client.setServer(mqtt_server, 1883);
-}
-
-void loop()
-{
-  if (!client.connected()) {
-    reconnect();
-  }
-  client.loop();    // maintain the MQTT connection and process incoming messages
-
-  sensors.requestTemperatures();
-  lcd.clear();
-  uint8_t rowcnt = 0;           // reset row count for a new page
-
-  // Loop through each configured (known) sensor slot
-  for (size_t i = 0; i < KNOWN_SENSORS; i++) {
-    TempValue[i] = DEVICE_DISCONNECTED_C;
-    bool configured = !isAddressZero(knownSensors[i]);
-
-    // If configured and physically present, read by ROM address
-    if (configured) {
-      if (sensors.isConnected(knownSensors[i])) {
-        TempValue[i] = sensors.getTempC(knownSensors[i]);
-      }
-    }
-
-    // Update LCD with new temperature values:
-    // - only sensors configured are shown, 4 sensors on one LCD page, ordered by slot index.
-    // - if more than 4 sensores are configured, a second page is shown after some delay
-    // Note: all 8 slots are getting logged to the Serial Monitor
-    //
-    // Example of one LCD page with 4 configured sensors (slots 0,1,2,7) and 4 unconfigured slots (3,4,5,6):
-    // |12345678901234567890|
-    // +--------------------+
-    // !S0: Sensor_1 23.45°C!
-    // !S1: Sensor_2 23.45°C!
-    // !S4: Sensor_5 23.45°C!
-    // !S7: Sensor_6 23.45°C!
-    // +--------------------+
-    // 
-    // Note: Sensor names are truncated to 7 Characters to fit the display,
-    //       if a sensor is configured but not connected, the display shows "--.--"
-
-    if (configured) {
-      if (rowcnt == 4) {          // 2nd page for more than 4 sensors: show after a delay to allow reading the first page
-        delay(4000);              // wait n seconds before switching to the second page
-        lcd.clear();
-        rowcnt = 0;               // reset row count for the new page
-      }
-      lcd.setCursor(0, rowcnt);   // set cursor to current row (rowcnt is reset to 0 on a new page)
-
-
-      lcd.print("S"); lcd.print(i); lcd.print(": ");
-
-      // Make sure that a sensor name is always 7 characters long to ensure a consistent display format.
-      char eq_length_str[9] = "        "; // 8 chars + null terminator as buffer for the formatted name
-      strncpy(eq_length_str, knownNames[i], strlen(knownNames[i]));
-      eq_length_str[7] = '\0';
-      lcd.print(eq_length_str);
-      lcd.print(" ");
+  client.setSocketTimeout((MQTT_CONNECT_TIMEOUT_MS + 999) / 1000);
+  client.setCallback(callback);
 
-      if (TempValue[i] != DEVICE_DISCONNECTED_C) {
-        // Sensor configured and connected, show sensor name and temperature value
-        // Make sure the temp. value is always 5 characters long to ensure a consistent display format.
-        dtostrf(TempValue[i], 5, 2, eq_length_str);
-        lcd.print(eq_length_str);
-      } else {
-        // Sensor configured but not connected: show sensor name use "--.--" in place for the temperature value
-        lcd.print("--.--");
-      }
-      lcd.print(" \xDF" "C"); // print degree symbol and C
-      rowcnt++;
-    }
-    
-    // Simple logging to the Serial Monitor for all slots (only in debug builds)
-#if APP_DEBUG
-    Serial.print("Slot "); Serial.print(i); Serial.print(" ");
-    if (knownNames[i] && knownNames[i][0]) { Serial.print(knownNames[i]); Serial.print(" "); }
-    if (!configured) {
-      Serial.println("- not configured");
-    } else {
-      Serial.print("-> "); printAddress(knownSensors[i]); Serial.print(" : ");
-      if (TempValue[i] != DEVICE_DISCONNECTED_C) Serial.println(TempValue[i]);
-      else Serial.println("disconnected");
-    }
+#if SLEEP_BATCH
+  sleepBatchCycle();
+  // never reached: the client deep-sleeps until the next sample point
 #endif
-  }
-
-// Loop through all temperature values and assemble a JSON payload string for MQTT
-  // transmission.  The payload spec v1.3 requires friendly sensor names as keys
-  // inside "ts_dat"; unconfigured slots are omitted.  If a name is blank we
-  // fall back to a generated "slotN" identifier.
-  String payload = "{";
-  payload += "\"client\":\"" + String(CLIENT_NAME) + "\",";
-  payload += "\"sb_nr\":" + String(SB_NUMBER) + ",";
-  payload += "\"ds_nr\":" + String(dataset_nr++) + ",";
-  payload += "\"ts_dat\":{";
 
-  bool firstEntry = true;
-  for (size_t i = 0; i < KNOWN_SENSORS; i++) {
-    if (!isAddressZero(knownSensors[i])) {
-      // determine key (friendly name or default)
-      String fname = (knownNames[i][0] != '\0') ? String(knownNames[i]) :
-                     String("slot") + String(i);
-      float value = (TempValue[i] == DEVICE_DISCONNECTED_C) ? 99.99 : TempValue[i];
-      if (!firstEntry) payload += ",";
-      payload += "\"" + fname + "\":" + String(value, 2);
-      firstEntry = false;
-    }
+  // Datasets left in the spill area from before a reset get forwarded as well
+  if (datasetSpill.begin()) {
+    LittleFS.remove("/spill.bin");      // spill area of the records without sample time (up to 2026-03-08)
+    LittleFS.remove("/spill.pos");
+    LittleFS.remove("/spill2.bin");     // records with 9999 as the missing value (payload v1.5)
+    LittleFS.remove("/spill2.pos");
+  } else {
+    Serial.println("LittleFS not available, buffering in RAM only");
   }
 
-  payload += "}}";
+  // Start joining WiFi now, the join runs in the background while the sensors get set up
+  if (FastConnectFile::load(WIFI_FAST_PATH, wifiFast())) Serial.println("Fast-connect data loaded from flash");
+  conn.step(millis());
 
-  // publish single JSON blob for the whole bank
-  String topic = String(CLIENT_NAME) + "/sb" + String(SB_NUMBER);
-  client.publish(topic.c_str(), payload.c_str(), false);
-
-  // debugging output; double-guarded in case macros were misconfigured
-#if APP_DEBUG
-  Serial.print("Publish topic: "); Serial.println(topic);
-  Serial.print("Payload: "); Serial.println(payload);
-#endif
+  // Conversions are started asynchronously, the measurement engine in loop() waits for them
+  setupSensors();
+  pageStartMs = millis();
+  statsStartMs = millis();
+  datasetPublisher.setTiming(sysClock, phaseStats[PH_BUILD], phaseStats[PH_PUB]);
+  setupTasks();
+  diagLastMs = millis() - DIAG_PERIOD_MS;       // first diagnostics right after the broker connection
+}
 
-  // wait n seconds before starting next measurement cycle
-  delay(4000);
+void loop()
+{
+  PhaseTimer loopTimer(PH_LOOP);
+  diagSampleHeap();
+  scheduler.tick();                   // all work runs as tasks, see Tasks
 }
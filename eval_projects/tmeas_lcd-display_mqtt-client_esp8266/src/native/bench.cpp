@@ -0,0 +1,393 @@
+/*
+  Benchmark runner of the core paths (lib/TmcCore) on the host, built by [env:native]:
+
+    pio run -e native -t exec
+
+  The hardware is replaced by host implementations of the core interfaces: a bus handing out
+  prepared scratchpads, a display and an MQTT sink that only count. Each path runs for a fixed
+  number of iterations with 8 and 16 configured sensors; the time per iteration shows how two
+  versions of the core compare on the host, not the time on the ESP8266. The JSON payload is also
+  built by the String concatenation it replaced (std::string standing in for String), see
+  test/test_payload for the byte-for-byte comparison of both.
+
+  The read strategies of a measurement cycle are compared on simulated buses (lib/OneWireSim),
+  one bus per sensor bank as on the client. Reported is the simulated time per cycle: bus time
+  (the bus is driven) and cycle time (conversion start, waiting for the conversion and reading
+  all sensors), for the same population with a clean bus and with a noisy one. On the noisy bus
+  the readings that reach the client are counted: the filtered strategy shows what the sample
+  filter (lib/SampleFilter) keeps away from the LCD and the payloads. An alarm round (searchAlarms())
+  converts the two alarm slots of a bank and searches the bus, quiet and with one slot tripped.
+*/
+
+#include <chrono>
+#include <initializer_list>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include <TmcCore.h>
+#include <OneWireSim.h>
+
+namespace {
+
+constexpr uint8_t BANKS = 2;
+constexpr uint32_t ITERATIONS = 200000;
+
+// Every sensor answers with a valid 12 bit scratchpad of its own temperature
+class PreparedBus : public SensorBus {
+public:
+  void requestConversions() override {}
+  bool readScratchPad(const uint8_t* rom, uint8_t* sp) override {
+    int16_t raw = 320 + rom[1] * 3;             // 20.00 degree C and up, by sensor
+    memset(sp, 0, SCRATCHPAD_SIZE);
+    sp[0] = raw & 0xFF;
+    sp[1] = raw >> 8;
+    sp[4] = 0x7F;                               // 12 bit
+    sp[8] = dallasCrc8(sp, SCRATCHPAD_SIZE - 1);
+    return true;
+  }
+  void resetSearch() override {}
+  bool search(uint8_t*) override { return false; }
+  bool requestConversion(const uint8_t*) override { return true; }
+  void resetAlarmSearch() override {}
+  bool alarmSearch(uint8_t*) override { return false; }
+  bool setAlarm(const uint8_t*, int8_t, int8_t) override { return true; }
+};
+
+class NullDisplay : public CharDisplay {
+public:
+  void setCursor(uint8_t, uint8_t) override {}
+  size_t write(uint8_t) override { return ++chars, 1; }
+  uint32_t chars = 0;
+};
+
+class CountingSink : public MqttSink {
+public:
+  bool publish(const char*, const uint8_t*, size_t len, bool) override {
+    messages++;
+    bytes += len;
+    return true;
+  }
+  uint32_t messages = 0;
+  uint64_t bytes = 0;
+};
+
+uint8_t roms[BANKS][SLOTS_PER_BANK][ROM_SIZE];
+char names[BANKS][SLOTS_PER_BANK][SENSOR_NAME_MAX + 1];
+uint8_t resolution[BANKS][SLOTS_PER_BANK];
+int16_t offsets[BANKS][SLOTS_PER_BANK];
+BankSlots banks[BANKS];
+const BankSlots* const bankSlots[BANKS] = { &banks[0], &banks[1] };
+
+// Configure the first sensors slots, bank 0 first
+void populate(uint8_t sensors) {
+  memset(roms, 0, sizeof(roms));
+  for (uint8_t b = 0; b < BANKS; b++) {
+    banks[b] = BankSlots{ b, roms[b], names[b], resolution[b], offsets[b], {}, {} };
+    for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+      uint8_t n = b * SLOTS_PER_BANK + i;
+      snprintf(names[b][i], sizeof(names[b][i]), "Sensor%u", n);
+      resolution[b][i] = 12;
+      if (n >= sensors) continue;
+      roms[b][i][0] = 0x28;
+      roms[b][i][1] = n;
+      roms[b][i][ROM_SIZE - 1] = dallasCrc8(roms[b][i], ROM_SIZE - 1);
+    }
+  }
+}
+
+// Payload of a bank as the String based builder before lib/TmcPayload assembled it (with the
+// missing value of payload v1.6)
+std::string legacyPayload(const BankSlots& bank, uint32_t dsNr) {
+  std::string payload = "{";
+  payload += "\"client\":\"" + std::string("tmc0") + "\",";
+  payload += "\"sb_nr\":" + std::to_string(bank.sbNr) + ",";
+  payload += "\"ds_nr\":" + std::to_string(dsNr) + ",";
+  payload += "\"ts_dat\":{";
+  bool firstEntry = true;
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+    if (isAddressZero(bank.rom[i])) continue;
+    std::string fname = bank.names[i][0] != '\0' ? std::string(bank.names[i]) : "slot" + std::to_string(i);
+    float value = bank.state[i] != SENSOR_OK ? -327.68f : bank.tempRaw[i] * 0.0625f;
+    char digits[16];
+    snprintf(digits, sizeof(digits), "%.2f", (double)value);     // String(value, 2)
+    if (!firstEntry) payload += ",";
+    payload += "\"" + fname + "\":" + digits;
+    firstEntry = false;
+  }
+  payload += "}}";
+  return payload;
+}
+
+template <class F>
+void bench(const char* name, uint8_t sensors, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t n = 0; n < ITERATIONS; n++) f(n);
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  printf("%-24s %2u sensors %10.1f ns/iteration\n", name, sensors, ns / ITERATIONS);
+}
+
+// Acquisition of a client on simulated buses
+
+enum ReadStrategy : uint8_t {
+  READ_TWICE,                   // isConnected() + getTempC() of DallasTemperature, scratchpad read twice
+  READ_ONCE,                    // readSlot() of the core, scratchpad read once with CRC check
+  READ_TEMP_BYTES,              // only the 2 temperature bytes, no CRC
+  READ_FILTERED                 // readSlot() with up to 2 re-reads after a CRC error, then filterSlot()
+};
+const char* const strategyName[] = { "scratchpad twice", "scratchpad once", "temp bytes only", "once + filter" };
+
+enum ConvWait : uint8_t {
+  WAIT_FIXED,                   // maximum conversion time of the resolution, as the firmware does
+  WAIT_POLL                     // read slots every 10 ms until the conversion is done (external power only)
+};
+
+struct SimResult {
+  uint64_t busUs = 0;
+  uint64_t cycleUs = 0;
+  uint32_t ok = 0, absent = 0, crc = 0, powerOn = 0, wrong = 0;
+};
+
+class SimClient {
+public:
+  SimClient(uint8_t sensors, uint8_t resolution, bool noisy) : _resolution(resolution) {
+    for (uint8_t b = 0; b < BANKS; b++) {
+      _wire[b] = new OneWireSim(b + 1);
+      _bus[b] = new OneWireSimBus(*_wire[b]);
+      _filter[b] = new SampleFilter(_ring[b], 3, SampleFilter::MEDIAN, 1);
+      for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+        if (isAddressZero(roms[b][i])) continue;
+        int8_t dev = _wire[b]->add(roms[b][i], rawToCenti(expectedRaw(roms[b][i], 12)), resolution);
+        if (noisy) _wire[b]->setDropout(dev, 5);
+      }
+      // Sensors assumed to convert in 80 % of the maximum time, so polling has something to gain
+      _wire[b]->setConversionScale(80);
+      if (noisy) {
+        _wire[b]->setBitErrors(2);
+        _wire[b]->setGlitch(2);
+      }
+    }
+    _banks = (sensors + SLOTS_PER_BANK - 1) / SLOTS_PER_BANK;
+  }
+  ~SimClient() {
+    for (uint8_t b = 0; b < BANKS; b++) {
+      delete _filter[b];
+      delete _bus[b];
+      delete _wire[b];
+    }
+  }
+
+  static int16_t expectedRaw(const uint8_t* rom, uint8_t resolution) {
+    return (320 + rom[1] * 3) & ~((1 << (12 - resolution)) - 1);
+  }
+
+  void cycle(ReadStrategy strategy, ConvWait wait, SimResult& r) {
+    uint64_t start = now(), busStart = busUs();
+    for (uint8_t b = 0; b < _banks; b++) run([&] { _bus[b]->requestConversions(); });
+    if (wait == WAIT_FIXED) {
+      for (uint8_t b = 0; b < _banks; b++) _wire[b]->delay(OneWireSim::conversionMs(_resolution) + 1);
+    } else {
+      for (uint8_t b = 0; b < _banks; b++)
+        run([&] { while (!_wire[b]->read_bit()) _wire[b]->delay(10); });
+    }
+    sync();
+    for (uint8_t b = 0; b < _banks; b++) run([&] { readBank(b, strategy, r); });
+    r.cycleUs += now() - start;
+    r.busUs += busUs() - busStart;
+  }
+
+private:
+  // The buses are driven one after the other, time spent on one passes on the others too
+  template <class F>
+  void run(F f) {
+    f();
+    sync();
+  }
+  void sync() {
+    uint64_t t = now();
+    for (uint8_t b = 0; b < BANKS; b++) _wire[b]->delayMicroseconds(t - _wire[b]->micros());
+  }
+  uint64_t now() const {
+    uint64_t t = 0;
+    for (uint8_t b = 0; b < BANKS; b++) if (_wire[b]->micros() > t) t = _wire[b]->micros();
+    return t;
+  }
+  uint64_t busUs() const {
+    uint64_t t = 0;
+    for (uint8_t b = 0; b < BANKS; b++) t += _wire[b]->busUs();
+    return t;
+  }
+
+  void readBank(uint8_t b, ReadStrategy strategy, SimResult& r) {
+    BankSlots& bank = banks[b];
+    for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+      if (isAddressZero(bank.rom[i])) continue;
+      if (strategy == READ_TWICE) {
+        uint8_t sp[SCRATCHPAD_SIZE];
+        int16_t raw;
+        if (!_bus[b]->readScratchPad(bank.rom[i], sp) || decodeScratchPad(sp, raw) != SENSOR_OK) {
+          bank.state[i] = SENSOR_ABSENT;      // isConnected() false
+        } else {
+          readSlot(*_bus[b], bank, i);
+        }
+      } else if (strategy == READ_ONCE) {
+        readSlot(*_bus[b], bank, i);
+      } else if (strategy == READ_FILTERED) {
+        for (uint8_t n = 0; readSlot(*_bus[b], bank, i) == SENSOR_CRC_ERROR && n < 2; n++) {}
+        filterSlot(*_filter[b], bank, i);
+      } else {
+        OneWireSim& w = *_wire[b];
+        w.reset();
+        w.select(bank.rom[i]);
+        w.write(0xBE);
+        uint8_t lsb = w.read(), msb = w.read();
+        w.reset();
+        bank.tempRaw[i] = (int16_t)((msb << 8) | lsb) & ~((1 << (12 - _resolution)) - 1);
+        bank.state[i] = lsb == 0xFF && msb == 0xFF ? SENSOR_ABSENT : SENSOR_OK;
+      }
+      switch (bank.state[i]) {
+        case SENSOR_OK:
+          if (bank.tempRaw[i] == SIM_POWER_ON_RAW) r.powerOn++;
+          else if (bank.tempRaw[i] != expectedRaw(bank.rom[i], _resolution)) r.wrong++;
+          else r.ok++;
+          break;
+        case SENSOR_CRC_ERROR: r.crc++; break;
+        case SENSOR_RESET: r.powerOn++; break;
+        default: r.absent++; break;
+      }
+    }
+  }
+
+  OneWireSim* _wire[BANKS];
+  OneWireSimBus* _bus[BANKS];
+  SampleFilter* _filter[BANKS];
+  int16_t _ring[BANKS][3][SLOTS_PER_BANK];
+  uint8_t _banks;
+  uint8_t _resolution;
+};
+
+void simulate(uint8_t sensors) {
+  constexpr uint32_t CYCLES = 1000;
+  printf("\n%-18s %-5s %7s %3s %9s %9s   %s\n", "read strategy", "wait", "sensors", "res", "bus ms", "cycle ms",
+         "noisy bus: ok/absent/crc/85C/wrong");
+  for (uint8_t strategy = READ_TWICE; strategy <= READ_FILTERED; strategy++) {
+    for (uint8_t wait = WAIT_FIXED; wait <= WAIT_POLL; wait++) {
+      for (uint8_t res : { 9, 12 }) {
+        SimResult clean, noisy;
+        SimClient cleanClient(sensors, res, false), noisyClient(sensors, res, true);
+        for (uint32_t n = 0; n < CYCLES; n++) {
+          cleanClient.cycle((ReadStrategy)strategy, (ConvWait)wait, clean);
+          noisyClient.cycle((ReadStrategy)strategy, (ConvWait)wait, noisy);
+        }
+        printf("%-18s %-5s %7u %3u %9.2f %9.2f   %u/%u/%u/%u/%u\n", strategyName[strategy],
+               wait == WAIT_FIXED ? "fixed" : "poll", sensors, res, clean.busUs / 1000.0 / CYCLES,
+               clean.cycleUs / 1000.0 / CYCLES, noisy.ok, noisy.absent, noisy.crc, noisy.powerOn, noisy.wrong);
+      }
+    }
+  }
+
+  // Boot: search of the populations
+  OneWireSim wire[BANKS] = { OneWireSim(1), OneWireSim(2) };
+  for (uint8_t b = 0; b < BANKS; b++)
+    for (uint8_t i = 0; i < SLOTS_PER_BANK; i++)
+      if (!isAddressZero(roms[b][i])) wire[b].add(roms[b][i], 2000);
+  uint8_t found = 0;
+  for (uint8_t b = 0; b < BANKS; b++) {
+    OneWireSimBus bus(wire[b]);
+    BusPopulation pop;
+    searchBus(bus, pop);
+    found += pop.count;
+  }
+  printf("%-18s %-5s %7u found, %.2f ms bus time\n", "bus search", "", found,
+         (wire[0].busUs() + wire[1].busUs()) / 1000.0);
+
+  // Alarm rounds on bank 0: slots 0 and 1 with thresholds at 10 bit, the other sensors off
+  constexpr uint32_t ROUNDS = 100;
+  for (bool trip : { false, true }) {
+    OneWireSim aw(3);
+    for (uint8_t i = 0; i < SLOTS_PER_BANK; i++)
+      if (!isAddressZero(roms[0][i])) aw.add(roms[0][i], 2000, i < 2 ? 10 : 12);
+    OneWireSimBus abus(aw);
+    for (uint8_t i = 0; i < SLOTS_PER_BANK; i++)
+      if (!isAddressZero(roms[0][i])) abus.setAlarm(roms[0][i], i < 2 ? 0 : -55, i < 2 ? 25 : 125);
+    if (trip) aw.setTemperature(1, 2650);
+    uint64_t busStart = aw.busUs(), start = aw.micros();
+    uint8_t hits = 0;
+    for (uint32_t n = 0; n < ROUNDS; n++) {
+      int16_t raw[SLOTS_PER_BANK];
+      abus.requestConversion(roms[0][0]);
+      abus.requestConversion(roms[0][1]);
+      aw.delay(OneWireSim::conversionMs(10));
+      hits = searchAlarms(abus, banks[0], 0x03, raw);
+    }
+    printf("%-18s %-5s %7u tripped, %.2f ms bus, %.2f ms round\n", "alarm round", trip ? "trip" : "quiet",
+           __builtin_popcount(hits), (aw.busUs() - busStart) / 1000.0 / ROUNDS, (aw.micros() - start) / 1000.0 / ROUNDS);
+  }
+}
+
+} // namespace
+
+int main() {
+  PreparedBus bus;
+  NullDisplay display;
+  CountingSink sink;
+  LcdFrameBuffer fb;
+
+  for (uint8_t sensors : { 8, 16 }) {
+    populate(sensors);
+    uint8_t pages = (configuredSlots(bankSlots, BANKS) + LcdFrameBuffer::ROWS - 1) / LcdFrameBuffer::ROWS;
+
+    bench("read all slots", sensors, [&](uint32_t) {
+      for (uint8_t b = 0; b < BANKS; b++)
+        for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) readSlot(bus, banks[b], i);
+    });
+    display.chars = 0;
+    bench("render + flush page", sensors, [&](uint32_t n) {
+      renderLcdPage(fb, bankSlots, BANKS, n % pages, ' ');
+      fb.flush(display);
+    });
+    printf("%-24s %2u sensors %10.1f chars/iteration\n", "", sensors, (double)display.chars / ITERATIONS);
+    uint32_t valid = 0;             // used, so the records are not optimized away
+    bench("make record", sensors, [&](uint32_t n) {
+      DatasetRecord rec;
+      makeRecord(banks[n % BANKS], n, 1760612345678ULL + n, rec);
+      valid += rec.slotMask & 1;
+    });
+    if (!valid) printf("no sensor in the records\n");
+
+    size_t payloadBytes = 0;        // used, so the payloads are not optimized away
+    bench("payload String (legacy)", sensors, [&](uint32_t n) {
+      payloadBytes += legacyPayload(banks[0], n).size();
+    });
+    bench("payload buffer", sensors, [&](uint32_t n) {
+      PayloadEntry entries[SLOTS_PER_BANK];
+      uint8_t count = 0;
+      for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+        if (isAddressZero(banks[0].rom[i])) continue;
+        int16_t centi = banks[0].state[i] == SENSOR_OK ? slotCenti(banks[0], i) : TEMP_INVALID_CENTI;
+        entries[count++] = { banks[0].names[i], i, centi };
+      }
+      char buf[PAYLOAD_JSON_MAX + 1];
+      payloadBytes += buildPayloadJson(buf, sizeof(buf), "tmc0", banks[0].sbNr, n, 0, entries, count);
+    });
+    if (!payloadBytes) printf("no payload built\n");
+
+    for (uint8_t formats : { DatasetPublisher::JSON, DatasetPublisher::CBOR }) {
+      DatasetPublisher publisher(sink, "tmc0", formats);
+      sink.messages = 0;
+      sink.bytes = 0;
+      bench(formats == DatasetPublisher::JSON ? "publish JSON" : "publish CBOR", sensors, [&](uint32_t n) {
+        DatasetRecord rec;
+        makeRecord(banks[0], n, 1760612345678ULL + n, rec);
+        publisher.publish("tmc0/sb0", "tmc0/sb0/cbor", banks[0].names, rec);
+      });
+      printf("%-24s %2u sensors %10.1f bytes/message\n", "", sensors, (double)sink.bytes / sink.messages);
+    }
+  }
+
+  for (uint8_t sensors : { 8, 16 }) {
+    populate(sensors);
+    simulate(sensors);
+  }
+  return 0;
+}
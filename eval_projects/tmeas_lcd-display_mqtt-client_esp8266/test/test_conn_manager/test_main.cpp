@@ -0,0 +1,240 @@
+/*
+  ConnManager state machine on a simulated link and clock
+
+    pio test -e native -f test_conn_manager
+*/
+
+#include <unity.h>
+
+#include <ConnManager.h>
+
+namespace {
+
+constexpr uint32_t WIFI_TIMEOUT_MS = 10000;
+constexpr uint32_t MIN_BACKOFF_MS = 500;
+constexpr uint32_t MAX_BACKOFF_MS = 60000;
+constexpr uint32_t FAST_TIMEOUT_MS = 3000;
+
+// WiFi and broker as the test sets them; every call returns at once and is counted
+class FakeLink : public ConnLink {
+public:
+  bool wifiBegin(bool fast) override {
+    begins++;
+    calls++;
+    lastFast = fast && fastData;
+    if (joinWorks) wifi = true;
+    return lastFast;
+  }
+  bool wifiConnected() override { return wifi; }
+  BrokerResult mqttConnect() override {
+    connects++;
+    calls++;
+    mqtt = wifi && brokerUp && !brokerRefuses;
+    if (mqtt) return BROKER_CONNECTED;
+    return wifi && brokerUp ? BROKER_REFUSED : BROKER_UNREACHABLE;
+  }
+  bool mqttConnected() override { return mqtt && wifi; }
+  void onOnline() override { onlines++; }
+
+  bool wifi = false;
+  bool mqtt = false;
+  bool joinWorks = true;          // a join connects WiFi (at the next step)
+  bool brokerUp = true;            // false: no TCP connection to the broker
+  bool brokerRefuses = false;     // the broker answers with a CONNACK return code
+  bool fastData = false;          // fast-connect data is available
+  bool lastFast = false;
+  uint32_t begins = 0, connects = 0, onlines = 0, calls = 0;
+};
+
+FakeLink* link;
+ConnManager* conn;
+uint32_t now;
+
+void start(uint32_t seed = 1) {
+  delete conn;
+  delete link;
+  link = new FakeLink();
+  conn = new ConnManager(*link, seed, WIFI_TIMEOUT_MS, MIN_BACKOFF_MS, MAX_BACKOFF_MS, FAST_TIMEOUT_MS);
+  now = 1000;
+}
+
+// One step per ms of the fake clock; no step may attempt more than one join or broker connect
+void run(uint32_t ms) {
+  for (uint32_t end = now + ms; now != end; now++) {
+    link->calls = 0;
+    conn->step(now);
+    TEST_ASSERT_LESS_OR_EQUAL(1, link->calls);
+  }
+}
+
+// Run until the next backoff ended, returns its length (0: none within limitMs)
+uint32_t nextBackoff(uint32_t limitMs = 2 * MAX_BACKOFF_MS) {
+  uint32_t end = now + limitMs;
+  while (conn->state() != CONN_BACKOFF && now != end) run(1);
+  uint32_t startMs = now;
+  while (conn->state() == CONN_BACKOFF && now != end) run(1);
+  return now == end ? 0 : now - startMs;
+}
+
+void test_connects_without_blocking() {
+  start();
+  run(10);
+  TEST_ASSERT_EQUAL(CONN_ONLINE, conn->state());
+  TEST_ASSERT_EQUAL(1, link->begins);
+  TEST_ASSERT_EQUAL(1, link->onlines);
+  TEST_ASSERT_EQUAL(1, conn->stats().connects);
+  run(1000);                          // online: no further attempts
+  TEST_ASSERT_EQUAL(1, link->connects);
+}
+
+void test_backoff_doubles_up_to_max() {
+  start();
+  link->brokerUp = false;
+  uint32_t expected = MIN_BACKOFF_MS;
+  for (int n = 0; n < 12; n++) {
+    uint32_t wait = nextBackoff();
+    // the step after the wait ended counts as well, hence + 1
+    TEST_ASSERT_GREATER_OR_EQUAL(expected - expected / 4, wait);
+    TEST_ASSERT_LESS_OR_EQUAL(expected + expected / 4 + 1, wait);
+    expected = expected * 2 > MAX_BACKOFF_MS ? MAX_BACKOFF_MS : expected * 2;
+  }
+  TEST_ASSERT_EQUAL(MAX_BACKOFF_MS, expected);
+  TEST_ASSERT_EQUAL(12, conn->stats().mqttFailures);
+  TEST_ASSERT_EQUAL(1, link->begins);             // the broker failures don't touch WiFi
+}
+
+void test_backoff_resets_on_connect() {
+  start();
+  link->brokerUp = false;
+  for (int n = 0; n < 5; n++) nextBackoff();        // backoff now at 16 s
+  link->brokerUp = true;
+  nextBackoff();
+  run(2);
+  TEST_ASSERT_EQUAL(CONN_ONLINE, conn->state());
+  link->brokerUp = false;
+  link->mqtt = false;                 // broker lost
+  uint32_t wait = nextBackoff();
+  TEST_ASSERT_EQUAL(1, conn->stats().connectionLosses);
+  TEST_ASSERT_LESS_OR_EQUAL(MIN_BACKOFF_MS + MIN_BACKOFF_MS / 4 + 1, wait);
+}
+
+void test_jitter_within_bounds() {
+  uint32_t lo = UINT32_MAX, hi = 0;     // first waits of all clients
+  for (uint32_t seed = 1; seed <= 20; seed++) {
+    start(seed * 7919);
+    link->brokerUp = false;
+    uint32_t expected = MIN_BACKOFF_MS;
+    for (int n = 0; n < 4; n++) {
+      uint32_t wait = nextBackoff();
+      TEST_ASSERT_GREATER_OR_EQUAL(expected - expected / 4, wait);
+      TEST_ASSERT_LESS_OR_EQUAL(expected + expected / 4 + 1, wait);
+      if (n == 0) {
+        lo = wait < lo ? wait : lo;
+        hi = wait > hi ? wait : hi;
+      }
+      expected *= 2;
+    }
+  }
+  // clients with different seeds don't retry in lockstep
+  TEST_ASSERT_GREATER_THAN(MIN_BACKOFF_MS / 10, hi - lo);
+}
+
+void test_wifi_loss_while_online() {
+  start();
+  run(10);
+  TEST_ASSERT_EQUAL(CONN_ONLINE, conn->state());
+  link->wifi = false;
+  link->joinWorks = false;
+  run(1);
+  TEST_ASSERT_EQUAL(CONN_WIFI_START, conn->state());
+  TEST_ASSERT_EQUAL(1, conn->stats().connectionLosses);
+  TEST_ASSERT_FALSE(conn->wifiUp());
+  run(1);
+  TEST_ASSERT_EQUAL(CONN_WIFI_WAIT, conn->state());
+  TEST_ASSERT_EQUAL(2, link->begins);
+}
+
+void test_wifi_timeout_backs_off() {
+  start();
+  link->joinWorks = false;
+  run(WIFI_TIMEOUT_MS + 2);
+  TEST_ASSERT_EQUAL(CONN_BACKOFF, conn->state());
+  TEST_ASSERT_EQUAL(1, conn->stats().wifiFailures);
+  link->joinWorks = true;
+  nextBackoff();
+  run(3);
+  TEST_ASSERT_EQUAL(CONN_ONLINE, conn->state());
+}
+
+void test_fast_join_timeout_falls_back_at_once() {
+  start();
+  link->fastData = true;
+  link->joinWorks = false;
+  run(1);
+  TEST_ASSERT_TRUE(conn->fast());
+  run(FAST_TIMEOUT_MS + 1);
+  TEST_ASSERT_EQUAL(1, conn->stats().fastFailures);
+  TEST_ASSERT_EQUAL(2, link->begins);             // joined again without a backoff
+  TEST_ASSERT_FALSE(link->lastFast);
+  TEST_ASSERT_EQUAL(0, conn->stats().wifiFailures);
+}
+
+void test_fast_join_broker_unreachable_falls_back_at_once() {
+  start();
+  link->fastData = true;
+  link->brokerUp = false;
+  run(3);                             // join, connect WiFi, broker attempt
+  TEST_ASSERT_EQUAL(1, conn->stats().fastFailures);
+  TEST_ASSERT_EQUAL(1, conn->stats().mqttFailures);
+  link->brokerUp = true;
+  run(3);
+  TEST_ASSERT_EQUAL(CONN_ONLINE, conn->state());
+  TEST_ASSERT_EQUAL(2, link->begins);             // joined again without a backoff
+  TEST_ASSERT_FALSE(link->lastFast);
+}
+
+void test_fast_join_broker_refused_retries_before_wifi() {
+  start();
+  link->fastData = true;
+  link->brokerRefuses = true;
+  uint32_t wait = nextBackoff();                  // the refusal backs off, WiFi is kept
+  TEST_ASSERT_GREATER_OR_EQUAL(MIN_BACKOFF_MS - MIN_BACKOFF_MS / 4, wait);
+  TEST_ASSERT_EQUAL(1, link->begins);
+  TEST_ASSERT_EQUAL(1, conn->stats().mqttFailures);
+  run(2);                             // refused again: join with scan and DHCP
+  TEST_ASSERT_EQUAL(2, link->begins);
+  TEST_ASSERT_FALSE(link->lastFast);
+  TEST_ASSERT_EQUAL(2, conn->stats().mqttFailures);
+  TEST_ASSERT_EQUAL(0, conn->stats().fastFailures);
+  nextBackoff();                      // a slow join only backs off from now on
+  TEST_ASSERT_EQUAL(2, link->begins);
+  link->brokerRefuses = false;
+  run(2);
+  TEST_ASSERT_EQUAL(CONN_ONLINE, conn->state());
+  TEST_ASSERT_EQUAL(3, conn->stats().mqttFailures);
+}
+
+void test_state_names() {
+  TEST_ASSERT_EQUAL_STRING("online", ConnManager::stateName(CONN_ONLINE));
+  TEST_ASSERT_EQUAL_STRING("backoff", ConnManager::stateName(CONN_BACKOFF));
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_connects_without_blocking);
+  RUN_TEST(test_backoff_doubles_up_to_max);
+  RUN_TEST(test_backoff_resets_on_connect);
+  RUN_TEST(test_jitter_within_bounds);
+  RUN_TEST(test_wifi_loss_while_online);
+  RUN_TEST(test_wifi_timeout_backs_off);
+  RUN_TEST(test_fast_join_timeout_falls_back_at_once);
+  RUN_TEST(test_fast_join_broker_unreachable_falls_back_at_once);
+  RUN_TEST(test_fast_join_broker_refused_retries_before_wifi);
+  RUN_TEST(test_state_names);
+  return UNITY_END();
+}
@@ -0,0 +1,240 @@
+/*
+  Cooperative scheduler (lib/CoopScheduler) on a simulated clock
+
+  The tasks are plain functions, they record their runs in the globals below and may take
+  simulated time (taskUs) to test the budget accounting.
+
+    pio test -e native -f test_coop_scheduler
+*/
+
+#include <unity.h>
+
+#include <string.h>
+
+#include <CoopScheduler.h>
+
+namespace {
+
+class FakeClock : public Clock {
+public:
+  uint32_t millis() override { return ms; }
+  uint32_t micros() override { return us; }
+  void advance(uint32_t deltaMs) {
+    ms += deltaMs;
+    us += deltaMs * 1000;
+  }
+  uint32_t ms = 0;
+  uint32_t us = 0;
+};
+
+FakeClock simClock;
+CoopScheduler* sched;
+char order[64];                       // task letters in the order they ran
+uint32_t runMs[32];                   // times of the runs of task A
+uint8_t runsA;
+uint32_t taskUs;                      // time task A takes
+uint32_t lagSeen;
+int8_t chainTask = -1;
+uint8_t chainLeft;
+
+void note(char c) {
+  size_t n = strlen(order);
+  if (n + 1 < sizeof(order)) {
+    order[n] = c;
+    order[n + 1] = '\0';
+  }
+}
+
+void taskA() {
+  note('A');
+  if (runsA < 32) runMs[runsA] = simClock.ms;
+  runsA++;
+  lagSeen = sched->lagMs();
+  simClock.us += taskUs;
+}
+void taskB() { note('B'); }
+void taskC() { note('C'); }
+void taskChain() {
+  note('O');
+  if (--chainLeft) sched->runAfter(chainTask, 10);
+}
+
+// Ticks every stepMs up to (excluding) endMs
+void runUntil(uint32_t endMs, uint32_t stepMs) {
+  while ((int32_t)(simClock.ms - endMs) < 0) {
+    sched->tick();
+    simClock.advance(stepMs);
+  }
+}
+
+void test_periodic_grid() {
+  CoopScheduler s(simClock);
+  sched = &s;
+  uint32_t start = simClock.ms;
+  int8_t a = s.addPeriodic("a", taskA, 100, 1000);
+  runUntil(start + 1000, 7);
+  TEST_ASSERT_EQUAL(10, runsA);
+  for (uint8_t i = 0; i < 10; i++) {               // on the grid, not drifting by the tick step
+    TEST_ASSERT_GREATER_OR_EQUAL(start + i * 100, runMs[i]);
+    TEST_ASSERT_LESS_THAN(start + i * 100 + 7, runMs[i]);
+  }
+  TEST_ASSERT_EQUAL(10, s.stats(a).runs);
+  TEST_ASSERT_LESS_THAN(7, s.stats(a).maxLagMs);
+  TEST_ASSERT_EQUAL(0, s.stats(a).skipped);
+}
+
+void test_fell_behind_restarts_grid() {
+  CoopScheduler s(simClock);
+  sched = &s;
+  uint32_t start = simClock.ms;
+  int8_t a = s.addPeriodic("a", taskA, 100, 1000, 10);
+  s.tick();
+  TEST_ASSERT_EQUAL(0, runsA);                     // phase
+  simClock.advance(10);
+  s.tick();
+  simClock.advance(350);                              // e.g. a blocking call elsewhere
+  s.tick();
+  TEST_ASSERT_EQUAL(2, runsA);
+  TEST_ASSERT_EQUAL(250, lagSeen);
+  TEST_ASSERT_EQUAL(2, s.stats(a).skipped);        // 110 was due, 210 and 310 dropped
+  TEST_ASSERT_EQUAL(250, s.stats(a).maxLagMs);
+  simClock.advance(99);
+  s.tick();
+  TEST_ASSERT_EQUAL(2, runsA);                     // new grid from 360
+  simClock.advance(1);
+  s.tick();
+  TEST_ASSERT_EQUAL(3, runsA);
+  TEST_ASSERT_EQUAL(start + 460, runMs[2]);
+}
+
+void test_one_shot() {
+  CoopScheduler s(simClock);
+  sched = &s;
+  int8_t a = s.addOneShot("a", taskA, 1000);
+  runUntil(simClock.ms + 100, 1);
+  TEST_ASSERT_EQUAL(0, runsA);
+  TEST_ASSERT_FALSE(s.armed(a));
+
+  s.runAfter(a, 50);
+  TEST_ASSERT_TRUE(s.armed(a));
+  uint32_t armedAt = simClock.ms;
+  runUntil(simClock.ms + 200, 1);
+  TEST_ASSERT_EQUAL(1, runsA);
+  TEST_ASSERT_EQUAL(armedAt + 50, runMs[0]);
+  TEST_ASSERT_FALSE(s.armed(a));
+
+  s.runAfter(a, 10);
+  s.cancel(a);
+  runUntil(simClock.ms + 100, 1);
+  TEST_ASSERT_EQUAL(1, runsA);
+
+  order[0] = '\0';
+  chainTask = s.addOneShot("o", taskChain, 1000);  // arms itself again from its run
+  chainLeft = 3;
+  s.runAfter(chainTask, 0);
+  runUntil(simClock.ms + 100, 1);
+  TEST_ASSERT_EQUAL_STRING("OOO", order);
+  TEST_ASSERT_EQUAL(3, s.stats(chainTask).runs);
+}
+
+void test_order_and_every_tick() {
+  CoopScheduler s(simClock);
+  sched = &s;
+  s.addPeriodic("b", taskB, CoopScheduler::EVERY_TICK, 1000);
+  s.addPeriodic("a", taskA, 20, 1000);
+  int8_t c = s.addOneShot("c", taskC, 1000);
+  s.runAfter(c, 0);
+  s.tick();                                        // once per tick each, in the order added
+  s.tick();
+  simClock.advance(20);
+  s.tick();
+  TEST_ASSERT_EQUAL_STRING("BACBBA", order);
+  TEST_ASSERT_EQUAL(0, lagSeen);
+}
+
+void test_budget_overruns() {
+  CoopScheduler s(simClock);
+  sched = &s;
+  int8_t a = s.addPeriodic("a", taskA, CoopScheduler::EVERY_TICK, 2000);
+  taskUs = 1500;
+  s.tick();
+  taskUs = 3000;
+  s.tick();
+  taskUs = 2000;                                   // at the budget: no overrun
+  s.tick();
+  TEST_ASSERT_EQUAL(3, s.stats(a).runs);
+  TEST_ASSERT_EQUAL(1, s.stats(a).overruns);
+  TEST_ASSERT_EQUAL(3000, s.stats(a).maxUs);
+  TEST_ASSERT_EQUAL(2000, s.budgetUs(a));
+  s.resetStats();
+  TEST_ASSERT_EQUAL(0, s.stats(a).runs);
+  TEST_ASSERT_EQUAL(0, s.stats(a).maxUs);
+}
+
+void test_set_period_and_restart() {
+  CoopScheduler s(simClock);
+  sched = &s;
+  uint32_t start = simClock.ms;
+  int8_t a = s.addPeriodic("a", taskA, 1000, 1000);
+  s.tick();
+  simClock.advance(100);
+  s.setPeriod(a, 200);                             // the next run moves along
+  runUntil(start + 450, 1);
+  TEST_ASSERT_EQUAL(3, runsA);
+  TEST_ASSERT_EQUAL(start + 200, runMs[1]);
+  TEST_ASSERT_EQUAL(start + 400, runMs[2]);
+
+  s.cancel(a);                                     // stopped until runAfter()
+  runUntil(start + 1000, 1);
+  TEST_ASSERT_EQUAL(3, runsA);
+  s.runAfter(a, 5);
+  runUntil(start + 1250, 1);
+  TEST_ASSERT_EQUAL(5, runsA);
+  TEST_ASSERT_EQUAL(start + 1005, runMs[3]);
+  TEST_ASSERT_EQUAL(start + 1205, runMs[4]);
+}
+
+void test_millis_wrap() {
+  simClock.ms = 0xFFFFFF00;
+  CoopScheduler s(simClock);
+  sched = &s;
+  s.addPeriodic("a", taskA, 100, 1000);
+  runUntil(0xFFFFFF00 + 1000, 1);
+  TEST_ASSERT_EQUAL(10, runsA);
+  TEST_ASSERT_EQUAL(0xFFFFFF00 + 300, runMs[3]);
+}
+
+void test_limits() {
+  CoopScheduler s(simClock);
+  for (uint8_t i = 0; i < CoopScheduler::TASKS_MAX; i++) TEST_ASSERT_EQUAL(i, s.addOneShot("t", taskB, 1000));
+  TEST_ASSERT_EQUAL(-1, s.addPeriodic("x", taskB, 10, 1000));
+  TEST_ASSERT_FALSE(s.armed(-1));
+  volatile int8_t beyond = CoopScheduler::TASKS_MAX;   // read at run time: a constant index past the
+  TEST_ASSERT_FALSE(s.armed(beyond));                 // guard trips -Warray-bounds of the inlined armed()
+  s.runAfter(-1, 0);                               // ignored
+  s.tick();
+  TEST_ASSERT_EQUAL_STRING("", order);
+}
+
+} // namespace
+
+void setUp() {
+  order[0] = '\0';
+  runsA = 0;
+  taskUs = 0;
+  lagSeen = 0;
+}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_periodic_grid);
+  RUN_TEST(test_fell_behind_restarts_grid);
+  RUN_TEST(test_one_shot);
+  RUN_TEST(test_order_and_every_tick);
+  RUN_TEST(test_budget_overruns);
+  RUN_TEST(test_set_period_and_restart);
+  RUN_TEST(test_millis_wrap);
+  RUN_TEST(test_limits);
+  return UNITY_END();
+}
@@ -0,0 +1,93 @@
+/*
+  Phase statistics (lib/CycleStats): exact count/min/max/avg, percentiles within one bucket
+
+    pio test -e native -f test_cycle_stats
+*/
+
+#include <unity.h>
+
+#include <CycleStats.h>
+
+namespace {
+
+void test_empty() {
+  PhaseStats s;
+  TEST_ASSERT_EQUAL(0, s.count());
+  TEST_ASSERT_EQUAL(0, s.min());
+  TEST_ASSERT_EQUAL(0, s.max());
+  TEST_ASSERT_EQUAL(0, s.avg());
+  TEST_ASSERT_EQUAL(0, s.percentile(50));
+}
+
+void test_exact_values() {
+  PhaseStats s;
+  s.add(300);
+  s.add(100);
+  s.add(200);
+  s.add(STATS_CLAMP_US * 2);                  // min/max/avg aren't clamped
+  TEST_ASSERT_EQUAL(4, s.count());
+  TEST_ASSERT_EQUAL(100, s.min());
+  TEST_ASSERT_EQUAL(STATS_CLAMP_US * 2, s.max());
+  TEST_ASSERT_EQUAL((600 + STATS_CLAMP_US * 2) / 4, s.avg());
+  TEST_ASSERT_EQUAL(STATS_CLAMP_US * 2, s.percentile(100));
+  s.reset();
+  TEST_ASSERT_EQUAL(0, s.count());
+  TEST_ASSERT_EQUAL(0, s.max());
+}
+
+// A percentile is the upper bound of its bucket: never below the exact value, at most 25% above
+void test_percentile_bucket_bound() {
+  for (uint32_t us = 0; us < STATS_CLAMP_US; us += 1 + us / 97) {
+    PhaseStats s;
+    s.add(us);
+    s.add(STATS_CLAMP_US);                    // max above the bucket, so its upper bound is reported
+    uint32_t p = s.percentile(50);
+    TEST_ASSERT_GREATER_OR_EQUAL(us, p);
+    TEST_ASSERT_LESS_OR_EQUAL(us + us / 4, p);
+  }
+}
+
+void test_percentile_never_above_max() {
+  PhaseStats s;
+  for (uint8_t i = 0; i < 10; i++) s.add(1000);
+  TEST_ASSERT_EQUAL(1000, s.percentile(50));
+  TEST_ASSERT_EQUAL(1000, s.percentile(99));
+}
+
+void test_percentile_rank() {
+  PhaseStats s;
+  for (uint8_t i = 0; i < 98; i++) s.add(10);
+  s.add(5000);
+  s.add(9000);
+  TEST_ASSERT_EQUAL(11, s.percentile(50));   // bucket 10..11
+  TEST_ASSERT_EQUAL(11, s.percentile(98));
+  TEST_ASSERT_GREATER_OR_EQUAL(5000, s.percentile(99));
+  TEST_ASSERT_LESS_THAN(9000, s.percentile(99));
+  TEST_ASSERT_EQUAL(9000, s.percentile(100));
+}
+
+// A phase counted on every loop() pass: buckets are halved instead of overflowing
+void test_histogram_halving_keeps_shape() {
+  PhaseStats s;
+  for (uint32_t i = 0; i < 300000; i++) s.add(i % 10 ? 50 : 2000);
+  TEST_ASSERT_EQUAL(300000, s.count());
+  TEST_ASSERT_EQUAL(55, s.percentile(50));   // bucket 48..55
+  TEST_ASSERT_EQUAL(55, s.percentile(89));
+  TEST_ASSERT_EQUAL(2000, s.percentile(95));
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_exact_values);
+  RUN_TEST(test_percentile_bucket_bound);
+  RUN_TEST(test_percentile_never_above_max);
+  RUN_TEST(test_percentile_rank);
+  RUN_TEST(test_histogram_halving_keeps_shape);
+  return UNITY_END();
+}
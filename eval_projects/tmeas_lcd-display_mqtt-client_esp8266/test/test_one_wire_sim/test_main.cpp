@@ -0,0 +1,242 @@
+/*
+  OneWire bus simulator (lib/OneWireSim): what the read strategies of the benchmark rely on
+
+  ROM search and alarm search, scratchpad and conversion timing, power-on value, dropouts and
+  bit errors, TH/TL in the EEPROM, and the bus time of a transaction.
+
+    pio test -e native -f test_one_wire_sim
+*/
+
+#include <unity.h>
+
+#include <string.h>
+
+#include <OneWireSim.h>
+
+namespace {
+
+// DS18B20 ROM code with a serial number and a valid CRC
+void makeRom(uint8_t* rom, uint32_t serial) {
+  memset(rom, 0, ROM_SIZE);
+  rom[0] = 0x28;
+  for (uint8_t i = 0; i < 4; i++) rom[1 + i] = serial >> (8 * i);
+  rom[ROM_SIZE - 1] = dallasCrc8(rom, ROM_SIZE - 1);
+}
+
+// Bus time of writing a byte, by the 1s and 0s in it
+uint32_t writeUs(uint8_t v) {
+  uint32_t us = 0;
+  for (uint8_t b = 0; b < 8; b++) us += (v >> b) & 1 ? SIM_WRITE1_US : SIM_WRITE0_US;
+  return us;
+}
+
+void test_search_order_and_crc() {
+  const uint32_t serials[] = { 0x00A1B2, 0x000003, 0x7F0001, 0x000100, 0x123456 };
+  uint8_t rom[ROM_SIZE];
+  OneWireSim forward, backward;
+  for (uint8_t i = 0; i < 5; i++) {
+    makeRom(rom, serials[i]);
+    forward.add(rom, 2000);
+    makeRom(rom, serials[4 - i]);
+    backward.add(rom, 2000);
+  }
+  OneWireSimBus fbus(forward), bbus(backward);
+  BusPopulation a, b;
+  searchBus(fbus, a);
+  searchBus(bbus, b);
+  TEST_ASSERT_EQUAL(5, a.count);
+  TEST_ASSERT_TRUE(samePopulation(a, b));             // the order is given by the ROM codes
+  for (uint8_t i = 0; i < a.count; i++) {
+    TEST_ASSERT_EQUAL_HEX8(dallasCrc8(a.rom[i], ROM_SIZE - 1), a.rom[i][ROM_SIZE - 1]);
+    for (uint8_t j = 0; j < i; j++) TEST_ASSERT_TRUE(memcmp(a.rom[i], a.rom[j], ROM_SIZE) != 0);
+  }
+
+  makeRom(rom, 0x000200);
+  rom[ROM_SIZE - 1] ^= 0xFF;                          // found by the search, dropped by searchBus()
+  forward.add(rom, 2000);
+  searchBus(fbus, a);
+  TEST_ASSERT_EQUAL(5, a.count);
+
+  OneWireSim empty;
+  TEST_ASSERT_EQUAL(0, empty.reset());
+  empty.reset_search();
+  TEST_ASSERT_FALSE(empty.search(rom));
+}
+
+void test_conversion_timing_and_power_on() {
+  uint8_t rom[ROM_SIZE];
+  makeRom(rom, 1);
+  OneWireSim wire;
+  wire.add(rom, 2350, 9);
+  OneWireSimBus bus(wire);
+  uint8_t sp[SCRATCHPAD_SIZE];
+  int16_t raw;
+  TEST_ASSERT_TRUE(bus.readScratchPad(rom, sp));
+  TEST_ASSERT_EQUAL(SENSOR_OK, decodeScratchPad(sp, raw));
+  TEST_ASSERT_EQUAL(SIM_POWER_ON_RAW, raw);           // before the first conversion
+
+  TEST_ASSERT_EQUAL(93, OneWireSim::conversionMs(9));
+  TEST_ASSERT_EQUAL(750, OneWireSim::conversionMs(12));
+  bus.requestConversions();
+  TEST_ASSERT_EQUAL(0, wire.read_bit());              // converting
+  wire.delay(80);
+  TEST_ASSERT_EQUAL(0, wire.read_bit());
+  bus.readScratchPad(rom, sp);                        // too early: the previous value
+  decodeScratchPad(sp, raw);
+  TEST_ASSERT_EQUAL(SIM_POWER_ON_RAW, raw);
+  wire.delay(7);                                      // 93.75 ms at 9 bit, the read took about 6 ms
+  bus.readScratchPad(rom, sp);
+  decodeScratchPad(sp, raw);
+  TEST_ASSERT_EQUAL(376, raw);                        // 23.50
+
+  wire.setConversionScale(50);
+  wire.setTemperature(0, -1000);
+  bus.requestConversions();
+  wire.delay(47);
+  bus.readScratchPad(rom, sp);
+  decodeScratchPad(sp, raw);
+  TEST_ASSERT_EQUAL(-160, raw);
+
+  wire.setGlitch(1000);                               // every conversion ends in a power-on reset
+  bus.requestConversions();
+  wire.delay(94);
+  bus.readScratchPad(rom, sp);
+  decodeScratchPad(sp, raw);
+  TEST_ASSERT_EQUAL(SIM_POWER_ON_RAW, raw);
+}
+
+void test_bus_time() {
+  uint8_t rom[ROM_SIZE];
+  makeRom(rom, 0x4711);
+  OneWireSim wire;
+  wire.add(rom, 2000);
+  OneWireSimBus bus(wire);
+  uint8_t sp[SCRATCHPAD_SIZE];
+  uint32_t expected = 2 * SIM_RESET_US + writeUs(0x55) + writeUs(0xBE) + SCRATCHPAD_SIZE * 8 * SIM_READ_US;
+  for (uint8_t i = 0; i < ROM_SIZE; i++) expected += writeUs(rom[i]);
+  uint64_t before = wire.busUs();
+  bus.readScratchPad(rom, sp);
+  TEST_ASSERT_EQUAL(expected, wire.busUs() - before);
+
+  before = wire.busUs();
+  uint64_t start = wire.micros();
+  wire.delay(100);                                    // waiting isn't bus time
+  TEST_ASSERT_EQUAL(0, wire.busUs() - before);
+  TEST_ASSERT_EQUAL(100000, wire.micros() - start);
+}
+
+void test_dropouts_and_bit_errors() {
+  uint8_t rom[ROM_SIZE];
+  makeRom(rom, 7);
+  OneWireSim wire(42);
+  wire.add(rom, 2000);
+  OneWireSimBus bus(wire);
+  uint8_t sp[SCRATCHPAD_SIZE];
+  int16_t raw;
+
+  wire.setDropout(0, 1000);
+  TEST_ASSERT_FALSE(bus.readScratchPad(rom, sp));
+  wire.setDropout(0, 0);
+  TEST_ASSERT_TRUE(bus.readScratchPad(rom, sp));
+
+  wire.setBitErrors(1000);                            // a flipped bit in every byte
+  uint8_t crcErrors = 0;
+  for (uint8_t i = 0; i < 100; i++) {
+    bus.readScratchPad(rom, sp);
+    if (decodeScratchPad(sp, raw) == SENSOR_CRC_ERROR) crcErrors++;
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(95, crcErrors);
+  wire.setBitErrors(0);
+  bus.readScratchPad(rom, sp);
+  TEST_ASSERT_EQUAL(SENSOR_OK, decodeScratchPad(sp, raw));
+}
+
+void test_alarm_search() {
+  uint8_t roms[4][ROM_SIZE];
+  OneWireSim wire;
+  for (uint8_t i = 0; i < 4; i++) {
+    makeRom(roms[i], 0x100 + i);
+    wire.add(roms[i], 2000);
+  }
+  wire.setAlarm(0, 25, 10);                           // in range
+  wire.setAlarm(1, 20, 10);                           // at TH: alarm
+  wire.setAlarm(2, 30, 20);                           // at TL: alarm
+  for (uint8_t i = 0; i < 3; i++) wire.powerOn(i);    // TH/TL recalled from the EEPROM
+  OneWireSimBus bus(wire);                            // device 3: factory TH 75/TL 70, alarm at 20
+  uint8_t rom[ROM_SIZE];
+  bus.resetAlarmSearch();
+  TEST_ASSERT_TRUE(bus.alarmSearch(rom));             // power-on value 85 is above every TH
+  bus.requestConversions();
+  wire.delay(OneWireSim::conversionMs(12) + 1);
+
+  bool found[4] = {};
+  uint8_t hits = 0;
+  bus.resetAlarmSearch();
+  while (bus.alarmSearch(rom)) {
+    for (uint8_t i = 0; i < 4; i++) if (memcmp(rom, roms[i], ROM_SIZE) == 0) found[i] = true;
+    hits++;
+  }
+  TEST_ASSERT_EQUAL(3, hits);
+  TEST_ASSERT_FALSE(found[0]);
+  TEST_ASSERT_TRUE(found[1] && found[2] && found[3]);
+}
+
+void test_set_alarm_eeprom() {
+  uint8_t rom[ROM_SIZE];
+  makeRom(rom, 9);
+  OneWireSim wire;
+  wire.add(rom, 2000, 10);
+  OneWireSimBus bus(wire);
+  TEST_ASSERT_TRUE(bus.setAlarm(rom, -30, -12));
+  wire.powerOn(0);                                    // recalled from the EEPROM
+  uint8_t sp[SCRATCHPAD_SIZE];
+  bus.readScratchPad(rom, sp);
+  TEST_ASSERT_EQUAL(-12, (int8_t)sp[2]);
+  TEST_ASSERT_EQUAL(-30, (int8_t)sp[3]);
+  TEST_ASSERT_EQUAL_HEX8(0x3F, sp[4]);                // resolution kept
+
+  uint64_t before = wire.busUs();
+  TEST_ASSERT_TRUE(bus.setAlarm(rom, -30, -12));      // unchanged: only the scratchpad is read
+  uint64_t readOnly = wire.busUs() - before;
+  before = wire.busUs();
+  bus.readScratchPad(rom, sp);
+  TEST_ASSERT_EQUAL(wire.busUs() - before, readOnly);
+
+  uint8_t other[ROM_SIZE];
+  makeRom(other, 10);
+  TEST_ASSERT_FALSE(bus.setAlarm(other, -30, -12));
+}
+
+void test_parasite_power() {
+  uint8_t rom[ROM_SIZE];
+  OneWireSim wire;
+  makeRom(rom, 1);
+  wire.add(rom, 2000);
+  wire.reset();
+  wire.skip();
+  wire.write(0xB4);                                   // READ POWER SUPPLY
+  TEST_ASSERT_EQUAL(1, wire.read_bit());
+  makeRom(rom, 2);
+  wire.add(rom, 2000, 12, true);
+  wire.reset();
+  wire.skip();
+  wire.write(0xB4);
+  TEST_ASSERT_EQUAL(0, wire.read_bit());
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_search_order_and_crc);
+  RUN_TEST(test_conversion_timing_and_power_on);
+  RUN_TEST(test_bus_time);
+  RUN_TEST(test_dropouts_and_bit_errors);
+  RUN_TEST(test_alarm_search);
+  RUN_TEST(test_set_alarm_eeprom);
+  RUN_TEST(test_parasite_power);
+  return UNITY_END();
+}
@@ -0,0 +1,125 @@
+/*
+  Payload serialization (lib/TmcPayload) against the String based builder it replaced
+
+  The legacy builder is kept here as it was in main.cpp (String concatenation, values as float
+  formatted by String(value, 2), i.e. printf "%.2f"), extended by time_ms of payload spec v1.5.
+  Both get the same datasets over the whole DS18B20 range at every resolution and have to give
+  the same bytes.
+
+    pio test -e native -f test_payload
+*/
+
+#include <unity.h>
+
+#include <stdio.h>
+#include <string>
+
+#include <TmcPayload.h>
+
+namespace {
+
+constexpr int16_t RAW_MIN = -55 * 16;
+constexpr int16_t RAW_MAX = 125 * 16;
+const char* const NAMES[SLOTS_PER_BANK] = { "Indoor0", "Indoor1", "", "Outdoor", "s4", "s5", "s6", "Freezer" };
+
+// String(value, 2) of the Arduino core
+std::string string2(float value) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%.2f", (double)value);
+  return buf;
+}
+
+// The builder before lib/TmcPayload; valid[] false publishes the missing value of payload v1.6
+std::string legacyPayload(const char* client, uint8_t sbNr, uint32_t dsNr, uint64_t timeMs,
+                          const float* value, const bool* valid, uint8_t count) {
+  std::string payload = "{";
+  payload += "\"client\":\"" + std::string(client) + "\",";
+  payload += "\"sb_nr\":" + std::to_string(sbNr) + ",";
+  payload += "\"ds_nr\":" + std::to_string(dsNr) + ",";
+  if (timeMs) payload += "\"time_ms\":" + std::to_string(timeMs) + ",";
+  payload += "\"ts_dat\":{";
+  bool firstEntry = true;
+  for (uint8_t i = 0; i < count; i++) {
+    std::string fname = NAMES[i][0] != '\0' ? std::string(NAMES[i]) : "slot" + std::to_string(i);
+    float v = valid[i] ? value[i] : -327.68f;
+    if (!firstEntry) payload += ",";
+    payload += "\"" + fname + "\":" + string2(v);
+    firstEntry = false;
+  }
+  payload += "}}";
+  return payload;
+}
+
+// Raw readings the sensor delivers at a resolution: the undefined low bits are 0
+int16_t rawAt(int16_t raw, uint8_t resolution) {
+  return raw & ~((1 << (12 - resolution)) - 1);
+}
+
+// Compare both builders for 8 slots with the readings starting at raw
+void compare(int16_t raw, uint8_t resolution, uint64_t timeMs, const bool* valid) {
+  float value[SLOTS_PER_BANK];
+  PayloadEntry entries[SLOTS_PER_BANK];
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+    int16_t r = rawAt(raw + i * (1 << (12 - resolution)), resolution);
+    if (r > RAW_MAX) r = RAW_MAX;
+    value[i] = r * 0.0625f;                   // DallasTemperature getTempC()
+    entries[i] = { NAMES[i], i, valid[i] ? rawToCenti(r) : TEMP_INVALID_CENTI };
+  }
+  char buf[PAYLOAD_JSON_MAX + 1];
+  size_t len = buildPayloadJson(buf, sizeof(buf), "tmc0", 1, 4294967295UL, timeMs, entries, SLOTS_PER_BANK);
+  std::string expected = legacyPayload("tmc0", 1, 4294967295UL, timeMs, value, valid, SLOTS_PER_BANK);
+  TEST_ASSERT_EQUAL(expected.size(), len);
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), buf);
+}
+
+const bool ALL_VALID[SLOTS_PER_BANK] = { true, true, true, true, true, true, true, true };
+
+void test_full_range_every_resolution() {
+  for (uint8_t res = 9; res <= 12; res++) {
+    int16_t step = SLOTS_PER_BANK * (1 << (12 - res));
+    for (int32_t raw = RAW_MIN; raw <= RAW_MAX; raw += step) compare((int16_t)raw, res, 0, ALL_VALID);
+  }
+}
+
+void test_invalid_marker() {
+  const bool valid[SLOTS_PER_BANK] = { true, false, true, false, false, true, true, false };
+  compare(-2, 12, 0, valid);
+  compare(1600, 12, 1760612345678ULL, valid);
+
+  PayloadEntry entry = { "OD", 0, TEMP_INVALID_CENTI };
+  char buf[PAYLOAD_JSON_MAX + 1];
+  buildPayloadJson(buf, sizeof(buf), "tmc0", 0, 0, 0, &entry, 1);
+  TEST_ASSERT_EQUAL_STRING("{\"client\":\"tmc0\",\"sb_nr\":0,\"ds_nr\":0,\"ts_dat\":{\"OD\":-327.68}}", buf);
+}
+
+void test_time_ms_on_off() {
+  for (uint64_t timeMs : { 0ULL, 1ULL, 1760612345678ULL, 9999999999999ULL }) {
+    for (int16_t raw : { RAW_MIN, (int16_t)-1, (int16_t)0, (int16_t)1, RAW_MAX }) compare(raw, 12, timeMs, ALL_VALID);
+  }
+}
+
+void test_worst_case_fits() {
+  PayloadEntry entries[SLOTS_PER_BANK];
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) entries[i] = { "Sensor_" "0", i, TEMP_INVALID_CENTI };
+  char buf[PAYLOAD_JSON_MAX + 1];
+  size_t len = buildPayloadJson(buf, sizeof(buf), "tmc00000", 255, 4294967295UL, 9999999999999ULL, entries,
+                                SLOTS_PER_BANK);
+  TEST_ASSERT_TRUE(len > 0);
+  TEST_ASSERT_LESS_OR_EQUAL(PAYLOAD_JSON_MAX, len);
+  TEST_ASSERT_EQUAL(0, buildPayloadJson(buf, len, "tmc00000", 255, 4294967295UL, 9999999999999ULL, entries,
+                                        SLOTS_PER_BANK));
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_full_range_every_resolution);
+  RUN_TEST(test_invalid_marker);
+  RUN_TEST(test_time_ms_on_off);
+  RUN_TEST(test_worst_case_fits);
+  return UNITY_END();
+}
@@ -0,0 +1,144 @@
+/*
+  Spike rejecting sample filter (lib/SampleFilter): median and trimmed mean, the power-on
+  value, holding over failed reads
+
+    pio test -e native -f test_sample_filter
+*/
+
+#include <unity.h>
+
+#include <SampleFilter.h>
+
+namespace {
+
+constexpr int16_t T20 = 20 * 16;              // 20.00 degree C, raw
+
+int16_t ring[SampleFilter::DEPTH_MAX][SLOTS_PER_BANK];
+
+void test_median_rejects_spike() {
+  SampleFilter f(ring, 3, SampleFilter::MEDIAN, 1);
+  TEST_ASSERT_FALSE(f.valid(0));
+  f.add(0, T20);
+  TEST_ASSERT_TRUE(f.valid(0));
+  TEST_ASSERT_EQUAL(T20, f.value(0));
+  f.add(0, T20 + 2);
+  TEST_ASSERT_EQUAL(T20 + 1, f.value(0));       // mean of the middle two
+  f.add(0, 2000);                               // spike
+  TEST_ASSERT_EQUAL(T20 + 2, f.value(0));
+  f.add(0, T20 + 16);                           // replaces the oldest (T20)
+  TEST_ASSERT_EQUAL(T20 + 16, f.value(0));      // T20 + 2, T20 + 16, 2000
+}
+
+void test_median_step_delay() {
+  SampleFilter f(ring, 3, SampleFilter::MEDIAN, 1);
+  for (uint8_t i = 0; i < 3; i++) f.add(1, T20);
+  f.add(1, T20 + 80);
+  TEST_ASSERT_EQUAL(T20, f.value(1));
+  f.add(1, T20 + 80);
+  TEST_ASSERT_EQUAL(T20 + 80, f.value(1));
+}
+
+void test_rounding() {
+  SampleFilter f(ring, 2, SampleFilter::MEDIAN, 1);
+  f.add(0, 401);
+  f.add(0, 402);
+  TEST_ASSERT_EQUAL(402, f.value(0));           // halves away from zero
+  f.add(1, -401);
+  f.add(1, -402);
+  TEST_ASSERT_EQUAL(-402, f.value(1));
+}
+
+void test_trimmed_mean() {
+  SampleFilter f(ring, 5, SampleFilter::TRIMMED_MEAN, 1);
+  f.add(2, 400);
+  f.add(2, 404);
+  TEST_ASSERT_EQUAL(402, f.value(2));           // below 3 samples: plain mean
+  f.add(2, -300);
+  TEST_ASSERT_EQUAL(400, f.value(2));
+  f.add(2, 401);
+  f.add(2, 2000);
+  TEST_ASSERT_EQUAL(402, f.value(2));           // lowest and highest dropped: 400, 401, 404
+  f.add(2, 403);                                // replaces the oldest (400)
+  TEST_ASSERT_EQUAL(403, f.value(2));           // 401, 403, 404 -> 402.67
+}
+
+void test_power_on_value() {
+  SampleFilter f(ring, 3, SampleFilter::MEDIAN, 1);
+  f.add(0, T20);
+  TEST_ASSERT_FALSE(f.add(0, SampleFilter::POWER_ON_RAW));
+  TEST_ASSERT_EQUAL(1, f.stats().rejected);
+  TEST_ASSERT_EQUAL(1, f.stats().held);         // rejected like a miss
+  TEST_ASSERT_EQUAL(T20, f.value(0));
+  TEST_ASSERT_TRUE(f.add(0, SampleFilter::POWER_ON_RAW));   // twice in a row: real
+  TEST_ASSERT_TRUE(f.add(0, SampleFilter::POWER_ON_RAW));
+  TEST_ASSERT_EQUAL(SampleFilter::POWER_ON_RAW, f.value(0));
+
+  f.add(1, T20);                                // a valid read in between starts over
+  TEST_ASSERT_FALSE(f.add(1, SampleFilter::POWER_ON_RAW));
+  f.add(1, T20);
+  TEST_ASSERT_FALSE(f.add(1, SampleFilter::POWER_ON_RAW));
+  f.miss(1);                                    // a failed read as well
+  TEST_ASSERT_FALSE(f.add(1, SampleFilter::POWER_ON_RAW));
+
+  TEST_ASSERT_FALSE(f.add(2, SampleFilter::POWER_ON_RAW));  // no history: not plausible
+  TEST_ASSERT_FALSE(f.valid(2));
+  f.add(3, SampleFilter::POWER_ON_RAW - SampleFilter::POWER_ON_NEAR_RAW);
+  TEST_ASSERT_TRUE(f.add(3, SampleFilter::POWER_ON_RAW));   // near the latest sample
+  f.resetStats();
+  TEST_ASSERT_EQUAL(0, f.stats().rejected);
+}
+
+void test_hold_and_lose() {
+  SampleFilter f(ring, 3, SampleFilter::MEDIAN, 2);
+  f.add(4, T20);
+  f.miss(4);
+  f.miss(4);
+  TEST_ASSERT_TRUE(f.valid(4));
+  TEST_ASSERT_EQUAL(T20, f.value(4));
+  TEST_ASSERT_EQUAL(2, f.stats().held);
+  f.miss(4);
+  TEST_ASSERT_FALSE(f.valid(4));
+  TEST_ASSERT_EQUAL(1, f.stats().lost);
+  f.miss(4);                                    // nothing left to lose
+  TEST_ASSERT_EQUAL(1, f.stats().lost);
+
+  f.add(4, T20 + 16);                           // starts from scratch, the old samples are gone
+  TEST_ASSERT_EQUAL(T20 + 16, f.value(4));
+  f.miss(4);
+  f.miss(4);
+  f.add(4, T20 + 16);                           // a read resets the misses in a row
+  f.miss(4);
+  f.miss(4);
+  TEST_ASSERT_TRUE(f.valid(4));
+}
+
+void test_depth_one_and_clear() {
+  SampleFilter f(ring, 1, SampleFilter::MEDIAN, 1);
+  f.add(5, T20);
+  f.add(5, 2000);
+  TEST_ASSERT_EQUAL(2000, f.value(5));          // no filtering
+  TEST_ASSERT_FALSE(f.add(5, SampleFilter::POWER_ON_RAW));  // the rejection stays
+  TEST_ASSERT_EQUAL(2000, f.value(5));
+
+  f.add(6, T20);
+  f.clear(5);
+  TEST_ASSERT_FALSE(f.valid(5));
+  TEST_ASSERT_EQUAL(T20, f.value(6));           // slots are independent
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_median_rejects_spike);
+  RUN_TEST(test_median_step_delay);
+  RUN_TEST(test_rounding);
+  RUN_TEST(test_trimmed_mean);
+  RUN_TEST(test_power_on_value);
+  RUN_TEST(test_hold_and_lose);
+  RUN_TEST(test_depth_one_and_clear);
+  return UNITY_END();
+}
@@ -0,0 +1,222 @@
+/*
+  Hardware alarms (lib/SensorAlarm, searchAlarms() of lib/TmcCore): trip and clear of the slots,
+  pending alerts, the alert payload, and the alarm search on the simulated bus
+
+    pio test -e native -f test_sensor_alarm
+*/
+
+#include <unity.h>
+
+#include <string.h>
+
+#include <SensorAlarm.h>
+#include <TmcCore.h>
+#include <OneWireSim.h>
+
+namespace {
+
+constexpr uint8_t CLEAR_ROUNDS = 3;
+constexpr uint8_t FREEZER = 0;            // slot with TL -30/TH -12 as in payload_alert_json.txt
+constexpr uint8_t HEATING = 2;            // slot with TL 35/TH 70
+
+const int8_t LOW[SLOTS_PER_BANK] = { -30, SENSOR_ALARM_OFF_LOW, 35, SENSOR_ALARM_OFF_LOW,
+                                     SENSOR_ALARM_OFF_LOW, SENSOR_ALARM_OFF_LOW, SENSOR_ALARM_OFF_LOW, 0 };
+const int8_t HIGH[SLOTS_PER_BANK] = { -12, SENSOR_ALARM_OFF_HIGH, 70, SENSOR_ALARM_OFF_HIGH,
+                                      SENSOR_ALARM_OFF_HIGH, SENSOR_ALARM_OFF_HIGH, SENSOR_ALARM_OFF_HIGH,
+                                      SENSOR_ALARM_OFF_HIGH };
+
+// DS18B20 ROM code with a serial number and a valid CRC
+void makeRom(uint8_t* rom, uint32_t serial) {
+  memset(rom, 0, ROM_SIZE);
+  rom[0] = 0x28;
+  for (uint8_t i = 0; i < 4; i++) rom[1 + i] = serial >> (8 * i);
+  rom[ROM_SIZE - 1] = dallasCrc8(rom, ROM_SIZE - 1);
+}
+
+// One alarm search in which only the given slot answered, with its reading
+uint8_t search(SensorAlarm& alarm, uint8_t slot, int16_t raw) {
+  int16_t readings[SLOTS_PER_BANK] = {};
+  readings[slot] = raw;
+  return alarm.update(alarm.slots(), 1 << slot, readings);
+}
+
+uint8_t quietSearch(SensorAlarm& alarm) {
+  int16_t readings[SLOTS_PER_BANK] = {};
+  return alarm.update(alarm.slots(), 0, readings);
+}
+
+void test_slots_with_thresholds() {
+  SensorAlarm alarm(LOW, HIGH, CLEAR_ROUNDS);
+  TEST_ASSERT_EQUAL_HEX8(0x85, alarm.slots());        // a low or a high threshold is enough
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) TEST_ASSERT_EQUAL(SensorAlarm::CLEAR, alarm.state(i));
+  TEST_ASSERT_EQUAL(0, alarm.pending());
+}
+
+void test_thresholds_in_whole_degrees() {
+  SensorAlarm alarm(LOW, HIGH, CLEAR_ROUNDS);
+  TEST_ASSERT_EQUAL(0, search(alarm, FREEZER, -193));              // -12.06: rounded down -13, below TH
+  TEST_ASSERT_EQUAL(SensorAlarm::CLEAR, alarm.state(FREEZER));
+  TEST_ASSERT_EQUAL_HEX8(1 << FREEZER, search(alarm, FREEZER, -192));   // -12.00: at TH
+  TEST_ASSERT_EQUAL(SensorAlarm::TRIP_HIGH, alarm.state(FREEZER));
+  TEST_ASSERT_EQUAL(-192, alarm.raw(FREEZER));
+
+  SensorAlarm cold(LOW, HIGH, CLEAR_ROUNDS);
+  TEST_ASSERT_EQUAL_HEX8(1 << FREEZER, search(cold, FREEZER, -465));    // -29.06: rounded down -30, at TL
+  TEST_ASSERT_EQUAL(SensorAlarm::TRIP_LOW, cold.state(FREEZER));
+
+  // found by a sensor that still compares against other thresholds: in range for the slot
+  SensorAlarm stale(LOW, HIGH, CLEAR_ROUNDS);
+  TEST_ASSERT_EQUAL(0, search(stale, HEATING, 50 * 16));
+  TEST_ASSERT_EQUAL(SensorAlarm::CLEAR, stale.state(HEATING));
+}
+
+void test_clears_after_quiet_rounds() {
+  SensorAlarm alarm(LOW, HIGH, CLEAR_ROUNDS);
+  TEST_ASSERT_EQUAL_HEX8(1 << HEATING, search(alarm, HEATING, 30 * 16));
+  TEST_ASSERT_EQUAL(SensorAlarm::TRIP_LOW, alarm.state(HEATING));
+  TEST_ASSERT_EQUAL(1, alarm.trips());
+
+  // hovering at the threshold: the missed searches in between don't clear it, no further trips
+  for (uint8_t n = 0; n < 5; n++) {
+    for (uint8_t q = 0; q < CLEAR_ROUNDS - 1; q++) TEST_ASSERT_EQUAL(0, quietSearch(alarm));
+    TEST_ASSERT_EQUAL(0, search(alarm, HEATING, 35 * 16));
+  }
+  TEST_ASSERT_EQUAL(SensorAlarm::TRIP_LOW, alarm.state(HEATING));
+  TEST_ASSERT_EQUAL(35 * 16, alarm.raw(HEATING));
+  TEST_ASSERT_EQUAL(1, alarm.trips());
+
+  for (uint8_t q = 0; q < CLEAR_ROUNDS - 1; q++) TEST_ASSERT_EQUAL(0, quietSearch(alarm));
+  TEST_ASSERT_EQUAL_HEX8(1 << HEATING, quietSearch(alarm));
+  TEST_ASSERT_EQUAL(SensorAlarm::CLEAR, alarm.state(HEATING));
+
+  // from low straight to high is a change as well
+  search(alarm, HEATING, 30 * 16);
+  TEST_ASSERT_EQUAL_HEX8(1 << HEATING, search(alarm, HEATING, 80 * 16));
+  TEST_ASSERT_EQUAL(SensorAlarm::TRIP_HIGH, alarm.state(HEATING));
+  TEST_ASSERT_EQUAL(3, alarm.trips());
+
+  // slots not searched keep their state
+  int16_t readings[SLOTS_PER_BANK] = {};
+  for (uint8_t q = 0; q < 2 * CLEAR_ROUNDS; q++) alarm.update(1 << FREEZER, 0, readings);
+  TEST_ASSERT_EQUAL(SensorAlarm::TRIP_HIGH, alarm.state(HEATING));
+}
+
+void test_pending_until_sent() {
+  SensorAlarm alarm(LOW, HIGH, CLEAR_ROUNDS);
+  search(alarm, FREEZER, -100);
+  search(alarm, HEATING, 20 * 16);
+  TEST_ASSERT_EQUAL_HEX8((1 << FREEZER) | (1 << HEATING), alarm.pending());
+  alarm.sent(1 << FREEZER);                           // the heating alert didn't get out
+  TEST_ASSERT_EQUAL_HEX8(1 << HEATING, alarm.pending());
+  for (uint8_t q = 0; q < CLEAR_ROUNDS; q++) quietSearch(alarm);
+  TEST_ASSERT_EQUAL_HEX8((1 << FREEZER) | (1 << HEATING), alarm.pending());
+  TEST_ASSERT_EQUAL(SensorAlarm::CLEAR, alarm.state(HEATING));   // published with the state of that time
+
+  alarm.sent(alarm.pending());
+  search(alarm, FREEZER, -100);
+  alarm.reset(FREEZER);                               // another sensor in the slot: no alert
+  TEST_ASSERT_EQUAL(SensorAlarm::CLEAR, alarm.state(FREEZER));
+  TEST_ASSERT_EQUAL(0, alarm.pending());
+}
+
+void test_alert_payload() {
+  const char names[SLOTS_PER_BANK][SENSOR_NAME_MAX + 1] = { "Freezer", "", "" };
+  SensorAlarm alarm(LOW, HIGH, CLEAR_ROUNDS);
+  search(alarm, FREEZER, -191);
+  search(alarm, HEATING, 20 * 16);
+  int16_t centi[SLOTS_PER_BANK];
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) centi[i] = TEMP_INVALID_CENTI;
+  centi[FREEZER] = -1194;
+
+  char buf[PAYLOAD_ALERT_JSON_MAX + 1];
+  size_t len = buildAlertJson(buf, sizeof(buf), "tmc0", 0, 3, 1760612345250ULL, alarm, alarm.pending(), centi, names);
+  TEST_ASSERT_EQUAL_STRING("{\"client\":\"tmc0\",\"sb_nr\":0,\"alert_nr\":3,\"time_ms\":1760612345250,\"ts_alert\":{"
+                           "\"Freezer\":{\"state\":\"high\",\"temp\":-11.94,\"tl\":-30,\"th\":-12},"
+                           "\"slot2\":{\"state\":\"low\",\"temp\":-327.68,\"tl\":35,\"th\":70}}}", buf);
+  TEST_ASSERT_EQUAL(strlen(buf), len);
+
+  len = buildAlertJson(buf, sizeof(buf), "tmc0", 1, 4, 0, alarm, 1 << FREEZER, centi, names);   // no time yet
+  TEST_ASSERT_EQUAL_STRING("{\"client\":\"tmc0\",\"sb_nr\":1,\"alert_nr\":4,\"ts_alert\":{"
+                           "\"Freezer\":{\"state\":\"high\",\"temp\":-11.94,\"tl\":-30,\"th\":-12}}}", buf);
+  TEST_ASSERT_EQUAL(0, buildAlertJson(buf, len, "tmc0", 1, 4, 0, alarm, 1 << FREEZER, centi, names));
+}
+
+void test_alert_worst_case_fits() {
+  int8_t low[SLOTS_PER_BANK], high[SLOTS_PER_BANK];
+  char names[SLOTS_PER_BANK][SENSOR_NAME_MAX + 1];
+  int16_t centi[SLOTS_PER_BANK];
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+    low[i] = -128;
+    high[i] = -100;
+    strcpy(names[i], "Sensor_0");
+    centi[i] = TEMP_INVALID_CENTI;
+  }
+  SensorAlarm alarm(low, high, CLEAR_ROUNDS);
+  char buf[PAYLOAD_ALERT_JSON_MAX + 1];
+  size_t len = buildAlertJson(buf, sizeof(buf), "tmc00000", 255, 4294967295UL, 9999999999999ULL, alarm, 0xFF,
+                              centi, names);
+  TEST_ASSERT_TRUE(len > 0);
+  TEST_ASSERT_LESS_OR_EQUAL(PAYLOAD_ALERT_JSON_MAX, len);
+}
+
+void test_search_alarms_on_bus() {
+  uint8_t roms[SLOTS_PER_BANK][ROM_SIZE] = {};
+  OneWireSim wire;
+  for (uint8_t i = 0; i < 4; i++) {
+    makeRom(roms[i], 0x200 + i);
+    wire.add(roms[i], 2000);
+  }
+  OneWireSimBus bus(wire);
+  TEST_ASSERT_TRUE(bus.setAlarm(roms[0], 10, 25));    // in range
+  TEST_ASSERT_TRUE(bus.setAlarm(roms[1], 10, 20));    // at TH
+  TEST_ASSERT_TRUE(bus.setAlarm(roms[2], 20, 30));    // at TL
+  for (uint8_t i = 0; i < 3; i++) wire.powerOn(i);    // TH/TL recalled from the EEPROM
+                                                      // device 3: factory TH 75/TL 70, alarm at 20
+
+  BankSlots bank = {};
+  bank.rom = roms;
+  const uint8_t slots = 0x07;                         // slot 3 has no thresholds, it isn't searched for
+  int16_t raw[SLOTS_PER_BANK] = {};
+  TEST_ASSERT_EQUAL(0, searchAlarms(bus, bank, slots, raw));    // power-on value 85: every sensor answers
+
+  bus.requestConversions();
+  wire.delay(OneWireSim::conversionMs(12) + 1);
+  TEST_ASSERT_EQUAL_HEX8(0x06, searchAlarms(bus, bank, slots, raw));
+  TEST_ASSERT_EQUAL(20 * 16, raw[1]);
+  TEST_ASSERT_EQUAL(20 * 16, raw[2]);
+
+  const int8_t low[SLOTS_PER_BANK] = { 10, 10, 20, SENSOR_ALARM_OFF_LOW, SENSOR_ALARM_OFF_LOW,
+                                       SENSOR_ALARM_OFF_LOW, SENSOR_ALARM_OFF_LOW, SENSOR_ALARM_OFF_LOW };
+  const int8_t high[SLOTS_PER_BANK] = { 25, 20, 30, SENSOR_ALARM_OFF_HIGH, SENSOR_ALARM_OFF_HIGH,
+                                        SENSOR_ALARM_OFF_HIGH, SENSOR_ALARM_OFF_HIGH, SENSOR_ALARM_OFF_HIGH };
+  SensorAlarm alarm(low, high, 1);
+  TEST_ASSERT_EQUAL_HEX8(slots, alarm.slots());
+  TEST_ASSERT_EQUAL_HEX8(0x06, alarm.update(slots, 0x06, raw));
+  TEST_ASSERT_EQUAL(SensorAlarm::TRIP_HIGH, alarm.state(1));
+  TEST_ASSERT_EQUAL(SensorAlarm::TRIP_LOW, alarm.state(2));
+
+  wire.setTemperature(1, 1850);                       // back in range
+  bus.requestConversions();
+  wire.delay(OneWireSim::conversionMs(12) + 1);
+  uint8_t found = searchAlarms(bus, bank, slots, raw);
+  TEST_ASSERT_EQUAL_HEX8(0x04, found);
+  TEST_ASSERT_EQUAL_HEX8(0x02, alarm.update(slots, found, raw));
+  TEST_ASSERT_EQUAL(SensorAlarm::CLEAR, alarm.state(1));
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_slots_with_thresholds);
+  RUN_TEST(test_thresholds_in_whole_degrees);
+  RUN_TEST(test_clears_after_quiet_rounds);
+  RUN_TEST(test_pending_until_sent);
+  RUN_TEST(test_alert_payload);
+  RUN_TEST(test_alert_worst_case_fits);
+  RUN_TEST(test_search_alarms_on_bus);
+  return UNITY_END();
+}
@@ -0,0 +1,143 @@
+/*
+  Sensor table and bus population cache (lib/SensorTable): ROM code text, file layout and CRC-16
+
+  A file is taken all or nothing: every single bit flipped, a wrong length or a cache written
+  for another sensor table must leave the arrays of the firmware untouched.
+
+    pio test -e native -f test_sensor_table
+*/
+
+#include <unity.h>
+
+#include <string.h>
+
+#include <SensorTable.h>
+
+namespace {
+
+constexpr uint8_t BANKS = 2;
+constexpr uint8_t ROM_A[ROM_SIZE] = { 0x28, 0x2C, 0x44, 0x6E, 0x00, 0x00, 0x00, 0xA6 };
+
+uint8_t rom[BANKS * SLOTS_PER_BANK][ROM_SIZE];
+char names[BANKS * SLOTS_PER_BANK][SENSOR_NAME_MAX + 1];
+uint8_t resolution[BANKS * SLOTS_PER_BANK];
+
+void fillTable() {
+  memset(rom, 0, sizeof(rom));
+  memset(names, 0, sizeof(names));
+  for (uint8_t i = 0; i < BANKS * SLOTS_PER_BANK; i++) resolution[i] = SENSOR_RESOLUTION_DEFAULT;
+  memcpy(rom[3], ROM_A, ROM_SIZE);
+  strcpy(names[3], "Outdoor");
+  resolution[3] = 10;
+  strcpy(names[SLOTS_PER_BANK], "Freezer");
+}
+
+void test_rom_text() {
+  uint8_t parsed[ROM_SIZE];
+  TEST_ASSERT_TRUE(parseRom("282C446E000000A6", 16, parsed));
+  TEST_ASSERT_EQUAL_MEMORY(ROM_A, parsed, ROM_SIZE);
+  TEST_ASSERT_TRUE(parseRom("282c446e000000a6", 16, parsed));
+  char text[17];
+  formatRom(ROM_A, text);
+  TEST_ASSERT_EQUAL_STRING("282C446E000000A6", text);
+  TEST_ASSERT_FALSE(parseRom("282C446E000000A7", 16, parsed));    // ROM CRC
+  TEST_ASSERT_FALSE(parseRom("282C446E000000A", 15, parsed));
+  TEST_ASSERT_FALSE(parseRom("282C446E0000X0A6", 16, parsed));
+}
+
+void test_table_round_trip() {
+  fillTable();
+  SensorTable table(rom, names, resolution, BANKS);
+  uint8_t file[512];
+  size_t len = table.serialize(file, sizeof(file));
+  TEST_ASSERT_EQUAL(table.fileSize(), len);
+  TEST_ASSERT_EQUAL(0, table.serialize(file, len - 1));
+  uint16_t fp = table.fingerprint();
+
+  memset(rom, 0, sizeof(rom));
+  memset(names, 0, sizeof(names));
+  TEST_ASSERT_TRUE(table.deserialize(file, len));
+  TEST_ASSERT_EQUAL_MEMORY(ROM_A, rom[3], ROM_SIZE);
+  TEST_ASSERT_EQUAL_STRING("Outdoor", names[3]);
+  TEST_ASSERT_EQUAL_STRING("Freezer", names[SLOTS_PER_BANK]);
+  TEST_ASSERT_EQUAL(10, resolution[3]);
+  TEST_ASSERT_EQUAL(fp, table.fingerprint());
+}
+
+void test_table_rejects_any_bit_error() {
+  fillTable();
+  SensorTable table(rom, names, resolution, BANKS);
+  uint8_t file[512];
+  size_t len = table.serialize(file, sizeof(file));
+  uint8_t before[sizeof(rom)];
+  memcpy(before, rom, sizeof(rom));
+  resolution[3] = 12;                          // a deserialize taking anything would overwrite it
+  for (size_t bit = 0; bit < len * 8; bit++) {
+    file[bit / 8] ^= 1 << (bit % 8);
+    TEST_ASSERT_FALSE(table.deserialize(file, len));
+    file[bit / 8] ^= 1 << (bit % 8);
+  }
+  TEST_ASSERT_EQUAL(12, resolution[3]);
+  TEST_ASSERT_EQUAL_MEMORY(before, rom, sizeof(rom));
+  TEST_ASSERT_FALSE(table.deserialize(file, len - 1));
+  SensorTable oneBank(rom, names, resolution, 1);
+  TEST_ASSERT_FALSE(oneBank.deserialize(file, len));
+}
+
+void test_fingerprint_follows_every_field() {
+  fillTable();
+  SensorTable table(rom, names, resolution, BANKS);
+  uint16_t fp = table.fingerprint();
+  resolution[SLOTS_PER_BANK + 7] = 9;
+  TEST_ASSERT_NOT_EQUAL(fp, table.fingerprint());
+  resolution[SLOTS_PER_BANK + 7] = SENSOR_RESOLUTION_DEFAULT;
+  names[3][0] = 'o';
+  TEST_ASSERT_NOT_EQUAL(fp, table.fingerprint());
+  names[3][0] = 'O';
+  rom[3][1] ^= 0x01;
+  TEST_ASSERT_NOT_EQUAL(fp, table.fingerprint());
+  rom[3][1] ^= 0x01;
+  TEST_ASSERT_EQUAL(fp, table.fingerprint());
+}
+
+void test_cache_round_trip_and_fingerprint() {
+  BusPopulation buses[BANKS] = {};
+  buses[0].count = 2;
+  buses[0].parasite = true;
+  buses[0].slowestRes = 10;
+  memcpy(buses[0].rom[0], ROM_A, ROM_SIZE);
+  buses[0].rom[1][0] = 0x28;
+  buses[1].count = 20;                          // more found than kept
+  uint8_t file[512];
+  size_t len = RomCache::serialize(file, sizeof(file), 0x1234, buses, BANKS);
+  TEST_ASSERT_EQUAL(RomCache::fileSize(BANKS), len);
+
+  BusPopulation read[BANKS] = {};
+  TEST_ASSERT_FALSE(RomCache::deserialize(file, len, 0x1235, read, BANKS));
+  TEST_ASSERT_FALSE(RomCache::deserialize(file, len, 0x1234, read, 1));
+  file[len - 1] ^= 0x80;
+  TEST_ASSERT_FALSE(RomCache::deserialize(file, len, 0x1234, read, BANKS));
+  file[len - 1] ^= 0x80;
+  TEST_ASSERT_TRUE(RomCache::deserialize(file, len, 0x1234, read, BANKS));
+  TEST_ASSERT_TRUE(read[0].parasite);
+  TEST_ASSERT_EQUAL(10, read[0].slowestRes);
+  TEST_ASSERT_TRUE(samePopulation(buses[0], read[0]));
+  TEST_ASSERT_TRUE(samePopulation(buses[1], read[1]));
+  read[0].rom[1][0] = 0x10;
+  TEST_ASSERT_FALSE(samePopulation(buses[0], read[0]));
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_rom_text);
+  RUN_TEST(test_table_round_trip);
+  RUN_TEST(test_table_rejects_any_bit_error);
+  RUN_TEST(test_fingerprint_follows_every_field);
+  RUN_TEST(test_cache_round_trip_and_fingerprint);
+  return UNITY_END();
+}
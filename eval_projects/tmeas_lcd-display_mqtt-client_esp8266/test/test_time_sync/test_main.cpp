@@ -0,0 +1,234 @@
+/*
+  NTP time synchronization (lib/TimeSync) against a simulated server
+
+  The server answers on request of the test, so round trip, timeouts and late replies are
+  under control; for the rate correction millis() runs off against the server's clock.
+
+    pio test -e native -f test_time_sync
+*/
+
+#include <unity.h>
+
+#include <string.h>
+
+#include <TimeSync.h>
+
+namespace {
+
+constexpr uint64_t NTP_UNIX_OFFSET_MS = 2208988800ULL * 1000;
+constexpr uint64_t T0 = 1792152000500ULL;        // 2026-10-16 12:00:00.500 UTC
+
+// Server reply to a request with the given transmit time (epoch ms), the token echoed
+void makeReply(const uint8_t* request, uint64_t epochMs, uint8_t* reply) {
+  memset(reply, 0, NTP_PACKET_SIZE);
+  reply[0] = 0x24;                                // LI 0, version 4, server mode
+  reply[1] = 2;                                   // stratum
+  memcpy(&reply[24], &request[40], 8);            // originate = transmit of the request
+  uint64_t ntpMs = epochMs + NTP_UNIX_OFFSET_MS;
+  uint32_t secs = (uint32_t)(ntpMs / 1000);       // wraps into NTP era 1 from 2036
+  uint32_t frac = (uint32_t)((((ntpMs % 1000) << 32) + 999) / 1000);
+  for (uint8_t i = 0; i < 4; i++) {
+    reply[40 + i] = secs >> (24 - 8 * i);
+    reply[44 + i] = frac >> (24 - 8 * i);
+  }
+}
+
+class FakeServer : public NtpTransport {
+public:
+  bool send(const uint8_t* packet, size_t len) override {
+    sends++;
+    if (!up) return false;
+    memcpy(request, packet, len);
+    return true;
+  }
+  size_t receive(uint8_t* packet, size_t size) override {
+    if (!pending || size < NTP_PACKET_SIZE) return 0;
+    pending = false;
+    memcpy(packet, reply, NTP_PACKET_SIZE);
+    return NTP_PACKET_SIZE;
+  }
+  void answer(uint64_t epochMs) { answer(request, epochMs); }
+  void answer(const uint8_t* req, uint64_t epochMs) {
+    makeReply(req, epochMs, reply);
+    pending = true;
+  }
+
+  bool up = true;
+  bool pending = false;
+  uint32_t sends = 0;
+  uint8_t request[NTP_PACKET_SIZE] = {};
+  uint8_t reply[NTP_PACKET_SIZE] = {};
+};
+
+void test_parse_reply() {
+  uint8_t request[NTP_PACKET_SIZE], reply[NTP_PACKET_SIZE];
+  uint64_t ms = 0;
+  ntpRequest(request, 0x12345678);
+  makeReply(request, T0, reply);
+  TEST_ASSERT_TRUE(ntpParse(reply, sizeof(reply), 0x12345678, ms));
+  TEST_ASSERT_EQUAL_UINT64(T0, ms);
+
+  makeReply(request, 2208988800123ULL, reply);    // 2040-01-01, NTP era 1
+  TEST_ASSERT_TRUE(ntpParse(reply, sizeof(reply), 0x12345678, ms));
+  TEST_ASSERT_EQUAL_UINT64(2208988800123ULL, ms);
+}
+
+void test_parse_rejects() {
+  uint8_t request[NTP_PACKET_SIZE], reply[NTP_PACKET_SIZE];
+  uint64_t ms = 0;
+  ntpRequest(request, 42);
+  makeReply(request, T0, reply);
+  TEST_ASSERT_FALSE(ntpParse(reply, sizeof(reply), 43, ms));         // reply to another request
+  TEST_ASSERT_FALSE(ntpParse(reply, NTP_PACKET_SIZE - 1, 42, ms));
+  TEST_ASSERT_FALSE(ntpParse(request, sizeof(request), 42, ms));      // client mode
+  reply[0] |= 0xC0;                                                   // LI 3: server not synchronized
+  TEST_ASSERT_FALSE(ntpParse(reply, sizeof(reply), 42, ms));
+  reply[0] &= 0x3F;
+  reply[1] = 0;                                                       // kiss-o'-death
+  TEST_ASSERT_FALSE(ntpParse(reply, sizeof(reply), 42, ms));
+  reply[1] = 16;
+  TEST_ASSERT_FALSE(ntpParse(reply, sizeof(reply), 42, ms));
+  TEST_ASSERT_EQUAL_UINT64(0, ms);
+}
+
+void test_sync_interval_and_timeout() {
+  FakeServer server;
+  TimeSync ts(server, 600000, 30000, 2000);
+  ts.step(0, false);
+  TEST_ASSERT_EQUAL(0, server.sends);
+  TEST_ASSERT_EQUAL_UINT64(0, ts.epochMs(0));
+
+  ts.step(100, true);
+  ts.step(150, true);
+  TEST_ASSERT_EQUAL(1, server.sends);
+  server.answer(T0);
+  ts.step(250, true);
+  TEST_ASSERT_TRUE(ts.valid());
+  TEST_ASSERT_TRUE(ts.synced());
+  TEST_ASSERT_EQUAL_UINT64(T0 + 75, ts.epochMs(250));   // middle of the round trip
+  TEST_ASSERT_EQUAL_UINT64(T0 + 75 + 1000, ts.epochMs(1250));
+
+  ts.step(600249, true);
+  TEST_ASSERT_EQUAL(1, server.sends);
+  ts.step(600250, true);
+  TEST_ASSERT_EQUAL(2, server.sends);
+  ts.step(602249, true);
+  TEST_ASSERT_EQUAL(0, ts.stats().failures);
+  ts.step(602250, true);
+  TEST_ASSERT_EQUAL(1, ts.stats().failures);
+  TEST_ASSERT_TRUE(ts.valid());                          // extrapolated on
+  ts.step(632249, true);
+  TEST_ASSERT_EQUAL(2, server.sends);
+  ts.step(632250, true);
+  TEST_ASSERT_EQUAL(3, server.sends);
+  TEST_ASSERT_EQUAL(1, ts.stats().syncs);
+}
+
+void test_late_reply_ignored() {
+  FakeServer server;
+  TimeSync ts(server, 600000, 30000, 2000);
+  ts.step(100, true);
+  uint8_t first[NTP_PACKET_SIZE];
+  memcpy(first, server.request, sizeof(first));
+  ts.step(2100, true);                                   // timed out
+  ts.step(32100, true);
+  TEST_ASSERT_EQUAL(2, server.sends);
+  server.answer(first, T0);
+  ts.step(32200, true);
+  TEST_ASSERT_FALSE(ts.valid());
+  server.answer(T0 + 32000);
+  ts.step(32200, true);
+  TEST_ASSERT_TRUE(ts.valid());
+  TEST_ASSERT_EQUAL_UINT64(T0 + 32050, ts.epochMs(32200));
+}
+
+// millis() running off by ppmFast against the server; synchronized every intervalMs with no round trip
+void syncDrifting(TimeSync& ts, FakeServer& server, int32_t ppmFast, uint32_t intervalMs, uint8_t syncs) {
+  for (uint8_t i = 0; i < syncs; i++) {
+    uint32_t now = 1000 + i * intervalMs;
+    ts.step(now, true);
+    server.answer(T0 + (int64_t)now * 1000000 / (1000000 + ppmFast));
+    ts.step(now, true);
+  }
+}
+
+void test_rate_converges() {
+  FakeServer server;
+  TimeSync fast(server, 600000, 30000, 2000);
+  syncDrifting(fast, server, 200, 600000, 12);
+  TEST_ASSERT_INT_WITHIN(2, -200, fast.driftPpm());
+  TEST_ASSERT_INT_WITHIN(2, 0, fast.stats().lastErrorMs);
+  TEST_ASSERT_EQUAL(12, fast.stats().syncs);
+
+  TimeSync slow(server, 600000, 30000, 2000);
+  syncDrifting(slow, server, -150, 600000, 12);
+  TEST_ASSERT_INT_WITHIN(2, 150, slow.driftPpm());
+}
+
+void test_rate_limited() {
+  FakeServer server;
+  TimeSync ts(server, 120000, 30000, 2000);
+  syncDrifting(ts, server, 2000, 120000, 12);
+  TEST_ASSERT_EQUAL(-TIME_DRIFT_MAX_PPM, ts.driftPpm());
+}
+
+// A new server an hour off: the time is taken, the rate stays
+void test_jump_resets_time_not_rate() {
+  FakeServer server;
+  TimeSync ts(server, 600000, 30000, 2000);
+  syncDrifting(ts, server, 200, 600000, 12);
+  int32_t ppm = ts.driftPpm();
+  uint32_t now = 1000 + 12 * 600000;
+  ts.requestSync();
+  ts.step(now, true);
+  server.answer(T0 + 3600000 + now);
+  ts.step(now, true);
+  TEST_ASSERT_EQUAL_UINT64(T0 + 3600000 + now, ts.epochMs(now));
+  TEST_ASSERT_EQUAL(ppm, ts.driftPpm());
+  TEST_ASSERT_GREATER_THAN(3000000, ts.stats().lastErrorMs);
+}
+
+// Time kept over a deep sleep: valid at once, replaced by NTP
+void test_set_then_sync() {
+  FakeServer server;
+  TimeSync ts(server, 600000, 30000, 2000);
+  ts.set(T0, 10);
+  TEST_ASSERT_TRUE(ts.valid());
+  TEST_ASSERT_FALSE(ts.synced());
+  TEST_ASSERT_EQUAL_UINT64(T0 + 90, ts.epochMs(100));
+  ts.step(100, true);
+  server.answer(T0 + 5000);
+  ts.step(100, true);
+  TEST_ASSERT_TRUE(ts.synced());
+  TEST_ASSERT_EQUAL_UINT64(T0 + 5000, ts.epochMs(100));
+  TEST_ASSERT_EQUAL(0, ts.driftPpm());
+  ts.set(0, 200);
+  TEST_ASSERT_FALSE(ts.valid());
+}
+
+void test_berlin_dst() {
+  TEST_ASSERT_FALSE(isBerlinDst(1774745999));   // 2026-03-29 00:59:59 UTC
+  TEST_ASSERT_TRUE(isBerlinDst(1774746000));
+  TEST_ASSERT_TRUE(isBerlinDst(1792889999));    // 2026-10-25 00:59:59 UTC
+  TEST_ASSERT_FALSE(isBerlinDst(1792890000));
+  TEST_ASSERT_FALSE(isBerlinDst(1767225600));   // 2026-01-01
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_reply);
+  RUN_TEST(test_parse_rejects);
+  RUN_TEST(test_sync_interval_and_timeout);
+  RUN_TEST(test_late_reply_ignored);
+  RUN_TEST(test_rate_converges);
+  RUN_TEST(test_rate_limited);
+  RUN_TEST(test_jump_resets_time_not_rate);
+  RUN_TEST(test_set_then_sync);
+  RUN_TEST(test_berlin_dst);
+  return UNITY_END();
+}
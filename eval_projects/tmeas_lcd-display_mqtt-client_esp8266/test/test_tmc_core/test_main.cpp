@@ -0,0 +1,409 @@
+/*
+  Hardware independent core (lib/TmcCore): scratchpad checks, reads with re-read policy and
+  filter, LCD page layout, dataset records, dead-band and heartbeat, and the publisher
+
+  The sensor bus is scripted: every scratchpad read takes the next scratchpad of the script.
+
+    pio test -e native -f test_tmc_core
+*/
+
+#include <unity.h>
+
+#include <string.h>
+
+#include <TmcCore.h>
+
+namespace {
+
+constexpr uint32_t READ_US = 12000;       // bus time of a scratchpad read
+
+// Scratchpad of a DS18B20 with the given reading and resolution, CRC set
+void scratchPad(uint8_t* sp, int16_t raw, uint8_t resolution = 12, int8_t th = 125, int8_t tl = -55) {
+  sp[0] = raw & 0xFF;
+  sp[1] = (uint16_t)raw >> 8;
+  sp[2] = th;
+  sp[3] = tl;
+  sp[4] = ((resolution - 9) << 5) | 0x1F;
+  sp[5] = 0xFF;
+  sp[6] = 0x0C;
+  sp[7] = 0x10;
+  sp[8] = dallasCrc8(sp, SCRATCHPAD_SIZE - 1);
+}
+
+class ScriptBus : public SensorBus {
+public:
+  void requestConversions() override {}
+  bool readScratchPad(const uint8_t*, uint8_t* sp) override {
+    reads++;
+    if (next == count) return false;        // end of the script: no presence pulse
+    memcpy(sp, script[next++], SCRATCHPAD_SIZE);
+    return true;
+  }
+  void resetSearch() override {}
+  bool search(uint8_t*) override { return false; }
+  bool requestConversion(const uint8_t*) override { return true; }
+  void resetAlarmSearch() override {}
+  bool alarmSearch(uint8_t*) override { return false; }
+  bool setAlarm(const uint8_t*, int8_t, int8_t) override { return true; }
+
+  void add(int16_t raw) { scratchPad(script[count++], raw); }
+  void addCrcError(int16_t raw) {
+    scratchPad(script[count], raw);
+    script[count++][8] ^= 0x01;
+  }
+
+  uint8_t script[16][SCRATCHPAD_SIZE];
+  uint8_t count = 0;
+  uint8_t next = 0;
+  uint8_t reads = 0;
+};
+
+// Records what flush() sends, i.e. the LCD content
+class CaptureDisplay : public CharDisplay {
+public:
+  CaptureDisplay() { memset(text, ' ', sizeof(text)); }
+  void setCursor(uint8_t c, uint8_t r) override { col = c; row = r; }
+  size_t write(uint8_t c) override {
+    text[row][col++] = c;
+    return 1;
+  }
+  const char* line(uint8_t r) {
+    memcpy(buf, text[r], LcdFrameBuffer::COLS);
+    buf[LcdFrameBuffer::COLS] = '\0';
+    return buf;
+  }
+
+  char text[LcdFrameBuffer::ROWS][LcdFrameBuffer::COLS];
+  char buf[LcdFrameBuffer::COLS + 1];
+  uint8_t col = 0, row = 0;
+};
+
+class FakeSink : public MqttSink {
+public:
+  bool publish(const char* topic, const uint8_t* payload, size_t len, bool) override {
+    strcpy(topics[count], topic);
+    memcpy(payloads[count], payload, len);
+    lens[count++] = len;
+    return !(failTopic && strcmp(topic, failTopic) == 0);
+  }
+
+  const char* failTopic = nullptr;
+  char topics[4][32];
+  uint8_t payloads[4][PAYLOAD_JSON_MAX + 1];
+  size_t lens[4];
+  uint8_t count = 0;
+};
+
+class StepClock : public Clock {
+public:
+  uint32_t millis() override { return us / 1000; }
+  uint32_t micros() override { return us += 7; }
+  uint32_t us = 0;
+};
+
+// Two banks; bank 0 has slots 0, 1, 2, 7 configured, bank 1 slot 4
+uint8_t roms[2][SLOTS_PER_BANK][ROM_SIZE];
+char names[2][SLOTS_PER_BANK][SENSOR_NAME_MAX + 1];
+uint8_t resolution[2][SLOTS_PER_BANK];
+int16_t offsets[2][SLOTS_PER_BANK];
+BankSlots bank0, bank1;
+const BankSlots* const BANKS[] = { &bank0, &bank1 };
+
+void setRom(uint8_t b, uint8_t slot) {
+  uint8_t* rom = roms[b][slot];
+  rom[0] = 0x28;
+  rom[1] = b * SLOTS_PER_BANK + slot + 1;
+  rom[ROM_SIZE - 1] = dallasCrc8(rom, ROM_SIZE - 1);
+}
+
+void setUpBanks() {
+  memset(roms, 0, sizeof(roms));
+  memset(names, 0, sizeof(names));
+  memset(offsets, 0, sizeof(offsets));
+  memset(resolution, 12, sizeof(resolution));
+  const uint8_t slots0[] = { 0, 1, 2, 7 };
+  const char* const names0[] = { "Indoor", "Outdoor", "Basement_long", "Freezer" };
+  for (uint8_t i = 0; i < 4; i++) {
+    setRom(0, slots0[i]);
+    strcpy(names[0][slots0[i]], names0[i]);
+  }
+  setRom(1, 4);
+  strcpy(names[1][4], "Garage");
+  offsets[0][1] = -25;
+  bank0 = { 0, roms[0], names[0], resolution[0], offsets[0], {}, {} };
+  bank1 = { 1, roms[1], names[1], resolution[1], offsets[1], {}, {} };
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) {
+    bank0.state[i] = bank1.state[i] = SENSOR_NOT_CONFIGURED;
+  }
+}
+
+void setReading(BankSlots& bank, uint8_t slot, int16_t raw) {
+  bank.tempRaw[slot] = raw;
+  bank.state[slot] = SENSOR_OK;
+}
+
+void test_decode_scratchpad() {
+  uint8_t sp[SCRATCHPAD_SIZE];
+  int16_t raw = 0;
+  scratchPad(sp, 0x0191);                             // 25.0625
+  TEST_ASSERT_EQUAL(SENSOR_OK, decodeScratchPad(sp, raw));
+  TEST_ASSERT_EQUAL(0x0191, raw);
+  scratchPad(sp, -162);                               // -10.125
+  TEST_ASSERT_EQUAL(SENSOR_OK, decodeScratchPad(sp, raw));
+  TEST_ASSERT_EQUAL(-162, raw);
+  scratchPad(sp, 0x0197, 9);                          // the 3 undefined low bits of 9 bit are dropped
+  TEST_ASSERT_EQUAL(SENSOR_OK, decodeScratchPad(sp, raw));
+  TEST_ASSERT_EQUAL(0x0190, raw);
+  scratchPad(sp, 0x0197, 11);
+  decodeScratchPad(sp, raw);
+  TEST_ASSERT_EQUAL(0x0196, raw);
+  scratchPad(sp, SampleFilter::POWER_ON_RAW);         // valid for the bus, the filter rejects it
+  TEST_ASSERT_EQUAL(SENSOR_OK, decodeScratchPad(sp, raw));
+
+  raw = 1234;
+  scratchPad(sp, 0x0191);
+  sp[0] ^= 0x04;
+  TEST_ASSERT_EQUAL(SENSOR_CRC_ERROR, decodeScratchPad(sp, raw));
+  memset(sp, 0xFF, sizeof(sp));
+  TEST_ASSERT_EQUAL(SENSOR_ABSENT, decodeScratchPad(sp, raw));
+  memset(sp, 0x00, sizeof(sp));                       // CRC of all zero is 0, still a shorted bus
+  TEST_ASSERT_EQUAL(SENSOR_ABSENT, decodeScratchPad(sp, raw));
+  TEST_ASSERT_EQUAL(1234, raw);
+}
+
+void test_read_slot() {
+  setUpBanks();
+  ScriptBus bus;
+  TEST_ASSERT_EQUAL(SENSOR_NOT_CONFIGURED, readSlot(bus, bank0, 3));
+  TEST_ASSERT_EQUAL(0, bus.reads);
+  bus.add(376);
+  TEST_ASSERT_EQUAL(SENSOR_OK, readSlot(bus, bank0, 0));
+  TEST_ASSERT_EQUAL(376, bank0.tempRaw[0]);
+  TEST_ASSERT_EQUAL(SENSOR_ABSENT, readSlot(bus, bank0, 0));
+  TEST_ASSERT_EQUAL(SENSOR_ABSENT, bank0.state[0]);
+}
+
+// The read loop of readSensorSlot() in main.cpp; returns the status of the last read
+SensorStatus readWithRetry(ScriptBus& bus, ReadRetry& retry, BankSlots& bank, uint8_t slot) {
+  SensorStatus st;
+  do st = readSlot(bus, bank, slot);
+  while (retry.again(st, READ_US));
+  return st;
+}
+
+void test_read_retry_per_slot() {
+  setUpBanks();
+  ScriptBus bus;
+  ReadRetry retry(2, 100000);
+  retry.startCycle();
+  bus.addCrcError(376);
+  bus.add(376);
+  TEST_ASSERT_EQUAL(SENSOR_OK, readWithRetry(bus, retry, bank0, 0));
+  TEST_ASSERT_EQUAL(2, bus.reads);
+  TEST_ASSERT_EQUAL(100000 - READ_US, retry.budgetUs());
+
+  for (uint8_t i = 0; i < 4; i++) bus.addCrcError(376);
+  TEST_ASSERT_EQUAL(SENSOR_CRC_ERROR, readWithRetry(bus, retry, bank0, 1));
+  TEST_ASSERT_EQUAL(2 + 3, bus.reads);                // 2 re-reads at most
+
+  bus.add(400);                                       // the next slot gets its own re-reads
+  TEST_ASSERT_EQUAL(SENSOR_OK, readWithRetry(bus, retry, bank0, 2));
+  TEST_ASSERT_EQUAL(5 + 2, bus.reads);
+  TEST_ASSERT_EQUAL(400, bank0.tempRaw[2]);
+
+  TEST_ASSERT_FALSE(retry.again(SENSOR_ABSENT, READ_US));   // only a CRC error is repeated
+  TEST_ASSERT_FALSE(retry.again(SENSOR_OK, READ_US));
+}
+
+void test_read_retry_budget() {
+  setUpBanks();
+  ScriptBus bus;
+  ReadRetry retry(2, 2 * READ_US - 1);
+  retry.startCycle();
+  bus.addCrcError(376);
+  bus.addCrcError(376);
+  bus.add(376);
+  TEST_ASSERT_EQUAL(SENSOR_CRC_ERROR, readWithRetry(bus, retry, bank0, 0));
+  TEST_ASSERT_EQUAL(2, bus.reads);                    // budget left for one re-read only
+  TEST_ASSERT_EQUAL(READ_US - 1, retry.budgetUs());
+  TEST_ASSERT_EQUAL(SENSOR_OK, readWithRetry(bus, retry, bank0, 1));
+
+  bus.addCrcError(376);
+  TEST_ASSERT_EQUAL(SENSOR_CRC_ERROR, readWithRetry(bus, retry, bank0, 2));
+  TEST_ASSERT_EQUAL(4, bus.reads);
+
+  retry.startCycle();                                 // a new cycle has the whole budget again
+  bus.addCrcError(376);
+  bus.add(376);
+  TEST_ASSERT_EQUAL(SENSOR_OK, readWithRetry(bus, retry, bank0, 2));
+}
+
+void test_filter_slot() {
+  setUpBanks();
+  int16_t ring[3][SLOTS_PER_BANK];
+  SampleFilter filter(ring, 3, SampleFilter::MEDIAN, 1);
+  setReading(bank0, 0, 376);
+  TEST_ASSERT_EQUAL(SENSOR_OK, filterSlot(filter, bank0, 0));
+
+  bank0.state[0] = SENSOR_CRC_ERROR;                  // bridged by the filter value
+  TEST_ASSERT_EQUAL(SENSOR_CRC_ERROR, filterSlot(filter, bank0, 0));
+  TEST_ASSERT_EQUAL(SENSOR_OK, bank0.state[0]);
+  TEST_ASSERT_EQUAL(376, bank0.tempRaw[0]);
+
+  setReading(bank0, 0, 380);
+  filterSlot(filter, bank0, 0);
+  int16_t held = bank0.tempRaw[0];
+  setReading(bank0, 0, SampleFilter::POWER_ON_RAW);   // rejected, the filter value stays
+  TEST_ASSERT_EQUAL(SENSOR_RESET, filterSlot(filter, bank0, 0));
+  TEST_ASSERT_EQUAL(SENSOR_OK, bank0.state[0]);
+  TEST_ASSERT_EQUAL(held, bank0.tempRaw[0]);
+
+  setReading(bank0, 1, SampleFilter::POWER_ON_RAW);   // nothing to hold: the failure shows
+  TEST_ASSERT_EQUAL(SENSOR_RESET, filterSlot(filter, bank0, 1));
+  TEST_ASSERT_EQUAL(SENSOR_RESET, bank0.state[1]);
+}
+
+void test_lcd_page_layout() {
+  setUpBanks();
+  setReading(bank0, 0, 376);                          // 23.50
+  setReading(bank0, 1, -160);                         // -10.00, offset -0.25
+  bank0.state[2] = SENSOR_ABSENT;
+  setReading(bank0, 7, -3 * 16);
+  setReading(bank1, 4, 8);                            // 0.50
+  LcdFrameBuffer fb;
+  CaptureDisplay lcd;
+  renderLcdPage(fb, BANKS, 2, 0, 'M');
+  fb.flush(lcd);
+  TEST_ASSERT_EQUAL_STRING("S0: Indoor  23.50\xDF" "CM", lcd.line(0));
+  TEST_ASSERT_EQUAL_STRING("S1: Outdoor -10.3\xDF" "C ", lcd.line(1));   // one decimal below -9.99
+  TEST_ASSERT_EQUAL_STRING("S2: Basemen --.--\xDF" "C ", lcd.line(2));
+  TEST_ASSERT_EQUAL_STRING("S7: Freezer -3.00\xDF" "C ", lcd.line(3));
+
+  renderLcdPage(fb, BANKS, 2, 1, ' ');                // the 5th sensor, numbered across the banks
+  fb.flush(lcd);
+  TEST_ASSERT_EQUAL_STRING("S12:Garage   0.50\xDF" "C ", lcd.line(0));
+  TEST_ASSERT_EQUAL_STRING("                    ", lcd.line(1));
+  TEST_ASSERT_EQUAL_STRING("                    ", lcd.line(3));
+  TEST_ASSERT_EQUAL(5, configuredSlots(BANKS, 2));
+}
+
+// Values of 6 characters with 2 decimals lose one, so the row 0 indicator never covers the "C"
+void test_lcd_value_width() {
+  setUpBanks();
+  setReading(bank0, 0, 2000);                         // 125.00
+  setReading(bank0, 1, -880);                         // -55.00, offset -0.25
+  setReading(bank0, 2, 1599);                         // 99.9375: 99.94
+  setReading(bank0, 7, -159);                         // -9.9375: -9.94
+  LcdFrameBuffer fb;
+  CaptureDisplay lcd;
+  renderLcdPage(fb, BANKS, 2, 0, 'M');
+  fb.flush(lcd);
+  TEST_ASSERT_EQUAL_STRING("S0: Indoor  125.0\xDF" "CM", lcd.line(0));
+  TEST_ASSERT_EQUAL_STRING("S1: Outdoor -55.3\xDF" "C ", lcd.line(1));
+  TEST_ASSERT_EQUAL_STRING("S2: Basemen 99.94\xDF" "C ", lcd.line(2));
+  TEST_ASSERT_EQUAL_STRING("S7: Freezer -9.94\xDF" "C ", lcd.line(3));
+
+  setReading(bank0, 0, 1600);                         // 100.00
+  setReading(bank0, 7, -161);                         // -10.0625: -10.06
+  renderLcdPage(fb, BANKS, 2, 0, 'M');
+  fb.flush(lcd);
+  TEST_ASSERT_EQUAL_STRING("S0: Indoor  100.0\xDF" "CM", lcd.line(0));
+  TEST_ASSERT_EQUAL_STRING("S7: Freezer -10.1\xDF" "C ", lcd.line(3));
+}
+
+void test_make_record() {
+  setUpBanks();
+  setReading(bank0, 0, 376);
+  setReading(bank0, 1, 376);
+  bank0.state[2] = SENSOR_CRC_ERROR;
+  setReading(bank0, 3, 376);                          // not configured: not in the record
+  DatasetRecord rec;
+  makeRecord(bank0, 41, 1792152000500ULL, rec);
+  TEST_ASSERT_EQUAL(0, rec.sbNr);
+  TEST_ASSERT_EQUAL(41, rec.dsNr);
+  TEST_ASSERT_EQUAL_UINT64(1792152000500ULL, rec.timeMs);
+  TEST_ASSERT_EQUAL_HEX8(0x87, rec.slotMask);
+  TEST_ASSERT_EQUAL(2350, rec.centi[0]);
+  TEST_ASSERT_EQUAL(2325, rec.centi[1]);              // calibration offset applied
+  TEST_ASSERT_EQUAL(TEMP_INVALID_CENTI, rec.centi[2]);
+  TEST_ASSERT_EQUAL(TEMP_INVALID_CENTI, rec.centi[3]);
+  TEST_ASSERT_EQUAL(TEMP_INVALID_CENTI, rec.centi[7]);   // configured, not read yet
+}
+
+void test_publish_due() {
+  DatasetRecord rec = {};
+  rec.slotMask = 0x03;
+  rec.centi[0] = 2350;
+  rec.centi[1] = TEMP_INVALID_CENTI;
+  int16_t last[SLOTS_PER_BANK] = { 2350, TEMP_INVALID_CENTI, 0, 0, 0, 0, 0, 0 };
+  rec.centi[2] = 5000;                                // outside the mask, ignored
+  TEST_ASSERT_FALSE(publishDue(rec, last, 10, 1000, 60000));
+  TEST_ASSERT_TRUE(publishDue(rec, last, 0, 1000, 60000));       // no dead-band
+  TEST_ASSERT_TRUE(publishDue(rec, last, 10, 60000, 60000));     // heartbeat
+
+  rec.centi[0] = 2360;                                // at the dead-band: suppressed
+  TEST_ASSERT_FALSE(publishDue(rec, last, 10, 1000, 60000));
+  rec.centi[0] = 2339;
+  TEST_ASSERT_TRUE(publishDue(rec, last, 10, 1000, 60000));
+  rec.centi[0] = 2350;
+  rec.centi[1] = 2350;                                // found
+  TEST_ASSERT_TRUE(publishDue(rec, last, 10000, 1000, 60000));
+  rec.centi[1] = TEMP_INVALID_CENTI;
+  rec.centi[0] = TEMP_INVALID_CENTI;                  // lost
+  TEST_ASSERT_TRUE(publishDue(rec, last, 10000, 1000, 60000));
+}
+
+void test_publisher_formats() {
+  setUpBanks();
+  setReading(bank0, 0, 376);
+  DatasetRecord rec;
+  makeRecord(bank0, 7, 0, rec);
+  PayloadEntry entries[4] = { { names[0][0], 0, 2350 }, { names[0][1], 1, TEMP_INVALID_CENTI },
+                              { names[0][2], 2, TEMP_INVALID_CENTI }, { names[0][7], 7, TEMP_INVALID_CENTI } };
+  char json[PAYLOAD_JSON_MAX + 1];
+  size_t jsonLen = buildPayloadJson(json, sizeof(json), "tmc0", 0, 7, 0, entries, 4);
+  uint8_t cbor[PAYLOAD_CBOR_MAX];
+  size_t cborLen = buildPayloadCbor(cbor, sizeof(cbor), "tmc0", 0, 7, 0, entries, 4);
+
+  FakeSink jsonSink;
+  DatasetPublisher jsonOnly(jsonSink, "tmc0", DatasetPublisher::JSON);
+  TEST_ASSERT_TRUE(jsonOnly.publish("tmc0/sb0", "tmc0/sb0/cbor", names[0], rec));
+  TEST_ASSERT_EQUAL(1, jsonSink.count);
+  TEST_ASSERT_EQUAL_STRING("tmc0/sb0", jsonSink.topics[0]);
+  TEST_ASSERT_EQUAL(jsonLen, jsonSink.lens[0]);
+  TEST_ASSERT_EQUAL_MEMORY(json, jsonSink.payloads[0], jsonLen);
+
+  FakeSink both;
+  both.failTopic = "tmc0/sb0";
+  DatasetPublisher publisher(both, "tmc0", DatasetPublisher::JSON | DatasetPublisher::CBOR);
+  StepClock clock;
+  PhaseStats build, pub;
+  publisher.setTiming(clock, build, pub);
+  TEST_ASSERT_FALSE(publisher.publish("tmc0/sb0", "tmc0/sb0/cbor", names[0], rec));
+  TEST_ASSERT_EQUAL(2, both.count);                   // a failed JSON publish doesn't hold back CBOR
+  TEST_ASSERT_EQUAL_STRING("tmc0/sb0/cbor", both.topics[1]);
+  TEST_ASSERT_EQUAL(cborLen, both.lens[1]);
+  TEST_ASSERT_EQUAL_MEMORY(cbor, both.payloads[1], cborLen);
+  TEST_ASSERT_EQUAL(2, build.count());
+  TEST_ASSERT_EQUAL(2, pub.count());
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_decode_scratchpad);
+  RUN_TEST(test_read_slot);
+  RUN_TEST(test_read_retry_per_slot);
+  RUN_TEST(test_read_retry_budget);
+  RUN_TEST(test_filter_slot);
+  RUN_TEST(test_lcd_page_layout);
+  RUN_TEST(test_lcd_value_width);
+  RUN_TEST(test_make_record);
+  RUN_TEST(test_publish_due);
+  RUN_TEST(test_publisher_formats);
+  return UNITY_END();
+}
@@ -0,0 +1,130 @@
+/*
+  Windowed aggregates (lib/WindowAgg): min/max/mean/count per slot, window alignment and the
+  aggregate payload
+
+    pio test -e native -f test_window_agg
+*/
+
+#include <unity.h>
+
+#include <string.h>
+
+#include <WindowAgg.h>
+
+namespace {
+
+constexpr uint64_t T0 = 1792152000000ULL;       // 2026-10-16 12:00:00 UTC, a multiple of 15 minutes
+constexpr uint64_t DAY0 = T0 - 43200000;         // 00:00
+
+DatasetRecord record(uint8_t mask, int16_t v0, int16_t v1 = TEMP_INVALID_CENTI) {
+  DatasetRecord rec = {};
+  rec.slotMask = mask;
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) rec.centi[i] = TEMP_INVALID_CENTI;
+  rec.centi[0] = v0;
+  rec.centi[1] = v1;
+  return rec;
+}
+
+void test_min_max_mean_count() {
+  WindowAgg agg(60000);
+  TEST_ASSERT_TRUE(agg.empty());
+  agg.add(record(0x03, 2001, TEMP_INVALID_CENTI), T0, true);
+  agg.add(record(0x03, 2045, TEMP_INVALID_CENTI), T0 + 1000, true);
+  agg.add(record(0x03, 2020, TEMP_INVALID_CENTI), T0 + 2000, true);
+  agg.add(record(0x03, TEMP_INVALID_CENTI, TEMP_INVALID_CENTI), T0 + 3000, true);   // not counted
+  TEST_ASSERT_FALSE(agg.empty());
+  TEST_ASSERT_EQUAL_HEX8(0x03, agg.slotMask());
+  TEST_ASSERT_EQUAL(3, agg.count(0));
+  TEST_ASSERT_EQUAL(2001, agg.min(0));
+  TEST_ASSERT_EQUAL(2045, agg.max(0));
+  TEST_ASSERT_EQUAL(2022, agg.mean(0));         // 20.22
+  TEST_ASSERT_EQUAL(0, agg.count(1));           // configured, never valid
+  TEST_ASSERT_EQUAL(TEMP_INVALID_CENTI, agg.min(1));
+  TEST_ASSERT_EQUAL(TEMP_INVALID_CENTI, agg.mean(1));
+}
+
+void test_mean_rounding() {
+  WindowAgg agg(60000);
+  agg.add(record(0x03, 1, -1), T0, true);
+  agg.add(record(0x03, 2, -2), T0, true);
+  TEST_ASSERT_EQUAL(2, agg.mean(0));            // 1.5, halves away from zero
+  TEST_ASSERT_EQUAL(-2, agg.mean(1));
+}
+
+// A day of 200 ms samples at the ends of the DS18B20 range: the sums are beyond 32 bits
+void test_day_window_does_not_overflow() {
+  WindowAgg agg(86400000UL);
+  DatasetRecord rec = record(0x03, 12500, -5500);
+  for (uint32_t ms = 0; ms < 86400000UL; ms += 200) agg.add(rec, DAY0 + ms, true);
+  TEST_ASSERT_EQUAL(432000, agg.count(0));
+  TEST_ASSERT_EQUAL(12500, agg.mean(0));
+  TEST_ASSERT_EQUAL(-5500, agg.mean(1));
+}
+
+void test_windows_aligned() {
+  WindowAgg agg(900000);                        // 15 minutes
+  agg.add(record(0x01, 2000), T0 + 600000, true);
+  TEST_ASSERT_EQUAL_UINT64(T0, agg.startMs());  // aligned to 12:00, not to the first sample
+  TEST_ASSERT_FALSE(agg.ends(T0 + 899999, true));
+  TEST_ASSERT_TRUE(agg.ends(T0 + 900000, true));
+  TEST_ASSERT_TRUE(agg.ends(T0 + 600000, false));   // the time base changed
+
+  agg.add(record(0x01, 3000), T0 + 900000, true);   // starts the next window
+  TEST_ASSERT_EQUAL_UINT64(T0 + 900000, agg.startMs());
+  TEST_ASSERT_EQUAL(1, agg.count(0));
+  TEST_ASSERT_EQUAL(3000, agg.min(0));
+
+  WindowAgg boot(60000);                        // on millis() before the client has the time
+  boot.add(record(0x01, 2000), 61000, false);
+  TEST_ASSERT_EQUAL_UINT64(0, boot.startMs());
+  TEST_ASSERT_FALSE(boot.ends(119999, false));
+  TEST_ASSERT_TRUE(boot.ends(120000, false));
+}
+
+void test_payload() {
+  char names[SLOTS_PER_BANK][SENSOR_NAME_MAX + 1] = { "Indoor0", "" };
+  WindowAgg agg(60000);
+  agg.add(record(0x03, 2001), T0, true);
+  agg.add(record(0x03, 2045), T0 + 30000, true);
+  char buf[PAYLOAD_AGG_JSON_MAX + 1];
+  size_t len = buildAggJson(buf, sizeof(buf), "tmc0", 0, 12, agg, names);
+  TEST_ASSERT_EQUAL_STRING("{\"client\":\"tmc0\",\"sb_nr\":0,\"agg_nr\":12,\"time_ms\":1792152000000,\"window_s\":60,"
+                           "\"ts_agg\":{\"Indoor0\":[20.01,20.45,20.23,2],\"slot1\":[-327.68,-327.68,-327.68,0]}}", buf);
+  TEST_ASSERT_EQUAL(strlen(buf), len);
+  TEST_ASSERT_EQUAL(0, buildAggJson(buf, len, "tmc0", 0, 12, agg, names));
+
+  WindowAgg boot(60000);                        // no time: time_ms omitted
+  boot.add(record(0x01, 2000), 1000, false);
+  buildAggJson(buf, sizeof(buf), "tmc0", 1, 0, boot, names);
+  TEST_ASSERT_EQUAL_STRING("{\"client\":\"tmc0\",\"sb_nr\":1,\"agg_nr\":0,\"window_s\":60,"
+                           "\"ts_agg\":{\"Indoor0\":[20.00,20.00,20.00,1]}}", buf);
+}
+
+void test_worst_case_fits() {
+  char names[SLOTS_PER_BANK][SENSOR_NAME_MAX + 1];
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) strcpy(names[i], "Sensor_0");
+  WindowAgg agg(86400000UL);
+  DatasetRecord rec = record(0xFF, -5500, -5500);
+  for (uint8_t i = 0; i < SLOTS_PER_BANK; i++) rec.centi[i] = -5500;
+  agg.add(rec, 9999999999999ULL, true);
+  char buf[PAYLOAD_AGG_JSON_MAX + 1];
+  size_t len = buildAggJson(buf, sizeof(buf), "tmc00000", 255, 4294967295UL, agg, names);
+  TEST_ASSERT_TRUE(len > 0);
+  TEST_ASSERT_LESS_OR_EQUAL(PAYLOAD_AGG_JSON_MAX, len);
+}
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_min_max_mean_count);
+  RUN_TEST(test_mean_rounding);
+  RUN_TEST(test_day_window_does_not_overflow);
+  RUN_TEST(test_windows_aligned);
+  RUN_TEST(test_payload);
+  RUN_TEST(test_worst_case_fits);
+  return UNITY_END();
+}